@@ -285,6 +285,8 @@
         "  <property name=\"NJobs\" type=\"u\" access=\"read\"/>\n"     \
         "  <property name=\"NInstalledJobs\" type=\"u\" access=\"read\"/>\n" \
         "  <property name=\"NFailedJobs\" type=\"u\" access=\"read\"/>\n" \
+        "  <property name=\"NNameOwnerSignals\" type=\"u\" access=\"read\"/>\n" \
+        "  <property name=\"NNameOwnerSignalsHandled\" type=\"u\" access=\"read\"/>\n" \
         "  <property name=\"Progress\" type=\"d\" access=\"read\"/>\n"  \
         "  <property name=\"Environment\" type=\"as\" access=\"read\"/>\n" \
         "  <property name=\"ConfirmSpawn\" type=\"b\" access=\"read\"/>\n" \
@@ -595,6 +597,8 @@ static const BusProperty bus_manager_properties[] = {
         { "NJobs",                       bus_manager_append_n_jobs,      "u",  0                                                },
         { "NInstalledJobs",              bus_property_append_uint32,     "u",  offsetof(Manager, n_installed_jobs)              },
         { "NFailedJobs",                 bus_property_append_uint32,     "u",  offsetof(Manager, n_failed_jobs)                 },
+        { "NNameOwnerSignals",           bus_property_append_uint32,     "u",  offsetof(Manager, n_name_owner_signals)          },
+        { "NNameOwnerSignalsHandled",    bus_property_append_uint32,     "u",  offsetof(Manager, n_name_owner_signals_handled)  },
         { "Progress",                    bus_manager_append_progress,    "d",  0                                                },
         { "Environment",                 bus_property_append_strv,       "as", offsetof(Manager, environment),                  true },
         { "ConfirmSpawn",                bus_property_append_bool,       "b",  offsetof(Manager, confirm_spawn)                 },
@@ -1044,6 +1048,15 @@ static DBusHandlerResult bus_manager_message_handler(DBusConnection *connection,
                 if (r < 0)
                         return bus_send_error_reply(connection, message, NULL, r);
 
+                /* Clients on the API bus are tracked via
+                 * NameOwnerChanged, the others by their
+                 * connection */
+                if (connection == m->api_bus) {
+                        r = bus_watch_name_owner(m, bus_message_get_sender_with_fallback(message));
+                        if (r < 0)
+                                return bus_send_error_reply(connection, message, NULL, r);
+                }
+
                 reply = dbus_message_new_method_return(message);
                 if (!reply)
                         goto oom;
@@ -1059,6 +1072,9 @@ static DBusHandlerResult bus_manager_message_handler(DBusConnection *connection,
                         return bus_send_error_reply(connection, message, &error, -ENOENT);
                 }
 
+                if (connection == m->api_bus)
+                        bus_unwatch_name_owner(m, client);
+
                 free(client);
 
                 reply = dbus_message_new_method_return(message);
@@ -80,6 +80,8 @@ static void bus_done_api(Manager *m);
 static void bus_done_system(Manager *m);
 static void bus_done_private(Manager *m);
 static void shutdown_connection(Manager *m, DBusConnection *c);
+static int query_name(Manager *m, const char *method, const char *name, DBusPendingCallNotifyFunction callback);
+static void query_name_owner_pending_cb(DBusPendingCall *pending, void *userdata);
 
 static void bus_dispatch_status(DBusConnection *bus, DBusDispatchStatus status, void *data)  {
         Manager *m = data;
@@ -306,6 +308,60 @@ static void bus_toggle_timeout(DBusTimeout *timeout, void *data) {
                 log_error("Failed to rearm timer: %s", strerror(-r));
 }
 
+static bool api_bus_registered(Manager *m) {
+        assert(m);
+
+        /* The unique name is set as soon as Hello() returned */
+        return m->api_bus && dbus_bus_get_unique_name(m->api_bus);
+}
+
+#define NAME_OWNER_MATCH_ALL                    \
+        "type='signal',"                        \
+        "sender='"DBUS_SERVICE_DBUS"',"         \
+        "interface='"DBUS_INTERFACE_DBUS"',"    \
+        "member='NameOwnerChanged',"            \
+        "path='"DBUS_PATH_DBUS"'"
+
+static char *name_owner_match(const char *name) {
+        assert(name);
+
+        return strjoin(NAME_OWNER_MATCH_ALL ",arg0='", name, "'", NULL);
+}
+
+static bool name_owner_changed(Manager *m, const char *name, const char *old_owner, const char *new_owner) {
+        bool handled = false;
+
+        assert(m);
+        assert(name);
+
+        /* Returns true if this concerned a name we watch, i.e. a
+         * subscribed client or a name of a unit */
+
+        if (!new_owner && m->api_bus) {
+                char *client;
+
+                client = set_remove(BUS_CONNECTION_SUBSCRIBED(m, m->api_bus), (char*) name);
+                if (client) {
+                        log_debug("Subscription client vanished: %s (left: %u)", name, set_size(BUS_CONNECTION_SUBSCRIBED(m, m->api_bus)));
+
+                        /* Unique names are never reused, so
+                         * there's no point in watching it any
+                         * longer */
+                        bus_unwatch_name_owner(m, client);
+                        free(client);
+
+                        handled = true;
+                }
+        }
+
+        if ((old_owner || new_owner) && hashmap_get(m->watch_bus, name)) {
+                manager_dispatch_bus_name_owner_changed(m, name, old_owner, new_owner);
+                handled = true;
+        }
+
+        return handled;
+}
+
 static DBusHandlerResult api_bus_message_filter(DBusConnection *connection, DBusMessage *message, void *data) {
         Manager *m = data;
         DBusError error;
@@ -331,6 +387,8 @@ static DBusHandlerResult api_bus_message_filter(DBusConnection *connection, DBus
         } else if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS, "NameOwnerChanged")) {
                 const char *name, *old_owner, *new_owner;
 
+                m->n_name_owner_signals ++;
+
                 if (!dbus_message_get_args(message, &error,
                                            DBUS_TYPE_STRING, &name,
                                            DBUS_TYPE_STRING, &old_owner,
@@ -338,16 +396,14 @@ static DBusHandlerResult api_bus_message_filter(DBusConnection *connection, DBus
                                            DBUS_TYPE_INVALID))
                         log_error("Failed to parse NameOwnerChanged message: %s", bus_error_message(&error));
                 else  {
-                        if (set_remove(BUS_CONNECTION_SUBSCRIBED(m, connection), (char*) name))
-                                log_debug("Subscription client vanished: %s (left: %u)", name, set_size(BUS_CONNECTION_SUBSCRIBED(m, connection)));
-
                         if (old_owner[0] == 0)
                                 old_owner = NULL;
 
                         if (new_owner[0] == 0)
                                 new_owner = NULL;
 
-                        manager_dispatch_bus_name_owner_changed(m, name, old_owner, new_owner);
+                        if (name_owner_changed(m, name, old_owner, new_owner))
+                                m->n_name_owner_signals_handled ++;
                 }
         } else if (dbus_message_is_signal(message, "org.freedesktop.systemd1.Activator", "ActivationRequest")) {
                 const char *name;
@@ -800,7 +856,91 @@ static int init_registered_system_bus(Manager *m) {
         return 0;
 }
 
+static void add_match_pending_cb(DBusPendingCall *pending, void *userdata);
+
+static void add_name_owner_match_all(Manager *m) {
+        const char *name;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(m);
+
+        /* The bus limits the number of matches per connection. If
+         * we hit that, fall back to a single match for all
+         * NameOwnerChanged signals. Drop the matches for the single
+         * names first to make room for it. */
+
+        HASHMAP_FOREACH_KEY(u, name, m->watch_bus, i)
+                bus_unwatch_name_owner(m, name);
+        SET_FOREACH(name, BUS_CONNECTION_SUBSCRIBED(m, m->api_bus), i)
+                bus_unwatch_name_owner(m, name);
+
+        m->name_owner_match_all = true;
+
+        r = query_name(m, "AddMatch", NAME_OWNER_MATCH_ALL, add_match_pending_cb);
+        if (r < 0) {
+                log_oom();
+                return;
+        }
+
+        /* We might have missed changes while switching over, hence
+         * ask for the current owners of all names again */
+        HASHMAP_FOREACH_KEY(u, name, m->watch_bus, i)
+                if (query_name(m, "GetNameOwner", name, query_name_owner_pending_cb) < 0)
+                        log_oom();
+        SET_FOREACH(name, BUS_CONNECTION_SUBSCRIBED(m, m->api_bus), i)
+                if (query_name(m, "GetNameOwner", name, query_name_owner_pending_cb) < 0)
+                        log_oom();
+}
+
+static void add_match_pending_cb(DBusPendingCall *pending, void *userdata) {
+        Manager *m = userdata;
+        DBusMessage *reply;
+        DBusError error;
+        const char *match;
+
+        dbus_error_init(&error);
+
+        assert_se(match = BUS_PENDING_CALL_NAME(m, pending));
+        assert_se(reply = dbus_pending_call_steal_reply(pending));
+
+        if (dbus_set_error_from_message(&error, reply)) {
+                if (dbus_error_has_name(&error, DBUS_ERROR_LIMITS_EXCEEDED) &&
+                    m->api_bus && !m->name_owner_match_all) {
+                        log_warning("Too many matches on the API bus, subscribing to all NameOwnerChanged signals.");
+                        add_name_owner_match_all(m);
+                } else
+                        log_warning("Failed to add match %s: %s", match, bus_error_message(&error));
+        }
+
+        dbus_message_unref(reply);
+        dbus_error_free(&error);
+}
+
+static int add_name_owner_match(Manager *m, const char *name) {
+        _cleanup_free_ char *match = NULL;
+
+        assert(m);
+        assert(name);
+
+        /* The catch-all match covers this name already */
+        if (m->name_owner_match_all)
+                return 0;
+
+        match = name_owner_match(name);
+        if (!match)
+                return log_oom();
+
+        /* We don't wait for the bus to confirm this, but need to
+         * learn when it refuses to add more matches */
+        return query_name(m, "AddMatch", match, add_match_pending_cb);
+}
+
 static int init_registered_api_bus(Manager *m) {
+        const char *name;
+        Iterator i;
+        Unit *u;
         int r;
 
         if (!dbus_connection_register_object_path(m->api_bus, "/org/freedesktop/systemd1", &bus_manager_vtable, m) ||
@@ -809,14 +949,28 @@ static int init_registered_api_bus(Manager *m) {
             !dbus_connection_add_filter(m->api_bus, api_bus_message_filter, m, NULL))
                 return log_oom();
 
-        /* Get NameOwnerChange messages */
-        dbus_bus_add_match(m->api_bus,
-                           "type='signal',"
-                           "sender='"DBUS_SERVICE_DBUS"',"
-                           "interface='"DBUS_INTERFACE_DBUS"',"
-                           "member='NameOwnerChanged',"
-                           "path='"DBUS_PATH_DBUS"'",
-                           NULL);
+        /* Get NameOwnerChange messages, but only for the names we
+         * care about, since on a busy bus clients come and go all
+         * the time. Later changes to these sets install their
+         * matches themselves, see bus_watch_name_owner(). */
+        HASHMAP_FOREACH_KEY(u, name, m->watch_bus, i) {
+                r = add_name_owner_match(m, name);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Clients deserialized before we got here might have gone
+         * away in the meantime, and ListNames() below only tells us
+         * about those that are still around, hence ask explicitly */
+        SET_FOREACH(name, BUS_CONNECTION_SUBSCRIBED(m, m->api_bus), i) {
+                r = add_name_owner_match(m, name);
+                if (r < 0)
+                        return r;
+
+                r = query_name(m, "GetNameOwner", name, query_name_owner_pending_cb);
+                if (r < 0)
+                        return r;
+        }
 
         /* Get activation requests */
         dbus_bus_add_match(m->api_bus,
@@ -1205,6 +1359,7 @@ static void bus_done_api(Manager *m) {
                 shutdown_connection(m, m->api_bus);
 
         m->api_bus = NULL;
+        m->name_owner_match_all = false;
 
         if (m->queued_message) {
                 dbus_message_unref(m->queued_message);
@@ -1300,19 +1455,21 @@ static void query_pid_pending_cb(DBusPendingCall *pending, void *userdata) {
         dbus_error_free(&error);
 }
 
-int bus_query_pid(Manager *m, const char *name) {
+static int query_name(Manager *m, const char *method, const char *name, DBusPendingCallNotifyFunction callback) {
         DBusMessage *message = NULL;
         DBusPendingCall *pending = NULL;
         char *n = NULL;
 
         assert(m);
+        assert(method);
         assert(name);
+        assert(callback);
 
         if (!(message = dbus_message_new_method_call(
                               DBUS_SERVICE_DBUS,
                               DBUS_PATH_DBUS,
                               DBUS_INTERFACE_DBUS,
-                              "GetConnectionUnixProcessID")))
+                              method)))
                 goto oom;
 
         if (!(dbus_message_append_args(
@@ -1332,7 +1489,7 @@ int bus_query_pid(Manager *m, const char *name) {
 
         n = NULL;
 
-        if (!dbus_pending_call_set_notify(pending, query_pid_pending_cb, m, NULL))
+        if (!dbus_pending_call_set_notify(pending, callback, m, NULL))
                 goto oom;
 
         dbus_message_unref(message);
@@ -1354,6 +1511,92 @@ oom:
         return -ENOMEM;
 }
 
+int bus_query_pid(Manager *m, const char *name) {
+        return query_name(m, "GetConnectionUnixProcessID", name, query_pid_pending_cb);
+}
+
+static void query_name_owner_pending_cb(DBusPendingCall *pending, void *userdata) {
+        Manager *m = userdata;
+        DBusMessage *reply;
+        DBusError error;
+        const char *name, *owner;
+
+        dbus_error_init(&error);
+
+        assert_se(name = BUS_PENDING_CALL_NAME(m, pending));
+        assert_se(reply = dbus_pending_call_steal_reply(pending));
+
+        switch (dbus_message_get_type(reply)) {
+
+        case DBUS_MESSAGE_TYPE_ERROR:
+
+                assert_se(dbus_set_error_from_message(&error, reply));
+
+                if (dbus_error_has_name(&error, DBUS_ERROR_NAME_HAS_NO_OWNER))
+                        name_owner_changed(m, name, NULL, NULL);
+                else
+                        log_warning("GetNameOwner() failed: %s", bus_error_message(&error));
+                break;
+
+        case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+
+                if (!dbus_message_get_args(reply,
+                                           &error,
+                                           DBUS_TYPE_STRING, &owner,
+                                           DBUS_TYPE_INVALID)) {
+                        log_error("Failed to parse GetNameOwner() reply: %s", bus_error_message(&error));
+                        break;
+                }
+
+                name_owner_changed(m, name, NULL, owner);
+                break;
+
+        default:
+                assert_not_reached("Invalid reply message");
+        }
+
+        dbus_message_unref(reply);
+        dbus_error_free(&error);
+}
+
+int bus_watch_name_owner(Manager *m, const char *name) {
+        int r;
+
+        assert(m);
+        assert(name);
+
+        /* Until we are registered on the API bus,
+         * init_registered_api_bus() will take care of this */
+        if (!api_bus_registered(m))
+                return 0;
+
+        r = add_name_owner_match(m, name);
+        if (r < 0)
+                return r;
+
+        /* The name might have changed hands before the match was
+         * in place, hence ask for its current owner */
+        return query_name(m, "GetNameOwner", name, query_name_owner_pending_cb);
+}
+
+void bus_unwatch_name_owner(Manager *m, const char *name) {
+        _cleanup_free_ char *match = NULL;
+
+        assert(m);
+        assert(name);
+
+        if (!api_bus_registered(m) || m->name_owner_match_all)
+                return;
+
+        match = name_owner_match(name);
+        if (!match) {
+                log_oom();
+                return;
+        }
+
+        dbus_bus_remove_match(m->api_bus, match, NULL);
+}
+
 int bus_broadcast(Manager *m, DBusMessage *message) {
         bool oom = false;
         Iterator i;
@@ -1551,6 +1794,7 @@ int bus_deserialize_item(Manager *m, const char *line) {
         const char *e;
         char *b;
         Set *s;
+        int r;
 
         assert(m);
         assert(line);
@@ -1570,7 +1814,12 @@ int bus_deserialize_item(Manager *m, const char *line) {
         if (!b)
                 return -ENOMEM;
 
-        set_consume(s, b);
+        r = set_consume(s, b);
+        if (r > 0) {
+                r = bus_watch_name_owner(m, e);
+                if (r < 0)
+                        return r;
+        }
 
         return 1;
 }
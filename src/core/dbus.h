@@ -35,6 +35,9 @@ void bus_timeout_event(Manager *m, Watch *w, int events);
 
 int bus_query_pid(Manager *m, const char *name);
 
+int bus_watch_name_owner(Manager *m, const char *name);
+void bus_unwatch_name_owner(Manager *m, const char *name);
+
 int bus_broadcast(Manager *m, DBusMessage *message);
 
 bool bus_has_subscriber(Manager *m);
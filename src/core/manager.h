@@ -238,6 +238,15 @@ struct Manager {
         unsigned n_installed_jobs;
         unsigned n_failed_jobs;
 
+        /* NameOwnerChanged signals received, and those that
+         * concerned a name we watch */
+        unsigned n_name_owner_signals;
+        unsigned n_name_owner_signals_handled;
+
+        /* The bus refused further matches, hence we receive all
+         * NameOwnerChanged signals */
+        bool name_owner_match_all;
+
         /* Jobs in progress watching */
         unsigned n_running_jobs;
         unsigned n_on_console;
@@ -41,6 +41,7 @@
 #include "log.h"
 #include "unit-name.h"
 #include "dbus-unit.h"
+#include "dbus.h"
 #include "special.h"
 #include "cgroup-util.h"
 #include "missing.h"
@@ -2141,20 +2142,27 @@ int unit_get_related_unit(Unit *u, const char *type, Unit **_found) {
 }
 
 int unit_watch_bus_name(Unit *u, const char *name) {
+        int r;
+
         assert(u);
         assert(name);
 
         /* Watch a specific name on the bus. We only support one unit
          * watching each name for now. */
 
-        return hashmap_put(u->manager->watch_bus, name, u);
+        r = hashmap_put(u->manager->watch_bus, name, u);
+        if (r <= 0)
+                return r;
+
+        return bus_watch_name_owner(u->manager, name);
 }
 
 void unit_unwatch_bus_name(Unit *u, const char *name) {
         assert(u);
         assert(name);
 
-        hashmap_remove_value(u->manager->watch_bus, name, u);
+        if (hashmap_remove_value(u->manager->watch_bus, name, u))
+                bus_unwatch_name_owner(u->manager, name);
 }
 
 bool unit_can_serialize(Unit *u) {
@@ -543,6 +543,226 @@ finish:
         return r;
 }
 
+/* How often to check whether the database was updated under a handle */
+#define CATALOG_RECHECK_USEC (1*USEC_PER_SEC)
+
+/* How many ids to remember the text of at most, including the ones
+ * that are not in the catalog */
+#define CATALOG_CACHE_MAX 1024
+
+typedef struct CatalogCacheItem {
+        sd_id128_t id;
+        const char *text;
+} CatalogCacheItem;
+
+struct Catalog {
+        char *database;
+
+        void *p;
+        struct stat st;
+        usec_t checked_usec;
+
+        /* Which text to show for an id, with the language fallback
+         * resolved for the locale below */
+        Hashmap *cache;
+        char *locale;
+
+        uint64_t n_hit;
+        uint64_t n_miss;
+};
+
+static unsigned catalog_id_hash_func(const void *p) {
+        const CatalogCacheItem *i = p;
+
+        /* The ids are random anyway */
+        return ((unsigned) i->id.bytes[0] << 24) |
+               ((unsigned) i->id.bytes[1] << 16) |
+               ((unsigned) i->id.bytes[2] << 8) |
+               ((unsigned) i->id.bytes[3]);
+}
+
+static int catalog_id_compare_func(const void *a, const void *b) {
+        const CatalogCacheItem *i = a, *j = b;
+
+        return memcmp(&i->id, &j->id, sizeof(i->id));
+}
+
+static void catalog_flush(Catalog *c) {
+        CatalogCacheItem *i;
+
+        assert(c);
+
+        while ((i = hashmap_steal_first(c->cache)))
+                free(i);
+}
+
+static void catalog_unmap(Catalog *c) {
+        assert(c);
+
+        catalog_flush(c);
+
+        if (c->p) {
+                munmap(c->p, PAGE_ALIGN(c->st.st_size));
+                c->p = NULL;
+        }
+}
+
+static int catalog_map(Catalog *c) {
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        assert(c);
+
+        catalog_unmap(c);
+
+        c->checked_usec = now(CLOCK_MONOTONIC);
+
+        r = open_mmap(c->database, &fd, &c->st, &c->p);
+        if (r < 0)
+                return r;
+
+        return 0;
+}
+
+int catalog_open(const char *database, Catalog **ret) {
+        Catalog *c;
+        int r;
+
+        assert(database);
+        assert(ret);
+
+        c = new0(Catalog, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->database = strdup(database);
+        c->cache = hashmap_new(catalog_id_hash_func, catalog_id_compare_func);
+        if (!c->database || !c->cache) {
+                catalog_close(c);
+                return -ENOMEM;
+        }
+
+        r = catalog_map(c);
+        if (r < 0) {
+                catalog_close(c);
+                return r;
+        }
+
+        *ret = c;
+        return 0;
+}
+
+void catalog_close(Catalog *c) {
+        if (!c)
+                return;
+
+        if (c->cache) {
+                catalog_unmap(c);
+                hashmap_free(c->cache);
+        }
+
+        free(c->database);
+        free(c->locale);
+        free(c);
+}
+
+static int catalog_revalidate(Catalog *c) {
+        const char *loc;
+        struct stat st;
+        usec_t n;
+
+        assert(c);
+
+        /* The texts depend on the locale, so start from scratch
+         * when it changes */
+        loc = setlocale(LC_MESSAGES, NULL);
+        if (!streq_ptr(loc, c->locale)) {
+                char *l = NULL;
+
+                if (loc) {
+                        l = strdup(loc);
+                        if (!l)
+                                return -ENOMEM;
+                }
+
+                free(c->locale);
+                c->locale = l;
+
+                catalog_flush(c);
+        }
+
+        /* Pick up updates of the database, but do not check for
+         * them on every single lookup */
+        n = now(CLOCK_MONOTONIC);
+        if (n < c->checked_usec + CATALOG_RECHECK_USEC)
+                return c->p ? 0 : -ENOENT;
+
+        if (c->p &&
+            stat(c->database, &st) >= 0 &&
+            st.st_dev == c->st.st_dev &&
+            st.st_ino == c->st.st_ino &&
+            st.st_size == c->st.st_size &&
+            timespec_load(&st.st_mtim) == timespec_load(&c->st.st_mtim)) {
+                c->checked_usec = n;
+                return 0;
+        }
+
+        return catalog_map(c);
+}
+
+int catalog_lookup(Catalog *c, sd_id128_t id, const char **text) {
+        CatalogCacheItem key, *i;
+        int r;
+
+        assert(c);
+        assert(text);
+
+        /* The text stays valid until the next lookup */
+
+        r = catalog_revalidate(c);
+        if (r < 0)
+                return r;
+
+        key.id = id;
+        i = hashmap_get(c->cache, &key);
+        if (i)
+                c->n_hit++;
+        else {
+                c->n_miss++;
+
+                if (hashmap_size(c->cache) >= CATALOG_CACHE_MAX)
+                        catalog_flush(c);
+
+                i = new(CatalogCacheItem, 1);
+                if (!i)
+                        return -ENOMEM;
+
+                i->id = id;
+                i->text = find_id(c->p, id);
+
+                r = hashmap_put(c->cache, i, i);
+                if (r < 0) {
+                        free(i);
+                        return r;
+                }
+        }
+
+        if (!i->text)
+                return -ENOENT;
+
+        *text = i->text;
+        return 0;
+}
+
+void catalog_get_statistics(Catalog *c, uint64_t *n_hit, uint64_t *n_miss) {
+        assert(c);
+
+        if (n_hit)
+                *n_hit = c->n_hit;
+        if (n_miss)
+                *n_miss = c->n_miss;
+}
+
 static char *find_header(const char *s, const char *header) {
 
         for (;;) {
@@ -32,6 +32,14 @@ unsigned catalog_hash_func(const void *p);
 int catalog_compare_func(const void *a, const void *b) _pure_;
 int catalog_update(const char* database, const char* root, const char* const* dirs);
 int catalog_get(const char* database, sd_id128_t id, char **data);
+
+typedef struct Catalog Catalog;
+
+int catalog_open(const char *database, Catalog **ret);
+void catalog_close(Catalog *c);
+int catalog_lookup(Catalog *c, sd_id128_t id, const char **text);
+void catalog_get_statistics(Catalog *c, uint64_t *n_hit, uint64_t *n_miss);
+
 int catalog_list(FILE *f, const char* database, bool oneline);
 int catalog_list_items(FILE *f, const char* database, bool oneline, char **items);
 extern const char * const catalog_file_dirs[];
@@ -20,197 +20,652 @@
 ***/
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <lzma.h>
+#include <unistd.h>
+
+#ifdef HAVE_XZ
+#  include <lzma.h>
+#endif
+
+#ifdef HAVE_LZ4
+#  include <lz4.h>
+#endif
 
 #include "macro.h"
+#include "util.h"
+#include "sparse-endian.h"
+#include "journal-def.h"
 #include "compress.h"
 
-bool compress_blob(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
-        lzma_stream s = LZMA_STREAM_INIT;
-        lzma_ret ret;
-        bool b = false;
+/* The chunk size streams are processed in. This is all the memory
+ * streaming needs apart from the codec state, regardless of how much
+ * data passes through. */
+#define STREAM_BUFFER_SIZE (64*1024)
+
+/* Streams are used for coredumps, which may be gigabytes in size and
+ * need to be consumed while the kernel holds on to the crashed
+ * process. Hence favour speed over ratio. This also caps the encoder
+ * state at a few MiB, while the default preset needs ~90MiB. */
+#define STREAM_XZ_PRESET 1
+
+struct CompressContext {
+        int n_ref;
+
+#ifdef HAVE_XZ
+        /* liblzma reuses the memory of an already initialized
+         * stream when it is set up again with compatible
+         * parameters, hence keep both streams around */
+        lzma_stream xz_encoder;
+        lzma_stream xz_decoder;
+        uint32_t xz_encoder_dict_size;
+        bool xz_encoder_ready:1;
+        bool xz_decoder_ready:1;
+#endif
+
+#ifdef HAVE_LZ4
+        void *lz4_state;
+#endif
+};
+
+static const char* const object_compressed_table[_OBJECT_COMPRESSED_MAX] = {
+        [OBJECT_COMPRESSED_XZ] = "xz",
+        [OBJECT_COMPRESSED_LZ4] = "lz4",
+};
+
+DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
+
+CompressContext* compress_context_new(void) {
+        CompressContext *c;
+
+        c = new0(CompressContext, 1);
+        if (!c)
+                return NULL;
+
+        c->n_ref = 1;
+        return c;
+}
+
+CompressContext* compress_context_ref(CompressContext *c) {
+        assert(c);
+        assert(c->n_ref > 0);
+
+        c->n_ref ++;
+        return c;
+}
+
+static void compress_context_free(CompressContext *c) {
+        assert(c);
+
+#ifdef HAVE_XZ
+        if (c->xz_encoder_ready)
+                lzma_end(&c->xz_encoder);
+        if (c->xz_decoder_ready)
+                lzma_end(&c->xz_decoder);
+#endif
+
+#ifdef HAVE_LZ4
+        free(c->lz4_state);
+#endif
+
+        free(c);
+}
+
+CompressContext* compress_context_unref(CompressContext *c) {
+        assert(c);
+        assert(c->n_ref > 0);
+
+        c->n_ref --;
+        if (c->n_ref == 0)
+                compress_context_free(c);
+
+        return NULL;
+}
+
+static int buffer_reserve(void **buffer, uint64_t *buffer_size, uint64_t size) {
+        void *p;
+        uint64_t a;
 
+        assert(buffer);
+        assert(buffer_size);
+        assert(*buffer_size == 0 || *buffer);
+
+        if (*buffer_size >= size)
+                return 0;
+
+        a = MAX(size, *buffer_size * 2);
+
+        /* We can't allocate more than 4G on a 32bit machine */
+        if ((uint64_t) (size_t) a != a)
+                return -E2BIG;
+
+        p = realloc(*buffer, a);
+        if (!p)
+                return -ENOMEM;
+
+        *buffer = p;
+        *buffer_size = a;
+        return 0;
+}
+
+#ifdef HAVE_XZ
+static int xz_encoder_setup(CompressContext *c, uint64_t src_size) {
+        lzma_options_lzma opt;
+        lzma_filter filters[] = {
+                { LZMA_FILTER_LZMA2, &opt },
+                { LZMA_VLI_UNKNOWN, NULL }
+        };
+        uint32_t dict_size;
+
+        /* The match finder's tables scale with the dictionary, and
+         * setting them up is what dominated compressing the small
+         * blobs we deal with. A dictionary larger than the input is
+         * useless, hence size it to the next power of two above
+         * it. That way most blobs end up in the same few size
+         * classes and the encoder memory is reused. */
+        dict_size = LZMA_DICT_SIZE_MIN;
+        while (dict_size < src_size && dict_size < (1U << 23))
+                dict_size <<= 1;
+
+        if (lzma_lzma_preset(&opt, LZMA_PRESET_DEFAULT))
+                return -EINVAL;
+
+        opt.dict_size = dict_size;
+
+        if (lzma_stream_encoder(&c->xz_encoder, filters, LZMA_CHECK_NONE) != LZMA_OK)
+                return -ENOMEM;
+
+        c->xz_encoder_ready = true;
+        c->xz_encoder_dict_size = dict_size;
+        return 0;
+}
+
+int compress_blob_xz(CompressContext *c, const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+        lzma_stream *s;
+        int r;
+
+        assert(c);
         assert(src);
         assert(src_size > 0);
         assert(dst);
         assert(dst_size);
 
-        /* Returns false if we couldn't compress the data or the
+        /* Returns -ENOBUFS if we couldn't compress the data or the
          * compressed result is longer than the original */
 
-        ret = lzma_easy_encoder(&s, LZMA_PRESET_DEFAULT, LZMA_CHECK_NONE);
-        if (ret != LZMA_OK)
-                return false;
+        r = xz_encoder_setup(c, src_size);
+        if (r < 0)
+                return r;
 
-        s.next_in = src;
-        s.avail_in = src_size;
-        s.next_out = dst;
-        s.avail_out = src_size;
+        s = &c->xz_encoder;
+        s->next_in = src;
+        s->avail_in = src_size;
+        s->next_out = dst;
+        s->avail_out = src_size;
 
         /* Does it fit? */
-        if (lzma_code(&s, LZMA_FINISH) != LZMA_STREAM_END)
-                goto fail;
+        if (lzma_code(s, LZMA_FINISH) != LZMA_STREAM_END)
+                return -ENOBUFS;
 
         /* Is it actually shorter? */
-        if (s.avail_out == 0)
-                goto fail;
+        if (s->avail_out == 0)
+                return -ENOBUFS;
+
+        *dst_size = src_size - s->avail_out;
+        return 0;
+}
 
-        *dst_size = src_size - s.avail_out;
-        b = true;
+static int xz_decoder_setup(CompressContext *c, const void *src, uint64_t src_size) {
+        lzma_stream *s;
 
-fail:
-        lzma_end(&s);
+        if (lzma_stream_decoder(&c->xz_decoder, UINT64_MAX, 0) != LZMA_OK)
+                return -ENOMEM;
 
-        return b;
+        c->xz_decoder_ready = true;
+
+        s = &c->xz_decoder;
+        s->next_in = src;
+        s->avail_in = src_size;
+
+        return 0;
 }
 
-bool uncompress_blob(const void *src, uint64_t src_size,
-                     void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+int uncompress_blob_xz(CompressContext *c, const void *src, uint64_t src_size,
+                       void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
 
-        lzma_stream s = LZMA_STREAM_INIT;
-        lzma_ret ret;
+        lzma_stream *s;
+        lzma_ret k;
         uint64_t space;
-        bool b = false;
+        int r;
 
+        assert(c);
         assert(src);
         assert(src_size > 0);
         assert(dst);
         assert(dst_alloc_size);
         assert(dst_size);
-        assert(*dst_alloc_size == 0 || *dst);
-
-        ret = lzma_stream_decoder(&s, UINT64_MAX, 0);
-        if (ret != LZMA_OK)
-                return false;
-
-        if (*dst_alloc_size <= src_size) {
-                void *p;
 
-                p = realloc(*dst, src_size*2);
-                if (!p)
-                        return false;
+        r = xz_decoder_setup(c, src, src_size);
+        if (r < 0)
+                return r;
 
-                *dst = p;
-                *dst_alloc_size = src_size*2;
-        }
-
-        s.next_in = src;
-        s.avail_in = src_size;
+        r = buffer_reserve(dst, dst_alloc_size, src_size * 2);
+        if (r < 0)
+                return r;
 
-        s.next_out = *dst;
+        s = &c->xz_decoder;
+        s->next_out = *dst;
         space = dst_max > 0 ? MIN(*dst_alloc_size, dst_max) : *dst_alloc_size;
-        s.avail_out = space;
+        s->avail_out = space;
 
         for (;;) {
-                void *p;
+                size_t used;
 
-                ret = lzma_code(&s, LZMA_FINISH);
+                k = lzma_code(s, LZMA_FINISH);
 
-                if (ret == LZMA_STREAM_END)
+                if (k == LZMA_STREAM_END)
                         break;
 
-                if (ret != LZMA_OK)
-                        goto fail;
+                if (k != LZMA_OK)
+                        return -EBADMSG;
 
-                if (dst_max > 0 && (space - s.avail_out) >= dst_max)
+                if (dst_max > 0 && (space - s->avail_out) >= dst_max)
                         break;
 
-                p = realloc(*dst, space*2);
-                if (!p)
-                        goto fail;
+                used = (uint8_t*) s->next_out - (uint8_t*) *dst;
 
-                s.next_out = (uint8_t*) p + ((uint8_t*) s.next_out - (uint8_t*) *dst);
-                s.avail_out += space;
+                r = buffer_reserve(dst, dst_alloc_size, space * 2);
+                if (r < 0)
+                        return r;
 
-                space *= 2;
-
-                *dst = p;
-                *dst_alloc_size = space;
+                s->next_out = (uint8_t*) *dst + used;
+                s->avail_out += *dst_alloc_size - space;
+                space = *dst_alloc_size;
         }
 
-        *dst_size = space - s.avail_out;
-        b = true;
-
-fail:
-        lzma_end(&s);
-
-        return b;
+        *dst_size = space - s->avail_out;
+        return 0;
 }
 
-bool uncompress_startswith(const void *src, uint64_t src_size,
-                           void **buffer, uint64_t *buffer_size,
-                           const void *prefix, uint64_t prefix_len,
-                           uint8_t extra) {
+int uncompress_startswith_xz(CompressContext *c, const void *src, uint64_t src_size,
+                             void **buffer, uint64_t *buffer_size,
+                             const void *prefix, uint64_t prefix_len,
+                             uint8_t extra) {
 
-        lzma_stream s = LZMA_STREAM_INIT;
-        lzma_ret ret;
-        bool b = false;
+        lzma_stream *s;
+        lzma_ret k;
+        uint64_t space;
+        int r;
 
         /* Checks whether the uncompressed blob starts with the
          * mentioned prefix. The byte extra needs to follow the
          * prefix */
 
+        assert(c);
         assert(src);
         assert(src_size > 0);
         assert(buffer);
         assert(buffer_size);
         assert(prefix);
-        assert(*buffer_size == 0 || *buffer);
 
-        ret = lzma_stream_decoder(&s, UINT64_MAX, 0);
-        if (ret != LZMA_OK)
-                return false;
+        r = xz_decoder_setup(c, src, src_size);
+        if (r < 0)
+                return r;
+
+        r = buffer_reserve(buffer, buffer_size, prefix_len + 1);
+        if (r < 0)
+                return r;
+
+        /* Only decode as much as we need to decide */
+        s = &c->xz_decoder;
+        s->next_out = *buffer;
+        space = prefix_len + 1;
+        s->avail_out = space;
+
+        k = lzma_code(s, LZMA_FINISH);
+        if (k != LZMA_STREAM_END && k != LZMA_OK)
+                return -EBADMSG;
+
+        if (s->avail_out > 0)
+                return 0;
+
+        return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+}
+#endif
+
+#ifdef HAVE_LZ4
+/* LZ4 blocks do not record the size of the uncompressed data, hence
+ * we prefix each compressed blob with it as little endian 64bit
+ * value. */
+#define LZ4_HEADER_SIZE sizeof(le64_t)
+
+int compress_blob_lz4(CompressContext *c, const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+        int r;
+
+        assert(c);
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_size);
+
+        /* Returns -ENOBUFS if we couldn't compress the data or the
+         * compressed result is longer than the original */
+
+        if (src_size <= LZ4_HEADER_SIZE || src_size > LZ4_MAX_INPUT_SIZE)
+                return -ENOBUFS;
+
+        if (!c->lz4_state) {
+                c->lz4_state = malloc(LZ4_sizeofState());
+                if (!c->lz4_state)
+                        return -ENOMEM;
+        }
+
+        r = LZ4_compress_fast_extState(c->lz4_state, src, (char*) dst + LZ4_HEADER_SIZE,
+                                       src_size, src_size - LZ4_HEADER_SIZE - 1, 1);
+        if (r <= 0)
+                return -ENOBUFS;
+
+        *(le64_t*) dst = htole64(src_size);
+        *dst_size = r + LZ4_HEADER_SIZE;
 
-        if (*buffer_size <= prefix_len) {
-                void *p;
+        return 0;
+}
+
+int uncompress_blob_lz4(CompressContext *c, const void *src, uint64_t src_size,
+                        void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+
+        uint64_t size;
+        int r;
+
+        assert(c);
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+
+        if (src_size <= LZ4_HEADER_SIZE)
+                return -EBADMSG;
+
+        size = le64toh(*(const le64_t*) src);
+        if (size == 0 || size > LZ4_MAX_INPUT_SIZE)
+                return -EBADMSG;
+
+        r = buffer_reserve(dst, dst_alloc_size, size);
+        if (r < 0)
+                return r;
+
+        /* Unlike XZ we cannot cheaply stop at dst_max, and a partial
+         * decode buys us little, so we always decode the full blob */
+        r = LZ4_decompress_safe((const char*) src + LZ4_HEADER_SIZE, *dst,
+                                src_size - LZ4_HEADER_SIZE, size);
+        if (r < 0 || (uint64_t) r != size)
+                return -EBADMSG;
+
+        *dst_size = size;
+        return 0;
+}
+
+int uncompress_startswith_lz4(CompressContext *c, const void *src, uint64_t src_size,
+                              void **buffer, uint64_t *buffer_size,
+                              const void *prefix, uint64_t prefix_len,
+                              uint8_t extra) {
+
+        uint64_t size;
+        int r;
+
+        assert(c);
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+
+        r = uncompress_blob_lz4(c, src, src_size, buffer, buffer_size, &size, 0);
+        if (r < 0)
+                return r;
+
+        if (size < prefix_len + 1)
+                return 0;
+
+        return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+}
+#endif
+
+int compress_blob(CompressContext *c, int compression,
+                  const void *src, uint64_t src_size,
+                  void *dst, uint64_t *dst_size) {
+
+#ifdef HAVE_XZ
+        if (compression == OBJECT_COMPRESSED_XZ)
+                return compress_blob_xz(c, src, src_size, dst, dst_size);
+#endif
+#ifdef HAVE_LZ4
+        if (compression == OBJECT_COMPRESSED_LZ4)
+                return compress_blob_lz4(c, src, src_size, dst, dst_size);
+#endif
+
+        return -EPROTONOSUPPORT;
+}
+
+int uncompress_blob(CompressContext *c, int compression,
+                    const void *src, uint64_t src_size,
+                    void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+
+#ifdef HAVE_XZ
+        if (compression == OBJECT_COMPRESSED_XZ)
+                return uncompress_blob_xz(c, src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+#endif
+#ifdef HAVE_LZ4
+        if (compression == OBJECT_COMPRESSED_LZ4)
+                return uncompress_blob_lz4(c, src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+#endif
+
+        if (compression & ~OBJECT_COMPRESSION_MASK ||
+            compression == OBJECT_COMPRESSION_MASK)
+                return -EBADMSG;
 
-                p = realloc(*buffer, prefix_len*2);
-                if (!p)
-                        return false;
+        return -EPROTONOSUPPORT;
+}
+
+int uncompress_startswith(CompressContext *c, int compression,
+                          const void *src, uint64_t src_size,
+                          void **buffer, uint64_t *buffer_size,
+                          const void *prefix, uint64_t prefix_len,
+                          uint8_t extra) {
+
+#ifdef HAVE_XZ
+        if (compression == OBJECT_COMPRESSED_XZ)
+                return uncompress_startswith_xz(c, src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+#endif
+#ifdef HAVE_LZ4
+        if (compression == OBJECT_COMPRESSED_LZ4)
+                return uncompress_startswith_lz4(c, src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+#endif
+
+        if (compression & ~OBJECT_COMPRESSION_MASK ||
+            compression == OBJECT_COMPRESSION_MASK)
+                return -EBADMSG;
+
+        return -EPROTONOSUPPORT;
+}
+
+static int write_all(int fd, const void *buf, size_t nbytes) {
+        ssize_t k;
+
+        k = loop_write(fd, buf, nbytes, false);
+        if (k < 0)
+                return (int) k;
+        if ((size_t) k != nbytes)
+                return -EIO;
+
+        return 0;
+}
+
+static int copy_stream(int fdf, int fdt, off_t max_bytes) {
+        uint8_t buf[STREAM_BUFFER_SIZE];
+        off_t total = 0;
+        int r;
 
-                *buffer = p;
-                *buffer_size = prefix_len*2;
+        for (;;) {
+                ssize_t n;
+
+                n = loop_read(fdf, buf, sizeof(buf), false);
+                if (n < 0)
+                        return (int) n;
+                if (n == 0)
+                        return 0;
+
+                total += n;
+                if (max_bytes != (off_t) -1 && total > max_bytes)
+                        return -E2BIG;
+
+                r = write_all(fdt, buf, n);
+                if (r < 0)
+                        return r;
         }
+}
+
+#ifdef HAVE_XZ
+int compress_stream_xz(int fdf, int fdt, off_t max_bytes) {
+        _cleanup_(lzma_end) lzma_stream s = LZMA_STREAM_INIT;
+        uint8_t buf[STREAM_BUFFER_SIZE], out[STREAM_BUFFER_SIZE];
+        lzma_action action = LZMA_RUN;
+        off_t total = 0;
+        lzma_ret k;
+        int r;
 
-        s.next_in = src;
-        s.avail_in = src_size;
+        assert(fdf >= 0);
+        assert(fdt >= 0);
 
-        s.next_out = *buffer;
-        s.avail_out = *buffer_size;
+        k = lzma_easy_encoder(&s, STREAM_XZ_PRESET, LZMA_CHECK_CRC64);
+        if (k != LZMA_OK)
+                return k == LZMA_MEM_ERROR ? -ENOMEM : -EINVAL;
+
+        s.next_out = out;
+        s.avail_out = sizeof(out);
 
         for (;;) {
-                void *p;
+                if (s.avail_in == 0 && action == LZMA_RUN) {
+                        ssize_t n;
+
+                        n = loop_read(fdf, buf, sizeof(buf), false);
+                        if (n < 0)
+                                return (int) n;
+
+                        if (n == 0)
+                                action = LZMA_FINISH;
+                        else {
+                                total += n;
+                                if (max_bytes != (off_t) -1 && total > max_bytes)
+                                        return -E2BIG;
+                        }
+
+                        s.next_in = buf;
+                        s.avail_in = n;
+                }
+
+                k = lzma_code(&s, action);
+                if (k != LZMA_OK && k != LZMA_STREAM_END)
+                        return k == LZMA_MEM_ERROR ? -ENOMEM : -EIO;
+
+                if (s.avail_out == 0 || k == LZMA_STREAM_END) {
+                        r = write_all(fdt, out, sizeof(out) - s.avail_out);
+                        if (r < 0)
+                                return r;
+
+                        if (k == LZMA_STREAM_END)
+                                return 0;
+
+                        s.next_out = out;
+                        s.avail_out = sizeof(out);
+                }
+        }
+}
 
-                ret = lzma_code(&s, LZMA_FINISH);
+int decompress_stream_xz(int fdf, int fdt, off_t max_bytes) {
+        _cleanup_(lzma_end) lzma_stream s = LZMA_STREAM_INIT;
+        uint8_t buf[STREAM_BUFFER_SIZE], out[STREAM_BUFFER_SIZE];
+        lzma_action action = LZMA_RUN;
+        off_t total = 0;
+        lzma_ret k;
+        int r;
 
-                if (ret != LZMA_STREAM_END && ret != LZMA_OK)
-                        goto fail;
+        assert(fdf >= 0);
+        assert(fdt >= 0);
 
-                if ((*buffer_size - s.avail_out > prefix_len) &&
-                    memcmp(*buffer, prefix, prefix_len) == 0 &&
-                    ((const uint8_t*) *buffer)[prefix_len] == extra)
-                        break;
+        k = lzma_stream_decoder(&s, UINT64_MAX, 0);
+        if (k != LZMA_OK)
+                return -ENOMEM;
+
+        s.next_out = out;
+        s.avail_out = sizeof(out);
+
+        for (;;) {
+                if (s.avail_in == 0 && action == LZMA_RUN) {
+                        ssize_t n;
+
+                        n = loop_read(fdf, buf, sizeof(buf), false);
+                        if (n < 0)
+                                return (int) n;
+
+                        if (n == 0)
+                                action = LZMA_FINISH;
+
+                        s.next_in = buf;
+                        s.avail_in = n;
+                }
 
-                if (ret == LZMA_STREAM_END)
-                        goto fail;
+                /* A truncated stream makes lzma_code() fail with
+                 * LZMA_BUF_ERROR once we are at the end of input */
+                k = lzma_code(&s, action);
+                if (k != LZMA_OK && k != LZMA_STREAM_END)
+                        return k == LZMA_MEM_ERROR ? -ENOMEM : -EBADMSG;
 
-                p = realloc(*buffer, *buffer_size*2);
-                if (!p)
-                        goto fail;
+                if (s.avail_out == 0 || k == LZMA_STREAM_END) {
+                        size_t n = sizeof(out) - s.avail_out;
 
-                s.next_out = (uint8_t*) p + ((uint8_t*) s.next_out - (uint8_t*) *buffer);
-                s.avail_out += *buffer_size;
+                        total += n;
+                        if (max_bytes != (off_t) -1 && total > max_bytes)
+                                return -E2BIG;
 
-                *buffer = p;
-                *buffer_size *= 2;
+                        r = write_all(fdt, out, n);
+                        if (r < 0)
+                                return r;
+
+                        if (k == LZMA_STREAM_END)
+                                return 0;
+
+                        s.next_out = out;
+                        s.avail_out = sizeof(out);
+                }
         }
+}
+#endif
+
+int compress_stream(int compression, int fdf, int fdt, off_t max_bytes) {
+
+        if (compression == 0)
+                return copy_stream(fdf, fdt, max_bytes);
+#ifdef HAVE_XZ
+        if (compression == OBJECT_COMPRESSED_XZ)
+                return compress_stream_xz(fdf, fdt, max_bytes);
+#endif
+
+        return -EPROTONOSUPPORT;
+}
 
-        b = true;
+int decompress_stream(int compression, int fdf, int fdt, off_t max_bytes) {
 
-fail:
-        lzma_end(&s);
+        if (compression == 0)
+                return copy_stream(fdf, fdt, max_bytes);
+#ifdef HAVE_XZ
+        if (compression == OBJECT_COMPRESSED_XZ)
+                return decompress_stream_xz(fdf, fdt, max_bytes);
+#endif
 
-        return b;
+        return -EPROTONOSUPPORT;
 }
@@ -23,13 +23,75 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
-bool compress_blob(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size);
+#include "macro.h"
+#include "util.h"
+#include "journal-def.h"
 
-bool uncompress_blob(const void *src, uint64_t src_size,
-                     void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max);
+/* The codec new journal files are written with if compression is
+ * simply enabled, without naming a specific algorithm. XZ stays the
+ * default since files written with it can be read by older
+ * versions. */
+#if defined(HAVE_XZ)
+#  define OBJECT_COMPRESSED_DEFAULT OBJECT_COMPRESSED_XZ
+#elif defined(HAVE_LZ4)
+#  define OBJECT_COMPRESSED_DEFAULT OBJECT_COMPRESSED_LZ4
+#else
+#  define OBJECT_COMPRESSED_DEFAULT 0
+#endif
 
-bool uncompress_startswith(const void *src, uint64_t src_size,
-                           void **buffer, uint64_t *buffer_size,
-                           const void *prefix, uint64_t prefix_len,
-                           uint8_t extra);
+/* A CompressContext keeps the codec state around between calls, so
+ * that the encoder and decoder do not need to be set up from scratch
+ * for each object. It is not thread safe, use one context per
+ * thread. */
+typedef struct CompressContext CompressContext;
+
+CompressContext* compress_context_new(void);
+CompressContext* compress_context_ref(CompressContext *c);
+CompressContext* compress_context_unref(CompressContext *c);
+
+const char* object_compressed_to_string(int compression);
+int object_compressed_from_string(const char *compression);
+
+int compress_blob_xz(CompressContext *c, const void *src, uint64_t src_size, void *dst, uint64_t *dst_size);
+int compress_blob_lz4(CompressContext *c, const void *src, uint64_t src_size, void *dst, uint64_t *dst_size);
+int compress_blob(CompressContext *c, int compression,
+                  const void *src, uint64_t src_size,
+                  void *dst, uint64_t *dst_size);
+
+int uncompress_blob_xz(CompressContext *c, const void *src, uint64_t src_size,
+                       void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max);
+int uncompress_blob_lz4(CompressContext *c, const void *src, uint64_t src_size,
+                        void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max);
+int uncompress_blob(CompressContext *c, int compression,
+                    const void *src, uint64_t src_size,
+                    void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max);
+
+int uncompress_startswith_xz(CompressContext *c, const void *src, uint64_t src_size,
+                             void **buffer, uint64_t *buffer_size,
+                             const void *prefix, uint64_t prefix_len,
+                             uint8_t extra);
+int uncompress_startswith_lz4(CompressContext *c, const void *src, uint64_t src_size,
+                              void **buffer, uint64_t *buffer_size,
+                              const void *prefix, uint64_t prefix_len,
+                              uint8_t extra);
+int uncompress_startswith(CompressContext *c, int compression,
+                          const void *src, uint64_t src_size,
+                          void **buffer, uint64_t *buffer_size,
+                          const void *prefix, uint64_t prefix_len,
+                          uint8_t extra);
+
+/* The stream functions read fdf until EOF and write the result to
+ * fdt in fixed size chunks, so that memory use does not depend on
+ * the amount of data. max_bytes limits the uncompressed size, or is
+ * -1 for no limit; -E2BIG is returned once it is exceeded. A
+ * compression of 0 copies the data unchanged. Only XZ is supported
+ * for streams, as our LZ4 blobs have no framing. */
+int compress_stream_xz(int fdf, int fdt, off_t max_bytes);
+int decompress_stream_xz(int fdf, int fdt, off_t max_bytes);
+int compress_stream(int compression, int fdf, int fdt, off_t max_bytes);
+int decompress_stream(int compression, int fdf, int fdt, off_t max_bytes);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(CompressContext*, compress_context_unref);
+#define _cleanup_compress_context_unref_ _cleanup_(compress_context_unrefp)
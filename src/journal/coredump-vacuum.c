@@ -0,0 +1,180 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "coredump-vacuum.h"
+
+/* Like for the journal: by default use at most 10% of the file
+ * system, and leave 15% free, both capped at 4G */
+#define DEFAULT_MAX_USE_LOWER ((off_t) (1ULL*1024ULL*1024ULL))
+#define DEFAULT_MAX_USE_UPPER ((off_t) (4ULL*1024ULL*1024ULL*1024ULL))
+#define DEFAULT_KEEP_FREE_UPPER ((off_t) (4ULL*1024ULL*1024ULL*1024ULL))
+#define DEFAULT_KEEP_FREE ((off_t) (1024ULL*1024ULL))
+
+static int vacuum_necessary(int fd, off_t sum, off_t keep_free, off_t max_use) {
+        struct statvfs sv;
+        off_t fs_size, fs_free;
+
+        if (fstatvfs(fd, &sv) < 0)
+                return -errno;
+
+        fs_size = (off_t) sv.f_frsize * (off_t) sv.f_blocks;
+        fs_free = (off_t) sv.f_frsize * (off_t) sv.f_bfree;
+
+        if (max_use == (off_t) -1) {
+                max_use = PAGE_ALIGN(fs_size / 10);
+                if (max_use > DEFAULT_MAX_USE_UPPER)
+                        max_use = DEFAULT_MAX_USE_UPPER;
+                if (max_use < DEFAULT_MAX_USE_LOWER)
+                        max_use = DEFAULT_MAX_USE_LOWER;
+        } else
+                max_use = PAGE_ALIGN(max_use);
+
+        if (max_use > 0 && sum > max_use)
+                return 1;
+
+        if (keep_free == (off_t) -1) {
+                keep_free = PAGE_ALIGN((fs_size * 3) / 20);
+                if (keep_free > DEFAULT_KEEP_FREE_UPPER)
+                        keep_free = DEFAULT_KEEP_FREE_UPPER;
+                if (keep_free < DEFAULT_KEEP_FREE)
+                        keep_free = DEFAULT_KEEP_FREE;
+        } else
+                keep_free = PAGE_ALIGN(keep_free);
+
+        if (keep_free > 0 && fs_free < keep_free)
+                return 1;
+
+        return 0;
+}
+
+int coredump_vacuum(const char *directory, int exclude_fd, off_t keep_free, off_t max_use) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct stat exclude_st;
+        struct dirent *de;
+
+        assert(directory);
+
+        if (keep_free == 0 && max_use == 0)
+                return 0;
+
+        if (exclude_fd >= 0) {
+                if (fstat(exclude_fd, &exclude_st) < 0) {
+                        log_error("Failed to fstat(): %m");
+                        return -errno;
+                }
+        }
+
+        /* Deleting one file changes what the file system looks like,
+         * hence start over after each one */
+        for (;;) {
+                _cleanup_free_ char *oldest = NULL;
+                usec_t oldest_mtime = 0;
+                off_t sum = 0;
+                int r = 0;
+
+                if (!d) {
+                        d = opendir(directory);
+                        if (!d) {
+                                if (errno == ENOENT)
+                                        return 0;
+
+                                log_error("Can't open coredump directory %s: %m", directory);
+                                return -errno;
+                        }
+                } else
+                        rewinddir(d);
+
+                FOREACH_DIRENT(de, d, r = -errno) {
+                        struct stat st;
+                        usec_t t;
+
+                        if (!startswith(de->d_name, "core."))
+                                continue;
+
+                        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                                if (errno == ENOENT)
+                                        continue;
+
+                                log_warning("Failed to stat %s/%s: %m", directory, de->d_name);
+                                continue;
+                        }
+
+                        if (!S_ISREG(st.st_mode))
+                                continue;
+
+                        sum += (off_t) st.st_blocks * 512;
+
+                        /* Counts, but stays */
+                        if (exclude_fd >= 0 &&
+                            exclude_st.st_dev == st.st_dev &&
+                            exclude_st.st_ino == st.st_ino)
+                                continue;
+
+                        t = timespec_load(&st.st_mtim);
+                        if (!oldest || t < oldest_mtime) {
+                                char *c;
+
+                                c = strdup(de->d_name);
+                                if (!c)
+                                        return log_oom();
+
+                                free(oldest);
+                                oldest = c;
+                                oldest_mtime = t;
+                        }
+                }
+
+                if (r < 0) {
+                        log_error("Failed to read coredump directory %s: %s", directory, strerror(-r));
+                        return r;
+                }
+
+                if (!oldest)
+                        return 0;
+
+                r = vacuum_necessary(dirfd(d), sum, keep_free, max_use);
+                if (r <= 0) {
+                        if (r < 0)
+                                log_error("Failed to check file system of %s: %s", directory, strerror(-r));
+                        return r;
+                }
+
+                if (unlinkat(dirfd(d), oldest, 0) < 0) {
+                        if (errno == ENOENT)
+                                continue;
+
+                        log_error("Failed to remove old coredump %s/%s: %m", directory, oldest);
+                        return -errno;
+                }
+
+                log_info("Removed old coredump %s/%s.", directory, oldest);
+        }
+}
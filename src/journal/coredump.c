@@ -20,6 +20,7 @@
 ***/
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/prctl.h>
@@ -36,12 +37,23 @@
 #include "mkdir.h"
 #include "special.h"
 #include "cgroup-util.h"
-
-/* Few programs have less than 3MiB resident */
-#define COREDUMP_MIN_START (3*1024*1024)
-/* Make sure to not make this larger than the maximum journal entry
- * size. See ENTRY_SIZE_MAX in journald-native.c. */
-#define COREDUMP_MAX (767*1024*1024)
+#include "journal-def.h"
+#include "compress.h"
+#include "coredump-vacuum.h"
+
+#define COREDUMP_DIR "/var/lib/systemd/coredump"
+
+/* The core is streamed to disk and never held in memory, hence this
+ * only protects the disk from runaway processes */
+#define COREDUMP_EXTERNAL_MAX ((off_t) 8*1024*1024*1024ULL)
+
+#ifdef HAVE_XZ
+#  define COREDUMP_COMPRESSION OBJECT_COMPRESSED_XZ
+#  define COREDUMP_SUFFIX ".xz"
+#else
+#  define COREDUMP_COMPRESSION 0
+#  define COREDUMP_SUFFIX ""
+#endif
 
 enum {
         ARG_PID = 1,
@@ -58,9 +70,9 @@ static int divert_coredump(void) {
 
         log_info("Detected coredump of the journal daemon itself, diverting coredump to /var/lib/systemd/coredump/.");
 
-        mkdir_p_label("/var/lib/systemd/coredump", 0755);
+        mkdir_p_label(COREDUMP_DIR, 0755);
 
-        f = fopen("/var/lib/systemd/coredump/core.systemd-journald", "we");
+        f = fopen(COREDUMP_DIR "/core.systemd-journald", "we");
         if (!f) {
                 log_error("Failed to create coredump file: %m");
                 return -errno;
@@ -97,18 +109,95 @@ static int divert_coredump(void) {
         return 0;
 }
 
+static int save_external_coredump(char **argv, uid_t uid, gid_t gid, char **ret) {
+        _cleanup_free_ char *comm = NULL, *name = NULL, *fn = NULL, *tmp = NULL;
+        _cleanup_close_ int fd = -1;
+        sd_id128_t boot;
+        char sb[33];
+        int r;
+
+        assert(argv);
+        assert(ret);
+
+        r = sd_id128_get_boot(&boot);
+        if (r < 0) {
+                log_error("Failed to determine boot ID: %s", strerror(-r));
+                return r;
+        }
+
+        comm = xescape(argv[ARG_COMM], "./");
+        if (!comm)
+                return log_oom();
+
+        name = strjoin("core.", comm, ".", argv[ARG_UID], ".", sd_id128_to_string(boot, sb), ".",
+                       argv[ARG_PID], ".", argv[ARG_TIMESTAMP], "000000" COREDUMP_SUFFIX, NULL);
+        if (!name)
+                return log_oom();
+
+        fn = strappend(COREDUMP_DIR "/", name);
+        tmp = strappend(COREDUMP_DIR "/.#", name);
+        if (!fn || !tmp)
+                return log_oom();
+
+        mkdir_p_label(COREDUMP_DIR, 0755);
+
+        /* Make room before, as we cannot tell how large the core
+         * is going to be */
+        coredump_vacuum(COREDUMP_DIR, -1, (off_t) -1, (off_t) -1);
+
+        fd = open(tmp, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW, 0400);
+        if (fd < 0) {
+                log_error("Failed to create coredump file %s: %m", tmp);
+                return -errno;
+        }
+
+        /* Like the journal entry, the core belongs to the user who
+         * owns the crashed process */
+        if (fchown(fd, uid, gid) < 0) {
+                log_error("Failed to fix ownership of coredump file %s: %m", tmp);
+                r = -errno;
+                goto fail;
+        }
+
+        r = compress_stream(COREDUMP_COMPRESSION, STDIN_FILENO, fd, COREDUMP_EXTERNAL_MAX);
+        if (r == -E2BIG) {
+                log_error("Core too large, core will not be stored.");
+                goto fail;
+        } else if (r < 0) {
+                log_error("Failed to write coredump file %s: %s", tmp, strerror(-r));
+                goto fail;
+        }
+
+        if (rename(tmp, fn) < 0) {
+                log_error("Failed to rename coredump file %s: %m", tmp);
+                r = -errno;
+                goto fail;
+        }
+
+        /* And make sure the new core fits in, at the expense of
+         * older ones */
+        coredump_vacuum(COREDUMP_DIR, fd, (off_t) -1, (off_t) -1);
+
+        *ret = fn;
+        fn = NULL;
+
+        return 0;
+
+fail:
+        unlink(tmp);
+        return r;
+}
+
 int main(int argc, char* argv[]) {
         int r, j = 0;
         char *t;
-        ssize_t n;
         pid_t pid;
         uid_t uid;
         gid_t gid;
         struct iovec iovec[14];
-        size_t coredump_bufsize, coredump_size;
         _cleanup_free_ char *core_pid = NULL, *core_uid = NULL, *core_gid = NULL, *core_signal = NULL,
                 *core_timestamp = NULL, *core_comm = NULL, *core_exe = NULL, *core_unit = NULL,
-                *core_session = NULL, *core_message = NULL, *core_cmdline = NULL, *coredump_data = NULL;
+                *core_session = NULL, *core_message = NULL, *core_cmdline = NULL, *core_filename = NULL;
 
         prctl(PR_SET_DUMPABLE, 0);
 
@@ -224,11 +313,23 @@ int main(int argc, char* argv[]) {
         if (core_message)
                 IOVEC_SET_STRING(iovec[j++], core_message);
 
+        /* The core is stored in a file of its own, and the journal
+         * only gets a reference to it. That way neither we nor
+         * journald ever need to keep it in memory. */
+        r = save_external_coredump(argv, uid, gid, &t);
+        if (r >= 0) {
+                core_filename = strappend("COREDUMP_FILENAME=", t);
+                free(t);
+
+                if (core_filename)
+                        IOVEC_SET_STRING(iovec[j++], core_filename);
+        }
+
         /* Now, let's drop privileges to become the user who owns the
-         * segfaulted process and allocate the coredump memory under
-         * his uid. This also ensures that the credentials journald
-         * will see are the ones of the coredumping user, thus making
-         * sure the user himself gets access to the core dump. */
+         * segfaulted process. This ensures that the credentials
+         * journald will see are the ones of the coredumping user,
+         * thus making sure the user himself gets access to the log
+         * entry. */
 
         if (setresgid(gid, gid, gid) < 0 ||
             setresuid(uid, uid, uid) < 0) {
@@ -237,44 +338,6 @@ int main(int argc, char* argv[]) {
                 goto finish;
         }
 
-        coredump_bufsize = COREDUMP_MIN_START;
-        coredump_data = malloc(coredump_bufsize);
-        if (!coredump_data) {
-                log_warning("Failed to allocate memory for core, core will not be stored.");
-                goto finalize;
-        }
-
-        memcpy(coredump_data, "COREDUMP=", 9);
-        coredump_size = 9;
-
-        for (;;) {
-                n = loop_read(STDIN_FILENO, coredump_data + coredump_size,
-                              coredump_bufsize - coredump_size, false);
-                if (n < 0) {
-                        log_error("Failed to read core data: %s", strerror(-n));
-                        r = (int) n;
-                        goto finish;
-                } else if (n == 0)
-                        break;
-
-                coredump_size += n;
-
-                if (coredump_size > COREDUMP_MAX) {
-                        log_error("Core too large, core will not be stored.");
-                        goto finalize;
-                }
-
-                if (!GREEDY_REALLOC(coredump_data, coredump_bufsize, coredump_size + 1)) {
-                        log_warning("Failed to allocate memory for core, core will not be stored.");
-                        goto finalize;
-                }
-        }
-
-        iovec[j].iov_base = coredump_data;
-        iovec[j].iov_len = coredump_size;
-        j++;
-
-finalize:
         r = sd_journal_sendv(iovec, j);
         if (r < 0)
                 log_error("Failed to log coredump: %s", strerror(-r));
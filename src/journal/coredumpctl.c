@@ -36,6 +36,8 @@
 #include "pager.h"
 #include "macro.h"
 #include "journal-internal.h"
+#include "journal-def.h"
+#include "compress.h"
 
 static enum {
         ACTION_NONE,
@@ -378,9 +380,111 @@ static int focus(sd_journal *j) {
         return r;
 }
 
-static int dump_core(sd_journal* j) {
+/* Writes the core of the current entry to fd. If fd is negative, a
+ * file containing the core is returned in path instead, which is a
+ * temporary one that the caller needs to remove if unlink_temp is
+ * set. */
+static int save_core(sd_journal *j, int fd, char **path, bool *unlink_temp) {
+        _cleanup_free_ char *filename = NULL, *temp = NULL;
+        _cleanup_close_ int fdt = -1, fdf = -1;
         const void *data;
-        size_t len, ret;
+        size_t len;
+        int r;
+
+        assert(j);
+        assert(fd >= 0 || (path && unlink_temp));
+
+        r = sd_journal_get_data(j, "COREDUMP_FILENAME", (const void**) &data, &len);
+        if (r >= 0) {
+                assert(len >= 18);
+
+                filename = strndup((const char*) data + 18, len - 18);
+                if (!filename)
+                        return log_oom();
+
+                /* An uncompressed core can be used as it is */
+                if (fd < 0 && !endswith(filename, ".xz")) {
+                        *path = filename;
+                        *unlink_temp = false;
+                        filename = NULL;
+                        return 0;
+                }
+        } else if (r != -ENOENT) {
+                log_error("Failed to retrieve COREDUMP_FILENAME field: %s", strerror(-r));
+                return r;
+        }
+
+        if (fd < 0) {
+                temp = strdup("/var/tmp/coredump-XXXXXX");
+                if (!temp)
+                        return log_oom();
+
+                fdt = mkostemp(temp, O_WRONLY|O_CLOEXEC);
+                if (fdt < 0) {
+                        log_error("Failed to create temporary file: %m");
+                        return -errno;
+                }
+
+                fd = fdt;
+        }
+
+        if (filename) {
+                fdf = open(filename, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+                if (fdf < 0) {
+                        log_error("Failed to open %s: %m", filename);
+                        r = -errno;
+                        goto fail;
+                }
+
+                r = decompress_stream(endswith(filename, ".xz") ? OBJECT_COMPRESSED_XZ : 0, fdf, fd, -1);
+                if (r < 0) {
+                        log_error("Failed to decompress %s: %s", filename, strerror(-r));
+                        goto fail;
+                }
+        } else {
+                ssize_t sz;
+
+                /* Older entries carry the core itself */
+                r = sd_journal_get_data(j, "COREDUMP", (const void**) &data, &len);
+                if (r < 0) {
+                        log_error("Failed to retrieve COREDUMP field: %s", strerror(-r));
+                        goto fail;
+                }
+
+                assert(len >= 9);
+                data = (const uint8_t*) data + 9;
+                len -= 9;
+
+                sz = loop_write(fd, data, len, false);
+                if (sz < 0) {
+                        log_error("Failed to write core: %s", strerror(-sz));
+                        r = (int) sz;
+                        goto fail;
+                }
+                if (sz != (ssize_t) len) {
+                        log_error("Short write of core.");
+                        r = -EIO;
+                        goto fail;
+                }
+        }
+
+        if (temp) {
+                *path = temp;
+                *unlink_temp = true;
+                temp = NULL;
+        }
+
+        return 0;
+
+fail:
+        if (temp)
+                unlink(temp);
+
+        return r;
+}
+
+static int dump_core(sd_journal* j) {
+        FILE *f;
         int r;
 
         assert(j);
@@ -399,21 +503,12 @@ static int dump_core(sd_journal* j) {
                 return -ENOTTY;
         }
 
-        r = sd_journal_get_data(j, "COREDUMP", (const void**) &data, &len);
-        if (r < 0) {
-                log_error("Failed to retrieve COREDUMP field: %s", strerror(-r));
-                return r;
-        }
-
-        assert(len >= 9);
-        data = (const uint8_t*) data + 9;
-        len -= 9;
+        f = output ? output : stdout;
+        fflush(f);
 
-        ret = fwrite(data, len, 1, output ? output : stdout);
-        if (ret != 1) {
-                log_error("dumping coredump: %m (%zu)", ret);
-                return -errno;
-        }
+        r = save_core(j, fileno(f), NULL, NULL);
+        if (r < 0)
+                return r;
 
         r = sd_journal_previous(j);
         if (r >= 0)
@@ -423,15 +518,13 @@ static int dump_core(sd_journal* j) {
 }
 
 static int run_gdb(sd_journal *j) {
-        char path[] = "/var/tmp/coredump-XXXXXX";
+        _cleanup_free_ char *exe = NULL, *path = NULL;
+        bool unlink_path = false;
         const void *data;
         size_t len;
-        ssize_t sz;
         pid_t pid;
-        _cleanup_free_ char *exe = NULL;
-        int r;
-        _cleanup_close_ int fd = -1;
         siginfo_t st;
+        int r;
 
         assert(j);
 
@@ -462,36 +555,11 @@ static int run_gdb(sd_journal *j) {
                 return -ENOENT;
         }
 
-        r = sd_journal_get_data(j, "COREDUMP", (const void**) &data, &len);
-        if (r < 0) {
-                log_error("Failed to retrieve COREDUMP field: %s", strerror(-r));
+        r = save_core(j, -1, &path, &unlink_path);
+        if (r < 0)
                 return r;
-        }
-
-        assert(len >= 9);
-        data = (const uint8_t*) data + 9;
-        len -= 9;
-
-        fd = mkostemp(path, O_WRONLY);
-        if (fd < 0) {
-                log_error("Failed to create temporary file: %m");
-                return -errno;
-        }
-
-        sz = write(fd, data, len);
-        if (sz < 0) {
-                log_error("Failed to write temporary file: %s", strerror(errno));
-                r = -errno;
-                goto finish;
-        }
-        if (sz != (ssize_t) len) {
-                log_error("Short write to temporary file.");
-                r = -EIO;
-                goto finish;
-        }
 
-        close_nointr_nofail(fd);
-        fd = -1;
+        fflush(stdout);
 
         pid = fork();
         if (pid < 0) {
@@ -514,7 +582,9 @@ static int run_gdb(sd_journal *j) {
         r = st.si_code == CLD_EXITED ? st.si_status : 255;
 
 finish:
-        unlink(path);
+        if (unlink_path)
+                unlink(path);
+
         return r;
 }
 
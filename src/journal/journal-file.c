@@ -33,10 +33,13 @@
 
 #include "journal-def.h"
 #include "journal-file.h"
+#include "journal-index.h"
+#include "journal-ranges.h"
 #include "journal-authenticate.h"
 #include "lookup3.h"
 #include "compress.h"
 #include "fsprg.h"
+#include "missing.h"
 
 #define DEFAULT_DATA_HASH_TABLE_SIZE (2047ULL*sizeof(HashItem))
 #define DEFAULT_FIELD_HASH_TABLE_SIZE (333ULL*sizeof(HashItem))
@@ -46,6 +49,16 @@
 /* This is the minimum journal file size */
 #define JOURNAL_FILE_SIZE_MIN (4ULL*1024ULL*1024ULL)           /* 4 MiB */
 
+/* The file is grown by what we expect to be written during the next
+ * few seconds, judging by how quickly the last extension got used up,
+ * but at least and at most by these steps */
+#define FILE_SIZE_INCREASE_MIN (1ULL*1024ULL*1024ULL)          /* 1 MiB */
+#define FILE_SIZE_INCREASE_MAX (32ULL*1024ULL*1024ULL)         /* 32 MiB */
+#define FILE_SIZE_INCREASE_USEC (10ULL*USEC_PER_SEC)
+
+/* How far ahead of the tail to pull pages into the page cache */
+#define PREFAULT_SIZE (1ULL*1024ULL*1024ULL)                   /* 1 MiB */
+
 /* These are the lower and upper bounds if we deduce the max_use value
  * from the file system size */
 #define DEFAULT_MAX_USE_LOWER (1ULL*1024ULL*1024ULL)           /* 1 MiB */
@@ -68,6 +81,13 @@
 /* How many entries to keep in the entry array chain cache at max */
 #define CHAIN_CACHE_MAX 20
 
+/* How many decompressed DATA objects to keep around per file, and how
+ * much memory they may take up in total. Very large objects (such as
+ * coredumps) are never cached. */
+#define DECOMPRESS_CACHE_MAX 64
+#define DECOMPRESS_CACHE_BYTES_MAX (4ULL*1024ULL*1024ULL)
+#define DECOMPRESS_CACHE_ITEM_MAX (256ULL*1024ULL)
+
 int journal_file_set_online(JournalFile *f) {
         assert(f);
 
@@ -121,6 +141,19 @@ void journal_file_close(JournalFile *f) {
                 journal_file_append_tag(f);
 #endif
 
+        /* Let readers know about anything we held back */
+        if (f->post_change_pending)
+                journal_file_post_change(f);
+
+        if (f->writable && f->n_allocate > 0) {
+                char ts[FORMAT_TIMESPAN_MAX];
+
+                log_debug("%s: Extended %"PRIu64" times in %s, %"PRIu64" prefaults, %"PRIu64" writes ahead of them.",
+                          f->path, f->n_allocate,
+                          format_timespan(ts, sizeof(ts), f->allocate_usec, 0),
+                          f->n_prefault, f->n_prefault_misses);
+        }
+
         /* Sync everything to disk, before we mark the file offline */
         if (f->mmap && f->fd >= 0)
                 mmap_cache_close_fd(f->mmap, f->fd);
@@ -140,9 +173,18 @@ void journal_file_close(JournalFile *f) {
 
         hashmap_free_free(f->chain_cache);
 
-#ifdef HAVE_XZ
+        if (f->compress_context)
+                compress_context_unref(f->compress_context);
+
         free(f->compress_buffer);
-#endif
+
+        hashmap_free_free(f->decompress_cache);
+
+        if (f->index)
+                journal_index_close(f->index);
+
+        free(f->projection_cache);
+        hashmap_free_free(f->unique_cache);
 
 #ifdef HAVE_GCRYPT
         if (f->fss_file)
@@ -170,8 +212,9 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
         memcpy(h.signature, HEADER_SIGNATURE, 8);
         h.header_size = htole64(ALIGN64(sizeof(h)));
 
-        h.incompatible_flags =
-                htole32(f->compress ? HEADER_INCOMPATIBLE_COMPRESSED : 0);
+        h.incompatible_flags = htole32(
+                (f->compress == OBJECT_COMPRESSED_XZ ? HEADER_INCOMPATIBLE_COMPRESSED_XZ : 0) |
+                (f->compress == OBJECT_COMPRESSED_LZ4 ? HEADER_INCOMPATIBLE_COMPRESSED_LZ4 : 0));
 
         h.compatible_flags =
                 htole32(f->seal ? HEADER_COMPATIBLE_SEALED : 0);
@@ -232,13 +275,8 @@ static int journal_file_verify_header(JournalFile *f) {
 
         /* In both read and write mode we refuse to open files with
          * incompatible flags we don't know */
-#ifdef HAVE_XZ
-        if ((le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_COMPRESSED) != 0)
-                return -EPROTONOSUPPORT;
-#else
-        if (f->header->incompatible_flags != 0)
+        if ((le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_SUPPORTED) != 0)
                 return -EPROTONOSUPPORT;
-#endif
 
         /* When open for writing we refuse to open files with
          * compatible flags, too */
@@ -305,15 +343,42 @@ static int journal_file_verify_header(JournalFile *f) {
                 }
         }
 
-        f->compress = JOURNAL_HEADER_COMPRESSED(f->header);
+        /* The codec is a property of the file, so stick to what
+         * the header says, regardless what we were asked for */
+        if (JOURNAL_HEADER_COMPRESSED_LZ4(f->header))
+                f->compress = OBJECT_COMPRESSED_LZ4;
+        else if (JOURNAL_HEADER_COMPRESSED_XZ(f->header))
+                f->compress = OBJECT_COMPRESSED_XZ;
+        else
+                f->compress = 0;
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
         return 0;
 }
 
+static uint64_t journal_file_increase(JournalFile *f, uint64_t old_size, usec_t n) {
+        uint64_t step;
+
+        assert(f);
+
+        if (f->allocate_last_usec <= 0 || n <= f->allocate_last_usec ||
+            old_size <= f->allocate_last_offset)
+                return FILE_SIZE_INCREASE_MIN;
+
+        /* Everything allocated the last time is used up by now, so
+         * this is the rate we have been writing at since. To not
+         * leave too much unused space behind when the file is
+         * archived, we never more than double the file though. */
+        step = (old_size - f->allocate_last_offset) * FILE_SIZE_INCREASE_USEC / (n - f->allocate_last_usec);
+        step = MIN(step, old_size);
+
+        return PAGE_ALIGN(CLAMP(step, FILE_SIZE_INCREASE_MIN, FILE_SIZE_INCREASE_MAX));
+}
+
 static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size) {
-        uint64_t old_size, new_size;
+        uint64_t old_size, new_size, needed;
+        usec_t n;
         int r;
 
         assert(f);
@@ -326,17 +391,28 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
                 le64toh(f->header->header_size) +
                 le64toh(f->header->arena_size);
 
-        new_size = PAGE_ALIGN(offset + size);
-        if (new_size < le64toh(f->header->header_size))
-                new_size = le64toh(f->header->header_size);
+        needed = PAGE_ALIGN(offset + size);
+        if (needed < le64toh(f->header->header_size))
+                needed = le64toh(f->header->header_size);
 
-        if (new_size <= old_size)
+        if (needed <= old_size)
                 return 0;
 
         if (f->metrics.max_size > 0 &&
-            new_size > f->metrics.max_size)
+            needed > f->metrics.max_size)
                 return -E2BIG;
 
+        /* Growing the file a page at a time means many small
+         * extensions, and on some file systems many small
+         * extents. Hence allocate ahead generously, but never so
+         * much that we hit a limit before we had to. */
+        n = now(CLOCK_MONOTONIC);
+
+        new_size = MAX(needed, old_size + journal_file_increase(f, old_size, n));
+        if (f->metrics.max_size > 0 &&
+            new_size > f->metrics.max_size)
+                new_size = f->metrics.max_size;
+
         if (new_size > f->metrics.min_size &&
             f->metrics.keep_free > 0) {
                 struct statvfs svfs;
@@ -352,6 +428,10 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
                                 available = 0;
 
                         if (new_size - old_size > available)
+                                new_size = needed;
+
+                        if (new_size > f->metrics.min_size &&
+                            new_size - old_size > available)
                                 return -E2BIG;
                 }
         }
@@ -368,9 +448,59 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
 
         f->header->arena_size = htole64(new_size - le64toh(f->header->header_size));
 
+        f->n_allocate++;
+        f->allocate_usec += now(CLOCK_MONOTONIC) - n;
+        f->allocate_last_usec = n;
+        f->allocate_last_offset = old_size;
+
         return 0;
 }
 
+static int journal_file_move_to(JournalFile *f, int context, bool keep_always, uint64_t offset, uint64_t size, void **ret);
+
+static void journal_file_prefault(JournalFile *f, int context, uint64_t offset, uint64_t size) {
+        uint64_t end, allocated, from, delta;
+        void *p;
+
+        assert(f);
+
+        /* Writing to pages of our mapping which are not populated
+         * yet faults them in one by one. Hence populate the window
+         * ahead of the tail in larger chunks, and count the writes
+         * which reached past the populated pages. */
+
+        end = offset + size;
+
+        if (end > f->prefault_offset)
+                f->n_prefault_misses++;
+
+        if (end + PREFAULT_SIZE / 2 <= f->prefault_offset)
+                return;
+
+        allocated =
+                le64toh(f->header->header_size) +
+                le64toh(f->header->arena_size);
+
+        from = MAX(offset, f->prefault_offset);
+        end = MIN(end + PREFAULT_SIZE, allocated);
+
+        if (end <= from)
+                return;
+
+        if (journal_file_move_to(f, context, false, from, end - from, &p) < 0)
+                return;
+
+        delta = (uint64_t) ((uintptr_t) p % page_size());
+
+        /* Before Linux 5.14 all we can do is read the pages into
+         * the page cache */
+        if (madvise((uint8_t*) p - delta, end - from + delta, MADV_POPULATE_WRITE) >= 0 ||
+            (errno == EINVAL && posix_fadvise(f->fd, from, end - from, POSIX_FADV_WILLNEED) == 0))
+                f->n_prefault++;
+
+        f->prefault_offset = end;
+}
+
 static int journal_file_move_to(JournalFile *f, int context, bool keep_always, uint64_t offset, uint64_t size, void **ret) {
         assert(f);
         assert(ret);
@@ -514,6 +644,8 @@ int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object *
         if (r < 0)
                 return r;
 
+        journal_file_prefault(f, type, p, size);
+
         r = journal_file_move_to(f, type, false, p, size, &t);
         if (r < 0)
                 return r;
@@ -783,6 +915,139 @@ int journal_file_find_field_object(
                                                         ret, offset);
 }
 
+typedef struct DecompressCacheItem {
+        uint64_t offset;
+        size_t size;
+        uint8_t data[];
+} DecompressCacheItem;
+
+static const void* decompress_cache_put(JournalFile *f, uint64_t offset, const void *data, size_t size) {
+        DecompressCacheItem *ci;
+
+        assert(f);
+
+        if (size > DECOMPRESS_CACHE_ITEM_MAX)
+                return NULL;
+
+        while (hashmap_size(f->decompress_cache) >= DECOMPRESS_CACHE_MAX ||
+               (hashmap_size(f->decompress_cache) > 0 &&
+                f->decompress_cache_bytes + size > DECOMPRESS_CACHE_BYTES_MAX)) {
+
+                ci = hashmap_steal_first(f->decompress_cache);
+                f->decompress_cache_bytes -= ci->size;
+                free(ci);
+        }
+
+        ci = malloc(offsetof(DecompressCacheItem, data) + size);
+        if (!ci)
+                return NULL;
+
+        ci->offset = offset;
+        ci->size = size;
+        memcpy(ci->data, data, size);
+
+        if (hashmap_put(f->decompress_cache, &ci->offset, ci) < 0) {
+                free(ci);
+                return NULL;
+        }
+
+        f->decompress_cache_bytes += size;
+        return ci->data;
+}
+
+int journal_file_data_payload(
+                JournalFile *f,
+                Object *o,
+                uint64_t offset,
+                const char *field,
+                size_t field_length,
+                uint64_t data_threshold,
+                const void **ret_data,
+                size_t *ret_size) {
+
+        DecompressCacheItem *ci;
+        const void *d;
+        uint64_t l, rsize;
+        int compression, r;
+
+        assert(f);
+        assert(o);
+        assert(ret_data);
+        assert(ret_size);
+
+        /* Returns the payload of a DATA object, decompressing it if
+         * necessary. If a field name is specified, returns 0 without
+         * decompressing the whole object if the object does not
+         * belong to the field, 1 otherwise. The returned data is
+         * valid until the next call for this file. */
+
+        l = le64toh(o->object.size);
+        if (l <= offsetof(Object, data.payload))
+                return -EBADMSG;
+
+        l -= offsetof(Object, data.payload);
+
+        compression = o->object.flags & OBJECT_COMPRESSION_MASK;
+        if (compression == 0) {
+                d = o->data.payload;
+                rsize = l;
+        } else {
+                ci = hashmap_get(f->decompress_cache, &offset);
+                if (ci) {
+                        f->n_decompress_cache_hit++;
+
+                        d = ci->data;
+                        rsize = ci->size;
+                } else {
+                        f->n_decompress_cache_miss++;
+
+                        if (field) {
+                                r = uncompress_startswith(f->compress_context, compression,
+                                                          o->data.payload, l,
+                                                          &f->compress_buffer, &f->compress_buffer_size,
+                                                          field, field_length, '=');
+                                if (r <= 0)
+                                        return r;
+                        }
+
+                        r = uncompress_blob(f->compress_context, compression,
+                                            o->data.payload, l,
+                                            &f->compress_buffer, &f->compress_buffer_size, &rsize,
+                                            data_threshold);
+                        if (r < 0)
+                                return r;
+
+                        d = f->compress_buffer;
+
+                        /* Only cache the object if we decompressed
+                         * all of it */
+                        if (data_threshold == 0 || rsize < data_threshold) {
+                                const void *c;
+
+                                c = decompress_cache_put(f, offset, d, rsize);
+                                if (c)
+                                        d = c;
+                        }
+
+                        field = NULL;
+                }
+        }
+
+        if (field &&
+            (rsize < field_length + 1 ||
+             memcmp(d, field, field_length) != 0 ||
+             ((const uint8_t*) d)[field_length] != '='))
+                return 0;
+
+        /* We can't return objects larger than 4G on a 32bit machine */
+        if ((uint64_t) (size_t) rsize != rsize)
+                return -E2BIG;
+
+        *ret_data = d;
+        *ret_size = (size_t) rsize;
+        return 1;
+}
+
 int journal_file_find_data_object_with_hash(
                 JournalFile *f,
                 const void *data, uint64_t size, uint64_t hash,
@@ -812,21 +1077,16 @@ int journal_file_find_data_object_with_hash(
                 if (le64toh(o->data.hash) != hash)
                         goto next;
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
-                        uint64_t l, rsize;
-
-                        l = le64toh(o->object.size);
-                        if (l <= offsetof(Object, data.payload))
-                                return -EBADMSG;
-
-                        l -= offsetof(Object, data.payload);
+                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+                        const void *d;
+                        size_t rsize;
 
-                        if (!uncompress_blob(o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0))
-                                return -EBADMSG;
+                        r = journal_file_data_payload(f, o, p, NULL, 0, 0, &d, &rsize);
+                        if (r < 0)
+                                return r;
 
                         if (rsize == size &&
-                            memcmp(f->compress_buffer, data, size) == 0) {
+                            memcmp(d, data, size) == 0) {
 
                                 if (ret)
                                         *ret = o;
@@ -836,9 +1096,6 @@ int journal_file_find_data_object_with_hash(
 
                                 return 1;
                         }
-#else
-                        return -EPROTONOSUPPORT;
-#endif
 
                 } else if (le64toh(o->object.size) == osize &&
                            memcmp(o->data.payload, data, size) == 0) {
@@ -976,21 +1233,20 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#ifdef HAVE_XZ
         if (f->compress &&
             size >= COMPRESSION_SIZE_THRESHOLD) {
                 uint64_t rsize;
 
-                compressed = compress_blob(data, size, o->data.payload, &rsize);
+                compressed = compress_blob(f->compress_context, f->compress, data, size, o->data.payload, &rsize) >= 0;
 
                 if (compressed) {
                         o->object.size = htole64(offsetof(Object, data.payload) + rsize);
-                        o->object.flags |= OBJECT_COMPRESSED;
+                        o->object.flags |= f->compress;
 
-                        log_debug("Compressed data object %"PRIu64" -> %"PRIu64, size, rsize);
+                        log_debug("Compressed data object %"PRIu64" -> %"PRIu64" using %s",
+                                  size, rsize, object_compressed_to_string(f->compress));
                 }
         }
-#endif
 
         if (!compressed && size > 0)
                 memcpy(o->data.payload, data, size);
@@ -1063,18 +1319,24 @@ uint64_t journal_file_hash_table_n_items(Object *o) {
         return (le64toh(o->object.size) - offsetof(Object, hash_table.items)) / sizeof(HashItem);
 }
 
-static int link_entry_into_array(JournalFile *f,
-                                 le64_t *first,
-                                 le64_t *idx,
-                                 uint64_t p) {
+static int link_entries_into_array(JournalFile *f,
+                                   le64_t *first,
+                                   le64_t *idx,
+                                   const uint64_t p[],
+                                   uint64_t n_p) {
         int r;
-        uint64_t n = 0, ap = 0, q, i, a, hidx;
+        uint64_t n = 0, ap = 0, q, i, a, hidx, j = 0;
         Object *o;
 
         assert(f);
         assert(first);
         assert(idx);
-        assert(p > 0);
+        assert(p);
+        assert(n_p > 0);
+
+        /* Links n_p entries into the array chain, walking the chain
+         * only once, and filling up each array as far as possible
+         * before moving on to the next one. */
 
         a = le64toh(*first);
         i = hidx = le64toh(*idx);
@@ -1086,9 +1348,13 @@ static int link_entry_into_array(JournalFile *f,
 
                 n = journal_file_entry_array_n_items(o);
                 if (i < n) {
-                        o->entry_array.items[i] = htole64(p);
-                        *idx = htole64(hidx + 1);
-                        return 0;
+                        while (i < n && j < n_p)
+                                o->entry_array.items[i++] = htole64(p[j++]);
+
+                        *idx = htole64(hidx + j);
+
+                        if (j >= n_p)
+                                return 0;
                 }
 
                 i -= n;
@@ -1096,72 +1362,94 @@ static int link_entry_into_array(JournalFile *f,
                 a = le64toh(o->entry_array.next_entry_array_offset);
         }
 
-        if (hidx > n)
-                n = (hidx+1) * 2;
-        else
-                n = n * 2;
+        while (j < n_p) {
 
-        if (n < 4)
-                n = 4;
+                if (hidx + j > n)
+                        n = (hidx + j + 1) * 2;
+                else
+                        n = n * 2;
 
-        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
-                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
-                                       &o, &q);
-        if (r < 0)
-                return r;
+                if (n < 4)
+                        n = 4;
+
+                r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
+                                               offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
+                                               &o, &q);
+                if (r < 0)
+                        return r;
 
 #ifdef HAVE_GCRYPT
-        r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY, o, q);
-        if (r < 0)
-                return r;
+                r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY, o, q);
+                if (r < 0)
+                        return r;
 #endif
 
-        o->entry_array.items[i] = htole64(p);
+                while (i < n && j < n_p)
+                        o->entry_array.items[i++] = htole64(p[j++]);
 
-        if (ap == 0)
-                *first = htole64(q);
-        else {
-                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, ap, &o);
-                if (r < 0)
-                        return r;
+                if (ap == 0)
+                        *first = htole64(q);
+                else {
+                        r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, ap, &o);
+                        if (r < 0)
+                                return r;
 
-                o->entry_array.next_entry_array_offset = htole64(q);
-        }
+                        o->entry_array.next_entry_array_offset = htole64(q);
+                }
 
-        if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
-                f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
+                if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
+                        f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
 
-        *idx = htole64(hidx + 1);
+                *idx = htole64(hidx + j);
+
+                i = 0;
+                ap = q;
+        }
 
         return 0;
 }
 
-static int link_entry_into_array_plus_one(JournalFile *f,
-                                          le64_t *extra,
-                                          le64_t *first,
-                                          le64_t *idx,
-                                          uint64_t p) {
+static int link_entry_into_array(JournalFile *f,
+                                 le64_t *first,
+                                 le64_t *idx,
+                                 uint64_t p) {
+        return link_entries_into_array(f, first, idx, &p, 1);
+}
 
+static int link_entries_into_array_plus_one(JournalFile *f,
+                                            le64_t *extra,
+                                            le64_t *first,
+                                            le64_t *idx,
+                                            const uint64_t p[],
+                                            uint64_t n_p) {
+
+        le64_t i;
         int r;
 
         assert(f);
         assert(extra);
         assert(first);
         assert(idx);
-        assert(p > 0);
+        assert(p);
+        assert(n_p > 0);
 
-        if (*idx == 0)
-                *extra = htole64(p);
-        else {
-                le64_t i;
+        if (*idx == 0) {
+                *extra = htole64(p[0]);
+                *idx = htole64(1);
 
-                i = htole64(le64toh(*idx) - 1);
-                r = link_entry_into_array(f, first, &i, p);
-                if (r < 0)
-                        return r;
+                p++;
+                n_p--;
+
+                if (n_p == 0)
+                        return 0;
         }
 
-        *idx = htole64(le64toh(*idx) + 1);
+        i = htole64(le64toh(*idx) - 1);
+        r = link_entries_into_array(f, first, &i, p, n_p);
+        if (r < 0)
+                return r;
+
+        *idx = htole64(le64toh(i) + 1);
         return 0;
 }
 
@@ -1180,11 +1468,11 @@ static int journal_file_link_entry_item(JournalFile *f, Object *o, uint64_t offs
         if (r < 0)
                 return r;
 
-        return link_entry_into_array_plus_one(f,
-                                              &o->data.entry_offset,
-                                              &o->data.entry_array_offset,
-                                              &o->data.n_entries,
-                                              offset);
+        return link_entries_into_array_plus_one(f,
+                                                &o->data.entry_offset,
+                                                &o->data.entry_array_offset,
+                                                &o->data.n_entries,
+                                                &offset, 1);
 }
 
 static int journal_file_link_entry(JournalFile *f, Object *o, uint64_t offset) {
@@ -1229,7 +1517,7 @@ static int journal_file_link_entry(JournalFile *f, Object *o, uint64_t offset) {
         return 0;
 }
 
-static int journal_file_append_entry_internal(
+static int journal_file_append_entry_object(
                 JournalFile *f,
                 const dual_timestamp *ts,
                 uint64_t xor_hash,
@@ -1264,6 +1552,30 @@ static int journal_file_append_entry_internal(
                 return r;
 #endif
 
+        if (ret)
+                *ret = o;
+
+        if (offset)
+                *offset = np;
+
+        return 0;
+}
+
+static int journal_file_append_entry_internal(
+                JournalFile *f,
+                const dual_timestamp *ts,
+                uint64_t xor_hash,
+                const EntryItem items[], unsigned n_items,
+                uint64_t *seqnum,
+                Object **ret, uint64_t *offset) {
+        uint64_t np;
+        Object *o;
+        int r;
+
+        r = journal_file_append_entry_object(f, ts, xor_hash, items, n_items, seqnum, &o, &np);
+        if (r < 0)
+                return r;
+
         r = journal_file_link_entry(f, o, np);
         if (r < 0)
                 return r;
@@ -1287,10 +1599,24 @@ void journal_file_post_change(JournalFile *f) {
 
         __sync_synchronize();
 
+        f->post_change_pending = false;
+
         if (ftruncate(f->fd, f->last_stat.st_size) < 0)
                 log_error("Failed to truncate file to its own size: %m");
 }
 
+static void journal_file_schedule_post_change(JournalFile *f) {
+        assert(f);
+
+        /* If the owner of the file wants to coalesce notifications
+         * it will call journal_file_post_change() later on */
+
+        if (f->defer_post_change)
+                f->post_change_pending = true;
+        else
+                journal_file_post_change(f);
+}
+
 static int entry_item_cmp(const void *_a, const void *_b) {
         const EntryItem *a = _a, *b = _b;
 
@@ -1348,7 +1674,249 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
 
         r = journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
 
-        journal_file_post_change(f);
+        journal_file_schedule_post_change(f);
+
+        return r;
+}
+
+typedef struct BatchData {
+        uint64_t hash;
+        uint64_t offset;
+        const struct iovec *iovec;
+} BatchData;
+
+typedef struct BatchLink {
+        uint64_t data_offset;
+        uint64_t entry_offset;
+} BatchLink;
+
+static int batch_link_cmp(const void *_a, const void *_b) {
+        const BatchLink *a = _a, *b = _b;
+
+        if (a->data_offset < b->data_offset)
+                return -1;
+        if (a->data_offset > b->data_offset)
+                return 1;
+        if (a->entry_offset < b->entry_offset)
+                return -1;
+        if (a->entry_offset > b->entry_offset)
+                return 1;
+        return 0;
+}
+
+static int journal_file_link_entries(
+                JournalFile *f,
+                const uint64_t offsets[], unsigned n_offsets,
+                BatchLink links[], unsigned n_links) {
+
+        unsigned i, j;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(offsets);
+        assert(n_offsets > 0);
+        assert(links || n_links == 0);
+
+        __sync_synchronize();
+
+        /* Link up the entries themselves */
+        r = link_entries_into_array(f,
+                                    &f->header->entry_array_offset,
+                                    &f->header->n_entries,
+                                    offsets, n_offsets);
+        if (r < 0)
+                return r;
+
+        if (f->header->head_entry_realtime == 0) {
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, offsets[0], &o);
+                if (r < 0)
+                        return r;
+
+                f->header->head_entry_realtime = o->entry.realtime;
+        }
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, offsets[n_offsets-1], &o);
+        if (r < 0)
+                return r;
+
+        f->header->tail_entry_realtime = o->entry.realtime;
+        f->header->tail_entry_monotonic = o->entry.monotonic;
+
+        f->tail_entry_monotonic_valid = true;
+
+        /* Link up the items, visiting every data object only once,
+         * no matter how many entries of the batch reference it. */
+        qsort_safe(links, n_links, sizeof(BatchLink), batch_link_cmp);
+
+        for (i = 0; i < n_links; i = j) {
+                _cleanup_free_ uint64_t *p = NULL;
+                unsigned k;
+
+                for (j = i + 1; j < n_links && links[j].data_offset == links[i].data_offset; j++)
+                        ;
+
+                p = new(uint64_t, j - i);
+                if (!p)
+                        return -ENOMEM;
+
+                for (k = i; k < j; k++)
+                        p[k - i] = links[k].entry_offset;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, links[i].data_offset, &o);
+                if (r < 0)
+                        return r;
+
+                r = link_entries_into_array_plus_one(f,
+                                                     &o->data.entry_offset,
+                                                     &o->data.entry_array_offset,
+                                                     &o->data.n_entries,
+                                                     p, j - i);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int journal_file_append_entries(
+                JournalFile *f,
+                const JournalAppendEntry entries[], unsigned n_entries,
+                uint64_t *seqnum,
+                unsigned *n_appended) {
+
+        _cleanup_hashmap_free_ Hashmap *h = NULL;
+        _cleanup_free_ BatchData *data = NULL;
+        _cleanup_free_ BatchLink *links = NULL;
+        _cleanup_free_ uint64_t *offsets = NULL;
+        _cleanup_free_ EntryItem *items = NULL;
+        unsigned i, n_data = 0, n_links = 0, n_offsets = 0, n_iovec_total = 0, n_iovec_max = 0;
+        uint64_t tail_monotonic;
+        bool tail_monotonic_valid;
+        int r = 0, k;
+
+        assert(f);
+        assert(entries || n_entries == 0);
+
+        /* Appends a number of entries in one go. Data objects shared
+         * between the entries are looked up only once, every entry
+         * array is walked only once, and the change is announced
+         * only once at the end. Entries are appended strictly in
+         * order. On failure the number of entries that made it into
+         * the file is returned in n_appended. */
+
+        if (n_appended)
+                *n_appended = 0;
+
+        if (n_entries == 0)
+                return 0;
+
+        for (i = 0; i < n_entries; i++) {
+                assert(entries[i].iovec || entries[i].n_iovec == 0);
+
+                n_iovec_total += entries[i].n_iovec;
+                n_iovec_max = MAX(n_iovec_max, entries[i].n_iovec);
+        }
+
+        h = hashmap_new(uint64_hash_func, uint64_compare_func);
+        data = new(BatchData, n_iovec_total);
+        links = new(BatchLink, n_iovec_total);
+        offsets = new(uint64_t, n_entries);
+        items = new(EntryItem, MAX(1u, n_iovec_max));
+        if (!h || (n_iovec_total > 0 && (!data || !links)) || !offsets || !items)
+                return -ENOMEM;
+
+        tail_monotonic_valid = f->tail_entry_monotonic_valid;
+        tail_monotonic = le64toh(f->header->tail_entry_monotonic);
+
+        for (i = 0; i < n_entries; i++) {
+                const JournalAppendEntry *e = entries + i;
+                uint64_t xor_hash = 0, np;
+                unsigned j;
+
+                if (tail_monotonic_valid &&
+                    e->ts.monotonic < tail_monotonic) {
+                        r = -EINVAL;
+                        break;
+                }
+
+#ifdef HAVE_GCRYPT
+                r = journal_file_maybe_append_tag(f, e->ts.realtime);
+                if (r < 0)
+                        break;
+#endif
+
+                for (j = 0; j < e->n_iovec; j++) {
+                        const struct iovec *v = e->iovec + j;
+                        BatchData *d;
+                        uint64_t hash, p;
+
+                        hash = hash64(v->iov_base, v->iov_len);
+
+                        d = hashmap_get(h, &hash);
+                        if (d &&
+                            d->iovec->iov_len == v->iov_len &&
+                            memcmp(d->iovec->iov_base, v->iov_base, v->iov_len) == 0)
+                                p = d->offset;
+                        else {
+                                Object *o;
+
+                                r = journal_file_append_data(f, v->iov_base, v->iov_len, &o, &p);
+                                if (r < 0)
+                                        break;
+
+                                if (!d) {
+                                        d = data + n_data++;
+                                        d->hash = hash;
+                                        d->offset = p;
+                                        d->iovec = v;
+
+                                        k = hashmap_put(h, &d->hash, d);
+                                        if (k < 0) {
+                                                r = k;
+                                                break;
+                                        }
+                                }
+                        }
+
+                        xor_hash ^= hash;
+                        items[j].object_offset = htole64(p);
+                        items[j].hash = htole64(hash);
+                }
+                if (r < 0)
+                        break;
+
+                /* Order by the position on disk, in order to improve seek
+                 * times for rotating media. */
+                qsort_safe(items, e->n_iovec, sizeof(EntryItem), entry_item_cmp);
+
+                r = journal_file_append_entry_object(f, &e->ts, xor_hash, items, e->n_iovec, seqnum, NULL, &np);
+                if (r < 0)
+                        break;
+
+                for (j = 0; j < e->n_iovec; j++) {
+                        links[n_links].data_offset = le64toh(items[j].object_offset);
+                        links[n_links].entry_offset = np;
+                        n_links++;
+                }
+
+                offsets[n_offsets++] = np;
+
+                tail_monotonic = e->ts.monotonic;
+                tail_monotonic_valid = true;
+        }
+
+        if (n_offsets > 0) {
+                /* Even if we failed half-way, link in what we managed to
+                 * write so far, so that it is not lost. */
+                k = journal_file_link_entries(f, offsets, n_offsets, links, n_links);
+                if (k < 0)
+                        r = k;
+                else if (n_appended)
+                        *n_appended = n_offsets;
+
+                journal_file_schedule_post_change(f);
+        }
 
         return r;
 }
@@ -2258,8 +2826,9 @@ void journal_file_dump(JournalFile *f) {
                         break;
                 }
 
-                if (o->object.flags & OBJECT_COMPRESSED)
-                        printf("Flags: COMPRESSED\n");
+                if (o->object.flags & OBJECT_COMPRESSION_MASK)
+                        printf("Flags: COMPRESSED-%s\n",
+                               object_compressed_to_string(o->object.flags & OBJECT_COMPRESSION_MASK) ?: "???");
 
                 if (p == le64toh(f->header->tail_object_offset))
                         p = 0;
@@ -2296,7 +2865,7 @@ void journal_file_print_header(JournalFile *f) {
                "Sequential Number ID: %s\n"
                "State: %s\n"
                "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s\n"
+               "Incompatible Flags:%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data Hash Table Size: %"PRIu64"\n"
@@ -2319,8 +2888,9 @@ void journal_file_print_header(JournalFile *f) {
                f->header->state == STATE_ARCHIVED ? "ARCHIVED" : "UNKNOWN",
                JOURNAL_HEADER_SEALED(f->header) ? " SEALED" : "",
                (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) ? " ???" : "",
-               JOURNAL_HEADER_COMPRESSED(f->header) ? " COMPRESSED" : "",
-               (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_COMPRESSED) ? " ???" : "",
+               JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
+               JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
                le64toh(f->header->arena_size),
                le64toh(f->header->data_hash_table_size) / sizeof(HashItem),
@@ -2361,7 +2931,7 @@ int journal_file_open(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -2393,8 +2963,15 @@ int journal_file_open(
         f->flags = flags;
         f->prot = prot_from_flags(flags);
         f->writable = (flags & O_ACCMODE) != O_RDONLY;
+        /* Silently fall back to no compression if the requested
+         * codec has not been compiled in */
 #ifdef HAVE_XZ
-        f->compress = compress;
+        if (compress == OBJECT_COMPRESSED_XZ)
+                f->compress = OBJECT_COMPRESSED_XZ;
+#endif
+#ifdef HAVE_LZ4
+        if (compress == OBJECT_COMPRESSED_LZ4)
+                f->compress = OBJECT_COMPRESSED_LZ4;
 #endif
 #ifdef HAVE_GCRYPT
         f->seal = seal;
@@ -2422,6 +2999,18 @@ int journal_file_open(
                 goto fail;
         }
 
+        f->decompress_cache = hashmap_new(uint64_hash_func, uint64_compare_func);
+        if (!f->decompress_cache) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        f->compress_context = compress_context_new();
+        if (!f->compress_context) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
         f->fd = open(f->path, f->flags|O_CLOEXEC, f->mode);
         if (f->fd < 0) {
                 r = -errno;
@@ -2506,6 +3095,9 @@ int journal_file_open(
                 } else if (template)
                         f->metrics = template->metrics;
 
+                if (template)
+                        f->defer_post_change = template->defer_post_change;
+
                 r = journal_file_refresh_header(f);
                 if (r < 0)
                         goto fail;
@@ -2550,7 +3142,7 @@ fail:
         return r;
 }
 
-int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
+int journal_file_rotate(JournalFile **f, int compress, bool seal) {
         _cleanup_free_ char *p = NULL;
         size_t l;
         JournalFile *old_file, *new_file = NULL;
@@ -2576,12 +3168,26 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         if (r < 0)
                 return -ENOMEM;
 
-        r = rename(old_file->path, p);
+        /* Write the index first, so that it is there as soon as
+         * readers see the archived file. It's only an optimization,
+         * hence failing to write it is not fatal. */
+        r = journal_index_write(old_file, p);
         if (r < 0)
-                return -errno;
+                log_warning("Failed to write index for %s: %s", p, strerror(-r));
+
+        r = rename(old_file->path, p);
+        if (r < 0) {
+                r = -errno;
+                unlink(strappenda(p, JOURNAL_INDEX_SUFFIX));
+                return r;
+        }
 
         old_file->header->state = STATE_ARCHIVED;
 
+        r = journal_ranges_add_file(p, old_file);
+        if (r < 0)
+                log_warning("Failed to record time range of %s: %s", p, strerror(-r));
+
         r = journal_file_open(old_file->path, old_file->flags, old_file->mode, compress, seal, NULL, old_file->mmap, old_file, &new_file);
         journal_file_close(old_file);
 
@@ -2593,7 +3199,7 @@ int journal_file_open_reliably(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -2668,10 +3274,10 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         items = alloca(sizeof(EntryItem) * n);
 
         for (i = 0; i < n; i++) {
-                uint64_t l, h;
+                uint64_t h;
                 le64_t le_hash;
                 size_t t;
-                void *data;
+                const void *data;
                 Object *u;
 
                 q = le64toh(o->entry.items[i].object_offset);
@@ -2684,29 +3290,11 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 if (le_hash != o->data.hash)
                         return -EBADMSG;
 
-                l = le64toh(o->object.size) - offsetof(Object, data.payload);
-                t = (size_t) l;
-
-                /* We hit the limit on 32bit machines */
-                if ((uint64_t) t != l)
-                        return -E2BIG;
-
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
-                        uint64_t rsize;
-
-                        if (!uncompress_blob(o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0))
-                                return -EBADMSG;
-
-                        data = from->compress_buffer;
-                        l = rsize;
-#else
-                        return -EPROTONOSUPPORT;
-#endif
-                } else
-                        data = o->data.payload;
+                r = journal_file_data_payload(from, o, q, NULL, 0, 0, &data, &t);
+                if (r < 0)
+                        return r;
 
-                r = journal_file_append_data(to, data, l, &u, &h);
+                r = journal_file_append_data(to, data, t, &u, &h);
                 if (r < 0)
                         return r;
 
@@ -34,6 +34,7 @@
 #include "util.h"
 #include "mmap-cache.h"
 #include "hashmap.h"
+#include "compress.h"
 
 typedef struct JournalMetrics {
         uint64_t max_use;
@@ -55,11 +56,16 @@ typedef struct JournalFile {
         int flags;
         int prot;
         bool writable;
-        bool compress;
+        int compress; /* OBJECT_COMPRESSED_XZ, OBJECT_COMPRESSED_LZ4 or 0 */
         bool seal;
 
         bool tail_entry_monotonic_valid;
 
+        /* Coalesce change notifications, the owner calls
+         * journal_file_post_change() when post_change_pending is set */
+        bool defer_post_change;
+        bool post_change_pending;
+
         direction_t last_direction;
 
         char *path;
@@ -71,15 +77,44 @@ typedef struct JournalFile {
 
         uint64_t current_offset;
 
+        /* How the writer grew the file, and how often a write
+         * reached past the pages populated for it */
+        usec_t allocate_last_usec;
+        uint64_t allocate_last_offset;
+        uint64_t prefault_offset;
+        uint64_t n_allocate;
+        usec_t allocate_usec;
+        uint64_t n_prefault;
+        uint64_t n_prefault_misses;
+
         JournalMetrics metrics;
         MMapCache *mmap;
 
         Hashmap *chain_cache;
 
-#ifdef HAVE_XZ
+        CompressContext *compress_context;
         void *compress_buffer;
         uint64_t compress_buffer_size;
-#endif
+
+        /* Recently decompressed DATA objects, keyed by offset */
+        Hashmap *decompress_cache;
+        uint64_t decompress_cache_bytes;
+        uint64_t n_decompress_cache_hit;
+        uint64_t n_decompress_cache_miss;
+
+        /* The index of an archived file, if there is one, loaded on
+         * first use by the reader */
+        struct JournalIndex *index;
+        bool index_loaded;
+
+        /* Which of the fields the reader asked for the DATA objects
+         * belong to, allocated on first use by the reader */
+        struct ProjectionCacheItem *projection_cache;
+        unsigned projection_generation;
+
+        /* The DATA objects of the fields enumerated with
+         * sd_journal_enumerate_unique(), for archived files only */
+        Hashmap *unique_cache;
 
 #ifdef HAVE_GCRYPT
         gcry_md_hd_t hmac;
@@ -99,11 +134,17 @@ typedef struct JournalFile {
 #endif
 } JournalFile;
 
+typedef struct JournalAppendEntry {
+        dual_timestamp ts;
+        const struct iovec *iovec;
+        unsigned n_iovec;
+} JournalAppendEntry;
+
 int journal_file_open(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -118,7 +159,7 @@ int journal_file_open_reliably(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -149,8 +190,11 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_SEALED(h) \
         (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_SEALED))
 
-#define JOURNAL_HEADER_COMPRESSED(h) \
-        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED))
+#define JOURNAL_HEADER_COMPRESSED_XZ(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_XZ))
+
+#define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
 
 int journal_file_move_to_object(JournalFile *f, int type, uint64_t offset, Object **ret);
 
@@ -160,6 +204,9 @@ uint64_t journal_file_hash_table_n_items(Object *o) _pure_;
 
 int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqno, Object **ret, uint64_t *offset);
+int journal_file_append_entries(JournalFile *f, const JournalAppendEntry entries[], unsigned n_entries, uint64_t *seqno, unsigned *n_appended);
+
+int journal_file_data_payload(JournalFile *f, Object *o, uint64_t offset, const char *field, size_t field_length, uint64_t data_threshold, const void **ret_data, size_t *ret_size);
 
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
@@ -187,7 +234,7 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
 
-int journal_file_rotate(JournalFile **f, bool compress, bool seal);
+int journal_file_rotate(JournalFile **f, int compress, bool seal);
 
 void journal_file_post_change(JournalFile *f);
 
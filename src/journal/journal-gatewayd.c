@@ -37,6 +37,15 @@
 #include "microhttpd-util.h"
 #include "build.h"
 #include "fileio.h"
+#include "path-util.h"
+#include "journal-internal.h"
+
+/* Items are serialized into an in-memory buffer which is reused for
+ * the next item, unless it grew larger than this */
+#define REQUEST_BUFFER_MAX (256U*1024U)
+
+/* How much to hand to microhttpd at once */
+#define REQUEST_BLOCK_SIZE (64U*1024U)
 
 typedef struct RequestMeta {
         sd_journal *journal;
@@ -49,10 +58,16 @@ typedef struct RequestMeta {
         bool n_entries_set;
 
         FILE *tmp;
+        char *buffer;
+        size_t buffer_size;
         uint64_t delta, size;
 
         int argument_parse_error;
 
+        /* Serializing an item failed after the preceding ones were
+         * handed out, reported on the next read */
+        int reader_error;
+
         bool follow;
         bool discrete;
 
@@ -98,6 +113,7 @@ static void request_meta_free(
         if (m->tmp)
                 fclose(m->tmp);
 
+        free(m->buffer);
         free(m->cursor);
         free(m);
 }
@@ -164,121 +180,183 @@ static int respond_error(
         return r;
 }
 
-static ssize_t request_reader_entries(
-                void *cls,
+static int request_meta_rewind(RequestMeta *m) {
+        assert(m);
+
+        /* Don't keep a lot of memory around after a huge item */
+        if (m->tmp && m->size > REQUEST_BUFFER_MAX) {
+                fclose(m->tmp);
+                m->tmp = NULL;
+
+                free(m->buffer);
+                m->buffer = NULL;
+                m->buffer_size = 0;
+        }
+
+        if (m->tmp) {
+                rewind(m->tmp);
+                return 0;
+        }
+
+        m->tmp = open_memstream(&m->buffer, &m->buffer_size);
+        if (!m->tmp) {
+                log_error("Failed to create memory stream: %m");
+                return -errno;
+        }
+
+        return 0;
+}
+
+static ssize_t request_reader(
+                RequestMeta *m,
                 uint64_t pos,
                 char *buf,
-                size_t max) {
+                size_t max,
+                int (*next)(RequestMeta *m, bool wait)) {
 
-        RequestMeta *m = cls;
+        size_t k = 0;
         int r;
-        size_t n, k;
 
         assert(m);
         assert(buf);
         assert(max > 0);
+        assert(next);
         assert(pos >= m->delta);
 
+        if (m->reader_error < 0)
+                return MHD_CONTENT_READER_END_WITH_ERROR;
+
         pos -= m->delta;
 
-        while (pos >= m->size) {
-                off_t sz;
+        /* Fill the buffer with as many items as fit, but hand out
+         * what we have rather than waiting for more */
 
-                /* End of this entry, so let's serialize the next
-                 * one */
+        while (k < max) {
+                size_t n;
 
-                if (m->n_entries_set &&
-                    m->n_entries <= 0)
-                        return MHD_CONTENT_READER_END_OF_STREAM;
+                if (pos >= m->size) {
+                        off_t sz;
 
-                if (m->n_skip < 0)
-                        r = sd_journal_previous_skip(m->journal, (uint64_t) -m->n_skip + 1);
-                else if (m->n_skip > 0)
-                        r = sd_journal_next_skip(m->journal, (uint64_t) m->n_skip + 1);
-                else
-                        r = sd_journal_next(m->journal);
+                        /* End of this item, so let's serialize the
+                         * next one */
 
-                if (r < 0) {
-                        log_error("Failed to advance journal pointer: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                } else if (r == 0) {
-
-                        if (m->follow) {
-                                r = sd_journal_wait(m->journal, (uint64_t) -1);
-                                if (r < 0) {
-                                        log_error("Couldn't wait for journal event: %s", strerror(-r));
-                                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                        r = next(m, k == 0);
+                        if (r < 0) {
+                                /* The journal already moved on,
+                                 * hence don't let the client miss
+                                 * that the stream is incomplete */
+                                if (k > 0) {
+                                        m->reader_error = r;
+                                        break;
                                 }
 
-                                continue;
+                                return MHD_CONTENT_READER_END_WITH_ERROR;
                         }
+                        if (r == 0) {
+                                if (k > 0)
+                                        break;
 
-                        return MHD_CONTENT_READER_END_OF_STREAM;
-                }
+                                return MHD_CONTENT_READER_END_OF_STREAM;
+                        }
 
-                if (m->discrete) {
-                        assert(m->cursor);
+                        if (fflush(m->tmp) != 0) {
+                                log_error("Failed to serialize item: %m");
+                                return MHD_CONTENT_READER_END_WITH_ERROR;
+                        }
 
-                        r = sd_journal_test_cursor(m->journal, m->cursor);
-                        if (r < 0) {
-                                log_error("Failed to test cursor: %s", strerror(-r));
+                        sz = ftello(m->tmp);
+                        if (sz == (off_t) -1) {
+                                log_error("Failed to retrieve file position: %m");
                                 return MHD_CONTENT_READER_END_WITH_ERROR;
                         }
 
-                        if (r == 0)
-                                return MHD_CONTENT_READER_END_OF_STREAM;
+                        pos -= m->size;
+                        m->delta += m->size;
+                        m->size = (uint64_t) sz;
+                        continue;
                 }
 
-                pos -= m->size;
-                m->delta += m->size;
+                n = MIN(m->size - pos, max - k);
+                memcpy(buf + k, m->buffer + pos, n);
 
-                if (m->n_entries_set)
-                        m->n_entries -= 1;
+                k += n;
+                pos += n;
+        }
 
-                m->n_skip = 0;
+        return (ssize_t) k;
+}
 
-                if (m->tmp)
-                        rewind(m->tmp);
-                else {
-                        m->tmp = tmpfile();
-                        if (!m->tmp) {
-                                log_error("Failed to create temporary file: %m");
-                                return MHD_CONTENT_READER_END_WITH_ERROR;
-                        }
-                }
+static int request_next_entry(RequestMeta *m, bool wait) {
+        int r;
+
+        assert(m);
+
+        for (;;) {
+                if (m->n_entries_set &&
+                    m->n_entries <= 0)
+                        return 0;
+
+                if (m->n_skip < 0)
+                        r = sd_journal_previous_skip(m->journal, (uint64_t) -m->n_skip + 1);
+                else if (m->n_skip > 0)
+                        r = sd_journal_next_skip(m->journal, (uint64_t) m->n_skip + 1);
+                else
+                        r = sd_journal_next(m->journal);
+
+                if (r < 0) {
+                        log_error("Failed to advance journal pointer: %s", strerror(-r));
+                        return r;
+                } else if (r > 0)
+                        break;
 
-                r = output_journal(m->tmp, m->journal, m->mode, 0, OUTPUT_FULL_WIDTH, NULL);
+                if (!m->follow || !wait)
+                        return 0;
+
+                r = sd_journal_wait(m->journal, (uint64_t) -1);
                 if (r < 0) {
-                        log_error("Failed to serialize item: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                        log_error("Couldn't wait for journal event: %s", strerror(-r));
+                        return r;
                 }
+        }
 
-                sz = ftello(m->tmp);
-                if (sz == (off_t) -1) {
-                        log_error("Failed to retrieve file position: %m");
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
+        if (m->discrete) {
+                assert(m->cursor);
+
+                r = sd_journal_test_cursor(m->journal, m->cursor);
+                if (r < 0) {
+                        log_error("Failed to test cursor: %s", strerror(-r));
+                        return r;
                 }
 
-                m->size = (uint64_t) sz;
+                if (r == 0)
+                        return 0;
         }
 
-        if (fseeko(m->tmp, pos, SEEK_SET) < 0) {
-                log_error("Failed to seek to position: %m");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
+        if (m->n_entries_set)
+                m->n_entries -= 1;
 
-        n = m->size - pos;
-        if (n > max)
-                n = max;
+        m->n_skip = 0;
 
-        errno = 0;
-        k = fread(buf, 1, n, m->tmp);
-        if (k != n) {
-                log_error("Failed to read from file: %s", errno ? strerror(errno) : "Premature EOF");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
+        r = request_meta_rewind(m);
+        if (r < 0)
+                return r;
+
+        r = output_journal(m->tmp, m->journal, m->mode, 0, OUTPUT_FULL_WIDTH, NULL);
+        if (r < 0) {
+                log_error("Failed to serialize item: %s", strerror(-r));
+                return r;
         }
 
-        return (ssize_t) k;
+        return 1;
+}
+
+static ssize_t request_reader_entries(
+                void *cls,
+                uint64_t pos,
+                char *buf,
+                size_t max) {
+
+        return request_reader(cls, pos, buf, max, request_next_entry);
 }
 
 static int request_parse_accept(
@@ -522,7 +600,7 @@ static int request_handler_entries(
         if (r < 0)
                 return respond_error(connection, MHD_HTTP_BAD_REQUEST, "Failed to seek in journal.\n");
 
-        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4*1024, request_reader_entries, m, NULL);
+        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, REQUEST_BLOCK_SIZE, request_reader_entries, m, NULL);
         if (!response)
                 return respond_oom(connection);
 
@@ -556,90 +634,47 @@ static int output_field(FILE *f, OutputMode m, const char *d, size_t l) {
         return 0;
 }
 
-static ssize_t request_reader_fields(
-                void *cls,
-                uint64_t pos,
-                char *buf,
-                size_t max) {
-
-        RequestMeta *m = cls;
+static int request_next_field(RequestMeta *m, bool wait) {
+        const void *d;
+        size_t l;
         int r;
-        size_t n, k;
 
         assert(m);
-        assert(buf);
-        assert(max > 0);
-        assert(pos >= m->delta);
 
-        pos -= m->delta;
-
-        while (pos >= m->size) {
-                off_t sz;
-                const void *d;
-                size_t l;
-
-                /* End of this field, so let's serialize the next
-                 * one */
-
-                if (m->n_fields_set &&
-                    m->n_fields <= 0)
-                        return MHD_CONTENT_READER_END_OF_STREAM;
-
-                r = sd_journal_enumerate_unique(m->journal, &d, &l);
-                if (r < 0) {
-                        log_error("Failed to advance field index: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                } else if (r == 0)
-                        return MHD_CONTENT_READER_END_OF_STREAM;
-
-                pos -= m->size;
-                m->delta += m->size;
-
-                if (m->n_fields_set)
-                        m->n_fields -= 1;
-
-                if (m->tmp)
-                        rewind(m->tmp);
-                else {
-                        m->tmp = tmpfile();
-                        if (!m->tmp) {
-                                log_error("Failed to create temporary file: %m");
-                                return MHD_CONTENT_READER_END_WITH_ERROR;
-                        }
-                }
+        if (m->n_fields_set &&
+            m->n_fields <= 0)
+                return 0;
 
-                r = output_field(m->tmp, m->mode, d, l);
-                if (r < 0) {
-                        log_error("Failed to serialize item: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                }
+        r = sd_journal_enumerate_unique(m->journal, &d, &l);
+        if (r < 0) {
+                log_error("Failed to advance field index: %s", strerror(-r));
+                return r;
+        } else if (r == 0)
+                return 0;
 
-                sz = ftello(m->tmp);
-                if (sz == (off_t) -1) {
-                        log_error("Failed to retrieve file position: %m");
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                }
+        if (m->n_fields_set)
+                m->n_fields -= 1;
 
-                m->size = (uint64_t) sz;
-        }
+        r = request_meta_rewind(m);
+        if (r < 0)
+                return r;
 
-        if (fseeko(m->tmp, pos, SEEK_SET) < 0) {
-                log_error("Failed to seek to position: %m");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
+        r = output_field(m->tmp, m->mode, d, l);
+        if (r < 0) {
+                log_error("Failed to serialize item: %s", strerror(-r));
+                return r;
         }
 
-        n = m->size - pos;
-        if (n > max)
-                n = max;
+        return 1;
+}
 
-        errno = 0;
-        k = fread(buf, 1, n, m->tmp);
-        if (k != n) {
-                log_error("Failed to read from file: %s", errno ? strerror(errno) : "Premature EOF");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
+static ssize_t request_reader_fields(
+                void *cls,
+                uint64_t pos,
+                char *buf,
+                size_t max) {
 
-        return (ssize_t) k;
+        return request_reader(cls, pos, buf, max, request_next_field);
 }
 
 static int request_handler_fields(
@@ -665,7 +700,7 @@ static int request_handler_fields(
         if (r < 0)
                 return respond_error(connection, MHD_HTTP_BAD_REQUEST, "Failed to query unique fields.\n");
 
-        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4*1024, request_reader_fields, m, NULL);
+        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, REQUEST_BLOCK_SIZE, request_reader_fields, m, NULL);
         if (!response)
                 return respond_oom(connection);
 
@@ -706,6 +741,42 @@ static int request_handler_redirect(
         return ret;
 }
 
+#ifndef HAVE_MHD_CREATE_RESPONSE_FROM_FD_AT_OFFSET
+static ssize_t request_reader_fd(
+                void *cls,
+                uint64_t pos,
+                char *buf,
+                size_t max) {
+
+        ssize_t n;
+
+        n = pread(PTR_TO_INT(cls), buf, max, (off_t) pos);
+        if (n < 0) {
+                log_error("Failed to read file: %m");
+                return MHD_CONTENT_READER_END_WITH_ERROR;
+        }
+        if (n == 0)
+                return MHD_CONTENT_READER_END_OF_STREAM;
+
+        return n;
+}
+
+static void request_reader_fd_free(void *cls) {
+        close_nointr_nofail(PTR_TO_INT(cls));
+}
+#endif
+
+/* On success the response owns the fd */
+static struct MHD_Response *response_from_fd(uint64_t size, int fd) {
+#ifdef HAVE_MHD_CREATE_RESPONSE_FROM_FD_AT_OFFSET
+        /* microhttpd hands the file to the socket with sendfile(),
+         * without us copying anything */
+        return MHD_create_response_from_fd_at_offset(size, fd, 0);
+#else
+        return MHD_create_response_from_callback(size, REQUEST_BLOCK_SIZE, request_reader_fd, INT_TO_PTR(fd), request_reader_fd_free);
+#endif
+}
+
 static int request_handler_file(
                 struct MHD_Connection *connection,
                 const char *path,
@@ -727,7 +798,7 @@ static int request_handler_file(
         if (fstat(fd, &st) < 0)
                 return respond_error(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to stat file: %m\n");
 
-        response = MHD_create_response_from_fd_at_offset(st.st_size, fd, 0);
+        response = response_from_fd(st.st_size, fd);
         if (!response)
                 return respond_oom(connection);
 
@@ -741,6 +812,109 @@ static int request_handler_file(
         return ret;
 }
 
+static JournalFile *find_archived_file(sd_journal *j, const char *name) {
+        JournalFile *f;
+        Iterator i;
+
+        assert(j);
+        assert(name);
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                /* Only archived files, since the others are still
+                 * being written to and would be inconsistent */
+                if (f->header->state != STATE_ARCHIVED)
+                        continue;
+
+                if (streq(path_get_file_name(f->path), name))
+                        return f;
+        }
+
+        return NULL;
+}
+
+static int request_handler_files(
+                struct MHD_Connection *connection,
+                const char *name,
+                void *connection_cls) {
+
+        struct MHD_Response *response;
+        RequestMeta *m = connection_cls;
+        _cleanup_close_ int fd = -1;
+        JournalFile *f;
+        struct stat st;
+        int r;
+
+        assert(connection);
+        assert(name);
+        assert(m);
+
+        r = open_journal(m);
+        if (r < 0)
+                return respond_error(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to open journal: %s\n", strerror(-r));
+
+        r = journal_add_deferred_files(m->journal);
+        if (r < 0)
+                return respond_error(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to open journal files: %s\n", strerror(-r));
+
+        if (isempty(name)) {
+                Iterator i;
+                char *list;
+                size_t size;
+                FILE *w;
+
+                w = open_memstream(&list, &size);
+                if (!w)
+                        return respond_oom(connection);
+
+                HASHMAP_FOREACH(f, m->journal->files, i)
+                        if (f->header->state == STATE_ARCHIVED)
+                                fprintf(w, "%s %llu\n",
+                                        path_get_file_name(f->path),
+                                        (unsigned long long) f->last_stat.st_size);
+
+                fflush(w);
+                if (ferror(w)) {
+                        fclose(w);
+                        free(list);
+                        return respond_oom(connection);
+                }
+
+                fclose(w);
+
+                response = MHD_create_response_from_buffer(size, list, MHD_RESPMEM_MUST_FREE);
+                if (!response) {
+                        free(list);
+                        return respond_oom(connection);
+                }
+
+                MHD_add_response_header(response, "Content-Type", "text/plain");
+        } else {
+                f = find_archived_file(m->journal, name);
+                if (!f)
+                        return respond_error(connection, MHD_HTTP_NOT_FOUND, "No archived journal file %s.\n", name);
+
+                fd = open(f->path, O_RDONLY|O_CLOEXEC);
+                if (fd < 0)
+                        return respond_error(connection, MHD_HTTP_NOT_FOUND, "Failed to open file %s: %m\n", f->path);
+
+                if (fstat(fd, &st) < 0)
+                        return respond_error(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to stat file: %m\n");
+
+                response = response_from_fd(st.st_size, fd);
+                if (!response)
+                        return respond_oom(connection);
+
+                fd = -1;
+
+                MHD_add_response_header(response, "Content-Type", "application/octet-stream");
+        }
+
+        r = MHD_queue_response(connection, MHD_HTTP_OK, response);
+        MHD_destroy_response(response);
+
+        return r;
+}
+
 static int get_virtualization(char **v) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_bus_unref_ sd_bus *bus = NULL;
@@ -896,6 +1070,12 @@ static int request_handler(
         if (startswith(url, "/fields/"))
                 return request_handler_fields(connection, url + 8, *connection_cls);
 
+        if (streq(url, "/files"))
+                return request_handler_files(connection, "", *connection_cls);
+
+        if (startswith(url, "/files/"))
+                return request_handler_files(connection, url + 7, *connection_cls);
+
         if (streq(url, "/browse"))
                 return request_handler_file(connection, DOCUMENT_ROOT "/browse.html", "text/html");
 
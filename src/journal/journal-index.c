@@ -0,0 +1,377 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "journal-index.h"
+
+struct JournalIndex {
+        void *map;
+        size_t map_size;
+
+        const JournalIndexItem *items;
+        uint64_t n_items;
+};
+
+static int item_compare(const void *a, const void *b) {
+        const JournalIndexItem *x = a, *y = b;
+
+        if (le64toh(x->hash) < le64toh(y->hash))
+                return -1;
+        if (le64toh(x->hash) > le64toh(y->hash))
+                return 1;
+
+        return 0;
+}
+
+static int entry_of_data(JournalFile *f, uint64_t p, direction_t direction, uint64_t *seqnum, uint64_t *realtime) {
+        Object *o;
+        int r;
+
+        r = journal_file_next_entry_for_data(f, NULL, 0, p, direction, &o, NULL);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -EBADMSG;
+
+        *seqnum = le64toh(o->entry.seqnum);
+        *realtime = le64toh(o->entry.realtime);
+
+        return 0;
+}
+
+static int journal_index_build(JournalFile *f, JournalIndexItem **ret, uint64_t *ret_n) {
+        _cleanup_free_ JournalIndexItem *items = NULL;
+        size_t n_allocated = 0;
+        uint64_t n = 0, m, i, k;
+        int r;
+
+        assert(f);
+        assert(ret);
+        assert(ret_n);
+
+        /* Collects all DATA objects which are referenced by at least
+         * one entry, sorted by hash. If two of them share the same
+         * hash, they are folded into one item. */
+
+        m = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
+
+        for (i = 0; i < m; i++) {
+                uint64_t p;
+
+                p = le64toh(f->data_hash_table[i].head_hash_offset);
+                while (p > 0) {
+                        JournalIndexItem *item;
+                        uint64_t next, seqnum, realtime;
+                        Object *o;
+
+                        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        next = le64toh(o->data.next_hash_offset);
+
+                        if (o->data.n_entries == 0) {
+                                p = next;
+                                continue;
+                        }
+
+                        if (!GREEDY_REALLOC(items, n_allocated, n + 1))
+                                return -ENOMEM;
+
+                        item = items + n++;
+                        item->hash = o->data.hash;
+                        item->n_entries = o->data.n_entries;
+
+                        r = entry_of_data(f, p, DIRECTION_DOWN, &seqnum, &realtime);
+                        if (r < 0)
+                                return r;
+
+                        item->head_entry_seqnum = htole64(seqnum);
+                        item->head_entry_realtime = htole64(realtime);
+
+                        r = entry_of_data(f, p, DIRECTION_UP, &seqnum, &realtime);
+                        if (r < 0)
+                                return r;
+
+                        item->tail_entry_seqnum = htole64(seqnum);
+                        item->tail_entry_realtime = htole64(realtime);
+
+                        p = next;
+                }
+        }
+
+        qsort_safe(items, n, sizeof(JournalIndexItem), item_compare);
+
+        for (i = 0, k = 0; i < n; i++) {
+                JournalIndexItem *a = items + k, *b = items + i;
+
+                if (i == 0)
+                        continue;
+
+                if (a->hash != b->hash) {
+                        items[++k] = *b;
+                        continue;
+                }
+
+                a->n_entries = htole64(le64toh(a->n_entries) + le64toh(b->n_entries));
+
+                if (le64toh(b->head_entry_seqnum) < le64toh(a->head_entry_seqnum))
+                        a->head_entry_seqnum = b->head_entry_seqnum;
+                if (le64toh(b->tail_entry_seqnum) > le64toh(a->tail_entry_seqnum))
+                        a->tail_entry_seqnum = b->tail_entry_seqnum;
+                if (le64toh(b->head_entry_realtime) < le64toh(a->head_entry_realtime))
+                        a->head_entry_realtime = b->head_entry_realtime;
+                if (le64toh(b->tail_entry_realtime) > le64toh(a->tail_entry_realtime))
+                        a->tail_entry_realtime = b->tail_entry_realtime;
+        }
+
+        *ret = items;
+        *ret_n = n > 0 ? k + 1 : 0;
+        items = NULL;
+
+        return 0;
+}
+
+static void journal_index_init_header(JournalFile *f, JournalIndexHeader *h, uint64_t n_items) {
+        assert(f);
+        assert(h);
+
+        zero(*h);
+        memcpy(h->signature, JOURNAL_INDEX_SIGNATURE, sizeof(h->signature));
+        h->header_size = htole64(ALIGN_TO(sizeof(JournalIndexHeader), 8));
+        h->item_size = htole64(sizeof(JournalIndexItem));
+        h->n_items = htole64(n_items);
+
+        h->file_id = f->header->file_id;
+        h->n_entries = f->header->n_entries;
+        h->tail_entry_seqnum = f->header->tail_entry_seqnum;
+        h->head_entry_realtime = f->header->head_entry_realtime;
+        h->tail_entry_realtime = f->header->tail_entry_realtime;
+}
+
+int journal_index_write(JournalFile *f, const char *journal_path) {
+        _cleanup_free_ JournalIndexItem *items = NULL;
+        _cleanup_free_ char *path = NULL, *p = NULL;
+        _cleanup_fclose_ FILE *w = NULL;
+        JournalIndexHeader h;
+        uint64_t n;
+        size_t k;
+        int r;
+
+        assert(f);
+        assert(journal_path);
+
+        r = journal_index_build(f, &items, &n);
+        if (r < 0)
+                return r;
+
+        path = strappend(journal_path, JOURNAL_INDEX_SUFFIX);
+        if (!path)
+                return -ENOMEM;
+
+        r = fopen_temporary(path, &w, &p);
+        if (r < 0)
+                return r;
+
+        journal_index_init_header(f, &h, n);
+
+        k = fwrite(&h, 1, sizeof(h), w);
+        if (k != sizeof(h))
+                goto error;
+
+        k = fwrite(items, 1, n * sizeof(JournalIndexItem), w);
+        if (k != n * sizeof(JournalIndexItem))
+                goto error;
+
+        fflush(w);
+
+        if (ferror(w))
+                goto error;
+
+        fchmod(fileno(w), f->mode & 0666);
+
+        if (rename(p, path) < 0) {
+                r = -errno;
+                unlink(p);
+                return r;
+        }
+
+        return 0;
+
+error:
+        unlink(p);
+        return -EIO;
+}
+
+static int journal_index_map(const char *journal_path, JournalIndexHeader **ret, size_t *ret_size) {
+        _cleanup_close_ int fd = -1;
+        JournalIndexHeader *h;
+        const char *path;
+        struct stat st;
+        void *p;
+
+        assert(journal_path);
+        assert(ret);
+        assert(ret_size);
+
+        path = strappenda(journal_path, JOURNAL_INDEX_SUFFIX);
+
+        fd = open(path, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        if (st.st_size < (off_t) sizeof(JournalIndexHeader))
+                return -EBADMSG;
+
+        p = mmap(NULL, PAGE_ALIGN(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+                return -errno;
+
+        h = p;
+        if (memcmp(h->signature, JOURNAL_INDEX_SIGNATURE, sizeof(h->signature)) != 0 ||
+            h->incompatible_flags != 0 ||
+            le64toh(h->header_size) < sizeof(JournalIndexHeader) ||
+            le64toh(h->header_size) > (uint64_t) st.st_size ||
+            le64toh(h->item_size) < sizeof(JournalIndexItem) ||
+            le64toh(h->n_items) > ((uint64_t) st.st_size - le64toh(h->header_size)) / le64toh(h->item_size) ||
+            (uint64_t) st.st_size != le64toh(h->header_size) + le64toh(h->item_size) * le64toh(h->n_items)) {
+                munmap(p, PAGE_ALIGN(st.st_size));
+                return -EBADMSG;
+        }
+
+        *ret = h;
+        *ret_size = PAGE_ALIGN(st.st_size);
+
+        return 0;
+}
+
+static bool journal_index_current(JournalFile *f, const JournalIndexHeader *h) {
+        assert(f);
+        assert(h);
+
+        return
+                sd_id128_equal(h->file_id, f->header->file_id) &&
+                h->n_entries == f->header->n_entries &&
+                h->tail_entry_seqnum == f->header->tail_entry_seqnum;
+}
+
+int journal_index_open(JournalFile *f, JournalIndex **ret) {
+        JournalIndexHeader *h;
+        JournalIndex *i;
+        size_t size;
+        int r;
+
+        assert(f);
+        assert(ret);
+
+        /* Only archived files never change, for all others an index
+         * would be out of date immediately */
+        if (f->header->state != STATE_ARCHIVED)
+                return -ENOENT;
+
+        r = journal_index_map(f->path, &h, &size);
+        if (r < 0)
+                return r;
+
+        if (!journal_index_current(f, h) ||
+            le64toh(h->item_size) != sizeof(JournalIndexItem)) {
+                munmap(h, size);
+                return -ESTALE;
+        }
+
+        i = new0(JournalIndex, 1);
+        if (!i) {
+                munmap(h, size);
+                return -ENOMEM;
+        }
+
+        i->map = h;
+        i->map_size = size;
+        i->items = (const JournalIndexItem*) ((const uint8_t*) h + le64toh(h->header_size));
+        i->n_items = le64toh(h->n_items);
+
+        *ret = i;
+        return 0;
+}
+
+void journal_index_close(JournalIndex *i) {
+        assert(i);
+
+        munmap(i->map, i->map_size);
+        free(i);
+}
+
+const JournalIndexItem *journal_index_lookup(JournalIndex *i, uint64_t hash) {
+        JournalIndexItem key;
+
+        assert(i);
+
+        zero(key);
+        key.hash = htole64(hash);
+
+        return bsearch(&key, i->items, i->n_items, sizeof(JournalIndexItem), item_compare);
+}
+
+int journal_index_verify(JournalFile *f) {
+        _cleanup_free_ JournalIndexItem *items = NULL;
+        JournalIndexHeader *h, expected;
+        size_t size;
+        uint64_t n;
+        int r;
+
+        assert(f);
+
+        /* Not having an index is fine, but if there is one it needs
+         * to match the journal file exactly */
+
+        r = journal_index_map(f->path, &h, &size);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return r;
+
+        r = journal_index_build(f, &items, &n);
+        if (r < 0)
+                goto finish;
+
+        journal_index_init_header(f, &expected, n);
+
+        if (memcmp(h, &expected, sizeof(expected)) != 0 ||
+            memcmp((const uint8_t*) h + le64toh(h->header_size), items, n * sizeof(JournalIndexItem)) != 0)
+                r = -EBADMSG;
+        else
+                r = 0;
+
+finish:
+        munmap(h, size);
+        return r;
+}
@@ -0,0 +1,82 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include <systemd/sd-id128.h>
+
+#include "macro.h"
+#include "sparse-endian.h"
+#include "journal-file.h"
+
+/* An index is stored next to an archived journal file, in a file
+ * with JOURNAL_INDEX_SUFFIX appended to its name. It lists the hashes
+ * of all DATA objects of the journal file, i.e. of all field/value
+ * pairs in it, sorted, together with the range of entries they
+ * appear in. Readers use it to find out whether a file can contain
+ * entries matching their matches at all, without looking into the
+ * journal file itself. As the hashes are not unique, an item in the
+ * index only says that the field/value pair might be in the file, but
+ * a missing item means that it is not. */
+
+#define JOURNAL_INDEX_SUFFIX ".index"
+
+typedef struct JournalIndexHeader JournalIndexHeader;
+typedef struct JournalIndexItem JournalIndexItem;
+typedef struct JournalIndex JournalIndex;
+
+struct JournalIndexHeader {
+        uint8_t signature[8]; /* "LPKSHIDX" */
+        le32_t compatible_flags;
+        le32_t incompatible_flags;
+        le64_t header_size;
+        le64_t item_size;
+        le64_t n_items;
+
+        /* Copied from the header of the journal file, to recognize
+         * indexes which do not belong to it. */
+        sd_id128_t file_id;
+        le64_t n_entries;
+        le64_t tail_entry_seqnum;
+        le64_t head_entry_realtime;
+        le64_t tail_entry_realtime;
+} _packed_;
+
+struct JournalIndexItem {
+        le64_t hash;
+        le64_t n_entries;
+        le64_t head_entry_seqnum;
+        le64_t tail_entry_seqnum;
+        le64_t head_entry_realtime;
+        le64_t tail_entry_realtime;
+} _packed_;
+
+#define JOURNAL_INDEX_SIGNATURE ((char[]) { 'L', 'P', 'K', 'S', 'H', 'I', 'D', 'X' })
+
+int journal_index_write(JournalFile *f, const char *journal_path);
+int journal_index_verify(JournalFile *f);
+
+int journal_index_open(JournalFile *f, JournalIndex **ret);
+void journal_index_close(JournalIndex *i);
+
+const JournalIndexItem *journal_index_lookup(JournalIndex *i, uint64_t hash);
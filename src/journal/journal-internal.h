@@ -31,11 +31,15 @@
 #include "list.h"
 #include "hashmap.h"
 #include "set.h"
+#include "prioq.h"
 #include "journal-file.h"
+#include "catalog.h"
 
 typedef struct Match Match;
 typedef struct Location Location;
 typedef struct Directory Directory;
+typedef struct Candidate Candidate;
+typedef struct DeferredFile DeferredFile;
 
 typedef enum MatchType {
         MATCH_DISCRETE,
@@ -90,6 +94,25 @@ struct Location {
         uint64_t xor_hash;
 };
 
+/* A direct mapped cache of which projected field the DATA object at
+ * an offset belongs to, so that the objects of all other fields are
+ * never looked at again */
+#define PROJECTION_CACHE_SIZE 4096
+
+typedef struct ProjectionCacheItem {
+        uint64_t offset;
+        int field;
+} ProjectionCacheItem;
+
+/* The offsets of the DATA objects of a field in an archived file, in
+ * the order of the field's list, allocated in one piece together with
+ * the field name */
+typedef struct UniqueCacheItem {
+        char *field;
+        uint64_t n_offsets;
+        uint64_t offsets[];
+} UniqueCacheItem;
+
 struct Directory {
         char *path;
         int wd;
@@ -102,11 +125,36 @@ struct sd_journal {
         Hashmap *files;
         MMapCache *mmap;
 
+        /* Archived files we know the time range of, which we did
+         * not open yet, keyed by path */
+        Hashmap *deferred_files;
+        CompressContext *compress_context;
+
         Location current_location;
 
         JournalFile *current_file;
         uint64_t current_field;
 
+        /* The next entry of each file in the current direction,
+         * ordered, so that stepping only needs to look at the file
+         * we took the last entry from. The files which had no more
+         * entries and might still be written to are kept in
+         * waiting. */
+        Candidate *candidates;
+        Prioq *candidate_queue;
+        Candidate **waiting;
+        unsigned n_waiting;
+        direction_t candidate_direction;
+        bool candidates_valid;
+
+        /* How often a file index was consulted, and how often it
+         * allowed us to skip the file */
+        uint64_t n_index_lookups;
+        uint64_t n_index_skipped;
+
+        /* The message catalog, opened on first use */
+        Catalog *catalog;
+
         Match *level0, *level1, *level2;
 
         pid_t original_pid;
@@ -118,6 +166,20 @@ struct sd_journal {
         char *unique_field;
         JournalFile *unique_file;
         uint64_t unique_offset;
+        bool unique_skip_file;
+
+        /* The values sd_journal_enumerate_unique() returned so far,
+         * and the time range they need to have entries in */
+        Set *unique_values;
+        usec_t unique_since, unique_until;
+
+        /* The DATA objects of the current file, either from its
+         * cache or collected to be put there */
+        const UniqueCacheItem *unique_cached;
+        uint64_t unique_index;
+        uint64_t *unique_collected;
+        size_t unique_n_collected, unique_collected_allocated;
+        bool unique_collect;
 
         int flags;
 
@@ -126,6 +188,11 @@ struct sd_journal {
 
         size_t data_threshold;
 
+        /* The fields sd_journal_enumerate_data() returns, all of
+         * them if NULL */
+        char **projection;
+        unsigned projection_generation;
+
         Hashmap *directories_by_path;
         Hashmap *directories_by_wd;
 
@@ -134,6 +201,9 @@ struct sd_journal {
 
 char *journal_make_match_string(sd_journal *j);
 void journal_print_header(sd_journal *j);
+int journal_add_deferred_files(sd_journal *j);
+int journal_set_unique_window(sd_journal *j, usec_t since, usec_t until);
+void journal_log_statistics(sd_journal *j);
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(sd_journal*, sd_journal_close);
 #define _cleanup_journal_close_ _cleanup_(sd_journal_closep)
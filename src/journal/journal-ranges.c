@@ -0,0 +1,348 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "log.h"
+#include "util.h"
+#include "path-util.h"
+#include "journal-ranges.h"
+
+static void item_free(JournalRangesItem *i) {
+        if (!i)
+                return;
+
+        free(i->filename);
+        free(i);
+}
+
+static int ranges_put_item(JournalRanges *r, JournalRangesItem *i) {
+        JournalRangesItem *old;
+        int k;
+
+        assert(r);
+        assert(i);
+
+        /* Takes possession of i */
+
+        old = hashmap_remove(r->items, i->filename);
+        item_free(old);
+
+        k = hashmap_put(r->items, i->filename, i);
+        if (k < 0) {
+                item_free(i);
+                return k;
+        }
+
+        return 0;
+}
+
+static int ranges_parse_line(JournalRanges *r, const char *line, bool merge) {
+        _cleanup_free_ char *filename = NULL;
+        char file_id[33], boot_id[33];
+        unsigned long long inode, head, tail;
+        JournalRangesItem *i;
+
+        assert(r);
+        assert(line);
+
+        if (sscanf(line, "%ms %llu %32s %32s %llu %llu", &filename, &inode, file_id, boot_id, &head, &tail) != 6)
+                return -EBADMSG;
+
+        i = new0(JournalRangesItem, 1);
+        if (!i)
+                return -ENOMEM;
+
+        if (sd_id128_from_string(file_id, &i->file_id) < 0 ||
+            sd_id128_from_string(boot_id, &i->boot_id) < 0) {
+                free(i);
+                return -EBADMSG;
+        }
+
+        /* What we learnt ourselves is at least as recent */
+        if (merge && hashmap_get(r->items, filename)) {
+                free(i);
+                return 0;
+        }
+
+        i->filename = filename;
+        filename = NULL;
+        i->inode = (ino_t) inode;
+        i->head_realtime = (usec_t) head;
+        i->tail_realtime = (usec_t) tail;
+
+        return ranges_put_item(r, i);
+}
+
+static JournalRanges *ranges_new(void) {
+        JournalRanges *r;
+
+        r = new0(JournalRanges, 1);
+        if (!r)
+                return NULL;
+
+        r->items = hashmap_new(string_hash_func, string_compare_func);
+        if (!r->items) {
+                free(r);
+                return NULL;
+        }
+
+        return r;
+}
+
+static int ranges_read(JournalRanges *r, const char *directory, bool merge) {
+        _cleanup_fclose_ FILE *f = NULL;
+        const char *p;
+        char line[LINE_MAX];
+        unsigned n = 0;
+        int k;
+
+        assert(r);
+        assert(directory);
+
+        /* A missing or broken catalog is no problem, it is just
+         * empty then */
+        p = strappenda(directory, "/" JOURNAL_RANGES_FILE);
+        f = fopen(p, "re");
+        if (!f) {
+                if (errno != ENOENT)
+                        log_debug("Failed to open %s: %m", p);
+
+                return 0;
+        }
+
+        while (fgets(line, sizeof(line), f)) {
+                n++;
+
+                truncate_nl(line);
+
+                if (line[0] == '#' || line[0] == 0)
+                        continue;
+
+                k = ranges_parse_line(r, line, merge);
+                if (k == -ENOMEM)
+                        return k;
+                if (k < 0)
+                        log_debug("%s:%u: Failed to parse line, ignoring.", p, n);
+        }
+
+        return 0;
+}
+
+int journal_ranges_load(const char *directory, JournalRanges **ret) {
+        JournalRanges *r;
+        int k;
+
+        assert(directory);
+        assert(ret);
+
+        r = ranges_new();
+        if (!r)
+                return -ENOMEM;
+
+        k = ranges_read(r, directory, false);
+        if (k < 0) {
+                journal_ranges_free(r);
+                return k;
+        }
+
+        *ret = r;
+        return 0;
+}
+
+int journal_ranges_save(JournalRanges *r, const char *directory) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *temp = NULL;
+        _cleanup_close_ int fd = -1;
+        JournalRangesItem *i;
+        Iterator it;
+        const char *p;
+        int k;
+
+        assert(r);
+        assert(directory);
+
+        fd = open(directory, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        /* journald and readers both update the catalog. Serialize
+         * them on the directory, and pick up what the others added
+         * since we loaded it, so that nobody's entries get lost. The
+         * lock goes away when fd is closed. */
+        if (flock(fd, LOCK_EX) < 0)
+                return -errno;
+
+        k = ranges_read(r, directory, true);
+        if (k < 0)
+                return k;
+
+        p = strappenda(directory, "/" JOURNAL_RANGES_FILE);
+
+        k = fopen_temporary(p, &f, &temp);
+        if (k < 0)
+                return k;
+
+        fputs("# Time ranges of archived journal files, automatically generated, do not edit.\n"
+              "# filename inode file_id boot_id head_realtime tail_realtime\n", f);
+
+        HASHMAP_FOREACH(i, r->items, it) {
+
+                /* Forget about files which have been removed
+                 * since */
+                if (faccessat(fd, i->filename, F_OK, 0) < 0) {
+                        hashmap_remove(r->items, i->filename);
+                        item_free(i);
+                        continue;
+                }
+
+                fprintf(f, "%s %llu " SD_ID128_FORMAT_STR " " SD_ID128_FORMAT_STR " %llu %llu\n",
+                        i->filename,
+                        (unsigned long long) i->inode,
+                        SD_ID128_FORMAT_VAL(i->file_id),
+                        SD_ID128_FORMAT_VAL(i->boot_id),
+                        (unsigned long long) i->head_realtime,
+                        (unsigned long long) i->tail_realtime);
+        }
+
+        fflush(f);
+
+        if (ferror(f)) {
+                unlink(temp);
+                return -EIO;
+        }
+
+        /* The catalog reveals boot IDs and time ranges, hence make
+         * it no more accessible than the journal files themselves */
+        fchmod(fileno(f), r->mode > 0 ? r->mode : 0640);
+
+        if (rename(temp, p) < 0) {
+                k = -errno;
+                unlink(temp);
+                return k;
+        }
+
+        r->dirty = false;
+        return 0;
+}
+
+void journal_ranges_free(JournalRanges *r) {
+        JournalRangesItem *i;
+
+        if (!r)
+                return;
+
+        while ((i = hashmap_steal_first(r->items)))
+                item_free(i);
+
+        hashmap_free(r->items);
+        free(r);
+}
+
+bool journal_ranges_file_wanted(const char *filename, JournalFile *f) {
+        assert(filename);
+
+        /* Only files which have been archived regularly, not the
+         * active ones, and not the ones put aside as corrupted */
+        if (!endswith(filename, ".journal") || !strchr(filename, '@'))
+                return false;
+
+        return !f || f->header->state == STATE_ARCHIVED;
+}
+
+const JournalRangesItem *journal_ranges_get(JournalRanges *r, const char *filename, ino_t inode) {
+        JournalRangesItem *i;
+
+        assert(r);
+        assert(filename);
+
+        i = hashmap_get(r->items, filename);
+        if (!i)
+                return NULL;
+
+        /* Not the file we have seen */
+        if (i->inode != inode)
+                return NULL;
+
+        return i;
+}
+
+int journal_ranges_put(JournalRanges *r, const char *filename, JournalFile *f) {
+        JournalRangesItem *i;
+
+        assert(r);
+        assert(filename);
+        assert(f);
+
+        if (!journal_ranges_file_wanted(filename, f))
+                return 0;
+
+        i = new0(JournalRangesItem, 1);
+        if (!i)
+                return -ENOMEM;
+
+        i->filename = strdup(filename);
+        if (!i->filename) {
+                free(i);
+                return -ENOMEM;
+        }
+
+        i->inode = f->last_stat.st_ino;
+        i->file_id = f->header->file_id;
+        i->boot_id = f->header->boot_id;
+        i->head_realtime = le64toh(f->header->head_entry_realtime);
+        i->tail_realtime = le64toh(f->header->tail_entry_realtime);
+
+        r->mode = f->last_stat.st_mode & 07777;
+        r->dirty = true;
+
+        return ranges_put_item(r, i);
+}
+
+int journal_ranges_add_file(const char *path, JournalFile *f) {
+        _cleanup_free_ char *directory = NULL;
+        JournalRanges *r;
+        int k;
+
+        assert(path);
+        assert(f);
+
+        directory = dirname_malloc(path);
+        if (!directory)
+                return -ENOMEM;
+
+        /* journal_ranges_save() merges in what is there already */
+        r = ranges_new();
+        if (!r)
+                return -ENOMEM;
+
+        k = journal_ranges_put(r, path_get_file_name(path), f);
+        if (k >= 0)
+                k = journal_ranges_save(r, directory);
+
+        journal_ranges_free(r);
+        return k;
+}
@@ -0,0 +1,68 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <systemd/sd-id128.h>
+
+#include "hashmap.h"
+#include "util.h"
+#include "journal-file.h"
+
+/* A catalog of the archived journal files of a directory and the time
+ * ranges they cover, kept in a file in the directory. Readers use it
+ * to decide which files they need to open for a query without looking
+ * at the files themselves. As archived files never change, an entry
+ * stays valid for as long as the file is around. */
+
+#define JOURNAL_RANGES_FILE ".journal-ranges"
+
+typedef struct JournalRanges JournalRanges;
+typedef struct JournalRangesItem JournalRangesItem;
+
+struct JournalRangesItem {
+        char *filename;
+        ino_t inode;
+        sd_id128_t file_id;
+        sd_id128_t boot_id;
+        usec_t head_realtime;
+        usec_t tail_realtime;
+};
+
+struct JournalRanges {
+        Hashmap *items;
+        mode_t mode;
+        bool dirty;
+};
+
+int journal_ranges_load(const char *directory, JournalRanges **ret);
+int journal_ranges_save(JournalRanges *r, const char *directory);
+void journal_ranges_free(JournalRanges *r);
+
+bool journal_ranges_file_wanted(const char *filename, JournalFile *f);
+
+const JournalRangesItem *journal_ranges_get(JournalRanges *r, const char *filename, ino_t inode);
+int journal_ranges_put(JournalRanges *r, const char *filename, JournalFile *f);
+
+int journal_ranges_add_file(const char *path, JournalFile *f);
@@ -32,25 +32,31 @@
 #include "journal-def.h"
 #include "journal-file.h"
 #include "journal-vacuum.h"
+#include "journal-index.h"
+#include "journal-ranges.h"
 #include "sd-id128.h"
 #include "util.h"
 
 struct vacuum_info {
         uint64_t usage;
         char *filename;
+        ino_t inode;
 
         uint64_t realtime;
         sd_id128_t seqnum_id;
         uint64_t seqnum;
 
         bool have_seqnum;
+
+        /* The last scan which found the file */
+        unsigned generation;
 };
 
 static int vacuum_compare(const void *_a, const void *_b) {
         const struct vacuum_info *a, *b;
 
-        a = _a;
-        b = _b;
+        a = *(struct vacuum_info * const *) _a;
+        b = *(struct vacuum_info * const *) _b;
 
         if (a->have_seqnum && b->have_seqnum &&
             sd_id128_equal(a->seqnum_id, b->seqnum_id)) {
@@ -147,20 +153,228 @@ static int journal_file_empty(int dir_fd, const char *name) {
         return le64toh(n_entries) == 0;
 }
 
+static uint64_t index_usage(int dfd, const char *filename) {
+        struct stat st;
+
+        if (fstatat(dfd, strappenda(filename, JOURNAL_INDEX_SUFFIX), &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return 0;
+
+        return 512UL * (uint64_t) st.st_blocks;
+}
+
+static void unlink_index(int dfd, const char *filename) {
+        const char *p;
+
+        p = strappenda(filename, JOURNAL_INDEX_SUFFIX);
+        if (unlinkat(dfd, p, 0) < 0 && errno != ENOENT)
+                log_warning("Failed to delete index %s: %m", p);
+}
+
+static void vacuum_info_free(struct vacuum_info *i) {
+        if (!i)
+                return;
+
+        free(i->filename);
+        free(i);
+}
+
+JournalVacuumCatalog* journal_vacuum_catalog_new(void) {
+        JournalVacuumCatalog *c;
+
+        c = new0(JournalVacuumCatalog, 1);
+        if (!c)
+                return NULL;
+
+        c->items = hashmap_new(string_hash_func, string_compare_func);
+        if (!c->items) {
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+void journal_vacuum_catalog_free(JournalVacuumCatalog *c) {
+        struct vacuum_info *i;
+
+        if (!c)
+                return;
+
+        while ((i = hashmap_steal_first(c->items)))
+                vacuum_info_free(i);
+
+        hashmap_free(c->items);
+        free(c);
+}
+
+static void catalog_forget(JournalVacuumCatalog *c, const char *filename) {
+        vacuum_info_free(hashmap_remove(c->items, filename));
+}
+
+static int catalog_probe(
+                JournalVacuumCatalog *c,
+                const char *directory,
+                int dfd,
+                const char *filename,
+                JournalRanges **ranges,
+                uint64_t *freed) {
+
+        _cleanup_free_ char *p = NULL;
+        struct vacuum_info *i;
+        const JournalRangesItem *ri = NULL;
+        size_t q;
+        struct stat st;
+        unsigned long long seqnum = 0, realtime;
+        sd_id128_t seqnum_id = {};
+        bool have_seqnum;
+        int empty, r;
+
+        assert(c);
+        assert(directory);
+        assert(filename);
+        assert(ranges);
+        assert(freed);
+
+        /* Looks at a file we do not know yet, and adds it to the
+         * catalog if it is a candidate for vacuuming. The name
+         * tells us that, hence active files, which show up on every
+         * run, cost us nothing but the readdir(). */
+
+        q = strlen(filename);
+
+        if (endswith(filename, ".journal")) {
+                char id[33];
+
+                /* Vacuum archived files */
+
+                if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
+                        return 0;
+
+                if (filename[q-8-16-1] != '-' ||
+                    filename[q-8-16-1-16-1] != '-' ||
+                    filename[q-8-16-1-16-1-32-1] != '@')
+                        return 0;
+
+                memcpy(id, filename + q-8-16-1-16-1-32, 32);
+                id[32] = 0;
+                if (sd_id128_from_string(id, &seqnum_id) < 0)
+                        return 0;
+
+                if (sscanf(filename + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2)
+                        return 0;
+
+                have_seqnum = true;
+
+        } else if (endswith(filename, ".journal~")) {
+                unsigned long long tmp;
+
+                /* Vacuum corrupted files */
+
+                if (q < 1 + 16 + 1 + 16 + 8 + 1)
+                        return 0;
+
+                if (filename[q-1-8-16-1] != '-' ||
+                    filename[q-1-8-16-1-16-1] != '@')
+                        return 0;
+
+                if (sscanf(filename + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2)
+                        return 0;
+
+                have_seqnum = false;
+        } else
+                /* We do not vacuum active files or unknown files! */
+                return 0;
+
+        if (fstatat(dfd, filename, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return 0;
+
+        if (!S_ISREG(st.st_mode))
+                return 0;
+
+        p = strdup(filename);
+        if (!p)
+                return -ENOMEM;
+
+        c->n_probed++;
+
+        /* For regularly archived files the ranges catalog knows
+         * the time range, which saves us opening the file */
+        if (have_seqnum) {
+                if (!*ranges) {
+                        r = journal_ranges_load(directory, ranges);
+                        if (r < 0)
+                                return r;
+                }
+
+                ri = journal_ranges_get(*ranges, p, st.st_ino);
+        }
+
+        if (ri) {
+                empty = ri->head_realtime == 0;
+                if (!empty && ri->head_realtime < realtime)
+                        realtime = ri->head_realtime;
+        } else
+                empty = journal_file_empty(dfd, p);
+
+        if (empty) {
+                /* Always vacuum empty non-online files. */
+
+                uint64_t size = 512UL * (uint64_t) st.st_blocks;
+
+                if (unlinkat(dfd, p, 0) >= 0) {
+                        log_info("Deleted empty journal %s/%s (%"PRIu64" bytes).",
+                                 directory, p, size);
+                        unlink_index(dfd, p);
+                        *freed += size;
+                } else if (errno != ENOENT)
+                        log_warning("Failed to delete %s/%s: %m", directory, p);
+
+                return 0;
+        }
+
+        if (!ri)
+                patch_realtime(directory, p, &st, &realtime);
+
+        i = new0(struct vacuum_info, 1);
+        if (!i)
+                return -ENOMEM;
+
+        i->filename = p;
+        p = NULL;
+        i->inode = st.st_ino;
+        i->usage = 512UL * (uint64_t) st.st_blocks + index_usage(dfd, i->filename);
+        i->seqnum = seqnum;
+        i->realtime = realtime;
+        i->seqnum_id = seqnum_id;
+        i->have_seqnum = have_seqnum;
+        i->generation = c->generation;
+
+        r = hashmap_put(c->items, i->filename, i);
+        if (r < 0) {
+                vacuum_info_free(i);
+                return r;
+        }
+
+        return 0;
+}
+
 int journal_directory_vacuum(
                 const char *directory,
+                JournalVacuumCatalog *c,
                 uint64_t max_use,
                 uint64_t min_free,
                 usec_t max_retention_usec,
                 usec_t *oldest_usec) {
 
         _cleanup_closedir_ DIR *d = NULL;
-        int r = 0;
-        struct vacuum_info *list = NULL;
-        unsigned n_list = 0, i;
-        size_t n_allocated = 0;
+        JournalVacuumCatalog *temporary = NULL;
+        JournalRanges *ranges = NULL;
+        struct vacuum_info **list = NULL, *i;
+        unsigned n_list = 0, k;
         uint64_t sum = 0, freed = 0;
         usec_t retention_limit = 0;
+        Iterator it;
+        int r = 0;
 
         assert(directory);
 
@@ -179,129 +393,69 @@ int journal_directory_vacuum(
         if (!d)
                 return -errno;
 
+        if (!c) {
+                c = temporary = journal_vacuum_catalog_new();
+                if (!c)
+                        return -ENOMEM;
+        }
+
+        c->generation++;
+
         for (;;) {
-                int k;
+                int q;
                 struct dirent *de;
                 union dirent_storage buf;
-                size_t q;
-                struct stat st;
-                char *p;
-                unsigned long long seqnum = 0, realtime;
-                sd_id128_t seqnum_id;
-                bool have_seqnum;
-
-                k = readdir_r(d, &buf.de, &de);
-                if (k != 0) {
-                        r = -k;
+
+                q = readdir_r(d, &buf.de, &de);
+                if (q != 0) {
+                        r = -q;
                         goto finish;
                 }
 
                 if (!de)
                         break;
 
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                if (!endswith(de->d_name, ".journal") &&
+                    !endswith(de->d_name, ".journal~"))
                         continue;
 
-                if (!S_ISREG(st.st_mode))
-                        continue;
-
-                q = strlen(de->d_name);
-
-                if (endswith(de->d_name, ".journal")) {
-
-                        /* Vacuum archived files */
-
-                        if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
-                                continue;
-
-                        if (de->d_name[q-8-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1-32-1] != '@')
-                                continue;
-
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
-
-                        de->d_name[q-8-16-1-16-1] = 0;
-                        if (sd_id128_from_string(de->d_name + q-8-16-1-16-1-32, &seqnum_id) < 0) {
-                                free(p);
-                                continue;
-                        }
-
-                        if (sscanf(de->d_name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2) {
-                                free(p);
-                                continue;
-                        }
-
-                        have_seqnum = true;
-
-                } else if (endswith(de->d_name, ".journal~")) {
-                        unsigned long long tmp;
-
-                        /* Vacuum corrupted files */
-
-                        if (q < 1 + 16 + 1 + 16 + 8 + 1)
+                i = hashmap_get(c->items, de->d_name);
+                if (i) {
+                        if (i->inode == de->d_ino) {
+                                i->generation = c->generation;
+                                c->n_cached++;
                                 continue;
-
-                        if (de->d_name[q-1-8-16-1] != '-' ||
-                            de->d_name[q-1-8-16-1-16-1] != '@')
-                                continue;
-
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
                         }
 
-                        if (sscanf(de->d_name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2) {
-                                free(p);
-                                continue;
-                        }
-
-                        have_seqnum = false;
-                } else
-                        /* We do not vacuum active files or unknown files! */
-                        continue;
-
-                if (journal_file_empty(dirfd(d), p)) {
-                        /* Always vacuum empty non-online files. */
-
-                        uint64_t size = 512UL * (uint64_t) st.st_blocks;
+                        /* A different file under a known name */
+                        catalog_forget(c, de->d_name);
+                }
 
-                        if (unlinkat(dirfd(d), p, 0) >= 0) {
-                                log_info("Deleted empty journal %s/%s (%"PRIu64" bytes).",
-                                         directory, p, size);
-                                freed += size;
-                        } else if (errno != ENOENT)
-                                log_warning("Failed to delete %s/%s: %m", directory, p);
+                r = catalog_probe(c, directory, dirfd(d), de->d_name, &ranges, &freed);
+                if (r < 0)
+                        goto finish;
+        }
 
-                        free(p);
+        /* Forget about what is gone, and collect the rest */
+        list = new(struct vacuum_info*, MAX(hashmap_size(c->items), 1U));
+        if (!list) {
+                r = -ENOMEM;
+                goto finish;
+        }
 
+        HASHMAP_FOREACH(i, c->items, it) {
+                if (i->generation != c->generation) {
+                        catalog_forget(c, i->filename);
                         continue;
                 }
 
-                patch_realtime(directory, p, &st, &realtime);
-
-                GREEDY_REALLOC(list, n_allocated, n_list + 1);
-
-                list[n_list].filename = p;
-                list[n_list].usage = 512UL * (uint64_t) st.st_blocks;
-                list[n_list].seqnum = seqnum;
-                list[n_list].realtime = realtime;
-                list[n_list].seqnum_id = seqnum_id;
-                list[n_list].have_seqnum = have_seqnum;
-
-                sum += list[n_list].usage;
-
-                n_list ++;
+                list[n_list++] = i;
+                sum += i->usage;
         }
 
-        qsort_safe(list, n_list, sizeof(struct vacuum_info), vacuum_compare);
+        qsort_safe(list, n_list, sizeof(struct vacuum_info*), vacuum_compare);
 
-        for (i = 0; i < n_list; i++) {
+        for (k = 0; k < n_list; k++) {
                 struct statvfs ss;
 
                 if (fstatvfs(dirfd(d), &ss) < 0) {
@@ -309,32 +463,38 @@ int journal_directory_vacuum(
                         goto finish;
                 }
 
-                if ((max_retention_usec <= 0 || list[i].realtime >= retention_limit) &&
+                if ((max_retention_usec <= 0 || list[k]->realtime >= retention_limit) &&
                     (max_use <= 0 || sum <= max_use) &&
                     (min_free <= 0 || (uint64_t) ss.f_bavail * (uint64_t) ss.f_bsize >= min_free))
                         break;
 
-                if (unlinkat(dirfd(d), list[i].filename, 0) >= 0) {
+                if (unlinkat(dirfd(d), list[k]->filename, 0) >= 0) {
                         log_debug("Deleted archived journal %s/%s (%"PRIu64" bytes).",
-                                  directory, list[i].filename, list[i].usage);
-                        freed += list[i].usage;
+                                  directory, list[k]->filename, list[k]->usage);
+                        unlink_index(dirfd(d), list[k]->filename);
+                        freed += list[k]->usage;
 
-                        if (list[i].usage < sum)
-                                sum -= list[i].usage;
+                        if (list[k]->usage < sum)
+                                sum -= list[k]->usage;
                         else
                                 sum = 0;
 
                 } else if (errno != ENOENT)
-                        log_warning("Failed to delete %s/%s: %m", directory, list[i].filename);
+                        log_warning("Failed to delete %s/%s: %m", directory, list[k]->filename);
+
+                /* Either way, the next scan will tell us whether
+                 * it is still around */
+                catalog_forget(c, list[k]->filename);
+                list[k] = NULL;
         }
 
-        if (oldest_usec && i < n_list && (*oldest_usec == 0 || list[i].realtime < *oldest_usec))
-                *oldest_usec = list[i].realtime;
+        if (oldest_usec && k < n_list && (*oldest_usec == 0 || list[k]->realtime < *oldest_usec))
+                *oldest_usec = list[k]->realtime;
 
 finish:
-        for (i = 0; i < n_list; i++)
-                free(list[i].filename);
         free(list);
+        journal_ranges_free(ranges);
+        journal_vacuum_catalog_free(temporary);
 
         log_info("Vacuuming done, freed %"PRIu64" bytes", freed);
 
@@ -23,4 +23,27 @@
 
 #include <inttypes.h>
 
-int journal_directory_vacuum(const char *directory, uint64_t max_use, uint64_t min_free, usec_t max_retention_usec, usec_t *oldest_usec);
+#include "hashmap.h"
+#include "util.h"
+
+/* What we know about the archived and corrupted files of one journal
+ * directory. Neither kind of file changes once it got its name, so
+ * after the first pass only files which showed up since need to be
+ * looked at, the others are recognized by name and inode number. */
+
+typedef struct JournalVacuumCatalog JournalVacuumCatalog;
+
+struct JournalVacuumCatalog {
+        Hashmap *items;
+        unsigned generation;
+
+        /* Files which had to be looked at, and files which were
+         * known already */
+        uint64_t n_probed;
+        uint64_t n_cached;
+};
+
+JournalVacuumCatalog* journal_vacuum_catalog_new(void);
+void journal_vacuum_catalog_free(JournalVacuumCatalog *c);
+
+int journal_directory_vacuum(const char *directory, JournalVacuumCatalog *c, uint64_t max_use, uint64_t min_free, usec_t max_retention_usec, usec_t *oldest_usec);
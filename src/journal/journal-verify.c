@@ -23,11 +23,13 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "macro.h"
 #include "journal-def.h"
 #include "journal-file.h"
+#include "journal-index.h"
 #include "journal-authenticate.h"
 #include "journal-verify.h"
 #include "lookup3.h"
@@ -38,6 +40,24 @@
  * files without adding to many zeros. */
 #define OFSfmt "%06"PRIx64
 
+/* Offsets of objects of one type, collected in a temporary file in
+ * the order they appear in the journal file, hence sorted. */
+typedef struct OffsetBuffer {
+        int fd;
+        size_t n;
+        uint64_t items[1024];
+} OffsetBuffer;
+
+typedef struct HashTableCheck {
+        JournalFile *f;
+        int data_fd, entry_fd, entry_array_fd;
+        uint64_t n_data, n_entries, n_entry_arrays;
+        usec_t usec;
+        int r;
+} HashTableCheck;
+
+static int parallel = -1;
+
 static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o) {
         uint64_t i;
 
@@ -49,7 +69,7 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
          * possible field values. It does not follow any references to
          * other objects. */
 
-        if ((o->object.flags & OBJECT_COMPRESSED) &&
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) &&
             o->object.type != OBJECT_DATA)
                 return -EBADMSG;
 
@@ -76,24 +96,22 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
 
                 h1 = le64toh(o->data.hash);
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
-                        void *b = NULL;
+                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+                        _cleanup_free_ void *b = NULL;
                         uint64_t alloc = 0, b_size;
-
-                        if (!uncompress_blob(o->data.payload,
-                                             le64toh(o->object.size) - offsetof(Object, data.payload),
-                                             &b, &alloc, &b_size, 0)) {
-                                log_error(OFSfmt": uncompression failed", offset);
-                                return -EBADMSG;
+                        int r;
+
+                        r = uncompress_blob(f->compress_context,
+                                            o->object.flags & OBJECT_COMPRESSION_MASK,
+                                            o->data.payload,
+                                            le64toh(o->object.size) - offsetof(Object, data.payload),
+                                            &b, &alloc, &b_size, 0);
+                        if (r < 0) {
+                                log_error(OFSfmt": uncompression failed: %s", offset, strerror(-r));
+                                return r;
                         }
 
                         h2 = hash64(b, b_size);
-                        free(b);
-#else
-                        log_error("Compression is not supported");
-                        return -EPROTONOSUPPORT;
-#endif
                 } else
                         h2 = hash64(o->data.payload, le64toh(o->object.size) - offsetof(Object, data.payload));
 
@@ -333,18 +351,35 @@ static void flush_progress(void) {
         fflush(stdout);
 }
 
-static int write_uint64(int fd, uint64_t p) {
+static int offset_buffer_flush(OffsetBuffer *b) {
         ssize_t k;
 
-        k = write(fd, &p, sizeof(p));
+        assert(b);
+
+        if (b->n <= 0)
+                return 0;
+
+        k = loop_write(b->fd, b->items, b->n * sizeof(uint64_t), false);
         if (k < 0)
-                return -errno;
-        if (k != sizeof(p))
+                return k;
+        if ((size_t) k != b->n * sizeof(uint64_t))
                 return -EIO;
 
+        b->n = 0;
         return 0;
 }
 
+static int write_uint64(OffsetBuffer *b, uint64_t p) {
+        assert(b);
+
+        b->items[b->n++] = p;
+
+        if (b->n < ELEMENTSOF(b->items))
+                return 0;
+
+        return offset_buffer_flush(b);
+}
+
 static int contains_uint64(MMapCache *m, int fd, uint64_t n, uint64_t p) {
         uint64_t a, b;
         int r;
@@ -619,6 +654,23 @@ static int verify_hash_table(
         return 0;
 }
 
+static void *hash_table_thread(void *p) {
+        HashTableCheck *c = p;
+        usec_t last_usec = 0, start;
+
+        start = now(CLOCK_MONOTONIC);
+
+        c->r = verify_hash_table(c->f,
+                                 c->data_fd, c->n_data,
+                                 c->entry_fd, c->n_entries,
+                                 c->entry_array_fd, c->n_entry_arrays,
+                                 &last_usec,
+                                 false);
+
+        c->usec = now(CLOCK_MONOTONIC) - start;
+        return NULL;
+}
+
 static int data_object_in_hash_table(JournalFile *f, uint64_t hash, uint64_t p) {
         uint64_t n, h, q;
         int r;
@@ -778,9 +830,15 @@ int journal_file_verify(
                 JournalFile *f,
                 const char *key,
                 usec_t *first_contained, usec_t *last_validated, usec_t *last_contained,
-                bool show_progress) {
+                bool show_progress,
+                JournalVerifyStatistics *statistics) {
         int r;
         Object *o;
+        JournalFile *g = NULL;
+        JournalVerifyStatistics dummy;
+        HashTableCheck check;
+        pthread_t thread;
+        usec_t start;
         uint64_t p = 0, last_epoch = 0, last_tag_realtime = 0, last_sealed_realtime = 0;
 
         uint64_t entry_seqnum = 0, entry_monotonic = 0, entry_realtime = 0;
@@ -789,6 +847,7 @@ int journal_file_verify(
         uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0;
         usec_t last_usec = 0;
         int data_fd = -1, entry_fd = -1, entry_array_fd = -1;
+        OffsetBuffer data_buffer, entry_buffer, entry_array_buffer;
         char data_path[] = "/var/tmp/journal-data-XXXXXX",
                 entry_path[] = "/var/tmp/journal-entry-XXXXXX",
                 entry_array_path[] = "/var/tmp/journal-entry-array-XXXXXX";
@@ -799,6 +858,11 @@ int journal_file_verify(
 #endif
         assert(f);
 
+        if (!statistics)
+                statistics = &dummy;
+
+        zero(*statistics);
+
         if (key) {
 #ifdef HAVE_GCRYPT
                 r = journal_file_parse_verification_key(f, key);
@@ -836,6 +900,11 @@ int journal_file_verify(
         }
         unlink(entry_array_path);
 
+        data_buffer.fd = data_fd;
+        entry_buffer.fd = entry_fd;
+        entry_array_buffer.fd = entry_array_fd;
+        data_buffer.n = entry_buffer.n = entry_array_buffer.n = 0;
+
 #ifdef HAVE_GCRYPT
         if ((le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) != 0)
 #else
@@ -857,6 +926,9 @@ int journal_file_verify(
         /* First iteration: we go through all objects, verify the
          * superficial structure, headers, hashes. */
 
+        start = now(CLOCK_MONOTONIC);
+        statistics->n_bytes = le64toh(f->header->header_size);
+
         p = le64toh(f->header->header_size);
         while (p != 0) {
                 if (show_progress)
@@ -878,6 +950,7 @@ int journal_file_verify(
                         found_last = true;
 
                 n_objects ++;
+                statistics->n_bytes += ALIGN64(le64toh(o->object.size));
 
                 r = journal_file_object_verify(f, p, o);
                 if (r < 0) {
@@ -885,8 +958,14 @@ int journal_file_verify(
                         goto fail;
                 }
 
-                if ((o->object.flags & OBJECT_COMPRESSED) && !JOURNAL_HEADER_COMPRESSED(f->header)) {
-                        log_error("Compressed object in file without compression at "OFSfmt, p);
+                if ((o->object.flags & OBJECT_COMPRESSED_XZ) && !JOURNAL_HEADER_COMPRESSED_XZ(f->header)) {
+                        log_error("XZ compressed object in file without XZ compression at "OFSfmt, p);
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
+                if ((o->object.flags & OBJECT_COMPRESSED_LZ4) && !JOURNAL_HEADER_COMPRESSED_LZ4(f->header)) {
+                        log_error("LZ4 compressed object in file without LZ4 compression at "OFSfmt, p);
                         r = -EBADMSG;
                         goto fail;
                 }
@@ -894,7 +973,7 @@ int journal_file_verify(
                 switch (o->object.type) {
 
                 case OBJECT_DATA:
-                        r = write_uint64(data_fd, p);
+                        r = write_uint64(&data_buffer, p);
                         if (r < 0)
                                 goto fail;
 
@@ -912,7 +991,7 @@ int journal_file_verify(
                                 goto fail;
                         }
 
-                        r = write_uint64(entry_fd, p);
+                        r = write_uint64(&entry_buffer, p);
                         if (r < 0)
                                 goto fail;
 
@@ -999,7 +1078,7 @@ int journal_file_verify(
                         break;
 
                 case OBJECT_ENTRY_ARRAY:
-                        r = write_uint64(entry_array_fd, p);
+                        r = write_uint64(&entry_array_buffer, p);
                         if (r < 0)
                                 goto fail;
 
@@ -1199,13 +1278,61 @@ int journal_file_verify(
                 goto fail;
         }
 
+        r = offset_buffer_flush(&data_buffer);
+        if (r >= 0)
+                r = offset_buffer_flush(&entry_buffer);
+        if (r >= 0)
+                r = offset_buffer_flush(&entry_array_buffer);
+        if (r < 0) {
+                log_error("Failed to write offset file: %s", strerror(-r));
+                goto fail;
+        }
+
+        statistics->n_items[JOURNAL_VERIFY_OBJECTS] = n_objects;
+        statistics->usec[JOURNAL_VERIFY_OBJECTS] = now(CLOCK_MONOTONIC) - start;
+
         /* Second iteration: we follow all objects referenced from the
          * two entry points: the object hash table and the entry
          * array. We also check that everything referenced (directly
          * or indirectly) in the data hash table also exists in the
          * entry array, and vice versa. Note that we do not care for
          * unreferenced objects. We only care that everything that is
-         * referenced is consistent. */
+         * referenced is consistent.
+         *
+         * Both checks only read, hence if we have CPUs to spare we
+         * do the hash table on a second thread. Neither JournalFile
+         * nor MMapCache may be used from two threads at once, so it
+         * gets a file object of its own. If both checks fail we
+         * report the entry array, like we do when running them one
+         * after the other. */
+
+        if (parallel > 0 || (parallel < 0 && sysconf(_SC_NPROCESSORS_ONLN) > 1)) {
+                r = journal_file_open(f->path, O_RDONLY, 0, 0, false, NULL, NULL, NULL, &g);
+                if (r < 0) {
+                        log_debug("Failed to reopen %s, checking serially: %s", f->path, strerror(-r));
+                        g = NULL;
+                }
+        }
+
+        if (g) {
+                zero(check);
+                check.f = g;
+                check.data_fd = data_fd;
+                check.entry_fd = entry_fd;
+                check.entry_array_fd = entry_array_fd;
+                check.n_data = n_data;
+                check.n_entries = n_entries;
+                check.n_entry_arrays = n_entry_arrays;
+
+                r = pthread_create(&thread, NULL, hash_table_thread, &check);
+                if (r != 0) {
+                        log_debug("Failed to start thread, checking serially: %s", strerror(r));
+                        journal_file_close(g);
+                        g = NULL;
+                }
+        }
+
+        start = now(CLOCK_MONOTONIC);
 
         r = verify_entry_array(f,
                                data_fd, n_data,
@@ -1213,17 +1340,40 @@ int journal_file_verify(
                                entry_array_fd, n_entry_arrays,
                                &last_usec,
                                show_progress);
-        if (r < 0)
-                goto fail;
 
-        r = verify_hash_table(f,
-                              data_fd, n_data,
-                              entry_fd, n_entries,
-                              entry_array_fd, n_entry_arrays,
-                              &last_usec,
-                              show_progress);
-        if (r < 0)
-                goto fail;
+        statistics->n_items[JOURNAL_VERIFY_ENTRY_ARRAY] = n_entries;
+        statistics->usec[JOURNAL_VERIFY_ENTRY_ARRAY] = now(CLOCK_MONOTONIC) - start;
+
+        if (g) {
+                pthread_join(thread, NULL);
+                journal_file_close(g);
+
+                statistics->n_items[JOURNAL_VERIFY_HASH_TABLE] = n_data;
+                statistics->usec[JOURNAL_VERIFY_HASH_TABLE] = check.usec;
+
+                if (r >= 0)
+                        r = check.r;
+                if (r < 0)
+                        goto fail;
+        } else {
+                if (r < 0)
+                        goto fail;
+
+                start = now(CLOCK_MONOTONIC);
+
+                r = verify_hash_table(f,
+                                      data_fd, n_data,
+                                      entry_fd, n_entries,
+                                      entry_array_fd, n_entry_arrays,
+                                      &last_usec,
+                                      show_progress);
+
+                statistics->n_items[JOURNAL_VERIFY_HASH_TABLE] = n_data;
+                statistics->usec[JOURNAL_VERIFY_HASH_TABLE] = now(CLOCK_MONOTONIC) - start;
+
+                if (r < 0)
+                        goto fail;
+        }
 
         if (show_progress)
                 flush_progress();
@@ -1236,6 +1386,20 @@ int journal_file_verify(
         close_nointr_nofail(entry_fd);
         close_nointr_nofail(entry_array_fd);
 
+        start = now(CLOCK_MONOTONIC);
+
+        r = journal_index_verify(f);
+        if (r < 0) {
+                log_error("Index %s" JOURNAL_INDEX_SUFFIX " does not match journal file: %s", f->path, strerror(-r));
+                return r;
+        }
+
+        statistics->n_items[JOURNAL_VERIFY_INDEX] = n_data;
+        statistics->usec[JOURNAL_VERIFY_INDEX] = now(CLOCK_MONOTONIC) - start;
+
+        log_debug("Verified %s:", f->path);
+        journal_verify_statistics_log(statistics, LOG_DEBUG);
+
         if (first_contained)
                 *first_contained = le64toh(f->header->head_entry_realtime);
         if (last_validated)
@@ -1272,3 +1436,65 @@ fail:
 
         return r;
 }
+
+void journal_verify_set_parallel(int b) {
+        parallel = b;
+}
+
+void journal_verify_statistics_add(JournalVerifyStatistics *a, const JournalVerifyStatistics *b) {
+        JournalVerifyPhase i;
+
+        assert(a);
+        assert(b);
+
+        a->n_bytes += b->n_bytes;
+
+        for (i = 0; i < _JOURNAL_VERIFY_PHASE_MAX; i++) {
+                a->n_items[i] += b->n_items[i];
+                a->usec[i] += b->usec[i];
+        }
+}
+
+static const char* const journal_verify_phase_items[_JOURNAL_VERIFY_PHASE_MAX] = {
+        [JOURNAL_VERIFY_OBJECTS] = "objects",
+        [JOURNAL_VERIFY_ENTRY_ARRAY] = "entries",
+        [JOURNAL_VERIFY_HASH_TABLE] = "data objects",
+        [JOURNAL_VERIFY_INDEX] = "data objects",
+};
+
+void journal_verify_statistics_log(const JournalVerifyStatistics *s, int level) {
+        JournalVerifyPhase i;
+
+        assert(s);
+
+        for (i = 0; i < _JOURNAL_VERIFY_PHASE_MAX; i++) {
+                char a[FORMAT_TIMESPAN_MAX], b[FORMAT_BYTES_MAX];
+                usec_t u;
+
+                /* Avoid dividing by zero for very small files */
+                u = MAX(s->usec[i], (usec_t) 1);
+
+                if (i == JOURNAL_VERIFY_OBJECTS)
+                        log_full(level, "%-12s %"PRIu64" %s in %s, %s/s, %"PRIu64" %s/s",
+                                 journal_verify_phase_to_string(i),
+                                 s->n_items[i], journal_verify_phase_items[i],
+                                 format_timespan(a, sizeof(a), s->usec[i], USEC_PER_MSEC),
+                                 format_bytes(b, sizeof(b), (off_t) (s->n_bytes * USEC_PER_SEC / u)),
+                                 (uint64_t) (s->n_items[i] * USEC_PER_SEC / u), journal_verify_phase_items[i]);
+                else
+                        log_full(level, "%-12s %"PRIu64" %s in %s, %"PRIu64" %s/s",
+                                 journal_verify_phase_to_string(i),
+                                 s->n_items[i], journal_verify_phase_items[i],
+                                 format_timespan(a, sizeof(a), s->usec[i], USEC_PER_MSEC),
+                                 (uint64_t) (s->n_items[i] * USEC_PER_SEC / u), journal_verify_phase_items[i]);
+        }
+}
+
+static const char* const journal_verify_phase_table[_JOURNAL_VERIFY_PHASE_MAX] = {
+        [JOURNAL_VERIFY_OBJECTS] = "objects",
+        [JOURNAL_VERIFY_ENTRY_ARRAY] = "entry-array",
+        [JOURNAL_VERIFY_HASH_TABLE] = "hash-table",
+        [JOURNAL_VERIFY_INDEX] = "index",
+};
+
+DEFINE_STRING_TABLE_LOOKUP(journal_verify_phase, JournalVerifyPhase);
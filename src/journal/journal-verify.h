@@ -21,6 +21,30 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "util.h"
 #include "journal-file.h"
 
-int journal_file_verify(JournalFile *f, const char *key, usec_t *first_contained, usec_t *last_validated, usec_t *last_contained, bool show_progress);
+typedef enum JournalVerifyPhase {
+        JOURNAL_VERIFY_OBJECTS,
+        JOURNAL_VERIFY_ENTRY_ARRAY,
+        JOURNAL_VERIFY_HASH_TABLE,
+        JOURNAL_VERIFY_INDEX,
+        _JOURNAL_VERIFY_PHASE_MAX,
+        _JOURNAL_VERIFY_PHASE_INVALID = -1
+} JournalVerifyPhase;
+
+typedef struct JournalVerifyStatistics {
+        uint64_t n_bytes;
+        uint64_t n_items[_JOURNAL_VERIFY_PHASE_MAX];
+        usec_t usec[_JOURNAL_VERIFY_PHASE_MAX];
+} JournalVerifyStatistics;
+
+int journal_file_verify(JournalFile *f, const char *key, usec_t *first_contained, usec_t *last_validated, usec_t *last_contained, bool show_progress, JournalVerifyStatistics *statistics);
+
+void journal_verify_set_parallel(int b);
+
+void journal_verify_statistics_add(JournalVerifyStatistics *a, const JournalVerifyStatistics *b);
+void journal_verify_statistics_log(const JournalVerifyStatistics *s, int level);
+
+const char* journal_verify_phase_to_string(JournalVerifyPhase p) _const_;
+JournalVerifyPhase journal_verify_phase_from_string(const char *s) _pure_;
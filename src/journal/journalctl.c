@@ -30,6 +30,7 @@
 #include <time.h>
 #include <getopt.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
@@ -1149,7 +1150,94 @@ finish:
 #endif
 }
 
+typedef struct VerifyJob {
+        JournalFile *file;
+        usec_t first, validated, last;
+        JournalVerifyStatistics statistics;
+        int result;
+        bool done;
+} VerifyJob;
+
+typedef struct VerifyQueue {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        VerifyJob *jobs;
+        unsigned n_jobs;
+        unsigned next;
+        bool cancel;
+} VerifyQueue;
+
+static void *verify_thread(void *p) {
+        VerifyQueue *q = p;
+
+        for (;;) {
+                VerifyJob *job;
+                JournalFile *f;
+                int k;
+
+                pthread_mutex_lock(&q->mutex);
+
+                if (q->cancel || q->next >= q->n_jobs) {
+                        pthread_mutex_unlock(&q->mutex);
+                        return NULL;
+                }
+
+                job = q->jobs + q->next++;
+                pthread_mutex_unlock(&q->mutex);
+
+                /* The files of the journal share one mmap cache,
+                 * which is not thread-safe, hence open our own */
+                k = journal_file_open(job->file->path, O_RDONLY, 0, 0, false, NULL, NULL, NULL, &f);
+                if (k >= 0) {
+                        k = journal_file_verify(f, arg_verify_key, &job->first, &job->validated, &job->last, false, &job->statistics);
+                        journal_file_close(f);
+                }
+
+                pthread_mutex_lock(&q->mutex);
+                job->result = k;
+                job->done = true;
+                pthread_cond_broadcast(&q->cond);
+                pthread_mutex_unlock(&q->mutex);
+        }
+}
+
+static void verify_show(VerifyJob *job) {
+        JournalFile *f = job->file;
+
+#ifdef HAVE_GCRYPT
+        if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
+                log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
+#endif
+
+        if (job->result < 0)
+                log_warning("FAIL: %s (%s)", f->path, strerror(-job->result));
+        else {
+                char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
+                log_info("PASS: %s", f->path);
+
+                if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
+                        if (job->validated > 0) {
+                                log_info("=> Validated from %s to %s, final %s entries not sealed.",
+                                         format_timestamp(a, sizeof(a), job->first),
+                                         format_timestamp(b, sizeof(b), job->validated),
+                                         format_timespan(c, sizeof(c), job->last > job->validated ? job->last - job->validated : 0, 0));
+                        } else if (job->last > 0)
+                                log_info("=> No sealing yet, %s of entries not sealed.",
+                                         format_timespan(c, sizeof(c), job->last - job->first, 0));
+                        else
+                                log_info("=> No sealing yet, no entries in file.");
+                }
+        }
+}
+
 static int verify(sd_journal *j) {
+        _cleanup_free_ VerifyJob *jobs = NULL;
+        _cleanup_free_ pthread_t *threads = NULL;
+        JournalVerifyStatistics statistics;
+        VerifyQueue q;
+        unsigned n_jobs = 0, n_threads = 0, k;
+        long n_cpus;
+        usec_t start;
         int r = 0;
         Iterator i;
         JournalFile *f;
@@ -1158,39 +1246,104 @@ static int verify(sd_journal *j) {
 
         log_show_color(true);
 
-        HASHMAP_FOREACH(f, j->files, i) {
-                int k;
-                usec_t first, validated, last;
+        r = journal_add_deferred_files(j);
+        if (r < 0) {
+                log_error("Failed to open journal files: %s", strerror(-r));
+                return r;
+        }
 
-#ifdef HAVE_GCRYPT
-                if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
-                        log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
-#endif
+        if (hashmap_isempty(j->files))
+                return 0;
+
+        jobs = new0(VerifyJob, hashmap_size(j->files));
+        if (!jobs)
+                return log_oom();
+
+        HASHMAP_FOREACH(f, j->files, i)
+                jobs[n_jobs++].file = f;
+
+        /* Files are verified independently of each other, so with
+         * enough CPUs we check several at once. Results are shown in
+         * the same order as when checking them one after the other.
+         * Each file already checks its hash table on a second
+         * thread, hence use no more than one worker per two CPUs.
+         * Checking seals calls into libgcrypt, which we do not set
+         * up for use from several threads, hence with a key we do
+         * one file after the other. */
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (!arg_verify_key && n_cpus >= 4 && n_jobs > 1) {
+                n_threads = MIN((unsigned) n_cpus / 2, n_jobs);
+
+                threads = new(pthread_t, n_threads);
+                if (!threads)
+                        return log_oom();
+        }
 
-                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, true);
-                if (k == -EINVAL) {
+        zero(q);
+        zero(statistics);
+        pthread_mutex_init(&q.mutex, NULL);
+        pthread_cond_init(&q.cond, NULL);
+        q.jobs = jobs;
+        q.n_jobs = n_jobs;
+
+        for (k = 0; k < n_threads; k++) {
+                r = pthread_create(threads + k, NULL, verify_thread, &q);
+                if (r != 0) {
+                        log_debug("Failed to start verification thread: %s", strerror(r));
+                        break;
+                }
+        }
+
+        /* If no thread could be started we do all the work here */
+        n_threads = k;
+        r = 0;
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (k = 0; k < n_jobs; k++) {
+                VerifyJob *job = jobs + k;
+
+                if (n_threads > 0) {
+                        pthread_mutex_lock(&q.mutex);
+                        while (!job->done)
+                                pthread_cond_wait(&q.cond, &q.mutex);
+                        pthread_mutex_unlock(&q.mutex);
+                } else
+                        job->result = journal_file_verify(job->file, arg_verify_key, &job->first, &job->validated, &job->last, true, &job->statistics);
+
+                if (job->result == -EINVAL) {
                         /* If the key was invalid give up right-away. */
-                        return k;
-                } else if (k < 0) {
-                        log_warning("FAIL: %s (%s)", f->path, strerror(-k));
-                        r = k;
-                } else {
-                        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
-                        log_info("PASS: %s", f->path);
-
-                        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
-                                if (validated > 0) {
-                                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
-                                                 format_timestamp(a, sizeof(a), first),
-                                                 format_timestamp(b, sizeof(b), validated),
-                                                 format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
-                                } else if (last > 0)
-                                        log_info("=> No sealing yet, %s of entries not sealed.",
-                                                 format_timespan(c, sizeof(c), last - first, 0));
-                                else
-                                        log_info("=> No sealing yet, no entries in file.");
-                        }
+                        r = job->result;
+                        break;
                 }
+
+                verify_show(job);
+
+                if (job->result < 0)
+                        r = job->result;
+
+                journal_verify_statistics_add(&statistics, &job->statistics);
+        }
+
+        pthread_mutex_lock(&q.mutex);
+        q.cancel = true;
+        pthread_mutex_unlock(&q.mutex);
+
+        for (k = 0; k < n_threads; k++)
+                pthread_join(threads[k], NULL);
+
+        pthread_mutex_destroy(&q.mutex);
+        pthread_cond_destroy(&q.cond);
+
+        if (r != -EINVAL) {
+                char a[FORMAT_BYTES_MAX], b[FORMAT_TIMESPAN_MAX];
+
+                log_info("Verified %u files, %s in %s using %u threads.",
+                          n_jobs,
+                          format_bytes(a, sizeof(a), statistics.n_bytes),
+                          format_timespan(b, sizeof(b), now(CLOCK_MONOTONIC) - start, USEC_PER_MSEC),
+                          MAX(n_threads, 1U));
+                journal_verify_statistics_log(&statistics, LOG_INFO);
         }
 
         return r;
@@ -1253,7 +1406,7 @@ static int access_check(sd_journal *j) {
         assert(j);
 
         if (set_isempty(j->errors)) {
-                if (hashmap_isempty(j->files))
+                if (hashmap_isempty(j->files) && hashmap_isempty(j->deferred_files))
                         log_notice("No journal files were found.");
                 return 0;
         }
@@ -1285,7 +1438,7 @@ static int access_check(sd_journal *j) {
                 }
 #endif
 
-                if (hashmap_isempty(j->files)) {
+                if (hashmap_isempty(j->files) && hashmap_isempty(j->deferred_files)) {
                         log_error("No journal files were opened due to insufficient permissions.");
                         r = -EACCES;
                 }
@@ -1457,6 +1610,16 @@ int main(int argc, char *argv[]) {
                         return EXIT_FAILURE;
                 }
 
+                if (arg_since_set || arg_until_set) {
+                        r = journal_set_unique_window(j,
+                                                      arg_since_set ? arg_since : 0,
+                                                      arg_until_set ? arg_until : (usec_t) -1);
+                        if (r < 0) {
+                                log_error("Failed to restrict time range: %s", strerror(-r));
+                                return EXIT_FAILURE;
+                        }
+                }
+
                 SD_JOURNAL_FOREACH_UNIQUE(j, data, size) {
                         const void *eq;
 
@@ -1475,6 +1638,12 @@ int main(int argc, char *argv[]) {
                 return EXIT_SUCCESS;
         }
 
+        r = output_journal_set_fields(j, arg_output);
+        if (r < 0) {
+                log_error("Failed to restrict fields: %s", strerror(-r));
+                return EXIT_FAILURE;
+        }
+
         /* Opening the fd now means the first sd_journal_wait() will actually wait */
         if (arg_follow) {
                 r = sd_journal_get_fd(j);
@@ -1656,6 +1825,8 @@ int main(int argc, char *argv[]) {
                         break;
                 }
 
+                fflush(stdout);
+
                 r = sd_journal_wait(j, (uint64_t) -1);
                 if (r < 0) {
                         log_error("Couldn't wait for journal event: %s", strerror(-r));
@@ -1668,5 +1839,8 @@ int main(int argc, char *argv[]) {
 finish:
         pager_close();
 
+        if (j)
+                journal_log_statistics(j);
+
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,340 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <string.h>
+
+#include "journald-client.h"
+#include "hashmap.h"
+#include "cgroup-util.h"
+#include "audit.h"
+
+/* A process may exec() or change its capabilities without us
+ * noticing, hence we reread everything once in a while, even if the
+ * process is still the same one in the same cgroup. */
+#define CLIENT_MAX_AGE_USEC (1*USEC_PER_SEC)
+
+struct JournalClientCache {
+        Hashmap *clients;
+        JournalClient *lru, *lru_tail;
+
+        unsigned n_clients;
+        unsigned max;
+
+        uint64_t n_hit;
+        uint64_t n_miss;
+};
+
+JournalClientCache *journal_client_cache_new(unsigned max) {
+        JournalClientCache *c;
+
+        assert(max > 0);
+
+        c = new0(JournalClientCache, 1);
+        if (!c)
+                return NULL;
+
+        c->clients = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!c->clients) {
+                free(c);
+                return NULL;
+        }
+
+        c->max = max;
+
+        return c;
+}
+
+static void journal_client_reset(JournalClient *j) {
+        assert(j);
+
+        free(j->cgroup_raw);
+        free(j->comm);
+        free(j->exe);
+        free(j->cmdline);
+        free(j->capeff);
+        free(j->audit_session);
+        free(j->audit_loginuid);
+        free(j->cgroup);
+        free(j->session);
+        free(j->owner_uid);
+        free(j->unit);
+        free(j->user_unit);
+        free(j->slice);
+
+        j->cgroup_raw = j->comm = j->exe = j->cmdline = j->capeff = NULL;
+        j->audit_session = j->audit_loginuid = NULL;
+        j->cgroup = j->session = j->owner_uid = j->unit = j->user_unit = j->slice = NULL;
+        j->owner_valid = false;
+}
+
+static void journal_client_free(JournalClient *j) {
+        assert(j);
+
+        if (j->parent) {
+                assert(j->parent->n_clients > 0);
+
+                if (j->parent->lru_tail == j)
+                        j->parent->lru_tail = j->lru_prev;
+
+                LIST_REMOVE(lru, j->parent->lru, j);
+                hashmap_remove(j->parent->clients, UINT_TO_PTR(j->pid));
+
+                j->parent->n_clients --;
+        }
+
+        journal_client_reset(j);
+        free(j);
+}
+
+void journal_client_cache_free(JournalClientCache *c) {
+        assert(c);
+
+        while (c->lru)
+                journal_client_free(c->lru);
+
+        hashmap_free(c->clients);
+        free(c);
+}
+
+static char *field_prepend(const char *field, char *value) {
+        char *x;
+
+        /* Takes possession of value */
+
+        if (!value)
+                return NULL;
+
+        x = strappend(field, value);
+        free(value);
+
+        return x;
+}
+
+static int journal_client_read(JournalClient *j, char *cgroup_raw) {
+        const char *c;
+        char *t;
+
+        assert(j);
+
+        /* Takes possession of cgroup_raw. Fields we cannot read are
+         * simply left unset, hence this fails only on OOM. */
+
+        journal_client_reset(j);
+        j->cgroup_raw = cgroup_raw;
+        j->timestamp = now(CLOCK_MONOTONIC);
+
+        if (get_process_comm(j->pid, &t) >= 0) {
+                j->comm = field_prepend("_COMM=", t);
+                if (!j->comm)
+                        return -ENOMEM;
+        }
+
+        if (get_process_exe(j->pid, &t) >= 0) {
+                j->exe = field_prepend("_EXE=", t);
+                if (!j->exe)
+                        return -ENOMEM;
+        }
+
+        if (get_process_cmdline(j->pid, 0, false, &t) >= 0) {
+                j->cmdline = field_prepend("_CMDLINE=", t);
+                if (!j->cmdline)
+                        return -ENOMEM;
+        }
+
+        if (get_process_capeff(j->pid, &t) >= 0) {
+                j->capeff = field_prepend("_CAP_EFFECTIVE=", t);
+                if (!j->capeff)
+                        return -ENOMEM;
+        }
+
+#ifdef HAVE_AUDIT
+        {
+                uint32_t audit;
+                uid_t loginuid;
+
+                if (audit_session_from_pid(j->pid, &audit) >= 0)
+                        if (asprintf(&j->audit_session, "_AUDIT_SESSION=%lu", (unsigned long) audit) < 0)
+                                return -ENOMEM;
+
+                if (audit_loginuid_from_pid(j->pid, &loginuid) >= 0)
+                        if (asprintf(&j->audit_loginuid, "_AUDIT_LOGINUID=%lu", (unsigned long) loginuid) < 0)
+                                return -ENOMEM;
+        }
+#endif
+
+        if (cg_pid_get_path_shifted(j->pid, NULL, &t) < 0)
+                return 0;
+
+        j->cgroup = field_prepend("_SYSTEMD_CGROUP=", t);
+        if (!j->cgroup)
+                return -ENOMEM;
+
+        c = j->cgroup + strlen("_SYSTEMD_CGROUP=");
+
+        if (cg_path_get_session(c, &t) >= 0) {
+                j->session = field_prepend("_SYSTEMD_SESSION=", t);
+                if (!j->session)
+                        return -ENOMEM;
+        }
+
+        if (cg_path_get_owner_uid(c, &j->owner) >= 0) {
+                j->owner_valid = true;
+
+                if (asprintf(&j->owner_uid, "_SYSTEMD_OWNER_UID=%lu", (unsigned long) j->owner) < 0)
+                        return -ENOMEM;
+        }
+
+        if (cg_path_get_unit(c, &t) >= 0) {
+                j->unit = field_prepend("_SYSTEMD_UNIT=", t);
+                if (!j->unit)
+                        return -ENOMEM;
+        }
+
+        if (cg_path_get_user_unit(c, &t) >= 0) {
+                j->user_unit = field_prepend("_SYSTEMD_USER_UNIT=", t);
+                if (!j->user_unit)
+                        return -ENOMEM;
+        }
+
+        if (cg_path_get_slice(c, &t) >= 0) {
+                j->slice = field_prepend("_SYSTEMD_SLICE=", t);
+                if (!j->slice)
+                        return -ENOMEM;
+        }
+
+        return 0;
+}
+
+static bool journal_client_valid(JournalClient *j, unsigned long long starttime, const char *cgroup_raw, usec_t ts) {
+        assert(j);
+
+        /* A different start time means the PID has been reused */
+        if (j->starttime != starttime)
+                return false;
+
+        if (!streq_ptr(j->cgroup_raw, cgroup_raw))
+                return false;
+
+        return j->timestamp + CLIENT_MAX_AGE_USEC > ts;
+}
+
+static void journal_client_cache_vacuum(JournalClientCache *c) {
+        assert(c);
+
+        /* Makes room for at least one new item */
+
+        while (c->n_clients >= c->max)
+                journal_client_free(c->lru_tail);
+}
+
+int journal_client_cache_get(JournalClientCache *c, pid_t pid, JournalClient **ret) {
+        _cleanup_free_ char *cgroup_raw = NULL;
+        unsigned long long starttime;
+        JournalClient *j;
+        int r;
+
+        assert(c);
+        assert(pid > 0);
+        assert(ret);
+
+        /* These two are all we read from /proc as long as the
+         * process is known to us. */
+        r = get_starttime_of_pid(pid, &starttime);
+        if (r < 0) {
+                /* The process is gone, forget about it */
+                j = hashmap_get(c->clients, UINT_TO_PTR(pid));
+                if (j)
+                        journal_client_free(j);
+
+                return r;
+        }
+
+        r = cg_pid_get_path(SYSTEMD_CGROUP_CONTROLLER, pid, &cgroup_raw);
+        if (r < 0 && r != -ENOENT && r != -ESRCH)
+                return r;
+
+        j = hashmap_get(c->clients, UINT_TO_PTR(pid));
+        if (j) {
+                /* Move to the front of the LRU list */
+                if (c->lru_tail == j && j->lru_prev)
+                        c->lru_tail = j->lru_prev;
+
+                LIST_REMOVE(lru, c->lru, j);
+                LIST_PREPEND(lru, c->lru, j);
+                if (!j->lru_next)
+                        c->lru_tail = j;
+
+                if (journal_client_valid(j, starttime, cgroup_raw, now(CLOCK_MONOTONIC))) {
+                        c->n_hit++;
+                        *ret = j;
+                        return 0;
+                }
+        } else {
+                journal_client_cache_vacuum(c);
+
+                j = new0(JournalClient, 1);
+                if (!j)
+                        return -ENOMEM;
+
+                j->pid = pid;
+
+                r = hashmap_put(c->clients, UINT_TO_PTR(pid), j);
+                if (r < 0) {
+                        free(j);
+                        return r;
+                }
+
+                LIST_PREPEND(lru, c->lru, j);
+                if (!j->lru_next)
+                        c->lru_tail = j;
+                c->n_clients ++;
+
+                j->parent = c;
+        }
+
+        c->n_miss++;
+
+        j->starttime = starttime;
+
+        r = journal_client_read(j, cgroup_raw);
+        cgroup_raw = NULL;
+        if (r < 0) {
+                journal_client_free(j);
+                return r;
+        }
+
+        *ret = j;
+        return 0;
+}
+
+void journal_client_cache_get_statistics(JournalClientCache *c, unsigned *n_clients, uint64_t *n_hit, uint64_t *n_miss) {
+        assert(c);
+
+        if (n_clients)
+                *n_clients = c->n_clients;
+
+        if (n_hit)
+                *n_hit = c->n_hit;
+
+        if (n_miss)
+                *n_miss = c->n_miss;
+}
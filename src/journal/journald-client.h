@@ -0,0 +1,74 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "macro.h"
+#include "util.h"
+#include "list.h"
+
+typedef struct JournalClientCache JournalClientCache;
+typedef struct JournalClient JournalClient;
+
+/* What we know about a process that logs to us. All strings are
+ * complete journal fields, ready to be added to an entry, or NULL if
+ * unknown. */
+struct JournalClient {
+        JournalClientCache *parent;
+
+        pid_t pid;
+        unsigned long long starttime;
+        usec_t timestamp;
+
+        /* Used to notice when the process is moved to a different
+         * cgroup */
+        char *cgroup_raw;
+
+        char *comm;
+        char *exe;
+        char *cmdline;
+        char *capeff;
+
+        char *audit_session;
+        char *audit_loginuid;
+
+        char *cgroup;
+        char *session;
+        char *owner_uid;
+        char *unit;
+        char *user_unit;
+        char *slice;
+
+        uid_t owner;
+        bool owner_valid;
+
+        LIST_FIELDS(JournalClient, lru);
+};
+
+JournalClientCache *journal_client_cache_new(unsigned max);
+void journal_client_cache_free(JournalClientCache *c);
+
+int journal_client_cache_get(JournalClientCache *c, pid_t pid, JournalClient **ret);
+
+void journal_client_cache_get_statistics(JournalClientCache *c, unsigned *n_clients, uint64_t *n_hit, uint64_t *n_miss);
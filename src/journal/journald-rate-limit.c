@@ -23,13 +23,18 @@
 #include <errno.h>
 
 #include "journald-rate-limit.h"
-#include "list.h"
 #include "util.h"
 #include "hashmap.h"
 
 #define POOLS_MAX 5
-#define BUCKETS_MAX 127
-#define GROUPS_MAX 2047
+
+/* The groups live in a fixed table with open addressing. A group is
+ * only ever looked for in PROBE_MAX slots from where its hash points
+ * to. If it is not there, it takes over an unused slot or the one
+ * which has been idle the longest, hence slots never become free
+ * again and a lookup can stop at the first unused one. */
+#define GROUPS_MAX 2048
+#define PROBE_MAX 16
 
 static const int priority_map[] = {
         [LOG_EMERG]   = 0,
@@ -45,33 +50,44 @@ static const int priority_map[] = {
 typedef struct JournalRateLimitPool JournalRateLimitPool;
 typedef struct JournalRateLimitGroup JournalRateLimitGroup;
 
+/* A token bucket: a message costs interval units of credit, and
+ * burst units are added per microsecond, up to burst messages. The
+ * credit is only brought up to date when a message arrives. */
 struct JournalRateLimitPool {
-        usec_t begin;
-        unsigned num;
+        usec_t last;
+        uint64_t credit;
+
+        usec_t suppressed_begin;
         unsigned suppressed;
 };
 
 struct JournalRateLimitGroup {
-        JournalRateLimit *parent;
-
         char *id;
-        JournalRateLimitPool pools[POOLS_MAX];
         unsigned hash;
+        usec_t last;
 
-        LIST_FIELDS(JournalRateLimitGroup, bucket);
-        LIST_FIELDS(JournalRateLimitGroup, lru);
+        JournalRateLimitPool pools[POOLS_MAX];
 };
 
 struct JournalRateLimit {
         usec_t interval;
         unsigned burst;
 
-        JournalRateLimitGroup* buckets[BUCKETS_MAX];
-        JournalRateLimitGroup *lru, *lru_tail;
+        /* The burst modulated with the available disk space, only
+         * recalculated when that changes */
+        uint64_t available;
+        unsigned burst_modulated;
 
+        JournalRateLimitGroup groups[GROUPS_MAX];
         unsigned n_groups;
+
+        uint64_t n_suppressed;
+        uint64_t n_evicted;
+        uint64_t n_forgotten;
 };
 
+static unsigned burst_modulate(unsigned burst, uint64_t available);
+
 JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst) {
         JournalRateLimit *r;
 
@@ -84,90 +100,91 @@ JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst) {
         r->interval = interval;
         r->burst = burst;
 
-        return r;
-}
-
-static void journal_rate_limit_group_free(JournalRateLimitGroup *g) {
-        assert(g);
-
-        if (g->parent) {
-                assert(g->parent->n_groups > 0);
-
-                if (g->parent->lru_tail == g)
-                        g->parent->lru_tail = g->lru_prev;
-
-                LIST_REMOVE(lru, g->parent->lru, g);
-                LIST_REMOVE(bucket, g->parent->buckets[g->hash % BUCKETS_MAX], g);
+        r->available = (uint64_t) -1;
+        r->burst_modulated = burst_modulate(burst, r->available);
 
-                g->parent->n_groups --;
-        }
-
-        free(g->id);
-        free(g);
+        return r;
 }
 
 void journal_rate_limit_free(JournalRateLimit *r) {
+        unsigned i;
+
         assert(r);
 
-        while (r->lru)
-                journal_rate_limit_group_free(r->lru);
+        for (i = 0; i < GROUPS_MAX; i++)
+                free(r->groups[i].id);
 
         free(r);
 }
 
-_pure_ static bool journal_rate_limit_group_expired(JournalRateLimitGroup *g, usec_t ts) {
-        unsigned i;
-
-        assert(g);
+void journal_rate_limit_get_statistics(
+                JournalRateLimit *r,
+                unsigned *n_groups,
+                uint64_t *n_suppressed,
+                uint64_t *n_evicted,
+                uint64_t *n_forgotten) {
 
-        for (i = 0; i < POOLS_MAX; i++)
-                if (g->pools[i].begin + g->parent->interval >= ts)
-                        return false;
+        assert(r);
 
-        return true;
-}
+        if (n_groups)
+                *n_groups = r->n_groups;
 
-static void journal_rate_limit_vacuum(JournalRateLimit *r, usec_t ts) {
-        assert(r);
+        if (n_suppressed)
+                *n_suppressed = r->n_suppressed;
 
-        /* Makes room for at least one new item, but drop all
-         * expored items too. */
+        if (n_evicted)
+                *n_evicted = r->n_evicted;
 
-        while (r->n_groups >= GROUPS_MAX ||
-               (r->lru_tail && journal_rate_limit_group_expired(r->lru_tail, ts)))
-                journal_rate_limit_group_free(r->lru_tail);
+        if (n_forgotten)
+                *n_forgotten = r->n_forgotten;
 }
 
-static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r, const char *id, usec_t ts) {
-        JournalRateLimitGroup *g;
+static JournalRateLimitGroup* journal_rate_limit_group_get(JournalRateLimit *r, const char *id, usec_t ts) {
+        JournalRateLimitGroup *g, *victim = NULL;
+        unsigned h, i, k;
+        char *copy;
 
         assert(r);
         assert(id);
 
-        g = new0(JournalRateLimitGroup, 1);
-        if (!g)
-                return NULL;
+        h = string_hash_func(id);
 
-        g->id = strdup(id);
-        if (!g->id)
-                goto fail;
+        for (i = 0; i < PROBE_MAX; i++) {
+                g = r->groups + ((h + i) & (GROUPS_MAX - 1));
+
+                if (!g->id) {
+                        victim = g;
+                        break;
+                }
 
-        g->hash = string_hash_func(g->id);
+                if (g->hash == h && streq(g->id, id))
+                        return g;
 
-        journal_rate_limit_vacuum(r, ts);
+                if (!victim || g->last < victim->last)
+                        victim = g;
+        }
+
+        copy = strdup(id);
+        if (!copy)
+                return NULL;
 
-        LIST_PREPEND(bucket, r->buckets[g->hash % BUCKETS_MAX], g);
-        LIST_PREPEND(lru, r->lru, g);
-        if (!g->lru_next)
-                r->lru_tail = g;
-        r->n_groups ++;
+        if (victim->id) {
+                /* Messages we suppressed but did not report yet
+                 * cannot be attributed anymore, count them */
+                for (k = 0; k < POOLS_MAX; k++)
+                        r->n_forgotten += victim->pools[k].suppressed;
 
-        g->parent = r;
-        return g;
+                free(victim->id);
+                r->n_evicted++;
+        } else
+                r->n_groups++;
 
-fail:
-        journal_rate_limit_group_free(g);
-        return NULL;
+        zero(*victim);
+        victim->id = copy;
+        victim->hash = h;
+        victim->last = ts;
+
+        return victim;
 }
 
 static unsigned burst_modulate(unsigned burst, uint64_t available) {
@@ -199,13 +216,17 @@ static unsigned burst_modulate(unsigned burst, uint64_t available) {
 }
 
 int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available) {
-        unsigned h;
+        return journal_rate_limit_test_at(r, id, priority, available, now(CLOCK_MONOTONIC));
+}
+
+int journal_rate_limit_test_at(JournalRateLimit *r, const char *id, int priority, uint64_t available, usec_t ts) {
         JournalRateLimitGroup *g;
         JournalRateLimitPool *p;
-        unsigned burst;
-        usec_t ts;
+        uint64_t capacity;
+        unsigned burst, s;
 
         assert(id);
+        assert(ts > 0);
 
         if (!r)
                 return 1;
@@ -213,48 +234,47 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, u
         if (r->interval == 0 || r->burst == 0)
                 return 1;
 
-        burst = burst_modulate(r->burst, available);
+        if (available != r->available) {
+                r->available = available;
+                r->burst_modulated = burst_modulate(r->burst, available);
+        }
 
-        ts = now(CLOCK_MONOTONIC);
+        burst = MAX(r->burst_modulated, 1U);
+        capacity = (uint64_t) burst * r->interval;
 
-        h = string_hash_func(id);
-        g = r->buckets[h % BUCKETS_MAX];
-
-        LIST_FOREACH(bucket, g, g)
-                if (streq(g->id, id))
-                        break;
+        g = journal_rate_limit_group_get(r, id, ts);
+        if (!g)
+                return -ENOMEM;
 
-        if (!g) {
-                g = journal_rate_limit_group_new(r, id, ts);
-                if (!g)
-                        return -ENOMEM;
-        }
+        g->last = ts;
 
         p = &g->pools[priority_map[priority]];
 
-        if (p->begin <= 0) {
-                p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
-                return 1;
+        if (p->last <= 0 || ts >= p->last + r->interval)
+                p->credit = capacity;
+        else if (ts > p->last)
+                p->credit = MIN(capacity, p->credit + (ts - p->last) * burst);
+
+        p->last = ts;
+
+        if (p->credit < r->interval) {
+                if (p->suppressed == 0)
+                        p->suppressed_begin = ts;
+
+                p->suppressed++;
+                r->n_suppressed++;
+                return 0;
         }
 
-        if (p->begin + r->interval < ts) {
-                unsigned s;
+        p->credit -= r->interval;
 
+        /* Report suppressed messages at most once per interval */
+        if (p->suppressed > 0 && ts >= p->suppressed_begin + r->interval) {
                 s = p->suppressed;
                 p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
 
                 return 1 + s;
         }
 
-        if (p->num <= burst) {
-                p->num++;
-                return 1;
-        }
-
-        p->suppressed++;
-        return 0;
+        return 1;
 }
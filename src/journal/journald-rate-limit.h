@@ -29,3 +29,11 @@ typedef struct JournalRateLimit JournalRateLimit;
 JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst);
 void journal_rate_limit_free(JournalRateLimit *r);
 int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available);
+int journal_rate_limit_test_at(JournalRateLimit *r, const char *id, int priority, uint64_t available, usec_t ts);
+
+void journal_rate_limit_get_statistics(
+                JournalRateLimit *r,
+                unsigned *n_groups,
+                uint64_t *n_suppressed,
+                uint64_t *n_evicted,
+                uint64_t *n_forgotten);
@@ -25,6 +25,8 @@
 #include <sys/statvfs.h>
 #include <sys/mman.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 #include <libudev.h>
 #include <systemd/sd-journal.h>
@@ -43,6 +45,7 @@
 #include "conf-parser.h"
 #include "journal-internal.h"
 #include "journal-vacuum.h"
+#include "compress.h"
 #include "journal-authenticate.h"
 #include "journald-server.h"
 #include "journald-rate-limit.h"
@@ -66,11 +69,17 @@
 #define USER_JOURNALS_MAX 1024
 
 #define DEFAULT_SYNC_INTERVAL_USEC (5*USEC_PER_MINUTE)
+#define DEFAULT_CHANGE_NOTIFY_INTERVAL_USEC (250*USEC_PER_MSEC)
 #define DEFAULT_RATE_LIMIT_INTERVAL (30*USEC_PER_SEC)
 #define DEFAULT_RATE_LIMIT_BURST 1000
 
 #define RECHECK_AVAILABLE_SPACE_USEC (30*USEC_PER_SEC)
 
+#define CLIENTS_MAX 1024
+
+/* The queue is handed to the writer once it holds this much */
+#define SERVER_QUEUE_SIZE_MAX (1024*1024)
+
 static const char* const storage_table[] = {
         [STORAGE_AUTO] = "auto",
         [STORAGE_VOLATILE] = "volatile",
@@ -90,6 +99,44 @@ static const char* const split_mode_table[] = {
 DEFINE_STRING_TABLE_LOOKUP(split_mode, SplitMode);
 DEFINE_CONFIG_PARSE_ENUM(config_parse_split_mode, split_mode, SplitMode, "Failed to parse split mode setting");
 
+int config_parse_compress(const char* unit,
+                          const char *filename,
+                          unsigned line,
+                          const char *section,
+                          const char *lvalue,
+                          int ltype,
+                          const char *rvalue,
+                          void *data,
+                          void *userdata) {
+
+        int *compress = data;
+        int k;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(data);
+
+        /* Accepts either a boolean, which picks the default codec,
+         * or the name of a specific codec */
+
+        k = parse_boolean(rvalue);
+        if (k >= 0) {
+                *compress = k ? OBJECT_COMPRESSED_DEFAULT : 0;
+                return 0;
+        }
+
+        k = object_compressed_from_string(rvalue);
+        if (k <= 0) {
+                log_syntax(unit, LOG_ERR, filename, line, EINVAL,
+                           "Failed to parse compression setting, ignoring: %s", rvalue);
+                return 0;
+        }
+
+        *compress = k;
+        return 0;
+}
+
 static uint64_t available_space(Server *s, bool verbose) {
         char ids[33];
         _cleanup_free_ char *p = NULL;
@@ -181,6 +228,29 @@ static uint64_t available_space(Server *s, bool verbose) {
         return s->cached_available_space;
 }
 
+static void server_set_writer_available_space(Server *s, uint64_t space) {
+        uint64_t old;
+
+        assert(s);
+
+        /* Written by the writer thread, read by the main thread,
+         * and 64bit stores are not atomic everywhere */
+        do
+                old = s->writer_available_space;
+        while (!__sync_bool_compare_and_swap(&s->writer_available_space, old, space));
+}
+
+static uint64_t server_available_space(Server *s) {
+        assert(s);
+
+        /* While the writer thread is running the journal files are
+         * off-limits for us, hence we use what it found last */
+        if (s->writer_running)
+                return __sync_fetch_and_add(&s->writer_available_space, 0);
+
+        return available_space(s, false);
+}
+
 void server_fix_perms(Server *s, JournalFile *f, uid_t uid) {
         int r;
 #ifdef HAVE_ACL
@@ -275,6 +345,8 @@ static JournalFile* find_journal(Server *s, uid_t uid) {
         if (r < 0)
                 return s->system_journal;
 
+        f->defer_post_change = s->change_notify_interval_usec > 0;
+
         server_fix_perms(s, f, uid);
 
         r = hashmap_put(s->user_journals, UINT32_TO_PTR(uid), f);
@@ -333,40 +405,80 @@ void server_rotate(Server *s) {
         }
 }
 
+static void server_report_forgotten(Server *s) {
+        uint64_t n_forgotten;
+
+        assert(s);
+
+        if (!s->rate_limit)
+                return;
+
+        /* Suppressed messages of services the rate limiter had to
+         * forget about before it could report them */
+        journal_rate_limit_get_statistics(s->rate_limit, NULL, NULL, NULL, &n_forgotten);
+        if (n_forgotten <= s->rate_limit_forgotten)
+                return;
+
+        server_driver_message(s, SD_MESSAGE_JOURNAL_DROPPED,
+                              "Suppressed %"PRIu64" messages from services which logged too much and were forgotten since",
+                              n_forgotten - s->rate_limit_forgotten);
+
+        s->rate_limit_forgotten = n_forgotten;
+}
+
 void server_sync(Server *s) {
-        static const struct itimerspec sync_timer_disable = {};
-        JournalFile *f;
-        void *k;
-        Iterator i;
-        int r;
+        assert(s);
 
-        if (s->system_journal) {
-                r = journal_file_set_offline(s->system_journal);
-                if (r < 0)
-                        log_error("Failed to sync system journal: %s", strerror(-r));
-        }
+        server_report_forgotten(s);
+        server_flush_queue(s, SERVER_BATCH_SYNC);
+        server_notify_status(s);
+}
 
-        HASHMAP_FOREACH_KEY(f, k, s->user_journals, i) {
-                r = journal_file_set_offline(f);
-                if (r < 0)
-                        log_error("Failed to sync user journal: %s", strerror(-r));
-        }
+void server_notify_status(Server *s) {
+        char ts1[FORMAT_TIMESPAN_MAX], ts2[FORMAT_TIMESPAN_MAX];
+        unsigned n_clients, n_groups = 0;
+        uint64_t n_hit, n_miss, n_suppressed = 0, n_stalls;
+        usec_t stall, stall_max;
 
-        r = timerfd_settime(s->sync_timer_fd, 0, &sync_timer_disable, NULL);
-        if (r < 0)
-                log_error("Failed to disable max timer: %m");
+        assert(s);
 
-        s->sync_scheduled = false;
+        journal_client_cache_get_statistics(s->clients, &n_clients, &n_hit, &n_miss);
+
+        if (s->rate_limit)
+                journal_rate_limit_get_statistics(s->rate_limit, &n_groups, &n_suppressed, NULL, NULL);
+
+        pthread_mutex_lock(&s->vacuum_mutex);
+        n_stalls = s->n_vacuum_stalls;
+        stall = s->vacuum_stall_usec;
+        stall_max = s->vacuum_stall_max_usec;
+        pthread_mutex_unlock(&s->vacuum_mutex);
+
+        sd_notifyf(false,
+                   "STATUS=Processing requests... (process metadata cache: %u entries, %"PRIu64" hits, %"PRIu64" misses, %.1f%% hit rate; "
+                   "rate limiting: %u services, %"PRIu64" messages suppressed; "
+                   "vacuuming: writing stalled %"PRIu64" times for %s, at most %s)",
+                   n_clients, n_hit, n_miss,
+                   n_hit + n_miss > 0 ? 100.0 * (double) n_hit / (double) (n_hit + n_miss) : 0.0,
+                   n_groups, n_suppressed,
+                   n_stalls,
+                   format_timespan(ts1, sizeof(ts1), stall, 0),
+                   format_timespan(ts2, sizeof(ts2), stall_max, 0));
 }
 
-void server_vacuum(Server *s) {
+static void server_vacuum_directories(Server *s, bool system, bool runtime, usec_t *oldest_usec) {
         char ids[33];
         sd_id128_t machine;
         int r;
 
+        assert(s);
+        assert(oldest_usec);
+
+        /* Runs in the vacuum thread, or in the calling thread if
+         * there is none */
+
         log_debug("Vacuuming...");
 
-        s->oldest_file_usec = 0;
+        *oldest_usec = 0;
 
         r = sd_id128_get_machine(&machine);
         if (r < 0) {
@@ -376,23 +488,175 @@ void server_vacuum(Server *s) {
 
         sd_id128_to_string(machine, ids);
 
-        if (s->system_journal) {
+        if (system) {
                 char *p = strappenda("/var/log/journal/", ids);
 
-                r = journal_directory_vacuum(p, s->system_metrics.max_use, s->system_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
+                if (!s->system_vacuum_catalog)
+                        s->system_vacuum_catalog = journal_vacuum_catalog_new();
+
+                r = journal_directory_vacuum(p, s->system_vacuum_catalog, s->system_metrics.max_use, s->system_metrics.keep_free, s->max_retention_usec, oldest_usec);
                 if (r < 0 && r != -ENOENT)
                         log_error("Failed to vacuum %s: %s", p, strerror(-r));
         }
 
-        if (s->runtime_journal) {
+        if (runtime) {
                 char *p = strappenda("/run/log/journal/", ids);
 
-                r = journal_directory_vacuum(p, s->runtime_metrics.max_use, s->runtime_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
+                if (!s->runtime_vacuum_catalog)
+                        s->runtime_vacuum_catalog = journal_vacuum_catalog_new();
+
+                r = journal_directory_vacuum(p, s->runtime_vacuum_catalog, s->runtime_metrics.max_use, s->runtime_metrics.keep_free, s->max_retention_usec, oldest_usec);
                 if (r < 0 && r != -ENOENT)
                         log_error("Failed to vacuum %s: %s", p, strerror(-r));
         }
+}
+
+static unsigned server_vacuum_request(Server *s) {
+        unsigned n;
+
+        assert(s);
+
+        pthread_mutex_lock(&s->vacuum_mutex);
+
+        /* The files are not ours to look at from the vacuum
+         * thread, hence tell it which directories are in use */
+        s->vacuum_system = !!s->system_journal;
+        s->vacuum_runtime = !!s->runtime_journal;
+        n = ++s->vacuum_requested;
+
+        pthread_cond_broadcast(&s->vacuum_cond);
+        pthread_mutex_unlock(&s->vacuum_mutex);
 
+        /* Until the vacuum thread tells us otherwise we do not
+         * know about any old file */
+        s->oldest_file_usec = 0;
+
+        return n;
+}
+
+static void server_vacuum_collect(Server *s) {
+        assert(s);
+
+        if (!s->vacuum_running)
+                return;
+
+        /* Picks up what the vacuum thread found, once it caught up
+         * with all our requests */
+
+        pthread_mutex_lock(&s->vacuum_mutex);
+
+        if (s->vacuum_done) {
+                s->oldest_file_usec = s->vacuum_oldest_usec;
+                s->cached_available_space_timestamp = 0;
+                s->vacuum_done = false;
+        }
+
+        pthread_mutex_unlock(&s->vacuum_mutex);
+}
+
+static void server_vacuum_stalled(Server *s, usec_t begin) {
+        char buf[FORMAT_TIMESPAN_MAX];
+        usec_t t;
+
+        assert(s);
+
+        t = now(CLOCK_MONOTONIC) - begin;
+
+        pthread_mutex_lock(&s->vacuum_mutex);
+        s->n_vacuum_stalls++;
+        s->vacuum_stall_usec += t;
+        s->vacuum_stall_max_usec = MAX(s->vacuum_stall_max_usec, t);
+        pthread_mutex_unlock(&s->vacuum_mutex);
+
+        log_debug("Writing stalled for %s while vacuuming.", format_timespan(buf, sizeof(buf), t, 0));
+}
+
+void server_vacuum(Server *s) {
+        usec_t begin;
+
+        assert(s);
+
+        if (s->vacuum_running) {
+                server_vacuum_request(s);
+                return;
+        }
+
+        begin = now(CLOCK_MONOTONIC);
+
+        server_vacuum_directories(s, !!s->system_journal, !!s->runtime_journal, &s->oldest_file_usec);
         s->cached_available_space_timestamp = 0;
+
+        server_vacuum_stalled(s, begin);
+}
+
+void server_vacuum_wait(Server *s) {
+        usec_t begin;
+        unsigned n;
+
+        assert(s);
+
+        if (!s->vacuum_running) {
+                server_vacuum(s);
+                return;
+        }
+
+        /* We are out of space, so there is nothing to do but to
+         * wait for the vacuum thread */
+
+        begin = now(CLOCK_MONOTONIC);
+        n = server_vacuum_request(s);
+
+        pthread_mutex_lock(&s->vacuum_mutex);
+        while ((int) (s->vacuum_completed - n) < 0)
+                pthread_cond_wait(&s->vacuum_cond, &s->vacuum_mutex);
+        pthread_mutex_unlock(&s->vacuum_mutex);
+
+        server_vacuum_collect(s);
+        server_vacuum_stalled(s, begin);
+}
+
+static void *server_vacuum_thread(void *p) {
+        Server *s = p;
+
+        assert(s);
+
+        pthread_mutex_lock(&s->vacuum_mutex);
+
+        for (;;) {
+                bool system, runtime;
+                usec_t oldest;
+                unsigned n;
+
+                if (s->vacuum_completed == s->vacuum_requested) {
+                        if (s->vacuum_exit)
+                                break;
+
+                        pthread_cond_wait(&s->vacuum_cond, &s->vacuum_mutex);
+                        continue;
+                }
+
+                /* Requests coming in while we are at it are merged
+                 * into one more run */
+                n = s->vacuum_requested;
+                system = s->vacuum_system;
+                runtime = s->vacuum_runtime;
+
+                pthread_mutex_unlock(&s->vacuum_mutex);
+                server_vacuum_directories(s, system, runtime, &oldest);
+                pthread_mutex_lock(&s->vacuum_mutex);
+
+                s->vacuum_completed = n;
+                if (n == s->vacuum_requested) {
+                        s->vacuum_oldest_usec = oldest;
+                        s->vacuum_done = true;
+                }
+
+                pthread_cond_broadcast(&s->vacuum_cond);
+        }
+
+        pthread_mutex_unlock(&s->vacuum_mutex);
+
+        return NULL;
 }
 
 bool shall_try_append_again(JournalFile *f, int r) {
@@ -424,64 +688,273 @@ bool shall_try_append_again(JournalFile *f, int r) {
         return true;
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+static int write_to_journal(Server *s, uid_t uid, const JournalAppendEntry *entries, unsigned n) {
         JournalFile *f;
-        bool vacuumed = false;
-        int r;
+        bool rotated = false, vacuumed = false;
+        int r, ret = 0;
 
         assert(s);
-        assert(iovec);
+        assert(entries);
         assert(n > 0);
 
         f = find_journal(s, uid);
         if (!f)
-                return;
+                return 0;
 
         if (journal_file_rotate_suggested(f, s->max_file_usec)) {
                 log_debug("%s: Journal header limits reached or header out-of-date, rotating.", f->path);
                 server_rotate(s);
+                rotated = true;
+
+                /* With the vacuum thread running this only queues
+                 * a request, nothing has been freed yet */
                 server_vacuum(s);
-                vacuumed = true;
+                vacuumed = !s->vacuum_running;
 
                 f = find_journal(s, uid);
                 if (!f)
-                        return;
-        }
-
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r >= 0) {
-                server_schedule_sync(s, priority);
-                return;
+                        return 0;
         }
 
-        if (vacuumed || !shall_try_append_again(f, r)) {
+        while (n > 0) {
+                unsigned k;
                 size_t size = 0;
                 unsigned i;
-                for (i = 0; i < n; i++)
-                        size += iovec[i].iov_len;
 
-                log_error("Failed to write entry (%d items, %zu bytes), ignoring: %s", n, size, strerror(-r));
-                return;
+                r = journal_file_append_entries(f, entries, n, &s->seqnum, &k);
+                if (r >= 0)
+                        break;
+
+                entries += k;
+                n -= k;
+
+                if (!vacuumed && shall_try_append_again(f, r)) {
+                        if (!rotated)
+                                server_rotate(s);
+                        rotated = true;
+
+                        server_vacuum_wait(s);
+                        vacuumed = true;
+
+                        f = find_journal(s, uid);
+                        if (!f)
+                                return 0;
+
+                        log_debug("Retrying write.");
+                        continue;
+                }
+
+                /* Skip over the entry that failed, and try again
+                 * with the rest */
+                for (i = 0; i < entries->n_iovec; i++)
+                        size += entries->iovec[i].iov_len;
+
+                log_error("Failed to write entry (%u items, %zu bytes)%s, ignoring: %s",
+                          entries->n_iovec, size, vacuumed ? " despite vacuuming" : "", strerror(-r));
+
+                entries++;
+                n--;
+                ret = r;
         }
 
-        server_rotate(s);
-        server_vacuum(s);
+        server_schedule_post_change(s);
 
-        f = find_journal(s, uid);
-        if (!f)
-                return;
+        return ret;
+}
 
-        log_debug("Retrying write.");
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r < 0) {
-                size_t size = 0;
-                unsigned i;
-                for (i = 0; i < n; i++)
-                        size += iovec[i].iov_len;
+static void server_sync_files(Server *s) {
+        JournalFile *f;
+        void *k;
+        Iterator i;
+        int r;
+
+        server_post_change(s);
+
+        if (s->system_journal) {
+                r = journal_file_set_offline(s->system_journal);
+                if (r < 0)
+                        log_error("Failed to sync system journal: %s", strerror(-r));
+        }
+
+        HASHMAP_FOREACH_KEY(f, k, s->user_journals, i) {
+                r = journal_file_set_offline(f);
+                if (r < 0)
+                        log_error("Failed to sync user journal: %s", strerror(-r));
+        }
+}
+
+static void server_process_batch(Server *s, ServerBatch *b) {
+        unsigned i, j;
+
+        assert(s);
+        assert(b);
+
+        /* Runs in the writer thread, or in the main thread while
+         * there is none. Write out runs of entries that end up in
+         * the same file in one go. */
+        for (i = 0; i < b->n; i = j) {
+                JournalFile *f;
+
+                f = find_journal(s, b->uid[i]);
+                for (j = i + 1; j < b->n && find_journal(s, b->uid[j]) == f; j++)
+                        ;
+
+                write_to_journal(s, b->uid[i], b->entries + i, j - i);
+        }
+
+        for (i = 0; i < b->n; i++)
+                free((void*) b->entries[i].iovec);
+
+        if (b->flags & SERVER_BATCH_ROTATE) {
+                server_rotate(s);
+                server_vacuum(s);
+        }
+
+        if (b->flags & SERVER_BATCH_SYNC)
+                server_sync_files(s);
+        else if (b->flags & SERVER_BATCH_POST_CHANGE)
+                server_post_change(s);
+
+        free(b);
+}
+
+static int server_submit_batch(Server *s, ServerBatch *b) {
+        uint64_t one = 1;
+
+        assert(s);
+        assert(b);
+
+        if (!s->writer_running) {
+                server_process_batch(s, b);
+                return 0;
+        }
+
+        /* If the writer cannot keep up we stop reading from our
+         * clients until it took something off the ring. */
+        for (;;) {
+                uint64_t t;
+
+                __sync_synchronize();
+                if (s->ring_head - s->ring_tail < SERVER_RING_MAX)
+                        break;
 
-                log_error("Failed to write entry (%d items, %zu bytes) despite vacuuming, ignoring: %s", n, size, strerror(-r));
-        } else
-                server_schedule_sync(s, priority);
+                if (read(s->writer_done_fd, &t, sizeof(t)) < 0 && errno != EINTR) {
+                        log_error("Failed to wait for writer thread: %m");
+                        return -errno;
+                }
+        }
+
+        s->ring[s->ring_head % SERVER_RING_MAX] = b;
+
+        /* Make sure the writer sees the batch before it sees the
+         * new head */
+        __sync_synchronize();
+        s->ring_head++;
+
+        if (write(s->writer_fd, &one, sizeof(one)) < 0) {
+                log_error("Failed to wake up writer thread: %m");
+                return -errno;
+        }
+
+        return 0;
+}
+
+int server_flush_queue(Server *s, ServerBatchFlags flags) {
+        ServerBatch *b;
+        int priority;
+
+        assert(s);
+
+        if (!s->queue && flags == 0)
+                return 0;
+
+        if (s->queue) {
+                b = s->queue;
+                priority = s->queue_priority;
+
+                s->queue = NULL;
+                s->queue_priority = LOG_DEBUG;
+
+                /* Immediately sync to disk when this is of priority
+                 * CRIT, ALERT, EMERG */
+                if (priority <= LOG_CRIT)
+                        flags |= SERVER_BATCH_SYNC;
+                else if (!(flags & SERVER_BATCH_SYNC))
+                        server_schedule_sync(s, priority);
+        } else {
+                b = new0(ServerBatch, 1);
+                if (!b)
+                        return log_oom();
+        }
+
+        if (flags & SERVER_BATCH_SYNC) {
+                static const struct itimerspec sync_timer_disable = {};
+
+                if (timerfd_settime(s->sync_timer_fd, 0, &sync_timer_disable, NULL) < 0)
+                        log_error("Failed to disable max timer: %m");
+
+                s->sync_scheduled = false;
+        }
+
+        b->flags = flags;
+
+        return server_submit_batch(s, b);
+}
+
+static int server_queue_entry(Server *s, uid_t uid, const dual_timestamp *ts, const struct iovec *iovec, unsigned n, int priority) {
+        JournalAppendEntry *e;
+        struct iovec *copy;
+        size_t size = 0;
+        uint8_t *p;
+        unsigned i;
+
+        assert(s);
+        assert(ts);
+        assert(iovec);
+        assert(n > 0);
+
+        /* Entries are copied into the queue while there is more to
+         * read, so that they can be handed to the writer in one
+         * batch when we are idle or the queue is full */
+
+        for (i = 0; i < n; i++)
+                size += iovec[i].iov_len;
+
+        if (!s->queue) {
+                s->queue = new0(ServerBatch, 1);
+                if (!s->queue)
+                        return log_oom();
+        }
+
+        copy = malloc(sizeof(struct iovec) * n + size);
+        if (!copy)
+                return log_oom();
+
+        p = (uint8_t*) (copy + n);
+        for (i = 0; i < n; i++) {
+                copy[i].iov_base = p;
+                copy[i].iov_len = iovec[i].iov_len;
+                p = mempcpy(p, iovec[i].iov_base, iovec[i].iov_len);
+        }
+
+        e = s->queue->entries + s->queue->n;
+        e->ts = *ts;
+        e->iovec = copy;
+        e->n_iovec = n;
+        s->queue->uid[s->queue->n] = uid;
+
+        s->queue->n++;
+        s->queue->size += size;
+        s->queue_priority = MIN(s->queue_priority, priority);
+
+        /* Immediately hand out when this is of priority CRIT,
+         * ALERT, EMERG, since we'll sync right-away */
+        if (s->queue->n >= SERVER_QUEUE_MAX ||
+            s->queue->size >= SERVER_QUEUE_SIZE_MAX ||
+            priority <= LOG_CRIT)
+                return server_flush_queue(s, 0);
+
+        return 0;
 }
 
 static void dispatch_message_real(
@@ -497,7 +970,6 @@ static void dispatch_message_real(
         char    pid[sizeof("_PID=") + DECIMAL_STR_MAX(pid_t)],
                 uid[sizeof("_UID=") + DECIMAL_STR_MAX(uid_t)],
                 gid[sizeof("_GID=") + DECIMAL_STR_MAX(gid_t)],
-                owner_uid[sizeof("_SYSTEMD_OWNER_UID=") + DECIMAL_STR_MAX(uid_t)],
                 source_time[sizeof("_SOURCE_REALTIME_TIMESTAMP=") + DECIMAL_STR_MAX(usec_t)],
                 boot_id[sizeof("_BOOT_ID=") + 32] = "_BOOT_ID=",
                 machine_id[sizeof("_MACHINE_ID=") + 32] = "_MACHINE_ID=",
@@ -512,10 +984,10 @@ static void dispatch_message_real(
         char *t, *c;
         uid_t realuid = 0, owner = 0, journal_uid;
         bool owner_valid = false;
+        dual_timestamp ts;
+        JournalClient *client = NULL;
 #ifdef HAVE_AUDIT
-        char    audit_session[sizeof("_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
-                audit_loginuid[sizeof("_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)],
-                o_audit_session[sizeof("OBJECT_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
+        char    o_audit_session[sizeof("OBJECT_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
                 o_audit_loginuid[sizeof("OBJECT_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)];
 
         uint32_t audit;
@@ -536,97 +1008,54 @@ static void dispatch_message_real(
                 sprintf(uid, "_UID=%lu", (unsigned long) ucred->uid);
                 IOVEC_SET_STRING(iovec[n++], uid);
 
-                sprintf(gid, "_GID=%lu", (unsigned long) ucred->gid);
-                IOVEC_SET_STRING(iovec[n++], gid);
-
-                r = get_process_comm(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strappenda("_COMM=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
-
-                r = get_process_exe(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strappenda("_EXE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
-
-                r = get_process_cmdline(ucred->pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strappenda("_CMDLINE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
-
-                r = get_process_capeff(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strappenda("_CAP_EFFECTIVE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
-
-#ifdef HAVE_AUDIT
-                r = audit_session_from_pid(ucred->pid, &audit);
-                if (r >= 0) {
-                        sprintf(audit_session, "_AUDIT_SESSION=%lu", (unsigned long) audit);
-                        IOVEC_SET_STRING(iovec[n++], audit_session);
-                }
+                sprintf(gid, "_GID=%lu", (unsigned long) ucred->gid);
+                IOVEC_SET_STRING(iovec[n++], gid);
 
-                r = audit_loginuid_from_pid(ucred->pid, &loginuid);
+                r = journal_client_cache_get(s->clients, ucred->pid, &client);
                 if (r >= 0) {
-                        sprintf(audit_loginuid, "_AUDIT_LOGINUID=%lu", (unsigned long) loginuid);
-                        IOVEC_SET_STRING(iovec[n++], audit_loginuid);
+                        if (client->comm)
+                                IOVEC_SET_STRING(iovec[n++], client->comm);
+                        if (client->exe)
+                                IOVEC_SET_STRING(iovec[n++], client->exe);
+                        if (client->cmdline)
+                                IOVEC_SET_STRING(iovec[n++], client->cmdline);
+                        if (client->capeff)
+                                IOVEC_SET_STRING(iovec[n++], client->capeff);
+                        if (client->audit_session)
+                                IOVEC_SET_STRING(iovec[n++], client->audit_session);
+                        if (client->audit_loginuid)
+                                IOVEC_SET_STRING(iovec[n++], client->audit_loginuid);
                 }
-#endif
-
-                r = cg_pid_get_path_shifted(ucred->pid, NULL, &c);
-                if (r >= 0) {
-                        char *session = NULL;
 
-                        x = strappenda("_SYSTEMD_CGROUP=", c);
-                        IOVEC_SET_STRING(iovec[n++], x);
+                if (r >= 0 && client->cgroup) {
+                        IOVEC_SET_STRING(iovec[n++], client->cgroup);
 
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                session = strappenda("_SYSTEMD_SESSION=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], session);
-                        }
+                        if (client->session)
+                                IOVEC_SET_STRING(iovec[n++], client->session);
 
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
+                        if (client->owner_valid) {
+                                owner = client->owner;
                                 owner_valid = true;
 
-                                sprintf(owner_uid, "_SYSTEMD_OWNER_UID=%lu", (unsigned long) owner);
-                                IOVEC_SET_STRING(iovec[n++], owner_uid);
+                                IOVEC_SET_STRING(iovec[n++], client->owner_uid);
                         }
 
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strappenda("_SYSTEMD_UNIT=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && !session) {
+                        if (client->unit)
+                                IOVEC_SET_STRING(iovec[n++], client->unit);
+                        else if (unit_id && !client->session) {
                                 x = strappenda("_SYSTEMD_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strappenda("_SYSTEMD_USER_UNIT=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && session) {
+                        if (client->user_unit)
+                                IOVEC_SET_STRING(iovec[n++], client->user_unit);
+                        else if (unit_id && client->session) {
                                 x = strappenda("_SYSTEMD_USER_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_slice(c, &t) >= 0) {
-                                x = strappenda("_SYSTEMD_SLICE=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], x);
-                        }
-
-                        free(c);
+                        if (client->slice)
+                                IOVEC_SET_STRING(iovec[n++], client->slice);
                 }
 
 #ifdef HAVE_SELINUX
@@ -776,7 +1205,7 @@ static void dispatch_message_real(
         else
                 journal_uid = 0;
 
-        write_to_journal(s, journal_uid, iovec, n, priority);
+        server_queue_entry(s, journal_uid, dual_timestamp_get(&ts), iovec, n, priority);
 }
 
 void server_driver_message(Server *s, sd_id128_t message_id, const char *format, ...) {
@@ -865,7 +1294,7 @@ void server_dispatch_message(
         }
 
         rl = journal_rate_limit_test(s->rate_limit, path,
-                                     priority & LOG_PRIMASK, available_space(s, false));
+                                     priority & LOG_PRIMASK, server_available_space(s));
 
         if (rl == 0)
                 return;
@@ -913,9 +1342,10 @@ static int system_journal_open(Server *s) {
                 fn = strappenda(fn, "/system.journal");
                 r = journal_file_open_reliably(fn, O_RDWR|O_CREAT, 0640, s->compress, s->seal, &s->system_metrics, s->mmap, NULL, &s->system_journal);
 
-                if (r >= 0)
+                if (r >= 0) {
                         server_fix_perms(s, s->system_journal, 0);
-                else if (r < 0) {
+                        s->system_journal->defer_post_change = s->change_notify_interval_usec > 0;
+                } else if (r < 0) {
                         if (r != -ENOENT && r != -EROFS)
                                 log_warning("Failed to open system journal: %s", strerror(-r));
 
@@ -961,8 +1391,10 @@ static int system_journal_open(Server *s) {
                         }
                 }
 
-                if (s->runtime_journal)
+                if (s->runtime_journal) {
                         server_fix_perms(s, s->runtime_journal, 0);
+                        s->runtime_journal->defer_post_change = s->change_notify_interval_usec > 0;
+                }
         }
 
         available_space(s, true);
@@ -970,7 +1402,65 @@ static int system_journal_open(Server *s) {
         return r;
 }
 
+static int flush_batch_to_var(Server *s, JournalAppendEntry *batch, unsigned n, struct iovec *iovec, uint8_t *buffer) {
+        struct iovec *v = iovec;
+        uint8_t *p = buffer;
+        unsigned i, j, k;
+        int r;
+
+        assert(s);
+        assert(batch);
+        assert(n > 0);
+
+        /* The arrays might have been moved around while we were
+         * filling them, hence only now fix up the pointers */
+        for (i = 0; i < n; i++) {
+                batch[i].iovec = v;
+
+                for (j = 0; j < batch[i].n_iovec; j++) {
+                        v[j].iov_base = p;
+                        p += v[j].iov_len;
+                }
+
+                v += batch[i].n_iovec;
+        }
+
+        r = journal_file_append_entries(s->system_journal, batch, n, NULL, &k);
+        if (r >= 0) {
+                server_schedule_post_change(s);
+                return 0;
+        }
+
+        if (!shall_try_append_again(s->system_journal, r)) {
+                log_error("Can't write entry: %s", strerror(-r));
+                return r;
+        }
+
+        server_rotate(s);
+        server_vacuum_wait(s);
+
+        if (!s->system_journal) {
+                log_notice("Didn't flush runtime journal since rotation of system journal wasn't successful.");
+                return -EIO;
+        }
+
+        log_debug("Retrying write.");
+        r = journal_file_append_entries(s->system_journal, batch + k, n - k, NULL, NULL);
+        if (r < 0) {
+                log_error("Can't write entry: %s", strerror(-r));
+                return r;
+        }
+
+        server_schedule_post_change(s);
+        return 0;
+}
+
 int server_flush_to_var(Server *s) {
+        JournalAppendEntry batch[SERVER_QUEUE_MAX];
+        _cleanup_free_ struct iovec *iovec = NULL;
+        _cleanup_free_ uint8_t *buffer = NULL;
+        size_t iovec_allocated = 0, buffer_allocated = 0, buffer_size = 0;
+        unsigned n_batch = 0, n_iovec = 0;
         int r;
         sd_id128_t machine;
         sd_journal *j = NULL;
@@ -991,6 +1481,9 @@ int server_flush_to_var(Server *s) {
 
         log_debug("Flushing to /var...");
 
+        /* Whatever is still queued belongs into the runtime journal */
+        server_flush_queue(s, 0);
+
         r = sd_id128_get_machine(&machine);
         if (r < 0)
                 return r;
@@ -1006,6 +1499,8 @@ int server_flush_to_var(Server *s) {
         SD_JOURNAL_FOREACH(j) {
                 Object *o = NULL;
                 JournalFile *f;
+                JournalAppendEntry *e;
+                uint64_t i, n;
 
                 f = j->current_file;
                 assert(f && f->current_offset > 0);
@@ -1016,35 +1511,70 @@ int server_flush_to_var(Server *s) {
                         goto finish;
                 }
 
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL, NULL, NULL);
-                if (r >= 0)
-                        continue;
+                n = journal_file_entry_n_items(o);
 
-                if (!shall_try_append_again(s->system_journal, r)) {
-                        log_error("Can't write entry: %s", strerror(-r));
+                if (!GREEDY_REALLOC(iovec, iovec_allocated, n_iovec + n)) {
+                        r = log_oom();
                         goto finish;
                 }
 
-                server_rotate(s);
-                server_vacuum(s);
+                e = batch + n_batch;
+                e->ts.monotonic = le64toh(o->entry.monotonic);
+                e->ts.realtime = le64toh(o->entry.realtime);
+                e->n_iovec = n;
+
+                for (i = 0; i < n; i++) {
+                        const void *data;
+                        uint64_t q;
+                        le64_t le_hash;
+                        size_t l;
+                        Object *d;
+
+                        q = le64toh(o->entry.items[i].object_offset);
+                        le_hash = o->entry.items[i].hash;
+
+                        r = journal_file_move_to_object(f, OBJECT_DATA, q, &d);
+                        if (r >= 0 && le_hash != d->data.hash)
+                                r = -EBADMSG;
+                        if (r >= 0)
+                                r = journal_file_data_payload(f, d, q, NULL, 0, 0, &data, &l);
+                        if (r < 0) {
+                                log_error("Can't read entry: %s", strerror(-r));
+                                goto finish;
+                        }
 
-                if (!s->system_journal) {
-                        log_notice("Didn't flush runtime journal since rotation of system journal wasn't successful.");
-                        r = -EIO;
-                        goto finish;
+                        if (!GREEDY_REALLOC(buffer, buffer_allocated, buffer_size + l)) {
+                                r = log_oom();
+                                goto finish;
+                        }
+
+                        memcpy(buffer + buffer_size, data, l);
+                        buffer_size += l;
+                        iovec[n_iovec++].iov_len = l;
+
+                        r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                        if (r < 0) {
+                                log_error("Can't read entry: %s", strerror(-r));
+                                goto finish;
+                        }
                 }
 
-                log_debug("Retrying write.");
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL, NULL, NULL);
-                if (r < 0) {
-                        log_error("Can't write entry: %s", strerror(-r));
+                n_batch++;
+
+                if (n_batch < SERVER_QUEUE_MAX && buffer_size < SERVER_QUEUE_SIZE_MAX)
+                        continue;
+
+                r = flush_batch_to_var(s, batch, n_batch, iovec, buffer);
+                if (r < 0)
                         goto finish;
-                }
+
+                n_batch = n_iovec = buffer_size = 0;
         }
 
-finish:
-        journal_file_post_change(s->system_journal);
+        if (n_batch > 0)
+                r = flush_batch_to_var(s, batch, n_batch, iovec, buffer);
 
+finish:
         journal_file_close(s->runtime_journal);
         s->runtime_journal = NULL;
 
@@ -1083,19 +1613,39 @@ int process_event(Server *s, struct epoll_event *ev) {
                 }
 
                 if (sfsi.ssi_signo == SIGUSR1) {
+                        bool restart;
+                        int r;
+
                         log_info("Received request to flush runtime journal from PID %"PRIu32,
                                  sfsi.ssi_pid);
+
+                        /* This opens the system journal and
+                         * logs about it, hence is done while the
+                         * writer is stopped */
+                        restart = s->writer_running;
+                        r = server_stop_writer(s);
+                        if (r < 0) {
+                                log_error("Not flushing runtime journal.");
+                                return 1;
+                        }
+
                         touch("/run/systemd/journal/flushed");
                         server_flush_to_var(s);
                         server_sync(s);
+
+                        if (restart) {
+                                r = server_start_writer(s);
+                                if (r < 0)
+                                        return r;
+                        }
+
                         return 1;
                 }
 
                 if (sfsi.ssi_signo == SIGUSR2) {
                         log_info("Received request to rotate journal from PID %"PRIu32,
                                  sfsi.ssi_pid);
-                        server_rotate(s);
-                        server_vacuum(s);
+                        server_flush_queue(s, SERVER_BATCH_ROTATE);
                         return 1;
                 }
 
@@ -1116,6 +1666,17 @@ int process_event(Server *s, struct epoll_event *ev) {
                 server_sync(s);
                 return 1;
 
+        } else if (ev->data.fd == s->change_timer_fd) {
+                int r;
+                uint64_t t;
+
+                r = read(ev->data.fd, (void *)&t, sizeof(t));
+                if (r < 0)
+                        return 0;
+
+                server_flush_queue(s, SERVER_BATCH_POST_CHANGE);
+                return 1;
+
         } else if (ev->data.fd == s->dev_kmsg_fd) {
                 int r;
 
@@ -1404,6 +1965,76 @@ static int server_open_sync_timer(Server *s) {
         return 0;
 }
 
+static int server_open_change_timer(Server *s) {
+        int r;
+        struct epoll_event ev;
+
+        assert(s);
+
+        s->change_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (s->change_timer_fd < 0)
+                return -errno;
+
+        zero(ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = s->change_timer_fd;
+
+        r = epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->change_timer_fd, &ev);
+        if (r < 0) {
+                log_error("Failed to add change timer fd to epoll object: %m");
+                return -errno;
+        }
+
+        return 0;
+}
+
+int server_schedule_post_change(Server *s) {
+        struct itimerspec change_timer_enable = {};
+        int r;
+
+        assert(s);
+
+        /* Without an interval every batch is announced right-away
+         * by the journal file itself */
+        if (s->change_notify_interval_usec <= 0)
+                return 0;
+
+        if (s->change_scheduled)
+                return 0;
+
+        timespec_store(&change_timer_enable.it_value, s->change_notify_interval_usec);
+
+        r = timerfd_settime(s->change_timer_fd, 0, &change_timer_enable, NULL);
+        if (r < 0)
+                return -errno;
+
+        s->change_scheduled = true;
+
+        return 0;
+}
+
+void server_post_change(Server *s) {
+        JournalFile *f;
+        Iterator i;
+
+        assert(s);
+
+        /* Wake up readers of all files we wrote to since the last
+         * time, once instead of once per entry */
+
+        if (s->system_journal && s->system_journal->post_change_pending)
+                journal_file_post_change(s->system_journal);
+
+        if (s->runtime_journal && s->runtime_journal->post_change_pending)
+                journal_file_post_change(s->runtime_journal);
+
+        HASHMAP_FOREACH(f, s->user_journals, i)
+                if (f->post_change_pending)
+                        journal_file_post_change(f);
+
+        s->change_scheduled = false;
+}
+
 int server_schedule_sync(Server *s, int priority) {
         int r;
 
@@ -1439,14 +2070,21 @@ int server_init(Server *s) {
         assert(s);
 
         zero(*s);
-        s->sync_timer_fd = s->syslog_fd = s->native_fd = s->stdout_fd =
-                s->signal_fd = s->epoll_fd = s->dev_kmsg_fd = -1;
-        s->compress = true;
+        s->sync_timer_fd = s->change_timer_fd = s->syslog_fd = s->native_fd = s->stdout_fd =
+                s->signal_fd = s->epoll_fd = s->dev_kmsg_fd = s->writer_fd = s->writer_done_fd = -1;
+        s->compress = OBJECT_COMPRESSED_DEFAULT;
         s->seal = true;
 
         s->sync_interval_usec = DEFAULT_SYNC_INTERVAL_USEC;
         s->sync_scheduled = false;
 
+        s->change_notify_interval_usec = DEFAULT_CHANGE_NOTIFY_INTERVAL_USEC;
+
+        s->queue_priority = LOG_DEBUG;
+
+        pthread_mutex_init(&s->vacuum_mutex, NULL);
+        pthread_cond_init(&s->vacuum_cond, NULL);
+
         s->rate_limit_interval = DEFAULT_RATE_LIMIT_INTERVAL;
         s->rate_limit_burst = DEFAULT_RATE_LIMIT_BURST;
 
@@ -1550,6 +2188,18 @@ int server_init(Server *s) {
         if (r < 0)
                 return r;
 
+        r = server_open_change_timer(s);
+        if (r < 0)
+                return r;
+
+        s->writer_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        if (s->writer_fd < 0)
+                return -errno;
+
+        s->writer_done_fd = eventfd(0, EFD_CLOEXEC);
+        if (s->writer_done_fd < 0)
+                return -errno;
+
         r = open_signalfd(s);
         if (r < 0)
                 return r;
@@ -1563,6 +2213,10 @@ int server_init(Server *s) {
         if (!s->rate_limit)
                 return -ENOMEM;
 
+        s->clients = journal_client_cache_new(CLIENTS_MAX);
+        if (!s->clients)
+                return -ENOMEM;
+
         r = system_journal_open(s);
         if (r < 0)
                 return r;
@@ -1586,10 +2240,217 @@ void server_maybe_append_tags(Server *s) {
 #endif
 }
 
+static int server_writer_maintain(Server *s) {
+        int t = -1;
+        usec_t n;
+
+        assert(s);
+
+        /* Does all the periodic work on the journal files, and
+         * returns how long the writer may sleep until it needs to
+         * be called again, in ms */
+
+        n = now(CLOCK_REALTIME);
+
+        server_vacuum_collect(s);
+
+        if (s->max_retention_usec > 0 && s->oldest_file_usec > 0) {
+
+                /* The retention time is reached, so let's vacuum! */
+                if (s->oldest_file_usec + s->max_retention_usec < n) {
+                        log_info("Retention time reached.");
+                        server_rotate(s);
+                        server_vacuum(s);
+                        return 0;
+                }
+
+                /* Calculate when to rotate the next time */
+                t = (int) ((s->oldest_file_usec + s->max_retention_usec - n + USEC_PER_MSEC - 1) / USEC_PER_MSEC);
+        }
+
+        server_maybe_append_tags(s);
+
+#ifdef HAVE_GCRYPT
+        if (s->system_journal) {
+                usec_t u;
+
+                if (journal_file_next_evolve_usec(s->system_journal, &u)) {
+                        if (n >= u)
+                                t = 0;
+                        else
+                                t = MIN(t, (int) ((u - n + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
+                }
+        }
+#endif
+
+        server_set_writer_available_space(s, available_space(s, false));
+
+        return t;
+}
+
+static void *server_writer_thread(void *p) {
+        Server *s = p;
+        bool done = false;
+
+        assert(s);
+
+        while (!done) {
+                struct pollfd pollfd = {
+                        .fd = s->writer_fd,
+                        .events = POLLIN,
+                };
+                uint64_t one = 1, t;
+                unsigned head;
+
+                /* Process batches strictly in the order the main
+                 * thread handed them to us, so that the sequence
+                 * numbers follow the order of reception */
+                head = s->ring_head;
+                __sync_synchronize();
+
+                if (s->ring_tail != head) {
+                        while (s->ring_tail != head) {
+                                ServerBatch *b;
+
+                                b = s->ring[s->ring_tail % SERVER_RING_MAX];
+                                if (b->flags & SERVER_BATCH_EXIT)
+                                        done = true;
+
+                                server_process_batch(s, b);
+
+                                /* Make sure we are done with the slot
+                                 * before the main thread may reuse it */
+                                __sync_synchronize();
+                                s->ring_tail++;
+                        }
+
+                        if (write(s->writer_done_fd, &one, sizeof(one)) < 0)
+                                log_error("Failed to notify main thread: %m");
+
+                        if (done)
+                                break;
+                }
+
+                if (poll(&pollfd, 1, server_writer_maintain(s)) < 0) {
+                        if (errno != EINTR)
+                                log_error("poll() failed: %m");
+                        continue;
+                }
+
+                if (pollfd.revents & POLLIN)
+                        (void) read(s->writer_fd, &t, sizeof(t));
+        }
+
+        return NULL;
+}
+
+static void server_start_vacuum(Server *s) {
+        int r;
+
+        assert(s);
+        assert(!s->vacuum_running);
+
+        r = pthread_create(&s->vacuum, NULL, server_vacuum_thread, s);
+        if (r != 0) {
+                /* Not fatal, the writer vacuums itself then */
+                log_warning("Failed to start vacuum thread: %s", strerror(r));
+                return;
+        }
+
+        s->vacuum_running = true;
+}
+
+static void server_stop_vacuum(Server *s) {
+        int r;
+
+        assert(s);
+
+        if (!s->vacuum_running)
+                return;
+
+        /* Requests still pending are served before the thread
+         * exits */
+        pthread_mutex_lock(&s->vacuum_mutex);
+        s->vacuum_exit = true;
+        pthread_cond_broadcast(&s->vacuum_cond);
+        pthread_mutex_unlock(&s->vacuum_mutex);
+
+        r = pthread_join(s->vacuum, NULL);
+        if (r != 0)
+                log_error("Failed to join vacuum thread: %s", strerror(r));
+
+        server_vacuum_collect(s);
+
+        s->vacuum_running = false;
+        s->vacuum_exit = false;
+}
+
+int server_start_writer(Server *s) {
+        int r;
+
+        assert(s);
+        assert(!s->writer_running);
+
+        /* Hand over whatever we queued so far in order */
+        server_flush_queue(s, 0);
+
+        server_set_writer_available_space(s, available_space(s, false));
+
+        server_start_vacuum(s);
+
+        r = pthread_create(&s->writer, NULL, server_writer_thread, s);
+        if (r != 0) {
+                log_error("Failed to start writer thread: %s", strerror(r));
+                server_stop_vacuum(s);
+                return -r;
+        }
+
+        s->writer_running = true;
+        return 0;
+}
+
+int server_stop_writer(Server *s) {
+        int r;
+
+        assert(s);
+
+        if (!s->writer_running)
+                return 0;
+
+        /* Everything queued so far is written before the thread
+         * exits. If we cannot tell it to exit, or cannot wait for
+         * that, it still owns the files. */
+        r = server_flush_queue(s, SERVER_BATCH_EXIT);
+        if (r < 0) {
+                log_error("Failed to stop writer thread: %s", strerror(-r));
+                return r;
+        }
+
+        r = pthread_join(s->writer, NULL);
+        if (r != 0) {
+                log_error("Failed to join writer thread: %s", strerror(r));
+                return -r;
+        }
+
+        /* From now on the main thread owns the files again */
+        s->writer_running = false;
+        s->ring_head = s->ring_tail = 0;
+
+        server_stop_vacuum(s);
+        return 0;
+}
+
 void server_done(Server *s) {
         JournalFile *f;
         assert(s);
 
+        /* The writer thread still uses all of this, hence leave
+         * it to the kernel to clean up after us */
+        if (server_stop_writer(s) < 0)
+                return;
+
+        server_flush_queue(s, 0);
+
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
@@ -1625,9 +2486,27 @@ void server_done(Server *s) {
         if (s->sync_timer_fd >= 0)
                 close_nointr_nofail(s->sync_timer_fd);
 
+        if (s->change_timer_fd >= 0)
+                close_nointr_nofail(s->change_timer_fd);
+
+        if (s->writer_fd >= 0)
+                close_nointr_nofail(s->writer_fd);
+
+        if (s->writer_done_fd >= 0)
+                close_nointr_nofail(s->writer_done_fd);
+
+        journal_vacuum_catalog_free(s->system_vacuum_catalog);
+        journal_vacuum_catalog_free(s->runtime_vacuum_catalog);
+
+        pthread_mutex_destroy(&s->vacuum_mutex);
+        pthread_cond_destroy(&s->vacuum_cond);
+
         if (s->rate_limit)
                 journal_rate_limit_free(s->rate_limit);
 
+        if (s->clients)
+                journal_client_cache_free(s->clients);
+
         if (s->kernel_seqnum)
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
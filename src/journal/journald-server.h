@@ -22,16 +22,19 @@
 ***/
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 #include "journal-file.h"
+#include "journal-vacuum.h"
 #include "hashmap.h"
 #include "util.h"
 #include "audit.h"
 #include "journald-rate-limit.h"
+#include "journald-client.h"
 #include "list.h"
 
 typedef enum Storage {
@@ -53,6 +56,26 @@ typedef enum SplitMode {
 
 typedef struct StdoutStream StdoutStream;
 
+#define SERVER_QUEUE_MAX 64
+#define SERVER_RING_MAX 16
+
+typedef enum ServerBatchFlags {
+        SERVER_BATCH_SYNC = 1,
+        SERVER_BATCH_POST_CHANGE = 2,
+        SERVER_BATCH_ROTATE = 4,
+        SERVER_BATCH_EXIT = 8
+} ServerBatchFlags;
+
+/* A number of entries together with requests to execute after writing
+ * them, handed from the main thread to the writer thread */
+typedef struct ServerBatch {
+        JournalAppendEntry entries[SERVER_QUEUE_MAX];
+        uid_t uid[SERVER_QUEUE_MAX];
+        unsigned n;
+        size_t size;
+        ServerBatchFlags flags;
+} ServerBatch;
+
 typedef struct Server {
         int epoll_fd;
         int signal_fd;
@@ -71,14 +94,16 @@ typedef struct Server {
         size_t buffer_size;
 
         JournalRateLimit *rate_limit;
+        JournalClientCache *clients;
         usec_t sync_interval_usec;
         usec_t rate_limit_interval;
         unsigned rate_limit_burst;
+        uint64_t rate_limit_forgotten;
 
         JournalMetrics runtime_metrics;
         JournalMetrics system_metrics;
 
-        bool compress;
+        int compress;
         bool seal;
 
         bool forward_to_kmsg;
@@ -120,6 +145,47 @@ typedef struct Server {
 
         int sync_timer_fd;
         bool sync_scheduled;
+
+        int change_timer_fd;
+        bool change_scheduled;
+        usec_t change_notify_interval_usec;
+
+        ServerBatch *queue;
+        int queue_priority;
+
+        /* While the writer thread is running it exclusively owns
+         * the journal files, and everything the main thread wants
+         * written goes through the ring. The main thread only moves
+         * ring_head, the writer thread only ring_tail. */
+        bool writer_running;
+        pthread_t writer;
+        int writer_fd;
+        int writer_done_fd;
+        ServerBatch *ring[SERVER_RING_MAX];
+        unsigned ring_head;
+        unsigned ring_tail;
+        uint64_t writer_available_space;
+
+        /* Old files are deleted by a thread of its own, so that the
+         * writer does not have to wait for it, unless it needs the
+         * space right away. The catalogs are owned by the vacuum
+         * thread, the rest below is protected by the mutex. */
+        bool vacuum_running;
+        pthread_t vacuum;
+        pthread_mutex_t vacuum_mutex;
+        pthread_cond_t vacuum_cond;
+        bool vacuum_exit;
+        bool vacuum_system;
+        bool vacuum_runtime;
+        unsigned vacuum_requested;
+        unsigned vacuum_completed;
+        bool vacuum_done;
+        usec_t vacuum_oldest_usec;
+        uint64_t n_vacuum_stalls;
+        usec_t vacuum_stall_usec;
+        usec_t vacuum_stall_max_usec;
+        JournalVacuumCatalog *system_vacuum_catalog;
+        JournalVacuumCatalog *runtime_vacuum_catalog;
 } Server;
 
 #define N_IOVEC_META_FIELDS 20
@@ -143,14 +209,23 @@ int config_parse_split_mode(const char *unit, const char *filename, unsigned lin
 const char *split_mode_to_string(SplitMode s) _const_;
 SplitMode split_mode_from_string(const char *s) _pure_;
 
+int config_parse_compress(const char *unit, const char *filename, unsigned line, const char *section, const char *lvalue, int ltype, const char *rvalue, void *data, void *userdata);
+
 void server_fix_perms(Server *s, JournalFile *f, uid_t uid);
 bool shall_try_append_again(JournalFile *f, int r);
 int server_init(Server *s);
 void server_done(Server *s);
 void server_sync(Server *s);
+void server_notify_status(Server *s);
 void server_vacuum(Server *s);
+void server_vacuum_wait(Server *s);
 void server_rotate(Server *s);
 int server_schedule_sync(Server *s, int priority);
+int server_schedule_post_change(Server *s);
+void server_post_change(Server *s);
 int server_flush_to_var(Server *s);
+int server_flush_queue(Server *s, ServerBatchFlags flags);
+int server_start_writer(Server *s);
+int server_stop_writer(Server *s);
 int process_event(Server *s, struct epoll_event *ev);
 void server_maybe_append_tags(Server *s);
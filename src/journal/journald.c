@@ -28,7 +28,6 @@
 #include <systemd/sd-messages.h>
 #include <systemd/sd-daemon.h>
 
-#include "journal-authenticate.h"
 #include "journald-server.h"
 #include "journald-kmsg.h"
 #include "journald-syslog.h"
@@ -69,39 +68,18 @@ int main(int argc, char *argv[]) {
                   "READY=1\n"
                   "STATUS=Processing requests...");
 
+        r = server_start_writer(&server);
+        if (r < 0)
+                goto finish;
+
         for (;;) {
                 struct epoll_event event;
-                int t = -1;
-                usec_t n;
-
-                n = now(CLOCK_REALTIME);
-
-                if (server.max_retention_usec > 0 && server.oldest_file_usec > 0) {
-
-                        /* The retention time is reached, so let's vacuum! */
-                        if (server.oldest_file_usec + server.max_retention_usec < n) {
-                                log_info("Retention time reached.");
-                                server_rotate(&server);
-                                server_vacuum(&server);
-                                continue;
-                        }
-
-                        /* Calculate when to rotate the next time */
-                        t = (int) ((server.oldest_file_usec + server.max_retention_usec - n + USEC_PER_MSEC - 1) / USEC_PER_MSEC);
-                }
+                int t;
 
-#ifdef HAVE_GCRYPT
-                if (server.system_journal) {
-                        usec_t u;
-
-                        if (journal_file_next_evolve_usec(server.system_journal, &u)) {
-                                if (n >= u)
-                                        t = 0;
-                                else
-                                        t = MIN(t, (int) ((u - n + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
-                        }
-                }
-#endif
+                /* Don't wait while there's something queued, so
+                 * that we notice quickly when we are idle and hand
+                 * it to the writer */
+                t = server.queue ? 0 : -1;
 
                 r = epoll_wait(server.epoll_fd, &event, 1, t);
                 if (r < 0) {
@@ -120,9 +98,9 @@ int main(int argc, char *argv[]) {
                                 goto finish;
                         else if (r == 0)
                                 break;
-                }
+                } else
+                        server_flush_queue(&server, 0);
 
-                server_maybe_append_tags(&server);
                 server_maybe_warn_forward_syslog_missed(&server);
         }
 
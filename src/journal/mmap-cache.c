@@ -65,22 +65,42 @@ struct Context {
 struct FileDescriptor {
         MMapCache *cache;
         int fd;
+        uint64_t window_size;
         LIST_HEAD(Window, windows);
 };
 
 struct MMapCache {
         int n_ref;
         unsigned n_windows;
+        uint64_t mapped;
+
+        uint64_t n_hit;
+        uint64_t n_miss;
+        uint64_t n_unmap;
 
         Hashmap *fds;
         Hashmap *contexts;
 
+        /* Windows no context refers to, most recently used first */
         LIST_HEAD(Window, unused);
         Window *last_unused;
 };
 
-#define WINDOWS_MIN 64
+/* Windows start out with WINDOW_SIZE, and grow up to WINDOW_SIZE_MAX
+ * while a file is read sequentially, or shrink down to WINDOW_SIZE_MIN
+ * while we jump around in it, for example when bisecting. */
 #define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
+#define WINDOW_SIZE_MIN (1ULL*1024ULL*1024ULL)
+#define WINDOW_SIZE_MAX (32ULL*1024ULL*1024ULL)
+
+/* How much all caches of the process may keep mapped together, before
+ * they start to unmap the windows they didn't use for the longest
+ * time. Windows that are in use are never unmapped, hence this may be
+ * exceeded. */
+#define MMAP_CACHE_BUDGET (512ULL*1024ULL*1024ULL)
+
+static uint64_t budget = MMAP_CACHE_BUDGET;
+static uint64_t mapped_total = 0;
 
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
@@ -106,9 +126,14 @@ static void window_unlink(Window *w) {
 
         assert(w);
 
-        if (w->ptr)
+        if (w->ptr) {
                 munmap(w->ptr, w->size);
 
+                w->cache->mapped -= w->size;
+                __sync_sub_and_fetch(&mapped_total, w->size);
+                w->cache->n_unmap++;
+        }
+
         if (w->fd)
                 LIST_REMOVE(by_fd, w->fd->windows, w);
 
@@ -151,20 +176,11 @@ static Window *window_add(MMapCache *m) {
 
         assert(m);
 
-        if (!m->last_unused || m->n_windows <= WINDOWS_MIN) {
-
-                /* Allocate a new window */
-                w = new0(Window, 1);
-                if (!w)
-                        return NULL;
-                m->n_windows++;
-        } else {
+        w = new0(Window, 1);
+        if (!w)
+                return NULL;
 
-                /* Reuse an existing one */
-                w = m->last_unused;
-                window_unlink(w);
-                zero(*w);
-        }
+        m->n_windows++;
 
         w->cache = m;
         return w;
@@ -288,6 +304,7 @@ static FileDescriptor* fd_add(MMapCache *m, int fd) {
 
         f->cache = m;
         f->fd = fd;
+        f->window_size = WINDOW_SIZE;
 
         r = hashmap_put(m->fds, UINT_TO_PTR(fd + 1), f);
         if (r < 0) {
@@ -341,6 +358,15 @@ static int make_room(MMapCache *m) {
         return 1;
 }
 
+static void keep_budget(MMapCache *m, uint64_t size) {
+        assert(m);
+
+        /* Unmap the least recently used windows until there is
+         * room for size more bytes */
+        while (m->last_unused && mapped_total + size > budget)
+                window_free(m->last_unused);
+}
+
 static int try_context(
                 MMapCache *m,
                 int fd,
@@ -377,6 +403,8 @@ static int try_context(
 
         c->window->keep_always = c->window->keep_always || keep_always;
 
+        m->n_hit++;
+
         *ret = (uint8_t*) c->window->ptr + (offset - c->window->offset);
         return 1;
 }
@@ -421,6 +449,8 @@ static int find_mmap(
         context_attach_window(c, w);
         w->keep_always = w->keep_always || keep_always;
 
+        m->n_hit++;
+
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         return 1;
 }
@@ -439,9 +469,9 @@ static int add_mmap(
         uint64_t woffset, wsize;
         Context *c;
         FileDescriptor *f;
-        Window *w;
+        Window *w, *last;
         void *d;
-        int r;
+        int direction = 0, r;
 
         assert(m);
         assert(m->n_ref > 0);
@@ -449,21 +479,53 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        m->n_miss++;
+
+        f = fd_add(m, fd);
+        if (!f)
+                return -ENOMEM;
+
+        /* Guess how the file is accessed from where the window we
+         * added last for it is: if we are just past either end of it
+         * we are reading sequentially, otherwise we are jumping
+         * around. */
+        last = f->windows;
+        if (last) {
+                if (offset >= last->offset &&
+                    offset + size > last->offset + last->size &&
+                    offset < last->offset + last->size + f->window_size) {
+                        f->window_size = MIN(f->window_size * 2, WINDOW_SIZE_MAX);
+                        direction = 1;
+                } else if (offset < last->offset &&
+                           offset + size + f->window_size > last->offset) {
+                        f->window_size = MIN(f->window_size * 2, WINDOW_SIZE_MAX);
+                        direction = -1;
+                } else
+                        f->window_size = MAX(f->window_size / 2, WINDOW_SIZE_MIN);
+        }
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
+        if (wsize < f->window_size) {
                 uint64_t delta;
 
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
+                /* Map ahead in the direction we are reading in, or
+                 * around the requested range if we don't know it */
+                if (direction > 0)
+                        delta = 0;
+                else if (direction < 0)
+                        delta = f->window_size - wsize;
+                else
+                        delta = PAGE_ALIGN((f->window_size - wsize) / 2);
 
-                if (delta > offset)
+                if (delta > woffset)
                         woffset = 0;
                 else
                         woffset -= delta;
 
-                wsize = WINDOW_SIZE;
+                wsize = f->window_size;
         }
 
         if (st) {
@@ -478,6 +540,8 @@ static int add_mmap(
                         wsize = PAGE_ALIGN(st->st_size - woffset);
         }
 
+        keep_budget(m, wsize);
+
         for (;;) {
                 d = mmap(NULL, wsize, prot, MAP_SHARED, fd, woffset);
                 if (d != MAP_FAILED)
@@ -494,15 +558,11 @@ static int add_mmap(
 
         c = context_add(m, context);
         if (!c)
-                return -ENOMEM;
-
-        f = fd_add(m, fd);
-        if (!f)
-                return -ENOMEM;
+                goto fail;
 
         w = window_add(m);
         if (!w)
-                return -ENOMEM;
+                goto fail;
 
         w->keep_always = keep_always;
         w->ptr = d;
@@ -511,6 +571,9 @@ static int add_mmap(
         w->size = wsize;
         w->fd = f;
 
+        m->mapped += wsize;
+        __sync_add_and_fetch(&mapped_total, wsize);
+
         LIST_PREPEND(by_fd, f->windows, w);
 
         context_detach_window(c);
@@ -519,6 +582,10 @@ static int add_mmap(
 
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         return 1;
+
+fail:
+        munmap(d, wsize);
+        return -ENOMEM;
 }
 
 int mmap_cache_get(
@@ -578,3 +645,25 @@ void mmap_cache_close_context(MMapCache *m, unsigned context) {
 
         context_free(c);
 }
+
+void mmap_cache_get_statistics(MMapCache *m, uint64_t *n_hit, uint64_t *n_miss, uint64_t *n_unmap, uint64_t *mapped) {
+        assert(m);
+
+        if (n_hit)
+                *n_hit = m->n_hit;
+
+        if (n_miss)
+                *n_miss = m->n_miss;
+
+        if (n_unmap)
+                *n_unmap = m->n_unmap;
+
+        if (mapped)
+                *mapped = m->mapped;
+}
+
+void mmap_cache_set_budget(uint64_t bytes) {
+        assert(bytes > 0);
+
+        budget = bytes;
+}
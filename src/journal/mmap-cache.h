@@ -34,3 +34,8 @@ MMapCache* mmap_cache_unref(MMapCache *m);
 int mmap_cache_get(MMapCache *m, int fd, int prot, unsigned context, bool keep_always, uint64_t offset, size_t size, struct stat *st, void **ret);
 void mmap_cache_close_fd(MMapCache *m, int fd);
 void mmap_cache_close_context(MMapCache *m, unsigned context);
+
+void mmap_cache_get_statistics(MMapCache *m, uint64_t *n_hit, uint64_t *n_miss, uint64_t *n_unmap, uint64_t *mapped);
+
+/* Applies to all caches of the process together */
+void mmap_cache_set_budget(uint64_t bytes);
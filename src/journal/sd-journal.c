@@ -31,6 +31,8 @@
 #include "sd-journal.h"
 #include "journal-def.h"
 #include "journal-file.h"
+#include "journal-index.h"
+#include "journal-ranges.h"
 #include "hashmap.h"
 #include "list.h"
 #include "strv.h"
@@ -74,6 +76,29 @@ static int set_put_error(sd_journal *j, int r) {
         return set_put(j->errors, INT_TO_PTR(r));
 }
 
+struct Candidate {
+        JournalFile *file;
+        uint64_t offset;
+        Location location;
+        unsigned idx;
+};
+
+static void invalidate_candidates(sd_journal *j) {
+        assert(j);
+
+        prioq_free(j->candidate_queue);
+        j->candidate_queue = NULL;
+
+        free(j->candidates);
+        j->candidates = NULL;
+
+        free(j->waiting);
+        j->waiting = NULL;
+        j->n_waiting = 0;
+
+        j->candidates_valid = false;
+}
+
 static void detach_location(sd_journal *j) {
         Iterator i;
         JournalFile *f;
@@ -83,6 +108,8 @@ static void detach_location(sd_journal *j) {
         j->current_file = NULL;
         j->current_field = 0;
 
+        invalidate_candidates(j);
+
         HASHMAP_FOREACH(f, j->files, i)
                 f->current_offset = 0;
 }
@@ -419,90 +446,6 @@ _public_ void sd_journal_flush_matches(sd_journal *j) {
         detach_location(j);
 }
 
-static int compare_entry_order(JournalFile *af, Object *_ao,
-                               JournalFile *bf, uint64_t bp) {
-
-        uint64_t a, b;
-        Object *ao, *bo;
-        int r;
-
-        assert(af);
-        assert(bf);
-        assert(_ao);
-
-        /* The mmap cache might invalidate the object from the first
-         * file if we look at the one from the second file. Hence
-         * temporarily copy the header of the first one, and look at
-         * that only. */
-        ao = alloca(offsetof(EntryObject, items));
-        memcpy(ao, _ao, offsetof(EntryObject, items));
-
-        r = journal_file_move_to_object(bf, OBJECT_ENTRY, bp, &bo);
-        if (r < 0)
-                return strcmp(af->path, bf->path);
-
-        /* We operate on two different files here, hence we can access
-         * two objects at the same time, which we normally can't.
-         *
-         * If contents and timestamps match, these entries are
-         * identical, even if the seqnum does not match */
-
-        if (sd_id128_equal(ao->entry.boot_id, bo->entry.boot_id) &&
-            ao->entry.monotonic == bo->entry.monotonic &&
-            ao->entry.realtime == bo->entry.realtime &&
-            ao->entry.xor_hash == bo->entry.xor_hash)
-                return 0;
-
-        if (sd_id128_equal(af->header->seqnum_id, bf->header->seqnum_id)) {
-
-                /* If this is from the same seqnum source, compare
-                 * seqnums */
-                a = le64toh(ao->entry.seqnum);
-                b = le64toh(bo->entry.seqnum);
-
-                if (a < b)
-                        return -1;
-                if (a > b)
-                        return 1;
-
-                /* Wow! This is weird, different data but the same
-                 * seqnums? Something is borked, but let's make the
-                 * best of it and compare by time. */
-        }
-
-        if (sd_id128_equal(ao->entry.boot_id, bo->entry.boot_id)) {
-
-                /* If the boot id matches compare monotonic time */
-                a = le64toh(ao->entry.monotonic);
-                b = le64toh(bo->entry.monotonic);
-
-                if (a < b)
-                        return -1;
-                if (a > b)
-                        return 1;
-        }
-
-        /* Otherwise compare UTC time */
-        a = le64toh(ao->entry.realtime);
-        b = le64toh(bo->entry.realtime);
-
-        if (a < b)
-                return -1;
-        if (a > b)
-                return 1;
-
-        /* Finally, compare by contents */
-        a = le64toh(ao->entry.xor_hash);
-        b = le64toh(bo->entry.xor_hash);
-
-        if (a < b)
-                return -1;
-        if (a > b)
-                return 1;
-
-        return 0;
-}
-
 _pure_ static int compare_with_location(JournalFile *af, Object *ao, Location *l) {
         uint64_t a;
 
@@ -655,6 +598,69 @@ static int next_for_match(
         return 1;
 }
 
+static int compare_locations(const Location *a, const Location *b) {
+        assert(a);
+        assert(b);
+
+        /* If contents and timestamps match, these entries are
+         * identical, even if the seqnum does not match */
+
+        if (sd_id128_equal(a->boot_id, b->boot_id) &&
+            a->monotonic == b->monotonic &&
+            a->realtime == b->realtime &&
+            a->xor_hash == b->xor_hash)
+                return 0;
+
+        if (sd_id128_equal(a->seqnum_id, b->seqnum_id)) {
+
+                /* If this is from the same seqnum source, compare
+                 * seqnums */
+                if (a->seqnum < b->seqnum)
+                        return -1;
+                if (a->seqnum > b->seqnum)
+                        return 1;
+
+                /* Wow! This is weird, different data but the same
+                 * seqnums? Something is borked, but let's make the
+                 * best of it and compare by time. */
+        }
+
+        if (sd_id128_equal(a->boot_id, b->boot_id)) {
+
+                /* If the boot id matches compare monotonic time */
+                if (a->monotonic < b->monotonic)
+                        return -1;
+                if (a->monotonic > b->monotonic)
+                        return 1;
+        }
+
+        /* Otherwise compare UTC time */
+        if (a->realtime < b->realtime)
+                return -1;
+        if (a->realtime > b->realtime)
+                return 1;
+
+        /* Finally, compare by contents */
+        if (a->xor_hash < b->xor_hash)
+                return -1;
+        if (a->xor_hash > b->xor_hash)
+                return 1;
+
+        return 0;
+}
+
+static int candidate_compare_down(const void *a, const void *b) {
+        const Candidate *x = a, *y = b;
+
+        return compare_locations(&x->location, &y->location);
+}
+
+static int candidate_compare_up(const void *a, const void *b) {
+        const Candidate *x = a, *y = b;
+
+        return compare_locations(&y->location, &x->location);
+}
+
 static int find_location_for_match(
                 sd_journal *j,
                 Match *m,
@@ -876,12 +882,188 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *f, *new_file = NULL;
-        uint64_t new_offset = 0;
+static bool index_may_match(sd_journal *j, JournalIndex *index, Match *m, direction_t direction, bool by_realtime) {
+        const JournalIndexItem *item;
+        Match *i;
+
+        assert(j);
+        assert(index);
+        assert(m);
+
+        if (m->type == MATCH_DISCRETE) {
+                item = journal_index_lookup(index, le64toh(m->le_hash));
+                if (!item)
+                        return false;
+
+                /* Seeking by time only finds entries on the right
+                 * side of the location */
+                if (by_realtime) {
+                        if (direction == DIRECTION_DOWN)
+                                return le64toh(item->tail_entry_realtime) >= j->current_location.realtime;
+                        else
+                                return le64toh(item->head_entry_realtime) <= j->current_location.realtime;
+                }
+
+                return true;
+
+        } else if (m->type == MATCH_OR_TERM) {
+
+                LIST_FOREACH(matches, i, m->matches)
+                        if (index_may_match(j, index, i, direction, by_realtime))
+                                return true;
+
+                return false;
+
+        } else {
+                assert(m->type == MATCH_AND_TERM);
+
+                if (!m->matches)
+                        return false;
+
+                LIST_FOREACH(matches, i, m->matches)
+                        if (!index_may_match(j, index, i, direction, by_realtime))
+                                return false;
+
+                return true;
+        }
+}
+
+static bool file_may_match(sd_journal *j, JournalFile *f, direction_t direction) {
+        bool by_realtime;
+        int r;
+
+        assert(j);
+        assert(f);
+
+        /* Uses the index of the file, if there is one, to find out
+         * if looking for matching entries in it is pointless */
+
+        if (!j->level0)
+                return true;
+
+        if (!f->index_loaded) {
+                r = journal_index_open(f, &f->index);
+                if (r < 0 && r != -ENOENT)
+                        log_debug("Failed to open index of %s, ignoring: %s", f->path, strerror(-r));
+
+                f->index_loaded = true;
+        }
+
+        if (!f->index)
+                return true;
+
+        j->n_index_lookups++;
+
+        /* Only if find_location_for_match() would end up looking
+         * for the realtime timestamp */
+        by_realtime =
+                f->current_offset == 0 &&
+                j->current_location.type == LOCATION_SEEK &&
+                j->current_location.realtime_set &&
+                !j->current_location.monotonic_set &&
+                !(j->current_location.seqnum_set && sd_id128_equal(j->current_location.seqnum_id, f->header->seqnum_id));
+
+        if (index_may_match(j, f->index, j->level0, direction, by_realtime))
+                return true;
+
+        j->n_index_skipped++;
+        return false;
+}
+
+static int candidate_update(sd_journal *j, Candidate *c, direction_t direction) {
         Object *o;
         uint64_t p;
+        int r;
+
+        assert(j);
+        assert(c);
+
+        /* Looks for the next entry of the file beyond the current
+         * location. Returns > 0 if there is one. */
+
+        r = next_beyond_location(j, c->file, direction, &o, &p);
+        if (r < 0) {
+                log_debug("Can't iterate through %s, ignoring: %s", c->file->path, strerror(-r));
+                return 0;
+        } else if (r == 0)
+                return 0;
+
+        c->offset = p;
+        init_location(&c->location, LOCATION_DISCRETE, c->file, o);
+
+        return 1;
+}
+
+static int candidate_wait(sd_journal *j, Candidate *c) {
+        assert(j);
+        assert(c);
+
+        /* Archived files will never get new entries, so there's no
+         * need to check them again. All others we look at on each
+         * step. */
+        if (c->file->header->state == STATE_ARCHIVED)
+                return 0;
+
+        j->waiting[j->n_waiting++] = c;
+        return 0;
+}
+
+static int add_deferred_files(sd_journal *j, bool all, direction_t direction);
+
+static int build_candidates(sd_journal *j, direction_t direction) {
+        JournalFile *f;
         Iterator i;
+        unsigned n = 0;
+        int r;
+
+        assert(j);
+
+        /* Open the files we need now, and only those */
+        r = add_deferred_files(j, false, direction);
+        if (r < 0)
+                return r;
+
+        invalidate_candidates(j);
+
+        j->candidates = new(Candidate, hashmap_size(j->files));
+        j->waiting = new(Candidate*, hashmap_size(j->files));
+        j->candidate_queue = prioq_new(direction == DIRECTION_DOWN ? candidate_compare_down : candidate_compare_up);
+        if (!j->candidates || !j->waiting || !j->candidate_queue) {
+                invalidate_candidates(j);
+                return -ENOMEM;
+        }
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                Candidate *c = j->candidates + n++;
+
+                c->file = f;
+                c->idx = PRIOQ_IDX_NULL;
+
+                /* Archived files never change, hence there's no
+                 * need to wait for them either */
+                if (!file_may_match(j, f, direction))
+                        continue;
+
+                if (candidate_update(j, c, direction) > 0)
+                        r = prioq_put(j->candidate_queue, c, &c->idx);
+                else
+                        r = candidate_wait(j, c);
+                if (r < 0) {
+                        invalidate_candidates(j);
+                        return r;
+                }
+        }
+
+        j->candidate_direction = direction;
+        j->candidates_valid = true;
+
+        return 0;
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        Candidate *c;
+        Object *o;
+        unsigned i;
         int r;
 
         if (!j)
@@ -889,40 +1071,65 @@ static int real_journal_next(sd_journal *j, direction_t direction) {
         if (journal_pid_changed(j))
                 return -ECHILD;
 
-        HASHMAP_FOREACH(f, j->files, i) {
-                bool found;
+        /* This is a k-way merge of the files: we keep the next entry
+         * of each file in a priority queue, and after taking one
+         * only the file it came from needs to be advanced. */
 
-                r = next_beyond_location(j, f, direction, &o, &p);
-                if (r < 0) {
-                        log_debug("Can't iterate through %s, ignoring: %s", f->path, strerror(-r));
-                        continue;
-                } else if (r == 0)
-                        continue;
+        if (!j->candidates_valid || j->candidate_direction != direction) {
+                r = build_candidates(j, direction);
+                if (r < 0)
+                        return r;
+        } else {
+                /* Files that had nothing more to offer might have
+                 * been written to in the meantime */
+                for (i = 0; i < j->n_waiting; ) {
+                        c = j->waiting[i];
 
-                if (!new_file)
-                        found = true;
-                else {
-                        int k;
+                        if (candidate_update(j, c, direction) <= 0) {
+                                i++;
+                                continue;
+                        }
 
-                        k = compare_entry_order(f, o, new_file, new_offset);
+                        r = prioq_put(j->candidate_queue, c, &c->idx);
+                        if (r < 0)
+                                return r;
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
+                        j->waiting[i] = j->waiting[--j->n_waiting];
                 }
+        }
 
-                if (found) {
-                        new_file = f;
-                        new_offset = p;
+        for (;;) {
+                int k;
+
+                c = prioq_peek(j->candidate_queue);
+                if (!c)
+                        return 0;
+
+                if (j->current_location.type != LOCATION_DISCRETE)
+                        break;
+
+                k = compare_locations(&c->location, &j->current_location);
+                if (direction == DIRECTION_DOWN ? k > 0 : k < 0)
+                        break;
+
+                /* This is the entry we returned last, or one
+                 * identical to it in another file, hence move on in
+                 * that file */
+                if (candidate_update(j, c, direction) > 0)
+                        r = prioq_reshuffle(j->candidate_queue, c, &c->idx);
+                else {
+                        prioq_remove(j->candidate_queue, c, &c->idx);
+                        r = candidate_wait(j, c);
                 }
+                if (r < 0)
+                        return r;
         }
 
-        if (!new_file)
-                return 0;
-
-        r = journal_file_move_to_object(new_file, OBJECT_ENTRY, new_offset, &o);
+        r = journal_file_move_to_object(c->file, OBJECT_ENTRY, c->offset, &o);
         if (r < 0)
                 return r;
 
-        set_location(j, LOCATION_DISCRETE, new_file, o, direction, new_offset);
+        set_location(j, LOCATION_DISCRETE, c->file, o, direction, c->offset);
 
         return 1;
 }
@@ -1324,10 +1531,15 @@ static int add_any_file(sd_journal *j, const char *path) {
                 return set_put_error(j, -ETOOMANYREFS);
         }
 
-        r = journal_file_open(path, O_RDONLY, 0, false, false, NULL, j->mmap, NULL, &f);
+        r = journal_file_open(path, O_RDONLY, 0, 0, false, NULL, j->mmap, NULL, &f);
         if (r < 0)
                 return r;
 
+        /* Share codec state and decompression scratch space among
+         * all files, there's no point in keeping them per file */
+        compress_context_unref(f->compress_context);
+        f->compress_context = compress_context_ref(j->compress_context);
+
         /* journal_file_dump(f); */
 
         r = hashmap_put(j->files, f->path, f);
@@ -1340,6 +1552,8 @@ static int add_any_file(sd_journal *j, const char *path) {
 
         check_network(j, f->fd);
 
+        invalidate_candidates(j);
+
         j->current_invalidate_counter ++;
 
         return 0;
@@ -1367,37 +1581,234 @@ static int add_file(sd_journal *j, const char *prefix, const char *filename) {
         return 0;
 }
 
-static int remove_file(sd_journal *j, const char *prefix, const char *filename) {
+struct DeferredFile {
         char *path;
-        JournalFile *f;
+        usec_t head_realtime;
+        usec_t tail_realtime;
+};
+
+static void deferred_file_free(DeferredFile *d) {
+        assert(d);
+
+        free(d->path);
+        free(d);
+}
+
+static int defer_file(sd_journal *j, const char *prefix, const JournalRangesItem *item) {
+        DeferredFile *d;
+        char *path;
+        int r;
 
         assert(j);
         assert(prefix);
-        assert(filename);
+        assert(item);
 
-        path = strjoin(prefix, "/", filename, NULL);
+        path = strjoin(prefix, "/", item->filename, NULL);
         if (!path)
                 return -ENOMEM;
 
-        f = hashmap_get(j->files, path);
-        free(path);
-        if (!f)
+        if (hashmap_get(j->files, path) || hashmap_get(j->deferred_files, path)) {
+                free(path);
                 return 0;
+        }
 
-        hashmap_remove(j->files, f->path);
+        d = new0(DeferredFile, 1);
+        if (!d) {
+                free(path);
+                return -ENOMEM;
+        }
 
-        log_debug("File %s removed.", f->path);
+        d->path = path;
+        d->head_realtime = item->head_realtime;
+        d->tail_realtime = item->tail_realtime;
 
-        if (j->current_file == f) {
-                j->current_file = NULL;
-                j->current_field = 0;
+        r = hashmap_put(j->deferred_files, d->path, d);
+        if (r < 0) {
+                deferred_file_free(d);
+                return r;
         }
 
+        log_debug("File %s deferred.", d->path);
+
+        return 0;
+}
+
+static bool deferred_file_wanted(sd_journal *j, DeferredFile *d, direction_t direction) {
+        Location *l;
+
+        assert(j);
+        assert(d);
+
+        l = &j->current_location;
+
+        /* Only if find_location_with_matches() would look for the
+         * realtime timestamp we know which files can be of
+         * interest */
+        if (l->type != LOCATION_SEEK ||
+            !l->realtime_set ||
+            l->monotonic_set ||
+            l->seqnum_set)
+                return true;
+
+        if (direction == DIRECTION_DOWN)
+                return d->tail_realtime >= l->realtime;
+        else
+                return d->head_realtime <= l->realtime;
+}
+
+static int add_deferred_file(sd_journal *j, DeferredFile *d) {
+        int r;
+
+        assert(j);
+        assert(d);
+
+        hashmap_remove(j->deferred_files, d->path);
+
+        r = add_any_file(j, d->path);
+        if (r < 0 && r != -ENOENT) {
+                log_debug("Failed to add file %s: %s", d->path, strerror(-r));
+
+                r = set_put_error(j, r);
+                if (r < 0) {
+                        deferred_file_free(d);
+                        return r;
+                }
+        }
+
+        deferred_file_free(d);
+        return 0;
+}
+
+static int add_deferred_files(sd_journal *j, bool all, direction_t direction) {
+        DeferredFile *d;
+        Iterator i;
+        int r;
+
+        assert(j);
+
+        HASHMAP_FOREACH(d, j->deferred_files, i) {
+
+                if (!all && !deferred_file_wanted(j, d, direction))
+                        continue;
+
+                r = add_deferred_file(j, d);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int journal_add_deferred_files(sd_journal *j) {
+        assert(j);
+
+        return add_deferred_files(j, true, DIRECTION_DOWN);
+}
+
+static int add_directory_file(sd_journal *j, Directory *m, JournalRanges *ranges, DIR *d, struct dirent *de) {
+        const JournalRangesItem *item;
+        struct stat st;
+        JournalFile *f;
+        char *path;
+        int r;
+
+        assert(j);
+        assert(m);
+        assert(ranges);
+        assert(d);
+        assert(de);
+
+        if (j->no_new_files ||
+            !file_type_wanted(j->flags, de->d_name))
+                return 0;
+
+        /* Archived files of which we know the time range are only
+         * opened once a query might need them */
+        if (journal_ranges_file_wanted(de->d_name, NULL) &&
+            fstatat(dirfd(d), de->d_name, &st, 0) >= 0) {
+
+                item = journal_ranges_get(ranges, de->d_name, st.st_ino);
+                if (item && faccessat(dirfd(d), de->d_name, R_OK, 0) >= 0)
+                        return defer_file(j, m->path, item);
+        }
+
+        r = add_file(j, m->path, de->d_name);
+        if (r < 0)
+                return r;
+
+        if (!journal_ranges_file_wanted(de->d_name, NULL))
+                return 0;
+
+        /* Remember the range of this one for the next time */
+        path = strjoin(m->path, "/", de->d_name, NULL);
+        if (!path)
+                return -ENOMEM;
+
+        f = hashmap_get(j->files, path);
+        free(path);
+
+        if (f)
+                return journal_ranges_put(ranges, de->d_name, f);
+
+        return 0;
+}
+
+static void save_ranges(JournalRanges *ranges, const char *path) {
+        int r;
+
+        assert(ranges);
+        assert(path);
+
+        if (!ranges->dirty || access(path, W_OK) < 0)
+                return;
+
+        r = journal_ranges_save(ranges, path);
+        if (r < 0)
+                log_debug("Failed to save time ranges of %s: %s", path, strerror(-r));
+}
+
+static int remove_file(sd_journal *j, const char *prefix, const char *filename) {
+        char *path;
+        JournalFile *f;
+        DeferredFile *d;
+
+        assert(j);
+        assert(prefix);
+        assert(filename);
+
+        path = strjoin(prefix, "/", filename, NULL);
+        if (!path)
+                return -ENOMEM;
+
+        d = hashmap_remove(j->deferred_files, path);
+        if (d) {
+                log_debug("Deferred file %s removed.", d->path);
+                deferred_file_free(d);
+        }
+
+        f = hashmap_get(j->files, path);
+        free(path);
+        if (!f)
+                return 0;
+
+        hashmap_remove(j->files, f->path);
+
+        log_debug("File %s removed.", f->path);
+
+        if (j->current_file == f) {
+                j->current_file = NULL;
+                j->current_field = 0;
+        }
+
+        /* The values returned so far are remembered, hence starting
+         * again from the first file does not return any twice */
         if (j->unique_file == f) {
                 j->unique_file = NULL;
                 j->unique_offset = 0;
         }
 
+        invalidate_candidates(j);
+
         journal_file_close(f);
 
         j->current_invalidate_counter ++;
@@ -1410,6 +1821,7 @@ static int add_directory(sd_journal *j, const char *prefix, const char *dirname)
         int r;
         _cleanup_closedir_ DIR *d = NULL;
         sd_id128_t id, mid;
+        JournalRanges *ranges;
         Directory *m;
 
         assert(j);
@@ -1469,6 +1881,10 @@ static int add_directory(sd_journal *j, const char *prefix, const char *dirname)
                         inotify_rm_watch(j->inotify_fd, m->wd);
         }
 
+        r = journal_ranges_load(m->path, &ranges);
+        if (r < 0)
+                return r;
+
         for (;;) {
                 struct dirent *de;
                 union dirent_storage buf;
@@ -1479,24 +1895,30 @@ static int add_directory(sd_journal *j, const char *prefix, const char *dirname)
 
                 if (dirent_is_file_with_suffix(de, ".journal") ||
                     dirent_is_file_with_suffix(de, ".journal~")) {
-                        r = add_file(j, m->path, de->d_name);
+                        r = add_directory_file(j, m, ranges, d, de);
                         if (r < 0) {
                                 log_debug("Failed to add file %s/%s: %s",
                                           m->path, de->d_name, strerror(-r));
                                 r = set_put_error(j, r);
-                                if (r < 0)
+                                if (r < 0) {
+                                        journal_ranges_free(ranges);
                                         return r;
+                                }
                         }
                 }
         }
 
         check_network(j, dirfd(d));
 
+        save_ranges(ranges, m->path);
+        journal_ranges_free(ranges);
+
         return 0;
 }
 
 static int add_root_directory(sd_journal *j, const char *p) {
         _cleanup_closedir_ DIR *d = NULL;
+        JournalRanges *ranges;
         Directory *m;
         int r;
 
@@ -1550,6 +1972,10 @@ static int add_root_directory(sd_journal *j, const char *p) {
         if (j->no_new_files)
                 return 0;
 
+        r = journal_ranges_load(m->path, &ranges);
+        if (r < 0)
+                return r;
+
         for (;;) {
                 struct dirent *de;
                 union dirent_storage buf;
@@ -1561,13 +1987,15 @@ static int add_root_directory(sd_journal *j, const char *p) {
 
                 if (dirent_is_file_with_suffix(de, ".journal") ||
                     dirent_is_file_with_suffix(de, ".journal~")) {
-                        r = add_file(j, m->path, de->d_name);
+                        r = add_directory_file(j, m, ranges, d, de);
                         if (r < 0) {
                                 log_debug("Failed to add file %s/%s: %s",
                                           m->path, de->d_name, strerror(-r));
                                 r = set_put_error(j, r);
-                                if (r < 0)
+                                if (r < 0) {
+                                        journal_ranges_free(ranges);
                                         return r;
+                                }
                         }
                 } else if ((de->d_type == DT_DIR || de->d_type == DT_LNK || de->d_type == DT_UNKNOWN) &&
                            sd_id128_from_string(de->d_name, &id) >= 0) {
@@ -1580,6 +2008,9 @@ static int add_root_directory(sd_journal *j, const char *p) {
 
         check_network(j, dirfd(d));
 
+        save_ranges(ranges, m->path);
+        journal_ranges_free(ranges);
+
         return 0;
 }
 
@@ -1689,6 +2120,7 @@ static sd_journal *journal_new(int flags, const char *path) {
         j->inotify_fd = -1;
         j->flags = flags;
         j->data_threshold = DEFAULT_DATA_THRESHOLD;
+        j->unique_until = (usec_t) -1;
 
         if (path) {
                 j->path = strdup(path);
@@ -1697,9 +2129,11 @@ static sd_journal *journal_new(int flags, const char *path) {
         }
 
         j->files = hashmap_new(string_hash_func, string_compare_func);
+        j->deferred_files = hashmap_new(string_hash_func, string_compare_func);
         j->directories_by_path = hashmap_new(string_hash_func, string_compare_func);
         j->mmap = mmap_cache_new();
-        if (!j->files || !j->directories_by_path || !j->mmap)
+        j->compress_context = compress_context_new();
+        if (!j->files || !j->deferred_files || !j->directories_by_path || !j->mmap || !j->compress_context)
                 goto fail;
 
         return j;
@@ -1808,6 +2242,7 @@ fail:
 _public_ void sd_journal_close(sd_journal *j) {
         Directory *d;
         JournalFile *f;
+        DeferredFile *df;
 
         if (!j)
                 return;
@@ -1819,6 +2254,11 @@ _public_ void sd_journal_close(sd_journal *j) {
 
         hashmap_free(j->files);
 
+        while ((df = hashmap_steal_first(j->deferred_files)))
+                deferred_file_free(df);
+
+        hashmap_free(j->deferred_files);
+
         while ((d = hashmap_first(j->directories_by_path)))
                 remove_directory(j, d);
 
@@ -1834,8 +2274,16 @@ _public_ void sd_journal_close(sd_journal *j) {
         if (j->mmap)
                 mmap_cache_unref(j->mmap);
 
+        catalog_close(j->catalog);
+
+        if (j->compress_context)
+                compress_context_unref(j->compress_context);
+
         free(j->path);
         free(j->unique_field);
+        set_free_free(j->unique_values);
+        free(j->unique_collected);
+        strv_free(j->projection);
         set_free(j->errors);
         free(j);
 }
@@ -1934,11 +2382,113 @@ static bool field_is_valid(const char *field) {
         return true;
 }
 
+static ProjectionCacheItem *projection_cache_item(sd_journal *j, JournalFile *f, uint64_t p) {
+        assert(j);
+        assert(f);
+
+        if (f->projection_generation != j->projection_generation) {
+                if (f->projection_cache)
+                        memzero(f->projection_cache, sizeof(ProjectionCacheItem) * PROJECTION_CACHE_SIZE);
+
+                f->projection_generation = j->projection_generation;
+        }
+
+        if (!f->projection_cache) {
+                f->projection_cache = new0(ProjectionCacheItem, PROJECTION_CACHE_SIZE);
+                if (!f->projection_cache)
+                        return NULL;
+        }
+
+        /* Objects are 64bit aligned */
+        return f->projection_cache + (p / 8) % PROJECTION_CACHE_SIZE;
+}
+
+static int projection_find(sd_journal *j, const char *field, size_t field_length) {
+        char **i;
+
+        assert(j);
+        assert(field);
+
+        STRV_FOREACH(i, j->projection)
+                if (strlen(*i) == field_length && memcmp(*i, field, field_length) == 0)
+                        return i - j->projection;
+
+        return -1;
+}
+
+static int projection_get_data(
+                sd_journal *j,
+                JournalFile *f,
+                uint64_t p,
+                le64_t le_hash,
+                int want,
+                const void **data,
+                size_t *size) {
+
+        ProjectionCacheItem *ci;
+        Object *o;
+        char **i;
+        int r, field = -1;
+
+        assert(j);
+        assert(f);
+        assert(data);
+        assert(size);
+
+        /* Returns the DATA object at p, if it belongs to the
+         * projected field want, or any projected field if want is
+         * negative. Which field an object belongs to is only figured
+         * out once and then remembered, for all other fields the
+         * object is not looked at again. */
+
+        ci = projection_cache_item(j, f, p);
+        if (ci && ci->offset == p) {
+                if (ci->field < 0 || (want >= 0 && ci->field != want))
+                        return 0;
+
+                field = ci->field;
+        }
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+        if (r < 0)
+                return r;
+
+        if (le_hash != o->data.hash)
+                return -EBADMSG;
+
+        if (field >= 0) {
+                r = journal_file_data_payload(f, o, p, NULL, 0, j->data_threshold, data, size);
+                if (r < 0)
+                        return r;
+
+                return 1;
+        }
+
+        /* Compressed objects are only decompressed as far as needed
+         * to compare the field names */
+        STRV_FOREACH(i, j->projection) {
+                r = journal_file_data_payload(f, o, p, *i, strlen(*i), j->data_threshold, data, size);
+                if (r < 0)
+                        return r;
+                if (r > 0) {
+                        field = i - j->projection;
+                        break;
+                }
+        }
+
+        if (ci) {
+                ci->offset = p;
+                ci->field = field;
+        }
+
+        return field >= 0 && (want < 0 || field == want);
+}
+
 _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **data, size_t *size) {
         JournalFile *f;
         uint64_t i, n;
         size_t field_length;
-        int r;
+        int r, want;
         Object *o;
 
         if (!j)
@@ -1967,96 +2517,96 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
                 return r;
 
         field_length = strlen(field);
+        want = projection_find(j, field, field_length);
 
         n = journal_file_entry_n_items(o);
         for (i = 0; i < n; i++) {
-                uint64_t p, l;
+                uint64_t p;
                 le64_t le_hash;
-                size_t t;
 
                 p = le64toh(o->entry.items[i].object_offset);
                 le_hash = o->entry.items[i].hash;
-                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
-                if (r < 0)
-                        return r;
 
-                if (le_hash != o->data.hash)
-                        return -EBADMSG;
+                if (want >= 0) {
+                        r = projection_get_data(j, f, p, le_hash, want, data, size);
+                        if (r < 0)
+                                return r;
+                        if (r > 0)
+                                return 0;
+                } else {
+                        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                        if (r < 0)
+                                return r;
 
-                l = le64toh(o->object.size) - offsetof(Object, data.payload);
+                        if (le_hash != o->data.hash)
+                                return -EBADMSG;
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
+                        r = journal_file_data_payload(f, o, p, field, field_length, j->data_threshold, data, size);
+                        if (r < 0)
+                                return r;
+                        if (r > 0)
+                                return 0;
+                }
 
-#ifdef HAVE_XZ
-                        if (uncompress_startswith(o->data.payload, l,
-                                                  &f->compress_buffer, &f->compress_buffer_size,
-                                                  field, field_length, '=')) {
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                if (r < 0)
+                        return r;
+        }
 
-                                uint64_t rsize;
+        return -ENOENT;
+}
 
-                                if (!uncompress_blob(o->data.payload, l,
-                                                     &f->compress_buffer, &f->compress_buffer_size, &rsize,
-                                                     j->data_threshold))
-                                        return -EBADMSG;
+static int return_data(sd_journal *j, JournalFile *f, Object *o, uint64_t p, const void **data, size_t *size) {
+        int r;
 
-                                *data = f->compress_buffer;
-                                *size = (size_t) rsize;
+        r = journal_file_data_payload(f, o, p, NULL, 0, j->data_threshold, data, size);
+        if (r < 0)
+                return r;
 
-                                return 0;
-                        }
-#else
-                        return -EPROTONOSUPPORT;
-#endif
+        return 0;
+}
 
-                } else if (l >= field_length+1 &&
-                           memcmp(o->data.payload, field, field_length) == 0 &&
-                           o->data.payload[field_length] == '=') {
+static int enumerate_projection(sd_journal *j, JournalFile *f, const void **data, size_t *size) {
+        uint64_t p, n;
+        le64_t le_hash;
+        int r;
+        Object *o;
 
-                        t = (size_t) l;
+        assert(j);
+        assert(f);
 
-                        if ((uint64_t) t != l)
-                                return -E2BIG;
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+        if (r < 0)
+                return r;
 
-                        *data = o->data.payload;
-                        *size = t;
+        n = journal_file_entry_n_items(o);
 
-                        return 0;
+        while (j->current_field < n) {
+                ProjectionCacheItem *ci;
+
+                p = le64toh(o->entry.items[j->current_field].object_offset);
+                le_hash = o->entry.items[j->current_field].hash;
+
+                /* Skip the fields we already know are not wanted
+                 * without touching anything but the entry */
+                ci = projection_cache_item(j, f, p);
+                if (ci && ci->offset == p && ci->field < 0) {
+                        j->current_field ++;
+                        continue;
                 }
 
-                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                r = projection_get_data(j, f, p, le_hash, -1, data, size);
                 if (r < 0)
                         return r;
-        }
-
-        return -ENOENT;
-}
-
-static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **data, size_t *size) {
-        size_t t;
-        uint64_t l;
-
-        l = le64toh(o->object.size) - offsetof(Object, data.payload);
-        t = (size_t) l;
 
-        /* We can't read objects larger than 4G on a 32bit machine */
-        if ((uint64_t) t != l)
-                return -E2BIG;
+                j->current_field ++;
 
-        if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
-                uint64_t rsize;
-
-                if (!uncompress_blob(o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, j->data_threshold))
-                        return -EBADMSG;
+                if (r > 0)
+                        return 1;
 
-                *data = f->compress_buffer;
-                *size = (size_t) rsize;
-#else
-                return -EPROTONOSUPPORT;
-#endif
-        } else {
-                *data = o->data.payload;
-                *size = t;
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                if (r < 0)
+                        return r;
         }
 
         return 0;
@@ -2085,6 +2635,9 @@ _public_ int sd_journal_enumerate_data(sd_journal *j, const void **data, size_t
         if (f->current_offset <= 0)
                 return -EADDRNOTAVAIL;
 
+        if (j->projection)
+                return enumerate_projection(j, f, data, size);
+
         r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
         if (r < 0)
                 return r;
@@ -2102,7 +2655,7 @@ _public_ int sd_journal_enumerate_data(sd_journal *j, const void **data, size_t
         if (le_hash != o->data.hash)
                 return -EBADMSG;
 
-        r = return_data(j, f, o, data, size);
+        r = return_data(j, f, o, p, data, size);
         if (r < 0)
                 return r;
 
@@ -2118,6 +2671,41 @@ _public_ void sd_journal_restart_data(sd_journal *j) {
         j->current_field = 0;
 }
 
+_public_ int sd_journal_add_data_field(sd_journal *j, const char *field) {
+        int r;
+
+        if (!j)
+                return -EINVAL;
+        if (journal_pid_changed(j))
+                return -ECHILD;
+        if (!field)
+                return -EINVAL;
+
+        if (!field_is_valid(field))
+                return -EINVAL;
+
+        if (projection_find(j, field, strlen(field)) >= 0)
+                return 0;
+
+        /* Objects the cache knows as unwanted might belong to the
+         * new field, hence it needs to be flushed */
+        r = strv_extend(&j->projection, field);
+        if (r < 0)
+                return r;
+
+        j->projection_generation++;
+        return 0;
+}
+
+_public_ void sd_journal_flush_data_fields(sd_journal *j) {
+        if (!j)
+                return;
+
+        strv_free(j->projection);
+        j->projection = NULL;
+        j->projection_generation++;
+}
+
 _public_ int sd_journal_get_fd(sd_journal *j) {
         int r;
 
@@ -2356,6 +2944,7 @@ _public_ int sd_journal_wait(sd_journal *j, uint64_t timeout_usec) {
 _public_ int sd_journal_get_cutoff_realtime_usec(sd_journal *j, uint64_t *from, uint64_t *to) {
         Iterator i;
         JournalFile *f;
+        DeferredFile *d;
         bool first = true;
         int r;
 
@@ -2393,6 +2982,25 @@ _public_ int sd_journal_get_cutoff_realtime_usec(sd_journal *j, uint64_t *from,
                 }
         }
 
+        /* For these we know the range without opening them */
+        HASHMAP_FOREACH(d, j->deferred_files, i) {
+                if (d->head_realtime == 0)
+                        continue;
+
+                if (first) {
+                        if (from)
+                                *from = d->head_realtime;
+                        if (to)
+                                *to = d->tail_realtime;
+                        first = false;
+                } else {
+                        if (from)
+                                *from = MIN(d->head_realtime, *from);
+                        if (to)
+                                *to = MAX(d->tail_realtime, *to);
+                }
+        }
+
         return first ? 0 : 1;
 }
 
@@ -2411,6 +3019,10 @@ _public_ int sd_journal_get_cutoff_monotonic_usec(sd_journal *j, sd_id128_t boot
         if (from == to)
                 return -EINVAL;
 
+        r = journal_add_deferred_files(j);
+        if (r < 0)
+                return r;
+
         HASHMAP_FOREACH(f, j->files, i) {
                 usec_t fr, t;
 
@@ -2446,6 +3058,8 @@ void journal_print_header(sd_journal *j) {
 
         assert(j);
 
+        journal_add_deferred_files(j);
+
         HASHMAP_FOREACH(f, j->files, i) {
                 if (newline)
                         putchar('\n');
@@ -2456,9 +3070,43 @@ void journal_print_header(sd_journal *j) {
         }
 }
 
+void journal_log_statistics(sd_journal *j) {
+        char fb[FORMAT_BYTES_MAX];
+        Iterator i;
+        JournalFile *f;
+        uint64_t hit = 0, miss = 0, unmap, mapped;
+
+        assert(j);
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                hit += f->n_decompress_cache_hit;
+                miss += f->n_decompress_cache_miss;
+        }
+
+        log_debug("Decompression cache: %"PRIu64" hits, %"PRIu64" misses, %.1f%% hit rate",
+                  hit, miss, hit + miss > 0 ? 100.0 * (double) hit / (double) (hit + miss) : 0.0);
+
+        mmap_cache_get_statistics(j->mmap, &hit, &miss, &unmap, &mapped);
+
+        log_debug("Memory map cache: %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" unmaps, %s mapped",
+                  hit, miss, unmap, format_bytes(fb, sizeof(fb), mapped));
+
+        log_debug("File indexes: %"PRIu64" files checked, %"PRIu64" skipped",
+                  j->n_index_lookups, j->n_index_skipped);
+
+        log_debug("Files: %u opened, %u not opened as they are outside the time range",
+                  hashmap_size(j->files), hashmap_size(j->deferred_files));
+
+        if (j->catalog) {
+                catalog_get_statistics(j->catalog, &hit, &miss);
+                log_debug("Catalog: %"PRIu64" lookups, %"PRIu64" of them in the database", hit + miss, miss);
+        }
+}
+
 _public_ int sd_journal_get_usage(sd_journal *j, uint64_t *bytes) {
         Iterator i;
         JournalFile *f;
+        DeferredFile *d;
         uint64_t sum = 0;
 
         if (!j)
@@ -2477,10 +3125,82 @@ _public_ int sd_journal_get_usage(sd_journal *j, uint64_t *bytes) {
                 sum += (uint64_t) st.st_blocks * 512ULL;
         }
 
+        HASHMAP_FOREACH(d, j->deferred_files, i) {
+                struct stat st;
+
+                if (stat(d->path, &st) < 0) {
+                        if (errno == ENOENT)
+                                continue;
+
+                        return -errno;
+                }
+
+                sum += (uint64_t) st.st_blocks * 512ULL;
+        }
+
         *bytes = sum;
         return 0;
 }
 
+typedef struct UniqueValue {
+        uint64_t hash;
+        size_t size;
+        const void *data;
+} UniqueValue;
+
+static unsigned unique_value_hash_func(const void *p) {
+        const UniqueValue *v = p;
+
+        /* The hash of the DATA object is good enough */
+        return (unsigned) (v->hash ^ (v->hash >> 32));
+}
+
+static int unique_value_compare_func(const void *a, const void *b) {
+        const UniqueValue *x = a, *y = b;
+
+        if (x->hash != y->hash)
+                return x->hash < y->hash ? -1 : 1;
+
+        if (x->size != y->size)
+                return x->size < y->size ? -1 : 1;
+
+        return memcmp(x->data, y->data, x->size);
+}
+
+static int unique_value_add(sd_journal *j, const UniqueValue *key) {
+        UniqueValue *v;
+        int r;
+
+        assert(j);
+        assert(key);
+
+        v = malloc(sizeof(UniqueValue) + key->size);
+        if (!v)
+                return -ENOMEM;
+
+        v->hash = key->hash;
+        v->size = key->size;
+        v->data = memcpy(v + 1, key->data, key->size);
+
+        r = set_put(j->unique_values, v);
+        if (r < 0) {
+                free(v);
+                return r;
+        }
+
+        return 0;
+}
+
+static void unique_reset(sd_journal *j) {
+        assert(j);
+
+        j->unique_file = NULL;
+        j->unique_offset = 0;
+
+        if (j->unique_values)
+                set_clear_free(j->unique_values);
+}
+
 _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
         char *f;
 
@@ -2493,21 +3213,212 @@ _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
         if (!field_is_valid(field))
                 return -EINVAL;
 
+        if (!j->unique_values) {
+                j->unique_values = set_new(unique_value_hash_func, unique_value_compare_func);
+                if (!j->unique_values)
+                        return -ENOMEM;
+        }
+
         f = strdup(field);
         if (!f)
                 return -ENOMEM;
 
         free(j->unique_field);
         j->unique_field = f;
-        j->unique_file = NULL;
+        unique_reset(j);
+
+        return 0;
+}
+
+int journal_set_unique_window(sd_journal *j, usec_t since, usec_t until) {
+        assert(j);
+
+        if (since > until)
+                return -EINVAL;
+
+        j->unique_since = since;
+        j->unique_until = until;
+        unique_reset(j);
+
+        return 0;
+}
+
+static bool unique_window_set(sd_journal *j) {
+        assert(j);
+
+        return j->unique_since > 0 || j->unique_until != (usec_t) -1;
+}
+
+static int unique_add_deferred_files(sd_journal *j) {
+        DeferredFile *d;
+        Iterator i;
+        int r;
+
+        assert(j);
+
+        if (!unique_window_set(j))
+                return journal_add_deferred_files(j);
+
+        /* Files which cover a different time range cannot contain
+         * any of the values we are looking for */
+        HASHMAP_FOREACH(d, j->deferred_files, i) {
+
+                if (d->tail_realtime < j->unique_since ||
+                    d->head_realtime > j->unique_until)
+                        continue;
+
+                r = add_deferred_file(j, d);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static void unique_begin_file(sd_journal *j) {
+        JournalFile *f;
+
+        assert(j);
+        assert(j->unique_file);
+
+        f = j->unique_file;
+
         j->unique_offset = 0;
+        j->unique_index = 0;
+        j->unique_n_collected = 0;
+        j->unique_cached = f->unique_cache ? hashmap_get(f->unique_cache, j->unique_field) : NULL;
+
+        /* Archived files never change, hence we can remember the
+         * objects of the field for the next time. Decided once, so
+         * that a file archived while we walk it is not cached with
+         * only the objects collected after that */
+        j->unique_collect = !j->unique_cached && f->header->state == STATE_ARCHIVED;
+
+        if (unique_window_set(j))
+                j->unique_skip_file =
+                        le64toh(f->header->n_entries) <= 0 ||
+                        le64toh(f->header->tail_entry_realtime) < j->unique_since ||
+                        le64toh(f->header->head_entry_realtime) > j->unique_until;
+        else
+                j->unique_skip_file = false;
+}
+
+static int unique_cache_put(sd_journal *j) {
+        UniqueCacheItem *u;
+        JournalFile *f;
+        size_t l;
+        int r;
+
+        assert(j);
+        assert(j->unique_file);
+
+        f = j->unique_file;
+
+        r = hashmap_ensure_allocated(&f->unique_cache, string_hash_func, string_compare_func);
+        if (r < 0)
+                return r;
+
+        l = strlen(j->unique_field);
+
+        u = malloc(offsetof(UniqueCacheItem, offsets) + sizeof(uint64_t) * j->unique_n_collected + l + 1);
+        if (!u)
+                return -ENOMEM;
+
+        u->n_offsets = j->unique_n_collected;
+        memcpy(u->offsets, j->unique_collected, sizeof(uint64_t) * u->n_offsets);
+        u->field = (char*) (u->offsets + u->n_offsets);
+        memcpy(u->field, j->unique_field, l + 1);
+
+        r = hashmap_put(f->unique_cache, u->field, u);
+        if (r < 0) {
+                free(u);
+                return r == -EEXIST ? 0 : r;
+        }
 
         return 0;
 }
 
-_public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_t *l) {
+static int unique_next_offset(sd_journal *j, uint64_t *ret) {
+        JournalFile *f;
         Object *o;
-        size_t k;
+        int r;
+
+        assert(j);
+        assert(j->unique_file);
+        assert(ret);
+
+        /* Returns the next DATA object of the field in the current
+         * file, 0 when there is none anymore */
+
+        f = j->unique_file;
+
+        if (j->unique_skip_file)
+                return 0;
+
+        if (j->unique_cached) {
+                if (j->unique_index >= j->unique_cached->n_offsets)
+                        return 0;
+
+                *ret = j->unique_cached->offsets[j->unique_index++];
+                return 1;
+        }
+
+        /* Proceed to next data object in the field's linked list */
+        if (j->unique_offset == 0) {
+                r = journal_file_find_field_object(f, j->unique_field, strlen(j->unique_field), &o, NULL);
+                if (r < 0)
+                        return r;
+
+                j->unique_offset = r > 0 ? le64toh(o->field.head_data_offset) : 0;
+        } else {
+                r = journal_file_move_to_object(f, OBJECT_DATA, j->unique_offset, &o);
+                if (r < 0)
+                        return r;
+
+                j->unique_offset = le64toh(o->data.next_field_offset);
+        }
+
+        if (j->unique_offset == 0) {
+                if (j->unique_collect) {
+                        r = unique_cache_put(j);
+                        if (r < 0)
+                                return r;
+                }
+
+                return 0;
+        }
+
+        if (j->unique_collect) {
+                if (!GREEDY_REALLOC(j->unique_collected, j->unique_collected_allocated, j->unique_n_collected + 1))
+                        return -ENOMEM;
+
+                j->unique_collected[j->unique_n_collected++] = j->unique_offset;
+        }
+
+        *ret = j->unique_offset;
+        return 1;
+}
+
+static int unique_in_window(sd_journal *j, uint64_t p) {
+        Object *o;
+        int r;
+
+        assert(j);
+        assert(j->unique_file);
+
+        if (!unique_window_set(j))
+                return 1;
+
+        /* Look for the first entry with the value since the
+         * beginning of the window */
+        r = journal_file_move_to_entry_by_realtime_for_data(j->unique_file, p, j->unique_since, DIRECTION_DOWN, &o, NULL);
+        if (r <= 0)
+                return r;
+
+        return le64toh(o->entry.realtime) <= j->unique_until;
+}
+
+_public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_t *l) {
         int r;
 
         if (!j)
@@ -2521,39 +3432,29 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
         if (!j->unique_field)
                 return -EINVAL;
 
-        k = strlen(j->unique_field);
-
         if (!j->unique_file) {
+                r = unique_add_deferred_files(j);
+                if (r < 0)
+                        return r;
+
                 j->unique_file = hashmap_first(j->files);
                 if (!j->unique_file)
                         return 0;
-                j->unique_offset = 0;
+
+                unique_begin_file(j);
         }
 
         for (;;) {
-                JournalFile *of;
-                Iterator i;
-                const void *odata;
-                size_t ol;
-                bool found;
-
-                /* Proceed to next data object in the field's linked list */
-                if (j->unique_offset == 0) {
-                        r = journal_file_find_field_object(j->unique_file, j->unique_field, k, &o, NULL);
-                        if (r < 0)
-                                return r;
+                UniqueValue key;
+                uint64_t p;
+                Object *o;
 
-                        j->unique_offset = r > 0 ? le64toh(o->field.head_data_offset) : 0;
-                } else {
-                        r = journal_file_move_to_object(j->unique_file, OBJECT_DATA, j->unique_offset, &o);
-                        if (r < 0)
-                                return r;
-
-                        j->unique_offset = le64toh(o->data.next_field_offset);
-                }
+                r = unique_next_offset(j, &p);
+                if (r < 0)
+                        return r;
 
                 /* We reached the end of the list? Then start again, with the next file */
-                if (j->unique_offset == 0) {
+                if (r == 0) {
                         JournalFile *n;
 
                         n = hashmap_next(j->files, j->unique_file->path);
@@ -2561,53 +3462,34 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                                 return 0;
 
                         j->unique_file = n;
+                        unique_begin_file(j);
                         continue;
                 }
 
-                /* We do not use the type context here, but 0 instead,
-                 * so that we can look at this data object at the same
-                 * time as one on another file */
-                r = journal_file_move_to_object(j->unique_file, 0, j->unique_offset, &o);
+                r = unique_in_window(j, p);
                 if (r < 0)
                         return r;
+                if (r == 0)
+                        continue;
 
-                /* Let's do the type check by hand, since we used 0 context above. */
-                if (o->object.type != OBJECT_DATA)
-                        return -EBADMSG;
-
-                r = return_data(j, j->unique_file, o, &odata, &ol);
+                r = journal_file_move_to_object(j->unique_file, OBJECT_DATA, p, &o);
                 if (r < 0)
                         return r;
 
-                /* OK, now let's see if we already returned this data
-                 * object by checking if it exists in the earlier
-                 * traversed files. */
-                found = false;
-                HASHMAP_FOREACH(of, j->files, i) {
-                        Object *oo;
-                        uint64_t op;
-
-                        if (of == j->unique_file)
-                                break;
-
-                        /* Skip this file it didn't have any fields
-                         * indexed */
-                        if (JOURNAL_HEADER_CONTAINS(of->header, n_fields) &&
-                            le64toh(of->header->n_fields) <= 0)
-                                continue;
-
-                        r = journal_file_find_data_object_with_hash(of, odata, ol, le64toh(o->data.hash), &oo, &op);
-                        if (r < 0)
-                                return r;
+                r = return_data(j, j->unique_file, o, p, data, l);
+                if (r < 0)
+                        return r;
 
-                        if (r > 0)
-                                found = true;
-                }
+                /* Did we return this value already, from this or an
+                 * earlier file? */
+                key.hash = le64toh(o->data.hash);
+                key.size = *l;
+                key.data = *data;
 
-                if (found)
+                if (set_get(j->unique_values, &key))
                         continue;
 
-                r = return_data(j, j->unique_file, o, data, l);
+                r = unique_value_add(j, &key);
                 if (r < 0)
                         return r;
 
@@ -2619,8 +3501,7 @@ _public_ void sd_journal_restart_unique(sd_journal *j) {
         if (!j)
                 return;
 
-        j->unique_file = NULL;
-        j->unique_offset = 0;
+        unique_reset(j);
 }
 
 _public_ int sd_journal_reliable_fd(sd_journal *j) {
@@ -2655,7 +3536,8 @@ _public_ int sd_journal_get_catalog(sd_journal *j, char **ret) {
         const void *data;
         size_t size;
         sd_id128_t id;
-        _cleanup_free_ char *text = NULL, *cid = NULL;
+        char cid[37];
+        const char *text;
         char *t;
         int r;
 
@@ -2670,15 +3552,25 @@ _public_ int sd_journal_get_catalog(sd_journal *j, char **ret) {
         if (r < 0)
                 return r;
 
-        cid = strndup((const char*) data + 11, size - 11);
-        if (!cid)
-                return -ENOMEM;
+        if (size - 11 >= sizeof(cid))
+                return -EINVAL;
+
+        memcpy(cid, (const char*) data + 11, size - 11);
+        cid[size - 11] = 0;
 
         r = sd_id128_from_string(cid, &id);
         if (r < 0)
                 return r;
 
-        r = catalog_get(CATALOG_DATABASE, id, &text);
+        /* This is called for every entry by journalctl -x, hence
+         * keep the database open, and remember what we found */
+        if (!j->catalog) {
+                r = catalog_open(CATALOG_DATABASE, &j->catalog);
+                if (r < 0)
+                        return r;
+        }
+
+        r = catalog_lookup(j->catalog, id, &text);
         if (r < 0)
                 return r;
 
@@ -0,0 +1,195 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <locale.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "sd-messages.h"
+#include "logs-show.h"
+#include "catalog.h"
+#include "journal-file.h"
+#include "journal-internal.h"
+
+/* Shows what the catalog costs per entry with journalctl -x, once
+ * for the lookup alone, once for the whole output. Takes the number
+ * of entries (default 10000). Every entry carries a MESSAGE_ID, one
+ * in eight of them one which is not in the catalog. */
+
+static unsigned arg_entries = 10000;
+
+static const char *catalog_dirs[] = {
+        CATALOG_DIR,
+        NULL,
+};
+
+static sd_id128_t id_for(unsigned i) {
+        static const sd_id128_t ids[] = {
+                SD_MESSAGE_UNIT_STARTING,
+                SD_MESSAGE_UNIT_STARTED,
+                SD_MESSAGE_UNIT_STOPPING,
+                SD_MESSAGE_UNIT_STOPPED,
+                SD_MESSAGE_SESSION_START,
+                SD_MESSAGE_COREDUMP,
+                SD_MESSAGE_JOURNAL_START,
+                SD_ID128_MAKE(01,23,45,67,89,ab,cd,ef,01,23,45,67,89,ab,cd,ef),
+        };
+
+        return ids[i % ELEMENTSOF(ids)];
+}
+
+static void make_journal(const char *directory) {
+        _cleanup_free_ char *path = NULL;
+        JournalFile *f;
+        uint64_t seqnum = 0;
+        unsigned i;
+
+        assert_se(path = strappend(directory, "/test.journal"));
+        assert_se(journal_file_open(path, O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < arg_entries; i++) {
+                char message[LINE_MAX], message_id[sizeof("MESSAGE_ID=") + 32];
+                struct iovec iovec[4];
+                dual_timestamp ts;
+
+                snprintf(message, sizeof(message), "MESSAGE=Benchmark message %u", i);
+                snprintf(message_id, sizeof(message_id), "MESSAGE_ID=" SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(id_for(i)));
+
+                IOVEC_SET_STRING(iovec[0], message);
+                IOVEC_SET_STRING(iovec[1], message_id);
+                IOVEC_SET_STRING(iovec[2], "UNIT=benchmark.service");
+                IOVEC_SET_STRING(iovec[3], "SYSLOG_IDENTIFIER=benchmark");
+
+                ts.realtime = 1000000000000000ULL + i;
+                ts.monotonic = i + 1;
+
+                assert_se(journal_file_append_entry(f, &ts, iovec, ELEMENTSOF(iovec), &seqnum, NULL, NULL) >= 0);
+        }
+
+        journal_file_close(f);
+}
+
+static void lookup(const char *database) {
+        Catalog *c;
+        usec_t usec;
+        unsigned i;
+
+        usec = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < arg_entries; i++) {
+                _cleanup_free_ char *text = NULL;
+
+                assert_se(catalog_get(database, id_for(i), &text) >= 0 || i % 8 == 7);
+        }
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+        printf("%-24s %8.0f ns/lookup\n", "lookup, reopening:", (double) usec * 1000.0 / arg_entries);
+
+        assert_se(catalog_open(database, &c) >= 0);
+
+        usec = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < arg_entries; i++) {
+                const char *text;
+
+                assert_se(catalog_lookup(c, id_for(i), &text) >= 0 || i % 8 == 7);
+        }
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+        printf("%-24s %8.0f ns/lookup\n", "lookup, handle:", (double) usec * 1000.0 / arg_entries);
+
+        catalog_close(c);
+}
+
+static usec_t run(const char *directory, const char *database, FILE *null, OutputFlags flags) {
+        sd_journal *j;
+        usec_t usec;
+        unsigned n = 0;
+        int r;
+
+        assert_se(sd_journal_open_directory(&j, directory, 0) >= 0);
+        assert_se(catalog_open(database, &j->catalog) >= 0);
+
+        usec = now(CLOCK_MONOTONIC);
+
+        while ((r = sd_journal_next(j)) > 0) {
+                assert_se(output_journal(null, j, OUTPUT_SHORT, 80, flags, NULL) >= 0);
+                n++;
+        }
+        assert_se(r == 0);
+
+        fflush(null);
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+
+        assert_se(n == arg_entries);
+
+        sd_journal_close(j);
+
+        return usec;
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/catalog-benchmark-XXXXXX";
+        _cleanup_fclose_ FILE *null = NULL;
+        _cleanup_free_ char *database = NULL;
+        usec_t plain, with_catalog;
+
+        setlocale(LC_ALL, "");
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_entries) < 0 || arg_entries == 0)) {
+                log_error("Failed to parse number of entries: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(null = fopen("/dev/null", "we"));
+
+        assert_se(mkdtemp(t));
+        assert_se(database = strappend(t, "/database"));
+        assert_se(catalog_update(database, NULL, catalog_dirs) >= 0);
+
+        make_journal(t);
+
+        lookup(database);
+
+        plain = run(t, database, null, 0);
+        with_catalog = run(t, database, null, OUTPUT_CATALOG);
+
+        printf("%-24s %8.0f ns/entry\n", "output:", (double) plain * 1000.0 / arg_entries);
+        printf("%-24s %8.0f ns/entry\n", "output with catalog:", (double) with_catalog * 1000.0 / arg_entries);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return EXIT_SUCCESS;
+}
@@ -120,6 +120,42 @@ static void test_catalog_update(void) {
         assert(r >= 0);
 }
 
+static void test_catalog_lookup(void) {
+        _cleanup_free_ char *text = NULL;
+        const char *s;
+        Catalog *c;
+        uint64_t n_hit, n_miss;
+        sd_id128_t unknown = SD_ID128_MAKE(01,23,45,67,89,ab,cd,ef,01,23,45,67,89,ab,cd,ef);
+
+        assert_se(catalog_open(database, &c) >= 0);
+        assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &text) >= 0);
+
+        /* The second time the text comes from the cache, same for
+         * ids which are not in the catalog */
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &s) >= 0);
+        assert_se(streq(s, text));
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &s) >= 0);
+        assert_se(streq(s, text));
+
+        assert_se(catalog_lookup(c, unknown, &s) == -ENOENT);
+        assert_se(catalog_lookup(c, unknown, &s) == -ENOENT);
+
+        catalog_get_statistics(c, &n_hit, &n_miss);
+        assert_se(n_hit == 2);
+        assert_se(n_miss == 2);
+
+        /* The language fallback is resolved again for another
+         * locale */
+        setlocale(LC_ALL, "C");
+        free(text);
+        text = NULL;
+        assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &text) >= 0);
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &s) >= 0);
+        assert_se(streq(s, text));
+
+        catalog_close(c);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_free_ char *text = NULL;
         int r;
@@ -141,6 +177,8 @@ int main(int argc, char *argv[]) {
         assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &text) >= 0);
         printf(">>>%s<<<\n", text);
 
+        test_catalog_lookup();
+
         if (database)
                 unlink(database);
 
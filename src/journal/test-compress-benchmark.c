@@ -0,0 +1,193 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "time-util.h"
+#include "compress.h"
+
+/* Compares the available compression codecs on the data fields of a
+ * real journal. Takes an optional journal directory and an optional
+ * minimal field size, which defaults to the threshold journald
+ * applies before compressing anything. */
+
+#define CORPUS_MAX (64ULL*1024ULL*1024ULL)
+
+typedef struct Blob {
+        void *data;
+        uint64_t size;
+} Blob;
+
+static Blob *blobs = NULL;
+static unsigned n_blobs = 0;
+static size_t n_allocated = 0;
+static uint64_t corpus_size = 0;
+
+static int load_corpus(const char *directory, uint64_t threshold) {
+        sd_journal *j;
+        const void *data;
+        size_t l;
+        int r;
+
+        if (directory)
+                r = sd_journal_open_directory(&j, directory, 0);
+        else
+                r = sd_journal_open(&j, 0);
+        if (r < 0) {
+                log_error("Failed to open journal: %s", strerror(-r));
+                return r;
+        }
+
+        SD_JOURNAL_FOREACH(j) {
+                SD_JOURNAL_FOREACH_DATA(j, data, l) {
+                        Blob *b;
+
+                        if (l < threshold)
+                                continue;
+
+                        if (corpus_size + l > CORPUS_MAX)
+                                goto finish;
+
+                        if (!GREEDY_REALLOC(blobs, n_allocated, n_blobs + 1)) {
+                                r = log_oom();
+                                goto finish;
+                        }
+
+                        b = blobs + n_blobs;
+                        b->data = memdup(data, l);
+                        if (!b->data) {
+                                r = log_oom();
+                                goto finish;
+                        }
+
+                        b->size = l;
+                        corpus_size += l;
+                        n_blobs++;
+                }
+        }
+
+finish:
+        sd_journal_close(j);
+        return r < 0 ? r : 0;
+}
+
+static void benchmark(int compression) {
+        _cleanup_compress_context_unref_ CompressContext *c = NULL;
+        Blob *compressed;
+        void *buffer = NULL;
+        uint64_t buffer_size = 0, total = 0, failed = 0;
+        usec_t t, compress_usec, uncompress_usec;
+        unsigned i;
+
+        c = compress_context_new();
+        assert_se(c);
+
+        compressed = new0(Blob, n_blobs);
+        assert_se(compressed);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n_blobs; i++) {
+                compressed[i].data = malloc(blobs[i].size);
+                assert_se(compressed[i].data);
+
+                if (compress_blob(c, compression, blobs[i].data, blobs[i].size,
+                                  compressed[i].data, &compressed[i].size) < 0) {
+                        /* Stored uncompressed, just like journald would */
+                        free(compressed[i].data);
+                        compressed[i].data = NULL;
+                        compressed[i].size = blobs[i].size;
+                        failed++;
+                }
+
+                total += compressed[i].size;
+        }
+        compress_usec = now(CLOCK_MONOTONIC) - t;
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n_blobs; i++) {
+                uint64_t size;
+
+                if (!compressed[i].data)
+                        continue;
+
+                assert_se(uncompress_blob(c, compression, compressed[i].data, compressed[i].size,
+                                          &buffer, &buffer_size, &size, 0) >= 0);
+                assert_se(size == blobs[i].size);
+        }
+        uncompress_usec = now(CLOCK_MONOTONIC) - t;
+
+        printf("%-4s %12"PRIu64" -> %12"PRIu64" bytes (%5.1f%%, %"PRIu64" not compressible), "
+               "compress %8.1f MB/s, decompress %8.1f MB/s\n",
+               object_compressed_to_string(compression),
+               corpus_size, total,
+               100.0 * (double) total / (double) corpus_size,
+               failed,
+               (double) corpus_size / (double) MAX(compress_usec, 1ULL),
+               (double) corpus_size / (double) MAX(uncompress_usec, 1ULL));
+
+        for (i = 0; i < n_blobs; i++)
+                free(compressed[i].data);
+        free(compressed);
+        free(buffer);
+}
+
+int main(int argc, char *argv[]) {
+        uint64_t threshold = 512;
+        unsigned i;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 2 && safe_atou64(argv[2], &threshold) < 0) {
+                log_error("Failed to parse threshold: %s", argv[2]);
+                return EXIT_FAILURE;
+        }
+
+        if (load_corpus(argc > 1 ? argv[1] : NULL, threshold) < 0)
+                return EXIT_FAILURE;
+
+        if (n_blobs == 0) {
+                log_info("No data fields of at least %"PRIu64" bytes found.", threshold);
+                return EXIT_SUCCESS;
+        }
+
+        printf("Corpus: %u fields, %"PRIu64" bytes\n", n_blobs, corpus_size);
+
+#ifdef HAVE_XZ
+        benchmark(OBJECT_COMPRESSED_XZ);
+#endif
+#ifdef HAVE_LZ4
+        benchmark(OBJECT_COMPRESSED_LZ4);
+#endif
+
+        for (i = 0; i < n_blobs; i++)
+                free(blobs[i].data);
+        free(blobs);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "compress.h"
+
+static void test_compress_roundtrip(int compression) {
+        char text[4096], compressed[4096], random[4096];
+        _cleanup_free_ char *decompressed = NULL;
+        _cleanup_compress_context_unref_ CompressContext *c = NULL;
+        uint64_t csize, dsize, alloc = 0;
+        unsigned i;
+        int r;
+
+        assert_se(c = compress_context_new());
+
+        log_info("/* testing %s */", object_compressed_to_string(compression));
+
+        for (i = 0; i < sizeof(text); i++)
+                text[i] = "MESSAGE=foobar waldo quux "[i % 26];
+
+        r = compress_blob(c, compression, text, sizeof(text), compressed, &csize);
+        assert_se(r == 0);
+        assert_se(csize > 0 && csize < sizeof(text));
+
+        r = uncompress_blob(c, compression, compressed, csize, (void**) &decompressed, &alloc, &dsize, 0);
+        assert_se(r == 0);
+        assert_se(dsize == sizeof(text));
+        assert_se(memcmp(text, decompressed, sizeof(text)) == 0);
+
+        /* The context is reused for the next round */
+        r = uncompress_blob(c, compression, compressed, csize, (void**) &decompressed, &alloc, &dsize, 0);
+        assert_se(r == 0);
+        assert_se(dsize == sizeof(text));
+        assert_se(memcmp(text, decompressed, sizeof(text)) == 0);
+
+        /* Corrupted data must not decompress */
+        memset(compressed, 0xFF, csize / 2);
+        r = uncompress_blob(c, compression, compressed, csize, (void**) &decompressed, &alloc, &dsize, 0);
+        assert_se(r < 0);
+
+        assert_se(compress_blob(c, compression, text, sizeof(text), compressed, &csize) == 0);
+
+        assert_se(uncompress_startswith(c, compression, compressed, csize,
+                                        (void**) &decompressed, &alloc,
+                                        "MESSAGE", 7, '=') > 0);
+        assert_se(uncompress_startswith(c, compression, compressed, csize,
+                                        (void**) &decompressed, &alloc,
+                                        "MESSAGE", 7, 'x') == 0);
+        assert_se(uncompress_startswith(c, compression, compressed, csize,
+                                        (void**) &decompressed, &alloc,
+                                        "FOOBAR", 6, '=') == 0);
+
+        r = uncompress_blob(c, compression, compressed, csize, (void**) &decompressed, &alloc, &dsize, 0);
+        assert_se(r == 0);
+        assert_se(dsize == sizeof(text));
+        assert_se(memcmp(text, decompressed, sizeof(text)) == 0);
+
+        /* Data that does not shrink must be refused */
+        srand(4711);
+        for (i = 0; i < sizeof(random); i++)
+                random[i] = rand() & 0xFF;
+
+        assert_se(compress_blob(c, compression, random, sizeof(random), compressed, &csize) == -ENOBUFS);
+}
+
+static void fill(char *buf, size_t size, uint64_t offset) {
+        size_t i;
+
+        /* Mostly zero pages with some text, which is roughly what
+         * cores look like */
+        if ((offset / size) % 4 != 0) {
+                memset(buf, 0, size);
+                return;
+        }
+
+        for (i = 0; i < size; i++)
+                buf[i] = "MESSAGE=foobar waldo quux "[(offset + i) % 26] ^ (((offset + i) / 4096) & 0x1F);
+}
+
+static void test_compress_stream(int compression) {
+        char src[] = "/tmp/compress-stream-XXXXXX", dst[] = "/tmp/compress-stream-XXXXXX",
+                out[] = "/tmp/compress-stream-XXXXXX";
+        _cleanup_close_ int fds = -1, fdd = -1, fdo = -1;
+        char buf[4096], buf2[4096];
+        uint64_t i, size = 256 * sizeof(buf);
+        off_t csize;
+
+        log_info("/* testing %s stream */", object_compressed_to_string(compression) ?: "uncompressed");
+
+        assert_se((fds = mkostemp(src, O_RDWR|O_CLOEXEC)) >= 0);
+        assert_se((fdd = mkostemp(dst, O_RDWR|O_CLOEXEC)) >= 0);
+        assert_se((fdo = mkostemp(out, O_RDWR|O_CLOEXEC)) >= 0);
+
+        for (i = 0; i < size; i += sizeof(buf)) {
+                fill(buf, sizeof(buf), i);
+                assert_se(loop_write(fds, buf, sizeof(buf), false) == sizeof(buf));
+        }
+
+        assert_se(lseek(fds, 0, SEEK_SET) == 0);
+        assert_se(compress_stream(compression, fds, fdd, -1) == 0);
+
+        csize = lseek(fdd, 0, SEEK_CUR);
+        assert_se(csize > 0);
+        assert_se(compression == 0 ? csize == (off_t) size : csize < (off_t) size);
+
+        assert_se(lseek(fdd, 0, SEEK_SET) == 0);
+        assert_se(decompress_stream(compression, fdd, fdo, -1) == 0);
+
+        assert_se(lseek(fdo, 0, SEEK_CUR) == (off_t) size);
+        assert_se(lseek(fdo, 0, SEEK_SET) == 0);
+        for (i = 0; i < size; i += sizeof(buf)) {
+                fill(buf, sizeof(buf), i);
+                assert_se(loop_read(fdo, buf2, sizeof(buf2), false) == sizeof(buf2));
+                assert_se(memcmp(buf, buf2, sizeof(buf)) == 0);
+        }
+
+        /* Both directions stop once the limit is exceeded */
+        assert_se(lseek(fds, 0, SEEK_SET) == 0);
+        assert_se(ftruncate(fdo, 0) == 0);
+        assert_se(compress_stream(compression, fds, fdo, size - 1) == -E2BIG);
+
+        assert_se(lseek(fdd, 0, SEEK_SET) == 0);
+        assert_se(ftruncate(fdo, 0) == 0);
+        assert_se(decompress_stream(compression, fdd, fdo, size - 1) == -E2BIG);
+
+        /* A truncated stream is refused */
+        if (compression != 0) {
+                assert_se(ftruncate(fdd, csize / 2) == 0);
+                assert_se(lseek(fdd, 0, SEEK_SET) == 0);
+                assert_se(ftruncate(fdo, 0) == 0);
+                assert_se(decompress_stream(compression, fdd, fdo, -1) == -EBADMSG);
+        }
+
+        unlink(src);
+        unlink(dst);
+        unlink(out);
+}
+
+static void test_compress_stream_rss(int compression, uint64_t size) {
+        _cleanup_close_ int null = -1;
+        struct rusage before, after;
+        int pipefd[2];
+        pid_t pid;
+        siginfo_t si;
+
+        /* Feeds a core of the given size through a pipe, like the
+         * kernel does, and checks that memory use does not grow
+         * with it */
+
+        assert_se((null = open("/dev/null", O_WRONLY|O_CLOEXEC)) >= 0);
+        assert_se(pipe2(pipefd, O_CLOEXEC) >= 0);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                char buf[64*1024];
+                uint64_t i;
+
+                close_nointr_nofail(pipefd[0]);
+
+                for (i = 0; i < size; i += sizeof(buf)) {
+                        fill(buf, sizeof(buf), i);
+                        if (loop_write(pipefd[1], buf, sizeof(buf), false) != sizeof(buf))
+                                _exit(EXIT_FAILURE);
+                }
+
+                _exit(EXIT_SUCCESS);
+        }
+
+        close_nointr_nofail(pipefd[1]);
+
+        assert_se(getrusage(RUSAGE_SELF, &before) >= 0);
+        assert_se(compress_stream(compression, pipefd[0], null, -1) == 0);
+        assert_se(getrusage(RUSAGE_SELF, &after) >= 0);
+
+        close_nointr_nofail(pipefd[0]);
+
+        assert_se(wait_for_terminate(pid, &si) >= 0);
+        assert_se(si.si_code == CLD_EXITED && si.si_status == EXIT_SUCCESS);
+
+        log_info("%s stream of %"PRIu64" MiB: peak RSS %li KiB before, %li KiB after",
+                 object_compressed_to_string(compression) ?: "uncompressed",
+                 size / 1024 / 1024, before.ru_maxrss, after.ru_maxrss);
+
+        assert_se(after.ru_maxrss - before.ru_maxrss < 32 * 1024);
+}
+
+int main(int argc, char *argv[]) {
+        uint64_t size = 64;
+
+        log_set_max_level(LOG_DEBUG);
+
+        /* Optionally takes the size of the core for the memory
+         * test in MiB, pass some GiB to test for a large one */
+        if (argc > 1)
+                assert_se(safe_atou64(argv[1], &size) >= 0);
+        size *= 1024 * 1024;
+
+        test_compress_stream(0);
+        test_compress_stream_rss(0, size);
+
+#ifdef HAVE_XZ
+        test_compress_roundtrip(OBJECT_COMPRESSED_XZ);
+        test_compress_stream(OBJECT_COMPRESSED_XZ);
+        test_compress_stream_rss(OBJECT_COMPRESSED_XZ, size);
+#endif
+#ifdef HAVE_LZ4
+        test_compress_roundtrip(OBJECT_COMPRESSED_LZ4);
+#endif
+
+        assert_se(object_compressed_from_string("xz") == OBJECT_COMPRESSED_XZ);
+        assert_se(object_compressed_from_string("lz4") == OBJECT_COMPRESSED_LZ4);
+        assert_se(object_compressed_from_string("gzip") < 0);
+
+#ifdef HAVE_LZ4
+        assert_se(compress_stream(OBJECT_COMPRESSED_LZ4, STDIN_FILENO, STDOUT_FILENO, -1) == -EPROTONOSUPPORT);
+#endif
+
+        return 0;
+}
@@ -0,0 +1,124 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "coredump-vacuum.h"
+
+#define N_CORES 5
+#define CORE_SIZE (64*1024)
+
+static int make_core(unsigned i) {
+        char fn[64], buf[CORE_SIZE];
+        struct timespec ts[2];
+        int fd;
+
+        snprintf(fn, sizeof(fn), "core.test.%u", i);
+
+        fd = open(fn, O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC, 0600);
+        assert_se(fd >= 0);
+
+        memset(buf, 'x', sizeof(buf));
+        assert_se(loop_write(fd, buf, sizeof(buf), false) == sizeof(buf));
+        assert_se(fsync(fd) >= 0);
+
+        /* core.test.0 is the oldest one */
+        timespec_store(&ts[0], (i + 1) * USEC_PER_HOUR);
+        ts[1] = ts[0];
+        assert_se(futimens(fd, ts) >= 0);
+
+        return fd;
+}
+
+static bool have_core(unsigned i) {
+        char fn[64];
+
+        snprintf(fn, sizeof(fn), "core.test.%u", i);
+        return access(fn, F_OK) >= 0;
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/coredump-vacuum-XXXXXX";
+        struct stat st;
+        int fds[N_CORES], fd;
+        unsigned i;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        for (i = 0; i < N_CORES; i++)
+                fds[i] = make_core(i);
+
+        /* Other files are left alone */
+        assert_se(mkdir("core.test.dir", 0700) >= 0);
+        fd = open(".#core.test.partial", O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC, 0600);
+        assert_se(fd >= 0);
+        close_nointr_nofail(fd);
+
+        assert_se(fstat(fds[0], &st) >= 0);
+        if (st.st_blocks * 512 < CORE_SIZE) {
+                log_info("File system does not allocate blocks, skipping.");
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+                return EXIT_TEST_SKIP;
+        }
+
+        /* Nothing to do */
+        assert_se(coredump_vacuum(t, -1, 0, 0) == 0);
+        assert_se(coredump_vacuum(t, -1, 0, N_CORES * st.st_blocks * 512) == 0);
+        for (i = 0; i < N_CORES; i++)
+                assert_se(have_core(i));
+
+        /* The oldest ones go first */
+        assert_se(coredump_vacuum(t, -1, 0, 3 * st.st_blocks * 512) == 0);
+        assert_se(!have_core(0));
+        assert_se(!have_core(1));
+        assert_se(have_core(2));
+        assert_se(have_core(3));
+        assert_se(have_core(4));
+
+        /* The excluded one counts, but is never deleted, even
+         * when it is the oldest one */
+        assert_se(coredump_vacuum(t, fds[2], 0, 2 * st.st_blocks * 512) == 0);
+        assert_se(have_core(2));
+        assert_se(!have_core(3));
+        assert_se(have_core(4));
+
+        assert_se(coredump_vacuum(t, fds[2], 0, 1) == 0);
+        assert_se(have_core(2));
+        assert_se(!have_core(4));
+
+        assert_se(access("core.test.dir", F_OK) >= 0);
+        assert_se(access(".#core.test.partial", F_OK) >= 0);
+
+        for (i = 0; i < N_CORES; i++)
+                close_nointr_nofail(fds[i]);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return 0;
+}
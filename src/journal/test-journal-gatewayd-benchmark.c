@@ -0,0 +1,141 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "time-util.h"
+#include "socket-util.h"
+
+/* Shows how fast a locally running systemd-journal-gatewayd serves
+ * a URL over the loopback device. Takes the path (default /entries),
+ * the format for the Accept header (default the export format), the
+ * port (default 19531) and the number of requests (default 3). Try
+ * /files/<name> for downloading an archived journal file. */
+
+static const char *arg_path = "/entries";
+static const char *arg_accept = "application/vnd.fdo.journal";
+static unsigned arg_port = 19531;
+static unsigned arg_requests = 3;
+
+static int request(uint64_t *ret_size) {
+        _cleanup_close_ int fd = -1;
+        _cleanup_free_ char *header = NULL;
+        union sockaddr_union sa = {};
+        char buf[64*1024];
+        uint64_t size = 0;
+        bool first = true;
+        ssize_t k;
+
+        sa.in4.sin_family = AF_INET;
+        sa.in4.sin_port = htons(arg_port);
+        sa.in4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return -errno;
+
+        if (connect(fd, &sa.sa, sizeof(sa.in4)) < 0)
+                return -errno;
+
+        /* HTTP/1.0, so that the server closes the connection at the
+         * end of the response */
+        if (asprintf(&header,
+                     "GET %s HTTP/1.0\r\n"
+                     "Accept: %s\r\n"
+                     "\r\n", arg_path, arg_accept) < 0)
+                return -ENOMEM;
+
+        k = loop_write(fd, header, strlen(header), false);
+        if (k < 0)
+                return (int) k;
+
+        while ((k = read(fd, buf, sizeof(buf))) > 0) {
+                if (first) {
+                        if (k < 12 || !startswith(buf, "HTTP/1.") || memcmp(buf + 8, " 200", 4) != 0) {
+                                log_error("Request failed: %.*s", (int) strcspn(buf, "\r\n"), buf);
+                                return -EIO;
+                        }
+
+                        first = false;
+                }
+
+                size += k;
+        }
+        if (k < 0)
+                return -errno;
+
+        *ret_size = size;
+        return 0;
+}
+
+int main(int argc, char *argv[]) {
+        unsigned i;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1)
+                arg_path = argv[1];
+
+        if (argc > 2)
+                arg_accept = argv[2];
+
+        if (argc > 3 && (safe_atou(argv[3], &arg_port) < 0 || arg_port == 0 || arg_port > 0xFFFF)) {
+                log_error("Failed to parse port: %s", argv[3]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc > 4 && (safe_atou(argv[4], &arg_requests) < 0 || arg_requests == 0)) {
+                log_error("Failed to parse number of requests: %s", argv[4]);
+                return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < arg_requests; i++) {
+                uint64_t size;
+                usec_t usec;
+                int r;
+
+                usec = now(CLOCK_MONOTONIC);
+
+                r = request(&size);
+                if (r < 0) {
+                        log_error("Failed to fetch http://localhost:%u%s: %s", arg_port, arg_path, strerror(-r));
+                        return r == -ECONNREFUSED ? EXIT_TEST_SKIP : EXIT_FAILURE;
+                }
+
+                usec = now(CLOCK_MONOTONIC) - usec;
+
+                printf("%s (%s): %10"PRIu64" bytes, %8llu ms, %8.1f MiB/s\n",
+                       arg_path, arg_accept, size,
+                       (unsigned long long) (usec / USEC_PER_MSEC),
+                       (double) size * USEC_PER_SEC / (double) MAX(usec, 1ULL) / 1024.0 / 1024.0);
+        }
+
+        return EXIT_SUCCESS;
+}
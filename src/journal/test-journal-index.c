@@ -0,0 +1,208 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "journal-file.h"
+#include "journal-index.h"
+#include "journal-internal.h"
+#include "journal-verify.h"
+
+#define N_FILES 3
+#define N_ENTRIES 10
+
+static char *archived[N_FILES-1];
+
+static void append(JournalFile *f, unsigned file, unsigned i, uint64_t *seqnum) {
+        char message[LINE_MAX], unit[LINE_MAX];
+        struct iovec iovec[3];
+        dual_timestamp ts;
+
+        snprintf(message, sizeof(message), "MESSAGE=Message %u of file %u", i, file);
+        snprintf(unit, sizeof(unit), "UNIT=unit%u.service", file);
+
+        IOVEC_SET_STRING(iovec[0], message);
+        IOVEC_SET_STRING(iovec[1], unit);
+        IOVEC_SET_STRING(iovec[2], "COMMON=1");
+
+        ts.realtime = 1000000000000000ULL + file * 1000 + i;
+        ts.monotonic = file * 1000 + i + 1;
+
+        assert_se(journal_file_append_entry(f, &ts, iovec, ELEMENTSOF(iovec), seqnum, NULL, NULL) >= 0);
+}
+
+static void find_archived(void) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        unsigned n = 0;
+
+        assert_se(d = opendir("."));
+
+        while ((de = readdir(d))) {
+                if (!endswith(de->d_name, ".journal") || !strchr(de->d_name, '@'))
+                        continue;
+
+                assert_se(n < ELEMENTSOF(archived));
+                assert_se(archived[n++] = strdup(de->d_name));
+        }
+
+        assert_se(n == ELEMENTSOF(archived));
+
+        /* The names sort by the first sequence number */
+        if (strcmp(archived[0], archived[1]) > 0) {
+                char *t = archived[0];
+                archived[0] = archived[1];
+                archived[1] = t;
+        }
+}
+
+static void test_write(void) {
+        JournalFile *f;
+        uint64_t seqnum = 0;
+        unsigned i, k;
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (k = 0; k < N_FILES; k++) {
+                for (i = 0; i < N_ENTRIES; i++)
+                        append(f, k, i, &seqnum);
+
+                if (k < N_FILES-1)
+                        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        }
+
+        journal_file_close(f);
+
+        find_archived();
+
+        for (k = 0; k < ELEMENTSOF(archived); k++)
+                assert_se(access(strappenda(archived[k], JOURNAL_INDEX_SUFFIX), F_OK) >= 0);
+
+        /* The active file has none */
+        assert_se(access("test.journal" JOURNAL_INDEX_SUFFIX, F_OK) < 0 && errno == ENOENT);
+}
+
+static void test_read(const char *match, usec_t since, unsigned n_expected, uint64_t n_lookups, uint64_t n_skipped) {
+        sd_journal *j;
+        unsigned n = 0;
+        int r;
+
+        assert_se(sd_journal_open_directory(&j, ".", 0) >= 0);
+        assert_se(sd_journal_add_match(j, match, 0) >= 0);
+
+        if (since > 0)
+                assert_se(sd_journal_seek_realtime_usec(j, since) >= 0);
+        else
+                assert_se(sd_journal_seek_head(j) >= 0);
+
+        while ((r = sd_journal_next(j)) > 0)
+                n++;
+        assert_se(r == 0);
+
+        log_info("%s since %llu: %u entries, %"PRIu64" of %"PRIu64" files skipped",
+                 match, (unsigned long long) since, n, j->n_index_skipped, j->n_index_lookups);
+
+        assert_se(n == n_expected);
+        assert_se(j->n_index_lookups == n_lookups);
+        assert_se(j->n_index_skipped == n_skipped);
+
+        sd_journal_close(j);
+}
+
+static int verify(const char *path) {
+        JournalFile *f;
+        int r;
+
+        assert_se(journal_file_open(path, O_RDONLY, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+        r = journal_file_verify(f, NULL, NULL, NULL, NULL, false, NULL);
+        journal_file_close(f);
+
+        return r;
+}
+
+static void corrupt(const char *path, size_t offset) {
+        _cleanup_close_ int fd = -1;
+        uint8_t b;
+
+        assert_se((fd = open(strappenda(path, JOURNAL_INDEX_SUFFIX), O_RDWR|O_CLOEXEC)) >= 0);
+        assert_se(pread(fd, &b, 1, offset) == 1);
+        b ^= 0xFF;
+        assert_se(pwrite(fd, &b, 1, offset) == 1);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-index-XXXXXX";
+        unsigned i;
+
+        log_set_max_level(LOG_DEBUG);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        test_write();
+
+        test_read("UNIT=unit0.service", 0, N_ENTRIES, 2, 1);
+        test_read("UNIT=unit1.service", 0, N_ENTRIES, 2, 1);
+        test_read("UNIT=unit2.service", 0, N_ENTRIES, 2, 2);
+        test_read("UNIT=unit9.service", 0, 0, 2, 2);
+        test_read("COMMON=1", 0, N_FILES * N_ENTRIES, 2, 0);
+
+        /* Seeking by time does not even open the older file, as
+         * its time range is known from the directory */
+        test_read("COMMON=1", 1000000000000000ULL + 1000 + 5, 2 * N_ENTRIES - 5, 1, 0);
+
+        for (i = 0; i < ELEMENTSOF(archived); i++)
+                assert_se(verify(archived[i]) >= 0);
+
+        /* An index which does not belong to the file is ignored by
+         * readers, but is an error for verification */
+        corrupt(archived[0], offsetof(JournalIndexHeader, n_entries));
+        assert_se(verify(archived[0]) < 0);
+        assert_se(verify(archived[1]) >= 0);
+
+        /* Now only archived[1] can be skipped */
+        test_read("UNIT=unit2.service", 0, N_ENTRIES, 1, 1);
+
+        corrupt(archived[0], offsetof(JournalIndexHeader, n_entries));
+        assert_se(verify(archived[0]) >= 0);
+
+        /* A broken item */
+        corrupt(archived[1], sizeof(JournalIndexHeader) + offsetof(JournalIndexItem, n_entries));
+        assert_se(verify(archived[1]) < 0);
+
+        for (i = 0; i < ELEMENTSOF(archived); i++)
+                free(archived[i]);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return 0;
+}
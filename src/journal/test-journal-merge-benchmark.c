@@ -0,0 +1,173 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "time-util.h"
+#include "journal-file.h"
+
+/* Shows how fast sd_journal_next() and sd_journal_previous() walk
+ * through a directory with many files, with and without a match. The
+ * files are filled either one after the other, like rotated files
+ * are, or round-robin, like the system and user journals are. Takes
+ * the number of files (default 1000) and the number of entries per
+ * file (default 100). */
+
+static unsigned arg_files = 1000;
+static unsigned arg_entries = 100;
+
+static void make_journal(const char *directory, bool interleaved) {
+        JournalFile **files;
+        uint64_t seqnum = 0;
+        unsigned i, n;
+
+        assert_se(files = new0(JournalFile*, arg_files));
+
+        for (i = 0; i < arg_files; i++) {
+                char fn[sizeof("/test-.journal") + DECIMAL_STR_MAX(unsigned)];
+                _cleanup_free_ char *path = NULL;
+
+                snprintf(fn, sizeof(fn), "/test-%05u.journal", i);
+                assert_se(path = strappend(directory, fn));
+
+                assert_se(journal_file_open(path, O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL,
+                                            i > 0 ? files[0] : NULL, &files[i]) == 0);
+        }
+
+        for (n = 0; n < arg_files * arg_entries; n++) {
+                char message[LINE_MAX], unit[LINE_MAX];
+                struct iovec iovec[3];
+                dual_timestamp ts;
+
+                i = interleaved ? n % arg_files : n / arg_entries;
+
+                snprintf(message, sizeof(message), "MESSAGE=Benchmark message %u", n);
+                snprintf(unit, sizeof(unit), "UNIT=unit%u.service", n % 10);
+
+                IOVEC_SET_STRING(iovec[0], message);
+                IOVEC_SET_STRING(iovec[1], unit);
+                IOVEC_SET_STRING(iovec[2], "SYSLOG_IDENTIFIER=test-journal-merge-benchmark");
+
+                ts.realtime = 1000000000000000ULL + n;
+                ts.monotonic = n + 1;
+
+                assert_se(journal_file_append_entry(files[i], &ts, iovec, ELEMENTSOF(iovec), &seqnum, NULL, NULL) >= 0);
+        }
+
+        for (i = 0; i < arg_files; i++) {
+                /* Like journald does when rotating */
+                files[i]->header->state = STATE_ARCHIVED;
+                journal_file_close(files[i]);
+        }
+
+        free(files);
+}
+
+static void run(const char *directory, const char *name, const char *match) {
+        sd_journal *j;
+        usec_t usec;
+        uint64_t n = 0, expected;
+        int r;
+
+        assert_se(sd_journal_open_directory(&j, directory, 0) >= 0);
+
+        if (match)
+                assert_se(sd_journal_add_match(j, match, 0) >= 0);
+
+        expected = match ? arg_files * arg_entries / 10 : arg_files * arg_entries;
+
+        usec = now(CLOCK_MONOTONIC);
+
+        assert_se(sd_journal_seek_head(j) >= 0);
+        while ((r = sd_journal_next(j)) > 0)
+                n++;
+        assert_se(r == 0);
+
+        assert_se(sd_journal_seek_tail(j) >= 0);
+        while ((r = sd_journal_previous(j)) > 0)
+                n++;
+        assert_se(r == 0);
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+
+        assert_se(n == 2 * expected);
+
+        printf("%-28s %10"PRIu64" entries, %8llu ms, %10.0f entries/s\n",
+               name, n, (unsigned long long) (usec / USEC_PER_MSEC),
+               (double) n * USEC_PER_SEC / (double) MAX(usec, 1ULL));
+
+        sd_journal_close(j);
+}
+
+int main(int argc, char *argv[]) {
+        struct rlimit rl;
+        rlim_t n;
+        unsigned i;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_files) < 0 || arg_files == 0)) {
+                log_error("Failed to parse number of files: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc > 2 && (safe_atou(argv[2], &arg_entries) < 0 || arg_entries == 0)) {
+                log_error("Failed to parse number of entries: %s", argv[2]);
+                return EXIT_FAILURE;
+        }
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        /* We keep all files open at the same time */
+        assert_se(getrlimit(RLIMIT_NOFILE, &rl) >= 0);
+        n = MIN(rl.rlim_max, (rlim_t) arg_files + 64);
+        rl.rlim_cur = MAX(rl.rlim_cur, n);
+        assert_se(setrlimit(RLIMIT_NOFILE, &rl) >= 0);
+
+        for (i = 0; i < 2; i++) {
+                char t[] = "/tmp/journal-merge-XXXXXX";
+
+                assert_se(mkdtemp(t));
+
+                make_journal(t, i > 0);
+
+                printf("%u files with %u entries each, %s:\n", arg_files, arg_entries,
+                       i > 0 ? "interleaved" : "one after the other");
+
+                run(t, "all entries", NULL);
+                run(t, "UNIT=unit3.service", "UNIT=unit3.service");
+
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "time-util.h"
+#include "journal-file.h"
+
+/* Shows how many change notifications the writer issues, and how
+ * often a reader following the file is woken up, while writing a
+ * number of messages at a fixed rate: once per entry (as journald
+ * used to do), once per batch, and coalesced at an interval (as
+ * journald does now). Takes the number of messages (default 100000)
+ * and the rate in messages per second (default 50000, 0 means as
+ * fast as possible). */
+
+#define BATCH_MAX 64
+
+static unsigned arg_messages = 100000;
+static unsigned arg_rate = 50000;
+
+static void follow(const char *path, int ready_fd, int ctl_fd, int result_fd) {
+        struct pollfd pollfd[2] = {};
+        unsigned wakeups = 0;
+        int fd;
+
+        /* This is what a journalctl -f would do: wake up on every
+         * IN_MODIFY and look at what's new */
+
+        fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        assert_se(fd >= 0);
+        assert_se(inotify_add_watch(fd, path, IN_MODIFY) >= 0);
+
+        assert_se(write(ready_fd, "", 1) == 1);
+
+        pollfd[0].fd = fd;
+        pollfd[0].events = POLLIN;
+        pollfd[1].fd = ctl_fd;
+        pollfd[1].events = POLLIN;
+
+        for (;;) {
+                uint8_t buffer[sizeof(struct inotify_event) + FILENAME_MAX];
+
+                assert_se(poll(pollfd, 2, -1) > 0);
+
+                if (pollfd[0].revents & POLLIN) {
+                        wakeups++;
+
+                        while (read(fd, buffer, sizeof(buffer)) > 0)
+                                ;
+                }
+
+                if (pollfd[1].revents)
+                        break;
+        }
+
+        assert_se(write(result_fd, &wakeups, sizeof(wakeups)) == sizeof(wakeups));
+        _exit(EXIT_SUCCESS);
+}
+
+static void run(const char *name, unsigned batch, usec_t interval) {
+        JournalAppendEntry entries[BATCH_MAX];
+        struct iovec iovec[BATCH_MAX][3];
+        char messages[BATCH_MAX][LINE_MAX];
+        char t[] = "/tmp/journal-notify-XXXXXX";
+        int ready[2], ctl[2], result[2];
+        unsigned i, n = 0, notifications = 0, wakeups = 0;
+        usec_t start, last_post, usec;
+        char *path;
+        JournalFile *f;
+        pid_t pid;
+        char c;
+
+        assert_se(batch > 0 && batch <= BATCH_MAX);
+
+        assert_se(mkdtemp(t));
+        path = strappenda(t, "/test.journal");
+
+        assert_se(journal_file_open(path, O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL, NULL, &f) == 0);
+        f->defer_post_change = interval > 0;
+
+        assert_se(pipe2(ready, O_CLOEXEC) >= 0);
+        assert_se(pipe2(ctl, O_CLOEXEC) >= 0);
+        assert_se(pipe2(result, O_CLOEXEC) >= 0);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                close_nointr_nofail(ctl[1]);
+                follow(path, ready[1], ctl[0], result[1]);
+        }
+
+        close_nointr_nofail(ready[1]);
+        close_nointr_nofail(ctl[0]);
+        close_nointr_nofail(result[1]);
+
+        assert_se(read(ready[0], &c, 1) == 1);
+
+        start = last_post = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < arg_messages; i++) {
+
+                snprintf(messages[n], sizeof(messages[n]), "MESSAGE=Benchmark message %u", i);
+
+                IOVEC_SET_STRING(iovec[n][0], messages[n]);
+                IOVEC_SET_STRING(iovec[n][1], "PRIORITY=6");
+                IOVEC_SET_STRING(iovec[n][2], "SYSLOG_IDENTIFIER=test-journal-notify-benchmark");
+
+                dual_timestamp_get(&entries[n].ts);
+                entries[n].iovec = iovec[n];
+                entries[n].n_iovec = 3;
+                n++;
+
+                if (n < batch && i + 1 < arg_messages)
+                        continue;
+
+                if (batch == 1)
+                        assert_se(journal_file_append_entry(f, &entries[0].ts, entries[0].iovec, entries[0].n_iovec, NULL, NULL, NULL) >= 0);
+                else
+                        assert_se(journal_file_append_entries(f, entries, n, NULL, NULL) >= 0);
+                n = 0;
+
+                usec = now(CLOCK_MONOTONIC);
+
+                if (!f->defer_post_change)
+                        notifications++;
+                else if (f->post_change_pending && usec >= last_post + interval) {
+                        journal_file_post_change(f);
+                        notifications++;
+                        last_post = usec;
+                }
+
+                /* Keep to the rate */
+                if (arg_rate > 0) {
+                        usec_t due;
+
+                        due = start + (usec_t) (i + 1) * USEC_PER_SEC / arg_rate;
+                        if (due > usec)
+                                usleep(due - usec);
+                }
+        }
+
+        if (f->post_change_pending)
+                notifications++;
+
+        journal_file_close(f);
+        usec = now(CLOCK_MONOTONIC) - start;
+
+        close_nointr_nofail(ctl[1]);
+        assert_se(read(result[0], &wakeups, sizeof(wakeups)) == sizeof(wakeups));
+        assert_se(waitpid(pid, NULL, 0) == pid);
+
+        close_nointr_nofail(ready[0]);
+        close_nointr_nofail(result[0]);
+
+        printf("%-24s %8u ftruncate() calls, %8u reader wakeups, %6"PRIu64" ms\n",
+               name, notifications, wakeups, (uint64_t) (usec / USEC_PER_MSEC));
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && safe_atou(argv[1], &arg_messages) < 0) {
+                log_error("Failed to parse number of messages: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc > 2 && safe_atou(argv[2], &arg_rate) < 0) {
+                log_error("Failed to parse rate: %s", argv[2]);
+                return EXIT_FAILURE;
+        }
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        printf("%u messages at %u/s:\n", arg_messages, arg_rate);
+
+        run("per entry", 1, 0);
+        run("per batch", BATCH_MAX, 0);
+        run("coalesced, 250ms", BATCH_MAX, 250 * USEC_PER_MSEC);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "time-util.h"
+#include "logs-show.h"
+#include "journal-file.h"
+
+/* Shows how fast entries are formatted in the various output modes
+ * of journalctl. Takes the number of entries (default 10000). The
+ * entries carry the usual fields, some of them twice, and some with
+ * non-ASCII, control characters or binary data. */
+
+static unsigned arg_entries = 10000;
+
+/* What most entries carry besides the message */
+static const char * const common_fields[] = {
+        "PRIORITY=6",
+        "_HOSTNAME=benchmark",
+        "_COMM=test-journal-output-benchmark",
+        "_EXE=/usr/lib/systemd/test-journal-output-benchmark",
+        "_CMDLINE=/usr/lib/systemd/test-journal-output-benchmark --foo",
+        "_SYSTEMD_UNIT=benchmark.service",
+        "_SYSTEMD_CGROUP=/system.slice/benchmark.service",
+        "_SYSTEMD_SLICE=system.slice",
+        "_BOOT_ID=0123456789abcdef0123456789abcdef",
+        "_MACHINE_ID=fedcba9876543210fedcba9876543210",
+        "_TRANSPORT=journal",
+        "_UID=0",
+        "_GID=0",
+        "_CAP_EFFECTIVE=1fffffffff",
+        "SYSLOG_IDENTIFIER=benchmark",
+        "CODE_FILE=src/journal/test-journal-output-benchmark.c",
+        "CODE_FUNC=make_journal",
+        NULL
+};
+
+static void make_journal(const char *directory) {
+        _cleanup_free_ char *path = NULL;
+        JournalFile *f;
+        uint64_t seqnum = 0;
+        unsigned i;
+
+        assert_se(path = strappend(directory, "/test.journal"));
+        assert_se(journal_file_open(path, O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < arg_entries; i++) {
+                static const char binary[] = "BINARY=a\001b\377c";
+                char message[LINE_MAX], pid[sizeof("_PID=") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[ELEMENTSOF(common_fields) + 6];
+                const char * const *k;
+                dual_timestamp ts;
+                unsigned n = 0;
+
+                snprintf(message, sizeof(message),
+                         "MESSAGE=Benchmark message %u, with \"quotes\", a back\\slash and some caf\xc3\xa9%s",
+                         i, i % 10 == 0 ? "\nand a second line" : "");
+                snprintf(pid, sizeof(pid), "_PID=%u", 1000 + i % 100);
+
+                IOVEC_SET_STRING(iovec[n++], message);
+                IOVEC_SET_STRING(iovec[n++], pid);
+
+                for (k = common_fields; *k; k++)
+                        IOVEC_SET_STRING(iovec[n++], *k);
+
+                if (i % 3 == 0) {
+                        IOVEC_SET_STRING(iovec[n++], "TAG=one");
+                        IOVEC_SET_STRING(iovec[n++], "TAG=two");
+                }
+
+                if (i % 7 == 0) {
+                        iovec[n].iov_base = (char*) binary;
+                        iovec[n++].iov_len = sizeof(binary) - 1;
+                }
+
+                if (i % 11 == 0)
+                        IOVEC_SET_STRING(iovec[n++], "ESCAPE=\033[1mbold\033[0m");
+
+                ts.realtime = 1000000000000000ULL + i;
+                ts.monotonic = i + 1;
+
+                assert_se(journal_file_append_entry(f, &ts, iovec, n, &seqnum, NULL, NULL) >= 0);
+        }
+
+        journal_file_close(f);
+}
+
+static void run(const char *directory, FILE *null, OutputMode mode) {
+        sd_journal *j;
+        usec_t usec;
+        unsigned n = 0;
+        int r;
+
+        assert_se(sd_journal_open_directory(&j, directory, 0) >= 0);
+        assert_se(output_journal_set_fields(j, mode) >= 0);
+
+        usec = now(CLOCK_MONOTONIC);
+
+        while ((r = sd_journal_next(j)) > 0) {
+                assert_se(output_journal(null, j, mode, 80, OUTPUT_FULL_WIDTH, NULL) >= 0);
+                n++;
+        }
+        assert_se(r == 0);
+
+        fflush(null);
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+
+        assert_se(n == arg_entries);
+
+        printf("%-16s %10u entries, %8llu ms, %10.0f entries/s\n",
+               output_mode_to_string(mode), n, (unsigned long long) (usec / USEC_PER_MSEC),
+               (double) n * USEC_PER_SEC / (double) MAX(usec, 1ULL));
+
+        sd_journal_close(j);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-output-XXXXXX";
+        _cleanup_fclose_ FILE *null = NULL;
+        OutputMode mode;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_entries) < 0 || arg_entries == 0)) {
+                log_error("Failed to parse number of entries: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(null = fopen("/dev/null", "we"));
+
+        assert_se(mkdtemp(t));
+        make_journal(t);
+
+        for (mode = 0; mode < _OUTPUT_MODE_MAX; mode++)
+                run(t, null, mode);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return EXIT_SUCCESS;
+}
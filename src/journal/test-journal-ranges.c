@@ -0,0 +1,220 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "journal-file.h"
+#include "journal-internal.h"
+#include "journal-ranges.h"
+
+#define N_FILES 5
+#define N_ENTRIES 10
+
+#define REALTIME(file, i) (1000000000000000ULL + (file) * 1000000ULL + (i))
+
+static void test_write(void) {
+        JournalFile *f;
+        uint64_t seqnum = 0;
+        unsigned i, k;
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0640, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (k = 0; k < N_FILES; k++) {
+                for (i = 0; i < N_ENTRIES; i++) {
+                        char message[LINE_MAX];
+                        struct iovec iovec;
+                        dual_timestamp ts;
+
+                        snprintf(message, sizeof(message), "MESSAGE=Message %u of file %u", i, k);
+                        IOVEC_SET_STRING(iovec, message);
+
+                        ts.realtime = REALTIME(k, i);
+                        ts.monotonic = k * N_ENTRIES + i + 1;
+
+                        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, &seqnum, NULL, NULL) >= 0);
+                }
+
+                if (k < N_FILES-1)
+                        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        }
+
+        journal_file_close(f);
+}
+
+static void test_ranges(unsigned n_expected) {
+        JournalRanges *r;
+
+        assert_se(journal_ranges_load(".", &r) >= 0);
+        assert_se(hashmap_size(r->items) == n_expected);
+        journal_ranges_free(r);
+}
+
+static void test_save(void) {
+        JournalRanges *r;
+        JournalRangesItem *i;
+        struct stat a, b;
+
+        /* The catalog is no more accessible than the journal files */
+        assert_se(stat("test.journal", &a) >= 0);
+        assert_se(stat(JOURNAL_RANGES_FILE, &b) >= 0);
+        assert_se((a.st_mode & 07777) == (b.st_mode & 07777));
+
+        /* Saving keeps what somebody else added after we loaded */
+        assert_se(journal_ranges_load(".", &r) >= 0);
+        i = hashmap_steal_first(r->items);
+        assert_se(i);
+        free(i->filename);
+        free(i);
+        r->dirty = true;
+        assert_se(journal_ranges_save(r, ".") >= 0);
+        assert_se(hashmap_size(r->items) == N_FILES-1);
+        journal_ranges_free(r);
+
+        test_ranges(N_FILES-1);
+}
+
+static void test_read(usec_t since, direction_t direction, unsigned n_expected, unsigned n_opened) {
+        sd_journal *j;
+        unsigned n = 0;
+        uint64_t from, to;
+        int r;
+
+        assert_se(sd_journal_open_directory(&j, ".", 0) >= 0);
+
+        /* All archived files are known and none is opened yet */
+        assert_se(hashmap_size(j->files) == 1);
+        assert_se(hashmap_size(j->deferred_files) == N_FILES-1);
+
+        assert_se(sd_journal_get_cutoff_realtime_usec(j, &from, &to) > 0);
+        assert_se(from == REALTIME(0, 0));
+        assert_se(to == REALTIME(N_FILES-1, N_ENTRIES-1));
+        assert_se(hashmap_size(j->files) == 1);
+
+        assert_se(sd_journal_seek_realtime_usec(j, since) >= 0);
+
+        if (direction == DIRECTION_DOWN)
+                while ((r = sd_journal_next(j)) > 0)
+                        n++;
+        else
+                while ((r = sd_journal_previous(j)) > 0)
+                        n++;
+        assert_se(r == 0);
+
+        log_info("Since %llu: %u entries, %u files opened",
+                 (unsigned long long) since, n, hashmap_size(j->files));
+
+        assert_se(n == n_expected);
+        assert_se(hashmap_size(j->files) == n_opened);
+        assert_se(hashmap_size(j->files) + hashmap_size(j->deferred_files) == N_FILES);
+
+        /* Going back in time needs all of them */
+        assert_se(sd_journal_seek_head(j) >= 0);
+        for (n = 0; (r = sd_journal_next(j)) > 0; n++)
+                ;
+        assert_se(r == 0);
+        assert_se(n == N_FILES * N_ENTRIES);
+        assert_se(hashmap_size(j->files) == N_FILES);
+        assert_se(hashmap_isempty(j->deferred_files));
+
+        sd_journal_close(j);
+}
+
+static void test_unique(usec_t since, usec_t until, unsigned n_expected, unsigned n_opened) {
+        sd_journal *j;
+        const void *data;
+        size_t l;
+        unsigned n, k;
+
+        assert_se(sd_journal_open_directory(&j, ".", 0) >= 0);
+        assert_se(sd_journal_query_unique(j, "MESSAGE") >= 0);
+        assert_se(journal_set_unique_window(j, since, until) >= 0);
+
+        /* The second time the archived files are served from the
+         * cache */
+        for (k = 0; k < 2; k++) {
+                n = 0;
+                SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                        n++;
+
+                log_info("Unique values from %llu to %llu: %u, %u files opened",
+                         (unsigned long long) since, (unsigned long long) until, n, hashmap_size(j->files));
+
+                assert_se(n == n_expected);
+                assert_se(hashmap_size(j->files) == n_opened);
+
+                sd_journal_restart_unique(j);
+        }
+
+        sd_journal_close(j);
+}
+
+static void test_missing(void) {
+        sd_journal *j;
+
+        assert_se(sd_journal_open_directory(&j, ".", 0) >= 0);
+        assert_se(hashmap_size(j->files) == N_FILES);
+        assert_se(hashmap_isempty(j->deferred_files));
+        sd_journal_close(j);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-ranges-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        test_write();
+        test_ranges(N_FILES-1);
+        test_save();
+
+        test_read(REALTIME(3, 5), DIRECTION_DOWN, N_ENTRIES + N_ENTRIES - 5, 2);
+        test_read(REALTIME(1, 5), DIRECTION_UP, N_ENTRIES + 6, 3);
+        test_read(REALTIME(N_FILES, 0), DIRECTION_DOWN, 0, 1);
+
+        test_unique(0, (usec_t) -1, N_FILES * N_ENTRIES, N_FILES);
+        test_unique(REALTIME(3, 5), REALTIME(4, 2), N_ENTRIES - 5 + 3, 2);
+        test_unique(REALTIME(1, 0), REALTIME(1, 0), 1, 2);
+        test_unique(REALTIME(N_FILES, 0), (usec_t) -1, 0, 1);
+
+        /* Readers rebuild the catalog if it is missing */
+        assert_se(unlink(JOURNAL_RANGES_FILE) >= 0);
+        test_ranges(0);
+        test_missing();
+        test_ranges(N_FILES-1);
+        test_read(REALTIME(3, 5), DIRECTION_DOWN, N_ENTRIES + N_ENTRIES - 5, 2);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return 0;
+}
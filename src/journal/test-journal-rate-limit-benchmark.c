@@ -0,0 +1,83 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "journald-rate-limit.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+/* Shows how long journald spends on rate limiting a message. Takes
+ * the number of messages (default 2000000). Each run spreads the
+ * messages over a different number of services, beyond the number of
+ * services the rate limiter keeps track of in the last ones. */
+
+static unsigned arg_messages = 2000000;
+
+#define ID_MAX 64
+
+static void run(unsigned n_services) {
+        JournalRateLimit *r;
+        char *ids;
+        unsigned i, n_passed = 0;
+        usec_t usec;
+
+        assert_se(ids = new(char, n_services * ID_MAX));
+        for (i = 0; i < n_services; i++)
+                snprintf(ids + i * ID_MAX, ID_MAX, "/system/benchmark-%u.service", i);
+
+        assert_se(r = journal_rate_limit_new(10 * USEC_PER_SEC, 200));
+
+        usec = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < arg_messages; i++)
+                if (journal_rate_limit_test(r, ids + (i * 7919) % n_services * ID_MAX, i % 8, 1024ULL * 1024ULL * 1024ULL) > 0)
+                        n_passed++;
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+
+        printf("%6u services: %8u of %u messages passed, %6llu ms, %6.1f ns/message\n",
+               n_services, n_passed, arg_messages,
+               (unsigned long long) (usec / USEC_PER_MSEC),
+               (double) usec * 1000.0 / (double) arg_messages);
+
+        journal_rate_limit_free(r);
+        free(ids);
+}
+
+int main(int argc, char *argv[]) {
+        static const unsigned services[] = { 1, 10, 100, 1000, 10000, 100000 };
+        unsigned i;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_messages) < 0 || arg_messages == 0)) {
+                log_error("Failed to parse number of messages: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < ELEMENTSOF(services); i++)
+                run(services[i]);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "journald-rate-limit.h"
+#include "macro.h"
+#include "util.h"
+
+#define INTERVAL (200 * USEC_PER_MSEC)
+#define BURST 10
+
+/* All timestamps are passed explicitly, so that the results do not
+ * depend on how fast we are */
+#define T0 USEC_PER_SEC
+
+static void test_burst(void) {
+        JournalRateLimit *r;
+        uint64_t n_suppressed;
+        unsigned i;
+
+        assert_se(r = journal_rate_limit_new(INTERVAL, BURST));
+
+        for (i = 0; i < BURST; i++)
+                assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, T0) == 1);
+
+        for (i = 0; i < 5; i++)
+                assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, T0) == 0);
+
+        /* Other services and priorities have their own buckets */
+        assert_se(journal_rate_limit_test_at(r, "/system/b.service", LOG_INFO, 0, T0) == 1);
+        assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_ERR, 0, T0) == 1);
+
+        journal_rate_limit_get_statistics(r, NULL, &n_suppressed, NULL, NULL);
+        assert_se(n_suppressed == 5);
+
+        /* Not even one message worth of credit came back yet */
+        assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, T0 + INTERVAL / BURST - 1) == 0);
+
+        /* Once the interval is over, the suppressed messages are
+         * reported with the next one that goes through */
+        assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, T0 + INTERVAL) == 1 + 6);
+        assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, T0 + INTERVAL) == 1);
+
+        journal_rate_limit_free(r);
+}
+
+static void test_refill(void) {
+        JournalRateLimit *r;
+        unsigned n = 0;
+        uint64_t n_suppressed;
+        usec_t ts;
+        int k;
+
+        assert_se(r = journal_rate_limit_new(INTERVAL, BURST));
+
+        /* Flooding with one message per millisecond, messages go
+         * through at the configured rate of one per INTERVAL/BURST,
+         * with the burst on top */
+        for (ts = T0; ts < T0 + INTERVAL; ts += USEC_PER_MSEC) {
+                k = journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, ts);
+                assert_se(k == 0 || k == 1);
+                n += k;
+        }
+
+        assert_se(n == BURST + (INTERVAL - USEC_PER_MSEC) / (INTERVAL / BURST));
+
+        journal_rate_limit_get_statistics(r, NULL, &n_suppressed, NULL, NULL);
+        assert_se(n_suppressed == INTERVAL / USEC_PER_MSEC - n);
+
+        /* After a quiet interval the full burst is available
+         * again, and the first one reports what we suppressed */
+        assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, ts + INTERVAL) == 1 + (int) n_suppressed);
+        for (n = 1; n < BURST; n++)
+                assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, ts + INTERVAL) == 1);
+        assert_se(journal_rate_limit_test_at(r, "/system/a.service", LOG_INFO, 0, ts + INTERVAL) == 0);
+
+        journal_rate_limit_free(r);
+}
+
+static void test_many(void) {
+        JournalRateLimit *r;
+        unsigned n_groups, i, k;
+        uint64_t n_evicted, n_forgotten;
+        char id[64];
+
+        assert_se(r = journal_rate_limit_new(INTERVAL, 1));
+
+        /* Each service logs twice, so that one message is
+         * suppressed, and then is forgotten */
+        for (i = 0; i < 10000; i++) {
+                snprintf(id, sizeof(id), "/system/unit%u.service", i);
+
+                for (k = 0; k < 2; k++)
+                        assert_se(journal_rate_limit_test_at(r, id, LOG_INFO, 0, T0 + i) == !k);
+        }
+
+        journal_rate_limit_get_statistics(r, &n_groups, NULL, &n_evicted, &n_forgotten);
+        printf("%u groups, %llu evicted, %llu forgotten\n",
+               n_groups, (unsigned long long) n_evicted, (unsigned long long) n_forgotten);
+
+        assert_se(n_groups <= 10000);
+        assert_se(n_groups + n_evicted == 10000);
+        assert_se(n_forgotten == n_evicted);
+
+        /* The most recent one is still known */
+        assert_se(journal_rate_limit_test_at(r, id, LOG_INFO, 0, T0 + i) == 0);
+
+        journal_rate_limit_free(r);
+}
+
+int main(int argc, char *argv[]) {
+        test_burst();
+        test_refill();
+        test_many();
+
+        /* Turned off */
+        assert_se(journal_rate_limit_test(NULL, "/system/a.service", LOG_INFO, 0) == 1);
+
+        return 0;
+}
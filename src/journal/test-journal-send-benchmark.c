@@ -0,0 +1,208 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <systemd/sd-journal.h>
+#include <systemd/sd-id128.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "time-util.h"
+
+/* A load generator for the running journald: a number of processes
+ * call sd_journal_send() as fast as they can for a while. Reports
+ * how many messages per second were sent and ended up in the journal,
+ * and the latency distribution of the sd_journal_send() calls, which
+ * grows as soon as journald cannot keep up and the socket buffer
+ * fills. Takes the duration in seconds (default 10), the number of
+ * senders (default 4) and the message size (default 100). Note that
+ * the rate limiting of journald needs to be turned off for useful
+ * results. */
+
+#define SAMPLES_MAX (4*1024*1024)
+
+typedef struct Sender {
+        unsigned n;
+        uint32_t latency[SAMPLES_MAX];
+} Sender;
+
+static unsigned arg_seconds = 10;
+static unsigned arg_senders = 4;
+static unsigned arg_size = 100;
+
+static void sender(Sender *x, unsigned id, const char *run, const char *message, usec_t until) {
+        usec_t t, u;
+
+        for (t = now(CLOCK_MONOTONIC); t < until && x->n < SAMPLES_MAX; t = u) {
+                assert_se(sd_journal_send("MESSAGE=%s", message,
+                                          "PRIORITY=6",
+                                          "BENCHMARK_RUN=%s", run,
+                                          "BENCHMARK_SENDER=%u", id,
+                                          "BENCHMARK_SEQNUM=%u", x->n,
+                                          NULL) >= 0);
+
+                u = now(CLOCK_MONOTONIC);
+                x->latency[x->n++] = (uint32_t) MIN(u - t, (usec_t) UINT32_MAX);
+        }
+
+        _exit(EXIT_SUCCESS);
+}
+
+static uint64_t count_stored(const char *run) {
+        _cleanup_free_ char *match = NULL;
+        sd_journal *j;
+        uint64_t n = 0;
+
+        assert_se(match = strappend("BENCHMARK_RUN=", run));
+
+        assert_se(sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY) >= 0);
+        assert_se(sd_journal_add_match(j, match, 0) >= 0);
+
+        SD_JOURNAL_FOREACH(j)
+                n++;
+
+        sd_journal_close(j);
+        return n;
+}
+
+static int compare_latency(const void *a, const void *b) {
+        uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+
+        return x < y ? -1 : x > y ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ char *message = NULL;
+        _cleanup_free_ uint32_t *latency = NULL;
+        char run[33];
+        sd_id128_t id;
+        Sender **senders;
+        uint64_t n = 0, stored, last = 0;
+        usec_t start, until, usec;
+        unsigned i, k;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_seconds) < 0 || arg_seconds == 0)) {
+                log_error("Failed to parse duration: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc > 2 && (safe_atou(argv[2], &arg_senders) < 0 || arg_senders == 0)) {
+                log_error("Failed to parse number of senders: %s", argv[2]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc > 3 && safe_atou(argv[3], &arg_size) < 0) {
+                log_error("Failed to parse message size: %s", argv[3]);
+                return EXIT_FAILURE;
+        }
+
+        if (access("/run/systemd/journal/socket", F_OK) < 0) {
+                log_info("journald is not running, skipping.");
+                return EXIT_TEST_SKIP;
+        }
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        sd_id128_to_string(id, run);
+
+        assert_se(message = malloc(arg_size + 1));
+        memset(message, 'x', arg_size);
+        message[arg_size] = 0;
+
+        assert_se(senders = new0(Sender*, arg_senders));
+
+        start = now(CLOCK_MONOTONIC);
+        until = start + arg_seconds * USEC_PER_SEC;
+
+        for (i = 0; i < arg_senders; i++) {
+                pid_t pid;
+
+                /* Only the pages actually used are allocated */
+                senders[i] = mmap(NULL, sizeof(Sender), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+                assert_se(senders[i] != MAP_FAILED);
+
+                pid = fork();
+                assert_se(pid >= 0);
+
+                if (pid == 0)
+                        sender(senders[i], i, run, message, until);
+        }
+
+        for (i = 0; i < arg_senders; i++) {
+                int status;
+
+                assert_se(wait(&status) > 0);
+                assert_se(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+        }
+
+        usec = now(CLOCK_MONOTONIC) - start;
+
+        for (i = 0; i < arg_senders; i++)
+                n += senders[i]->n;
+
+        assert_se(n > 0);
+        assert_se(latency = new(uint32_t, n));
+
+        for (i = 0, k = 0; i < arg_senders; i++) {
+                memcpy(latency + k, senders[i]->latency, senders[i]->n * sizeof(uint32_t));
+                k += senders[i]->n;
+
+                assert_se(munmap(senders[i], sizeof(Sender)) >= 0);
+        }
+
+        free(senders);
+
+        qsort(latency, n, sizeof(uint32_t), compare_latency);
+
+        /* journald might still be busy writing, hence wait until
+         * the number of stored messages doesn't change anymore */
+        for (i = 0; i < 10; i++) {
+                stored = count_stored(run);
+                if (stored >= n)
+                        break;
+
+                if (stored != last) {
+                        last = stored;
+                        i = 0;
+                }
+
+                usleep(100 * USEC_PER_MSEC);
+        }
+
+        printf("%u senders, %u byte messages, %llu ms:\n"
+               "sent     %10"PRIu64" messages, %10.0f msg/s\n"
+               "stored   %10"PRIu64" messages, %10.0f msg/s\n"
+               "latency  p50 %"PRIu32" us, p99 %"PRIu32" us, p99.9 %"PRIu32" us, max %"PRIu32" us\n",
+               arg_senders, arg_size, (unsigned long long) (usec / USEC_PER_MSEC),
+               n, (double) n * USEC_PER_SEC / (double) usec,
+               stored, (double) stored * USEC_PER_SEC / (double) usec,
+               latency[n / 2], latency[n * 99 / 100], latency[n * 999 / 1000], latency[n - 1]);
+
+        return EXIT_SUCCESS;
+}
@@ -71,6 +71,43 @@ static void verify_contents(sd_journal *j, unsigned skip) {
                 assert_se(i == N_ENTRIES);
 }
 
+static void verify_projection(sd_journal *j, unsigned n_fields, const char *first) {
+        unsigned i = 0;
+
+        assert(j);
+
+        SD_JOURNAL_FOREACH(j) {
+                const void *d;
+                size_t l;
+                unsigned k, n;
+                int r;
+
+                /* The second pass is served from the cache */
+                for (k = 0; k < 2; k++) {
+                        n = 0;
+                        JOURNAL_FOREACH_DATA_RETVAL(j, d, l, r) {
+                                if (n == 0 && first)
+                                        assert_se(l > strlen(first) && memcmp(d, first, strlen(first)) == 0);
+                                n++;
+                        }
+                        assert_se(r == 0);
+                        assert_se(n == n_fields);
+                }
+
+                /* Fields which are not projected can still be
+                 * asked for */
+                assert_se(sd_journal_get_data(j, "NUMBER", &d, &l) >= 0);
+                assert_se(l > 7 && memcmp(d, "NUMBER=", 7) == 0);
+                assert_se(sd_journal_get_data(j, "MAGIC", &d, &l) >= 0);
+                assert_se(l > 6 && memcmp(d, "MAGIC=", 6) == 0);
+                assert_se(sd_journal_get_data(j, "FOOBAR", &d, &l) == -ENOENT);
+
+                i++;
+        }
+
+        assert_se(i == N_ENTRIES);
+}
+
 int main(int argc, char *argv[]) {
         JournalFile *one, *two, *three;
         char t[] = "/tmp/journal-stream-XXXXXX";
@@ -89,9 +126,9 @@ int main(int argc, char *argv[]) {
         assert_se(mkdtemp(t));
         assert_se(chdir(t) >= 0);
 
-        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &one) == 0);
-        assert_se(journal_file_open("two.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &two) == 0);
-        assert_se(journal_file_open("three.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &three) == 0);
+        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, OBJECT_COMPRESSED_XZ, false, NULL, NULL, NULL, &one) == 0);
+        assert_se(journal_file_open("two.journal", O_RDWR|O_CREAT, 0666, OBJECT_COMPRESSED_XZ, false, NULL, NULL, NULL, &two) == 0);
+        assert_se(journal_file_open("three.journal", O_RDWR|O_CREAT, 0666, OBJECT_COMPRESSED_XZ, false, NULL, NULL, NULL, &three) == 0);
 
         for (i = 0; i < N_ENTRIES; i++) {
                 char *p, *q;
@@ -176,8 +213,44 @@ int main(int argc, char *argv[]) {
         verify_contents(j, 0);
 
         assert_se(sd_journal_query_unique(j, "NUMBER") >= 0);
-        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l) {
                 printf("%.*s\n", (int) l, (const char*) data);
+                i++;
+        }
+        assert_se(i == N_ENTRIES);
+
+        /* Both values are in all three files, but are returned once */
+        assert_se(sd_journal_query_unique(j, "MAGIC") >= 0);
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                i++;
+        assert_se(i == 2);
+
+        sd_journal_restart_unique(j);
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                i++;
+        assert_se(i == 2);
+
+        printf("NEXT TEST\n");
+        sd_journal_flush_matches(j);
+
+        assert_se(sd_journal_add_data_field(j, "NUMBER") >= 0);
+        assert_se(sd_journal_add_data_field(j, "NUMBER") >= 0);
+        assert_se(sd_journal_add_data_field(j, "FOOBAR") >= 0);
+        assert_se(sd_journal_add_data_field(j, "number") == -EINVAL);
+        verify_projection(j, 1, "NUMBER=");
+
+        assert_se(sd_journal_add_data_field(j, "MAGIC") >= 0);
+        verify_projection(j, 2, NULL);
+
+        sd_journal_flush_data_fields(j);
+        assert_se(sd_journal_add_data_field(j, "MAGIC") >= 0);
+        verify_projection(j, 1, "MAGIC=");
+
+        sd_journal_flush_data_fields(j);
+        verify_projection(j, 2, NULL);
 
         assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
 
@@ -0,0 +1,152 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "time-util.h"
+#include "journal-file.h"
+#include "journal-internal.h"
+
+/* Shows how long it takes to list the values of a field, as
+ * "journalctl -F" does, over many archived files. Takes the number of
+ * files (default 500), the number of entries per file (default 20)
+ * and the number of distinct values (default 50). */
+
+static unsigned arg_files = 500;
+static unsigned arg_entries = 20;
+static unsigned arg_values = 50;
+
+#define REALTIME(file, i) (1000000000000000ULL + (file) * 1000000ULL + (i))
+
+static void make_journal(const char *directory) {
+        _cleanup_free_ char *path = NULL;
+        JournalFile *f;
+        uint64_t seqnum = 0;
+        unsigned i, k;
+
+        assert_se(path = strappend(directory, "/test.journal"));
+        assert_se(journal_file_open(path, O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (k = 0; k < arg_files; k++) {
+                for (i = 0; i < arg_entries; i++) {
+                        char message[LINE_MAX], unit[LINE_MAX];
+                        struct iovec iovec[2];
+                        dual_timestamp ts;
+
+                        snprintf(message, sizeof(message), "MESSAGE=Message %u of file %u", i, k);
+                        snprintf(unit, sizeof(unit), "_SYSTEMD_UNIT=unit%u.service", (k * arg_entries + i) % arg_values);
+
+                        IOVEC_SET_STRING(iovec[0], message);
+                        IOVEC_SET_STRING(iovec[1], unit);
+
+                        ts.realtime = REALTIME(k, i);
+                        ts.monotonic = k * arg_entries + i + 1;
+
+                        assert_se(journal_file_append_entry(f, &ts, iovec, ELEMENTSOF(iovec), &seqnum, NULL, NULL) >= 0);
+                }
+
+                if (k < arg_files-1)
+                        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        }
+
+        journal_file_close(f);
+}
+
+static unsigned run(sd_journal *j, const char *title) {
+        const void *data;
+        size_t l;
+        usec_t usec;
+        unsigned n = 0;
+
+        usec = now(CLOCK_MONOTONIC);
+
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                n++;
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+
+        printf("%-24s %6u values, %5u files open, %8llu ms\n",
+               title, n, hashmap_size(j->files), (unsigned long long) (usec / USEC_PER_MSEC));
+
+        return n;
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-unique-XXXXXX";
+        sd_journal *j;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_files) < 0 || arg_files == 0)) {
+                log_error("Failed to parse number of files: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc > 2 && (safe_atou(argv[2], &arg_entries) < 0 || arg_entries == 0)) {
+                log_error("Failed to parse number of entries: %s", argv[2]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc > 3 && (safe_atou(argv[3], &arg_values) < 0 || arg_values == 0)) {
+                log_error("Failed to parse number of values: %s", argv[3]);
+                return EXIT_FAILURE;
+        }
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(mkdtemp(t));
+        make_journal(t);
+
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        assert_se(sd_journal_set_data_threshold(j, 0) >= 0);
+
+        assert_se(sd_journal_query_unique(j, "_SYSTEMD_UNIT") >= 0);
+        assert_se(run(j, "first") == MIN(arg_values, arg_files * arg_entries));
+
+        sd_journal_restart_unique(j);
+        assert_se(run(j, "again") == MIN(arg_values, arg_files * arg_entries));
+
+        assert_se(sd_journal_query_unique(j, "MESSAGE") >= 0);
+        assert_se(run(j, "all values") == arg_files * arg_entries);
+
+        sd_journal_close(j);
+
+        /* Only the last tenth of the files, most are not even opened */
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        assert_se(sd_journal_query_unique(j, "MESSAGE") >= 0);
+        assert_se(journal_set_unique_window(j, REALTIME(arg_files - arg_files / 10, 0), (usec_t) -1) >= 0);
+        assert_se(run(j, "last tenth") == arg_files / 10 * arg_entries);
+        sd_journal_close(j);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "journal-file.h"
+#include "journal-vacuum.h"
+
+#define N_FILES 5
+#define N_ENTRIES 10
+
+static usec_t base;
+
+#define REALTIME(file, i) (base + (file) * USEC_PER_HOUR + (i))
+
+static void test_write(void) {
+        JournalFile *f;
+        uint64_t seqnum = 0;
+        unsigned i, k;
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (k = 0; k < N_FILES; k++) {
+                for (i = 0; i < N_ENTRIES; i++) {
+                        char message[LINE_MAX];
+                        struct iovec iovec;
+                        dual_timestamp ts;
+
+                        snprintf(message, sizeof(message), "MESSAGE=Message %u of file %u", i, k);
+                        IOVEC_SET_STRING(iovec, message);
+
+                        ts.realtime = REALTIME(k, i);
+                        ts.monotonic = k * N_ENTRIES + i + 1;
+
+                        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, &seqnum, NULL, NULL) >= 0);
+                }
+
+                assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        }
+
+        /* An empty one, which is always deleted */
+        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+
+        journal_file_close(f);
+}
+
+static unsigned n_archived(void) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        unsigned n = 0;
+
+        assert_se(d = opendir("."));
+
+        while ((de = readdir(d)))
+                if (endswith(de->d_name, ".journal") && strchr(de->d_name, '@'))
+                        n++;
+
+        return n;
+}
+
+static void test_vacuum(JournalVacuumCatalog *c, uint64_t max_use, usec_t max_retention_usec,
+                        unsigned n_expected, usec_t oldest_expected, uint64_t n_probed) {
+        usec_t oldest = 0;
+
+        assert_se(journal_directory_vacuum(".", c, max_use, 0, max_retention_usec, &oldest) >= 0);
+
+        log_info("%u archived files left, oldest %llu, %"PRIu64" probed, %"PRIu64" cached",
+                 n_archived(), (unsigned long long) oldest, c->n_probed, c->n_cached);
+
+        assert_se(n_archived() == n_expected);
+        assert_se(hashmap_size(c->items) == n_expected);
+        assert_se(oldest == oldest_expected);
+        assert_se(c->n_probed == n_probed);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-vacuum-XXXXXX";
+        JournalVacuumCatalog *c;
+        usec_t n;
+
+        log_set_max_level(LOG_DEBUG);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* The last file was started an hour ago */
+        n = now(CLOCK_REALTIME);
+        base = n - N_FILES * USEC_PER_HOUR;
+
+        test_write();
+        assert_se(n_archived() == N_FILES + 1);
+
+        assert_se(c = journal_vacuum_catalog_new());
+
+        /* The first pass looks at all files and drops the empty
+         * one, the second one looks at none */
+        test_vacuum(c, (uint64_t) -1, 0, N_FILES, REALTIME(0, 0), N_FILES + 1);
+        test_vacuum(c, (uint64_t) -1, 0, N_FILES, REALTIME(0, 0), N_FILES + 1);
+        assert_se(c->n_cached == N_FILES);
+
+        /* Retention deletes what was started before the limit */
+        test_vacuum(c, (uint64_t) -1, 3 * USEC_PER_HOUR + USEC_PER_HOUR / 2, 3, REALTIME(2, 0), N_FILES + 1);
+
+        /* Size, a tiny limit deletes all archived files, but the
+         * active one stays */
+        test_vacuum(c, 1, 0, 0, 0, N_FILES + 1);
+        assert_se(access("test.journal", F_OK) >= 0);
+
+        journal_vacuum_catalog_free(c);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return 0;
+}
@@ -55,16 +55,44 @@ static int raw_verify(const char *fn, const char *verification_key) {
         JournalFile *f;
         int r;
 
-        r = journal_file_open(fn, O_RDONLY, 0666, true, !!verification_key, NULL, NULL, NULL, &f);
+        r = journal_file_open(fn, O_RDONLY, 0666, OBJECT_COMPRESSED_XZ, !!verification_key, NULL, NULL, NULL, &f);
         if (r < 0)
                 return r;
 
-        r = journal_file_verify(f, verification_key, NULL, NULL, NULL, false);
+        r = journal_file_verify(f, verification_key, NULL, NULL, NULL, false, NULL);
         journal_file_close(f);
 
         return r;
 }
 
+static void test_parallel(const char *fn, const char *verification_key) {
+        struct stat st;
+        uint64_t p;
+
+        /* Corruption is detected the same way no matter whether the
+         * checks are run one after the other or concurrently */
+
+        assert_se(stat(fn, &st) >= 0);
+
+        for (p = 0; p < ((uint64_t) st.st_size * 8); p += 509 * 8 + 3) {
+                int serial, parallel;
+
+                bit_toggle(fn, p);
+
+                journal_verify_set_parallel(false);
+                serial = raw_verify(fn, verification_key);
+
+                journal_verify_set_parallel(true);
+                parallel = raw_verify(fn, verification_key);
+
+                assert_se(serial == parallel);
+
+                bit_toggle(fn, p);
+        }
+
+        journal_verify_set_parallel(-1);
+}
+
 int main(int argc, char *argv[]) {
         char t[] = "/tmp/journal-XXXXXX";
         unsigned n;
@@ -88,7 +116,7 @@ int main(int argc, char *argv[]) {
 
         log_info("Generating...");
 
-        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, !!verification_key, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, OBJECT_COMPRESSED_XZ, !!verification_key, NULL, NULL, NULL, &f) == 0);
 
         for (n = 0; n < N_ENTRIES; n++) {
                 struct iovec iovec;
@@ -111,11 +139,11 @@ int main(int argc, char *argv[]) {
 
         log_info("Verifying...");
 
-        assert_se(journal_file_open("test.journal", O_RDONLY, 0666, true, !!verification_key, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_open("test.journal", O_RDONLY, 0666, OBJECT_COMPRESSED_XZ, !!verification_key, NULL, NULL, NULL, &f) == 0);
         /* journal_file_print_header(f); */
         journal_file_dump(f);
 
-        assert_se(journal_file_verify(f, verification_key, &from, &to, &total, true) >= 0);
+        assert_se(journal_file_verify(f, verification_key, &from, &to, &total, true, NULL) >= 0);
 
         if (verification_key && JOURNAL_HEADER_SEALED(f->header)) {
                 log_info("=> Validated from %s to %s, %s missing",
@@ -126,6 +154,8 @@ int main(int argc, char *argv[]) {
 
         journal_file_close(f);
 
+        test_parallel("test.journal", verification_key);
+
         if (verification_key) {
                 log_info("Toggling bits...");
 
@@ -28,6 +28,7 @@
 #include "journal-file.h"
 #include "journal-authenticate.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
 
 static bool arg_keep = false;
 
@@ -45,7 +46,7 @@ static void test_non_empty(void) {
         assert_se(mkdtemp(t));
         assert_se(chdir(t) >= 0);
 
-        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, true, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, OBJECT_COMPRESSED_XZ, true, NULL, NULL, NULL, &f) == 0);
 
         dual_timestamp_get(&ts);
 
@@ -116,8 +117,8 @@ static void test_non_empty(void) {
 
         assert(journal_file_move_to_entry_by_seqnum(f, 10, DIRECTION_DOWN, &o, NULL) == 0);
 
-        journal_file_rotate(&f, true, true);
-        journal_file_rotate(&f, true, true);
+        journal_file_rotate(&f, OBJECT_COMPRESSED_XZ, true);
+        journal_file_rotate(&f, OBJECT_COMPRESSED_XZ, true);
 
         journal_file_close(f);
 
@@ -126,7 +127,7 @@ static void test_non_empty(void) {
         if (arg_keep)
                 log_info("Not removing %s", t);
         else {
-                journal_directory_vacuum(".", 3000000, 0, 0, NULL);
+                journal_directory_vacuum(".", NULL, 3000000, 0, 0, NULL);
 
                 assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
         }
@@ -134,6 +135,135 @@ static void test_non_empty(void) {
         puts("------------------------------------------------------------");
 }
 
+static void test_append_entries(void) {
+        JournalAppendEntry entries[100];
+        struct iovec iovec[100][3];
+        char numbers[100][16];
+        static const char common[] = "BATCH=common", even[] = "PARITY=0", odd[] = "PARITY=1";
+        JournalFile *f;
+        Object *o, *d;
+        uint64_t p, q, seqnum = 0;
+        unsigned i, n;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < ELEMENTSOF(entries); i++) {
+                snprintf(numbers[i], sizeof(numbers[i]), "NUMBER=%u", i);
+
+                IOVEC_SET_STRING(iovec[i][0], common);
+                IOVEC_SET_STRING(iovec[i][1], numbers[i]);
+                IOVEC_SET_STRING(iovec[i][2], i % 2 ? odd : even);
+
+                dual_timestamp_get(&entries[i].ts);
+                entries[i].iovec = iovec[i];
+                entries[i].n_iovec = 3;
+        }
+
+        /* Two batches, so that the second one has to continue in the
+         * partially filled entry arrays of the first one */
+        assert_se(journal_file_append_entries(f, entries, 61, &seqnum, &n) == 0);
+        assert_se(n == 61);
+        assert_se(journal_file_append_entries(f, entries + 61, 39, &seqnum, &n) == 0);
+        assert_se(n == 39);
+        assert_se(seqnum == 100);
+
+        /* Going back in time fails, but keeps what came before */
+        dual_timestamp_get(&entries[0].ts);
+        entries[1].ts.monotonic = entries[0].ts.monotonic - 1;
+        assert_se(journal_file_append_entries(f, entries, 2, &seqnum, &n) == -EINVAL);
+        assert_se(n == 1);
+        assert_se(seqnum == 101);
+
+        assert_se(le64toh(f->header->n_entries) == 101);
+
+        for (i = 0, o = NULL, p = 0; journal_file_next_entry(f, o, p, DIRECTION_DOWN, &o, &p) > 0; i++)
+                assert_se(le64toh(o->entry.seqnum) == i + 1);
+        assert_se(i == 101);
+
+        assert_se(journal_file_find_data_object(f, common, strlen(common), &d, &q) == 1);
+        assert_se(le64toh(d->data.n_entries) == 101);
+
+        assert_se(journal_file_find_data_object(f, odd, strlen(odd), &d, &q) == 1);
+        assert_se(le64toh(d->data.n_entries) == 50);
+
+        for (i = 0, o = NULL, p = 0; journal_file_next_entry_for_data(f, o, p, q, DIRECTION_DOWN, &o, &p) > 0; i++)
+                assert_se(le64toh(o->entry.seqnum) == i * 2 + 2);
+        assert_se(i == 50);
+
+        assert_se(journal_file_find_data_object(f, numbers[42], strlen(numbers[42]), &d, &q) == 1);
+        assert_se(le64toh(d->data.n_entries) == 1);
+
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false, NULL) >= 0);
+
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_allocate(void) {
+        JournalFile *f;
+        uint64_t seqnum = 0, allocated;
+        unsigned i;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < 20000; i++) {
+                char message[LINE_MAX];
+                struct iovec iovec;
+                dual_timestamp ts;
+
+                snprintf(message, sizeof(message), "MESSAGE=Message number %u, padded to make it a bit longer than it needs to be", i);
+                IOVEC_SET_STRING(iovec, message);
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, &seqnum, NULL, NULL) == 0);
+        }
+
+        allocated = le64toh(f->header->header_size) + le64toh(f->header->arena_size);
+
+        log_info("%"PRIu64" bytes used, %"PRIu64" allocated in %"PRIu64" steps, %"PRIu64" prefaults, %"PRIu64" misses",
+                 le64toh(f->header->tail_object_offset), allocated,
+                 f->n_allocate, f->n_prefault, f->n_prefault_misses);
+
+        /* The file grows in large steps, not page by page, and
+         * writes only reach past the populated pages when the
+         * file is extended */
+        assert_se(le64toh(f->header->tail_object_offset) < allocated);
+        assert_se(f->n_allocate <= allocated / (1024*1024) + 1);
+        assert_se(f->n_prefault > 0);
+        assert_se(f->n_prefault_misses <= f->n_allocate + 1);
+
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false, NULL) >= 0);
+
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
 static void test_empty(void) {
         JournalFile *f1, *f2, *f3, *f4;
         char t[] = "/tmp/journal-XXXXXX";
@@ -143,13 +273,13 @@ static void test_empty(void) {
         assert_se(mkdtemp(t));
         assert_se(chdir(t) >= 0);
 
-        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f1) == 0);
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f1) == 0);
 
-        assert_se(journal_file_open("test-compress.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f2) == 0);
+        assert_se(journal_file_open("test-compress.journal", O_RDWR|O_CREAT, 0666, OBJECT_COMPRESSED_XZ, false, NULL, NULL, NULL, &f2) == 0);
 
-        assert_se(journal_file_open("test-seal.journal", O_RDWR|O_CREAT, 0666, false, true, NULL, NULL, NULL, &f3) == 0);
+        assert_se(journal_file_open("test-seal.journal", O_RDWR|O_CREAT, 0666, 0, true, NULL, NULL, NULL, &f3) == 0);
 
-        assert_se(journal_file_open("test-seal-compress.journal", O_RDWR|O_CREAT, 0666, true, true, NULL, NULL, NULL, &f4) == 0);
+        assert_se(journal_file_open("test-seal-compress.journal", O_RDWR|O_CREAT, 0666, OBJECT_COMPRESSED_XZ, true, NULL, NULL, NULL, &f4) == 0);
 
         journal_file_print_header(f1);
         puts("");
@@ -165,7 +295,7 @@ static void test_empty(void) {
         if (arg_keep)
                 log_info("Not removing %s", t);
         else {
-                journal_directory_vacuum(".", 3000000, 0, 0, NULL);
+                journal_directory_vacuum(".", NULL, 3000000, 0, 0, NULL);
 
                 assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
         }
@@ -184,6 +314,8 @@ int main(int argc, char *argv[]) {
                 return EXIT_TEST_SKIP;
 
         test_non_empty();
+        test_append_entries();
+        test_allocate();
         test_empty();
 
         return 0;
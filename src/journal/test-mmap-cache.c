@@ -28,6 +28,92 @@
 #include "util.h"
 #include "mmap-cache.h"
 
+#define MB (1024ULL*1024ULL)
+
+static void log_statistics(MMapCache *m) {
+        uint64_t hit, miss, unmap, mapped;
+
+        mmap_cache_get_statistics(m, &hit, &miss, &unmap, &mapped);
+        log_info("%"PRIu64" hits, %"PRIu64" misses, %"PRIu64" unmaps, %"PRIu64" bytes mapped",
+                 hit, miss, unmap, mapped);
+}
+
+static void test_window_size(int fd) {
+        MMapCache *m;
+        uint64_t mapped, last;
+        void *p;
+
+        assert_se(m = mmap_cache_new());
+
+        assert_se(mmap_cache_get(m, fd, PROT_READ, 0, false, 0, 1, NULL, &p) > 0);
+        mmap_cache_get_statistics(m, NULL, NULL, NULL, &mapped);
+        assert_se(mapped == 8*MB);
+
+        /* Reading on sequentially makes the windows grow */
+        assert_se(mmap_cache_get(m, fd, PROT_READ, 0, false, 8*MB, 1, NULL, &p) > 0);
+        mmap_cache_get_statistics(m, NULL, NULL, NULL, &last);
+        assert_se(last - mapped == 16*MB);
+        mapped = last;
+
+        assert_se(mmap_cache_get(m, fd, PROT_READ, 0, false, 24*MB + 10, 1, NULL, &p) > 0);
+        mmap_cache_get_statistics(m, NULL, NULL, NULL, &last);
+        assert_se(last - mapped == 32*MB);
+        mapped = last;
+
+        /* And jumping around makes them shrink again */
+        assert_se(mmap_cache_get(m, fd, PROT_READ, 0, false, 1024*MB, 1, NULL, &p) > 0);
+        mmap_cache_get_statistics(m, NULL, NULL, NULL, &last);
+        assert_se(last - mapped == 16*MB);
+        mapped = last;
+
+        assert_se(mmap_cache_get(m, fd, PROT_READ, 0, false, 512*MB, 1, NULL, &p) > 0);
+        mmap_cache_get_statistics(m, NULL, NULL, NULL, &last);
+        assert_se(last - mapped == 8*MB);
+
+        log_statistics(m);
+        mmap_cache_unref(m);
+}
+
+static void test_budget(int fd) {
+        MMapCache *m;
+        uint64_t hit, miss, unmap, mapped;
+        unsigned i;
+        void *p;
+
+        mmap_cache_set_budget(16*MB);
+
+        assert_se(m = mmap_cache_new());
+
+        /* Only one window is in use at a time, all others may go */
+        for (i = 0; i < 64; i++) {
+                assert_se(mmap_cache_get(m, fd, PROT_READ, 0, false, (uint64_t) i * 64*MB, 1, NULL, &p) > 0);
+
+                mmap_cache_get_statistics(m, NULL, NULL, NULL, &mapped);
+                assert_se(mapped <= 16*MB);
+        }
+
+        /* The windows that are in use are never unmapped */
+        for (i = 0; i < 4; i++)
+                assert_se(mmap_cache_get(m, fd, PROT_READ, i + 1, false, (uint64_t) i * 64*MB, 1, NULL, &p) > 0);
+
+        for (i = 64; i < 128; i++)
+                assert_se(mmap_cache_get(m, fd, PROT_READ, 0, false, (uint64_t) i * 64*MB, 1, NULL, &p) > 0);
+
+        for (i = 0; i < 4; i++)
+                assert_se(mmap_cache_get(m, fd, PROT_READ, i + 1, false, (uint64_t) i * 64*MB, 1, NULL, &p) > 0);
+
+        mmap_cache_get_statistics(m, &hit, &miss, &unmap, &mapped);
+        assert_se(hit == 4);
+        assert_se(miss == 132);
+        assert_se(unmap > 0);
+        assert_se(mapped <= 16*MB);
+
+        log_statistics(m);
+        mmap_cache_unref(m);
+
+        mmap_cache_set_budget(512*MB);
+}
+
 int main(int argc, char *argv[]) {
         int x, y, z, r;
         char px[] = "/tmp/testmmapXXXXXXX", py[] = "/tmp/testmmapYXXXXXX", pz[] = "/tmp/testmmapZXXXXXX";
@@ -69,8 +155,12 @@ int main(int argc, char *argv[]) {
 
         assert((uint8_t*) p + 1 == (uint8_t*) q);
 
+        log_statistics(m);
         mmap_cache_unref(m);
 
+        test_window_size(y);
+        test_budget(z);
+
         close_nointr_nofail(x);
         close_nointr_nofail(y);
         close_nointr_nofail(z);
@@ -113,6 +113,18 @@ struct vtable_member {
         const sd_bus_vtable *vtable;
 };
 
+/* A ring buffer of messages, which is grown as needed */
+struct bus_queue {
+        sd_bus_message **items;
+        unsigned head;
+        unsigned size;
+        unsigned allocated;
+};
+
+static inline sd_bus_message *bus_queue_peek(struct bus_queue *q) {
+        return q->size > 0 ? q->items[q->head] : NULL;
+}
+
 enum bus_state {
         BUS_UNSET,
         BUS_OPENING,
@@ -165,12 +177,17 @@ struct sd_bus {
         void *rbuffer;
         size_t rbuffer_size;
 
-        sd_bus_message **rqueue;
-        unsigned rqueue_size;
+        struct bus_queue rqueue;
 
-        sd_bus_message **wqueue;
-        unsigned wqueue_size;
+        struct bus_queue wqueue;
         size_t windex;
+        unsigned wqueue_low;
+        unsigned wqueue_high;
+        bool congested:1;
+        bool writable_pending:1;
+
+        sd_bus_writable_handler_t writable_callback;
+        void *writable_userdata;
 
         uint64_t serial;
 
@@ -235,6 +252,8 @@ struct sd_bus {
         struct memfd_cache memfd_cache[MEMFD_CACHE_MAX];
         unsigned n_memfd_cache;
 
+        struct message_cache *message_cache;
+
         pid_t original_pid;
 
         uint64_t hello_flags;
@@ -249,8 +268,13 @@ struct sd_bus {
 
 #define BUS_DEFAULT_TIMEOUT ((usec_t) (25 * USEC_PER_SEC))
 
-#define BUS_WQUEUE_MAX 128
-#define BUS_RQUEUE_MAX 128
+/* Flow control happens via the write queue watermarks, these are
+ * merely a safety net against runaway peers */
+#define BUS_WQUEUE_MAX (384*1024)
+#define BUS_RQUEUE_MAX (384*1024)
+
+#define BUS_WQUEUE_HIGH_DEFAULT 128
+#define BUS_WQUEUE_LOW_DEFAULT 32
 
 #define BUS_MESSAGE_SIZE_MAX (64*1024*1024)
 #define BUS_AUTH_SIZE_MAX (64*1024)
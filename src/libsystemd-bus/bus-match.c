@@ -64,8 +64,15 @@ static inline bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
 }
 
 static inline bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
-        return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
-                (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST);
+        /* Namespace and path compares are hashed too, they are
+         * looked up by all prefixes of the tested value, see
+         * bus_match_run_prefixes() */
+        return t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_ARG_NAMESPACE_LAST;
+}
+
+static inline bool BUS_MATCH_IS_PREFIX(enum bus_match_node_type t) {
+        return t == BUS_MATCH_PATH_NAMESPACE ||
+                (t >= BUS_MATCH_ARG_PATH && t <= BUS_MATCH_ARG_NAMESPACE_LAST);
 }
 
 static void bus_match_node_free(struct bus_match_node *node) {
@@ -196,6 +203,118 @@ static bool value_node_same(
         }
 }
 
+static int bus_match_run_value(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value_str,
+                sd_bus_message *m) {
+
+        struct bus_match_node *found;
+
+        found = hashmap_get(node->compare.children, value_str);
+        if (!found)
+                return 0;
+
+        return bus_match_run(bus, found, m);
+}
+
+static int bus_match_run_prefixes(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value_str,
+                sd_bus_message *m) {
+
+        bool complex;
+        char separator;
+        size_t i, l;
+        char *p;
+        int r;
+
+        assert(node);
+        assert(value_str);
+
+        /* Rather than testing all values of a namespace or path
+         * compare one by one, we look up the few values that could
+         * possibly match: the tested string itself, and each of its
+         * prefixes ending at a separator. This way the cost depends
+         * on the depth of the path, not on the number of matches
+         * installed. */
+
+        complex = node->type >= BUS_MATCH_ARG_PATH && node->type <= BUS_MATCH_ARG_PATH_LAST;
+        separator = node->type >= BUS_MATCH_ARG_NAMESPACE ? '.' : '/';
+
+        l = strlen(value_str);
+
+        if (complex && l > 0 && value_str[l-1] == separator) {
+                struct bus_match_node *c;
+                Iterator j;
+
+                /* argNpath also matches all paths below a value
+                 * ending in a slash, and that's a lookup a hash
+                 * table can't do. Since such values are rare, we
+                 * just test each one. */
+
+                HASHMAP_FOREACH(c, node->compare.children, j) {
+                        if (!value_node_test(c, node->type, 0, value_str))
+                                continue;
+
+                        r = bus_match_run(bus, c, m);
+                        if (r != 0)
+                                return r;
+
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+
+                return 0;
+        }
+
+        p = alloca(l + 2);
+        memcpy(p, value_str, l + 1);
+
+        r = bus_match_run_value(bus, node, p, m);
+        if (r != 0)
+                return r;
+
+        for (i = 0; i < l; i++) {
+                size_t k;
+                char x;
+
+                if (p[i] != separator)
+                        continue;
+
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
+
+                /* Simple patterns match on prefixes without the
+                 * trailing separator, argNpath ones with */
+                k = complex ? i + 1 : i;
+
+                x = p[k];
+                p[k] = 0;
+                r = bus_match_run_value(bus, node, p, m);
+                p[k] = x;
+
+                if (r != 0)
+                        return r;
+        }
+
+        if (complex) {
+                /* And argNpath also matches when the value is the
+                 * tested string with a slash appended */
+
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
+
+                p[l] = separator;
+                p[l+1] = 0;
+
+                return bus_match_run_value(bus, node, p, m);
+        }
+
+        return 0;
+}
+
 int bus_match_run(
                 sd_bus *bus,
                 struct bus_match_node *node,
@@ -310,7 +429,13 @@ int bus_match_run(
 
                 /* Lookup via hash table, nice! So let's jump directly. */
 
-                if (test_str)
+                if (test_str && BUS_MATCH_IS_PREFIX(node->type)) {
+                        r = bus_match_run_prefixes(bus, node, test_str, m);
+                        if (r != 0)
+                                return r;
+
+                        found = NULL;
+                } else if (test_str)
                         found = hashmap_get(node->compare.children, test_str);
                 else if (node->type == BUS_MATCH_MESSAGE_TYPE)
                         found = hashmap_get(node->compare.children, UINT_TO_PTR(test_u8));
@@ -21,6 +21,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
 #include "util.h"
@@ -54,6 +55,188 @@ static void *adjust_pointer(const void *p, void *old_base, size_t sz, void *new_
         return (uint8_t*) new_base + ((uint8_t*) p - (uint8_t*) old_base);
 }
 
+struct message_cache {
+        /* Messages may be freed on a different thread than the one
+         * they were allocated on, hence all of this is protected by
+         * the mutex, including the reference counter. Every message
+         * allocated from the cache holds a reference, so that the
+         * cache outlives the bus if necessary. */
+        pthread_mutex_t mutex;
+        unsigned n_ref;
+
+        void *items[MESSAGE_CACHE_MAX];
+        unsigned n_items;
+};
+
+struct message_cache *message_cache_new(void) {
+        struct message_cache *c;
+
+        c = new0(struct message_cache, 1);
+        if (!c)
+                return NULL;
+
+        assert_se(pthread_mutex_init(&c->mutex, NULL) == 0);
+        c->n_ref = 1;
+
+        return c;
+}
+
+static void message_cache_free(struct message_cache *c) {
+        unsigned i;
+
+        assert(c);
+
+        for (i = 0; i < c->n_items; i++)
+                free(c->items[i]);
+
+        assert_se(pthread_mutex_destroy(&c->mutex) == 0);
+        free(c);
+}
+
+struct message_cache *message_cache_unref(struct message_cache *c) {
+        bool last;
+
+        if (!c)
+                return NULL;
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        assert(c->n_ref > 0);
+        last = --c->n_ref == 0;
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        if (last)
+                message_cache_free(c);
+
+        return NULL;
+}
+
+static sd_bus_message *message_alloc(struct message_cache *c, size_t size, size_t zero) {
+        sd_bus_message *m = NULL;
+
+        assert(zero >= sizeof(sd_bus_message));
+        assert(zero <= size);
+
+        /* Returns a message of at least size bytes, of which the
+         * first zero bytes are initialized to zero. */
+
+        if (!c || size > MESSAGE_CHUNK_SIZE) {
+                m = malloc(size);
+                if (!m)
+                        return NULL;
+
+                memset(m, 0, zero);
+                return m;
+        }
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        if (c->n_items > 0)
+                m = c->items[--c->n_items];
+        c->n_ref++;
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        if (!m) {
+                m = malloc(MESSAGE_CHUNK_SIZE);
+                if (!m) {
+                        message_cache_unref(c);
+                        return NULL;
+                }
+        }
+
+        memset(m, 0, zero);
+        m->cache = c;
+
+        return m;
+}
+
+static void message_release(sd_bus_message *m) {
+        struct message_cache *c;
+
+        assert(m);
+
+        c = m->cache;
+        if (!c) {
+                free(m);
+                return;
+        }
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        if (c->n_items < MESSAGE_CACHE_MAX) {
+                c->items[c->n_items++] = m;
+                m = NULL;
+        }
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        free(m);
+        message_cache_unref(c);
+}
+
+static char *message_push_signature(sd_bus_message *m, const char *s) {
+        size_t l;
+        char *p;
+
+        assert(m);
+        assert(s);
+
+        l = strlen(s) + 1;
+        if (m->signature_buffer_used + l > sizeof(m->signature_buffer))
+                return strdup(s);
+
+        p = m->signature_buffer + m->signature_buffer_used;
+        memcpy(p, s, l);
+        m->signature_buffer_used += l;
+
+        return p;
+}
+
+static void message_pop_signature(sd_bus_message *m, char *s) {
+        assert(m);
+
+        /* The signature of a message we parsed is at the bottom of
+         * the stack, and it is only released with the message */
+
+        if (s >= m->signature_buffer && s < m->signature_buffer + sizeof(m->signature_buffer)) {
+                assert(s + strlen(s) + 1 == m->signature_buffer + m->signature_buffer_used);
+                m->signature_buffer_used = s - m->signature_buffer;
+        } else
+                free(s);
+}
+
+static int message_grow_containers(sd_bus_message *m) {
+        struct bus_container *w;
+        unsigned n;
+
+        assert(m);
+
+        /* Make sure we have space for one more container */
+        if (m->n_containers < m->n_containers_allocated)
+                return 0;
+
+        if (!m->containers) {
+                m->containers = m->containers_fixed;
+                m->n_containers_allocated = ELEMENTSOF(m->containers_fixed);
+                return 0;
+        }
+
+        n = m->n_containers_allocated * 2;
+
+        if (m->containers == m->containers_fixed) {
+                w = new(struct bus_container, n);
+                if (!w)
+                        return -ENOMEM;
+
+                memcpy(w, m->containers, sizeof(struct bus_container) * m->n_containers);
+        } else {
+                w = realloc(m->containers, sizeof(struct bus_container) * n);
+                if (!w)
+                        return -ENOMEM;
+        }
+
+        m->containers = w;
+        m->n_containers_allocated = n;
+
+        return 0;
+}
+
 static void message_free_part(sd_bus_message *m, struct bus_body_part *part) {
         assert(m);
         assert(part);
@@ -104,13 +287,15 @@ static void message_reset_containers(sd_bus_message *m) {
 
         assert(m);
 
-        for (i = 0; i < m->n_containers; i++)
-                free(m->containers[i].signature);
+        for (i = m->n_containers; i > 0; i--)
+                message_pop_signature(m, m->containers[i-1].signature);
 
-        free(m->containers);
+        if (m->containers != m->containers_fixed)
+                free(m->containers);
         m->containers = NULL;
 
         m->n_containers = 0;
+        m->n_containers_allocated = 0;
         m->root_container.index = 0;
 }
 
@@ -146,14 +331,15 @@ static void message_free(sd_bus_message *m) {
         free(m->cmdline_array);
 
         message_reset_containers(m);
-        free(m->root_container.signature);
+        message_pop_signature(m, m->root_container.signature);
 
         free(m->peeked_signature);
 
         free(m->unit);
         free(m->user_unit);
         free(m->session);
-        free(m);
+
+        message_release(m);
 }
 
 static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz) {
@@ -179,16 +365,21 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz) {
                 np = realloc(m->header, ALIGN8(new_size));
                 if (!np)
                         goto poison;
+        } else if (ALIGN8(new_size) <= MESSAGE_FIELDS_INLINE) {
+                /* Initially, the header is allocated as part of
+                 * the sd_bus_message itself, with some room for the
+                 * fields, use that as long as it suffices */
+
+                np = m->header;
         } else {
-                /* Initially, the header is allocated as part of of
-                 * the sd_bus_message itself, let's replace it by
-                 * dynamic data */
+                /* Otherwise replace it by dynamic data */
 
                 np = malloc(ALIGN8(new_size));
                 if (!np)
                         goto poison;
 
-                memcpy(np, m->header, sizeof(struct bus_header));
+                memcpy(np, m->header, old_size);
+                m->free_header = true;
         }
 
         /* Zero out padding */
@@ -207,8 +398,6 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz) {
         m->sender = adjust_pointer(m->sender, op, old_size, m->header);
         m->error.name = adjust_pointer(m->error.name, op, old_size, m->header);
 
-        m->free_header = true;
-
         return (uint8_t*) np + start;
 
 poison:
@@ -305,6 +494,7 @@ static int message_append_field_uint32(sd_bus_message *m, uint8_t h, uint32_t x)
 }
 
 int bus_message_from_header(
+                sd_bus *bus,
                 void *buffer,
                 size_t length,
                 int *fds,
@@ -346,7 +536,7 @@ int bus_message_from_header(
                 a += label_sz + 1;
         }
 
-        m = malloc0(a);
+        m = message_alloc(bus ? bus->message_cache : NULL, a, a);
         if (!m)
                 return -ENOMEM;
 
@@ -373,6 +563,7 @@ int bus_message_from_header(
 }
 
 int bus_message_from_malloc(
+                sd_bus *bus,
                 void *buffer,
                 size_t length,
                 int *fds,
@@ -384,7 +575,7 @@ int bus_message_from_malloc(
         sd_bus_message *m;
         int r;
 
-        r = bus_message_from_header(buffer, length, fds, n_fds, ucred, label, 0, &m);
+        r = bus_message_from_header(bus, buffer, length, fds, n_fds, ucred, label, 0, &m);
         if (r < 0)
                 return r;
 
@@ -423,12 +614,15 @@ fail:
 static sd_bus_message *message_new(sd_bus *bus, uint8_t type) {
         sd_bus_message *m;
 
-        m = malloc0(ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
+        m = message_alloc(bus ? bus->message_cache : NULL,
+                          MESSAGE_CHUNK_SIZE,
+                          ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
         if (!m)
                 return NULL;
 
         m->n_ref = 1;
         m->header = (struct bus_header*) ((uint8_t*) m + ALIGN(sizeof(struct sd_bus_message)));
+        m->body_inline = (uint8_t*) m->header + MESSAGE_FIELDS_INLINE;
         m->header->endian = SD_BUS_NATIVE_ENDIAN;
         m->header->type = type;
         m->header->version = bus ? bus->message_version : 1;
@@ -1297,15 +1491,36 @@ static int part_make_space(
                 }
 
                 part->munmap_this = true;
-        } else {
-                n = realloc(part->data, MAX(sz, 1u));
-                if (!n) {
-                        m->poisoned = true;
-                        return -ENOMEM;
+        } else if (!part->data || sz > part->allocated) {
+                size_t a;
+
+                /* The first part of a message starts out in the
+                 * space allocated along with the message, others
+                 * grow exponentially */
+                if (!part->data && part == &m->body && m->body_inline && sz <= MESSAGE_BODY_INLINE) {
+                        n = m->body_inline;
+                        a = MESSAGE_BODY_INLINE;
+                } else {
+                        a = MAX(sz, 1u);
+                        a = MAX(a, part->allocated * 2);
+
+                        if (part->free_this || !part->data)
+                                n = realloc(part->data, a);
+                        else {
+                                n = malloc(a);
+                                if (n)
+                                        memcpy(n, part->data, part->size);
+                        }
+                        if (!n) {
+                                m->poisoned = true;
+                                return -ENOMEM;
+                        }
+
+                        part->free_this = true;
                 }
 
                 part->data = n;
-                part->free_this = true;
+                part->allocated = a;
         }
 
         if (q)
@@ -1856,18 +2071,15 @@ int sd_bus_message_open_container(
         if (m->poisoned)
                 return -ESTALE;
 
-        /* Make sure we have space for one more container */
-        w = realloc(m->containers, sizeof(struct bus_container) * (m->n_containers + 1));
-        if (!w) {
+        r = message_grow_containers(m);
+        if (r < 0) {
                 m->poisoned = true;
-                return -ENOMEM;
+                return r;
         }
 
-        m->containers = w;
-
         c = message_get_container(m);
 
-        signature = strdup(contents);
+        signature = message_push_signature(m, contents);
         if (!signature) {
                 m->poisoned = true;
                 return -ENOMEM;
@@ -1890,12 +2102,12 @@ int sd_bus_message_open_container(
                 r = -EINVAL;
 
         if (r < 0) {
-                free(signature);
+                message_pop_signature(m, signature);
                 return r;
         }
 
         /* OK, let's fill it in */
-        w += m->n_containers++;
+        w = m->containers + m->n_containers++;
         w->enclosing = type;
         w->signature = signature;
         w->index = 0;
@@ -1923,7 +2135,7 @@ int sd_bus_message_close_container(sd_bus_message *m) {
                 if (c->signature && c->signature[c->index] != 0)
                         return -EINVAL;
 
-        free(c->signature);
+        message_pop_signature(m, c->signature);
         m->n_containers--;
 
         return 0;
@@ -2997,17 +3209,16 @@ int sd_bus_message_enter_container(sd_bus_message *m, char type, const char *con
         if (m->n_containers >= BUS_CONTAINER_DEPTH)
                 return -EBADMSG;
 
-        w = realloc(m->containers, sizeof(struct bus_container) * (m->n_containers + 1));
-        if (!w)
-                return -ENOMEM;
-        m->containers = w;
+        r = message_grow_containers(m);
+        if (r < 0)
+                return r;
 
         c = message_get_container(m);
 
         if (!c->signature || c->signature[c->index] == 0)
                 return 0;
 
-        signature = strdup(contents);
+        signature = message_push_signature(m, contents);
         if (!signature)
                 return -ENOMEM;
 
@@ -3026,12 +3237,12 @@ int sd_bus_message_enter_container(sd_bus_message *m, char type, const char *con
                 r = -EINVAL;
 
         if (r <= 0) {
-                free(signature);
+                message_pop_signature(m, signature);
                 return r;
         }
 
         /* OK, let's fill it in */
-        w += m->n_containers++;
+        w = m->containers + m->n_containers++;
         w->enclosing = type;
         w->signature = signature;
         w->index = 0;
@@ -3065,7 +3276,7 @@ int sd_bus_message_exit_container(sd_bus_message *m) {
                         return -EINVAL;
         }
 
-        free(c->signature);
+        message_pop_signature(m, c->signature);
         m->n_containers--;
 
         return 1;
@@ -3085,7 +3296,7 @@ static void message_quit_container(sd_bus_message *m) {
         m->rindex = c->before;
 
         /* Free container */
-        free(c->signature);
+        message_pop_signature(m, c->signature);
         m->n_containers--;
 
         /* Correct index of new top-level container */
@@ -3833,11 +4044,10 @@ int bus_message_parse_fields(sd_bus_message *m) {
                         if (r < 0)
                                 return r;
 
-                        c = strdup(s);
+                        c = message_push_signature(m, s);
                         if (!c)
                                 return -ENOMEM;
 
-                        free(m->root_container.signature);
                         m->root_container.signature = c;
                         break;
                 }
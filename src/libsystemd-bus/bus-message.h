@@ -30,6 +30,20 @@
 #include "kdbus.h"
 #include "time-util.h"
 
+/* Messages we build are allocated in one chunk, together with room
+ * for the header fields and the first body part of a typical method
+ * call, so that small messages need no further allocations. */
+#define MESSAGE_FIELDS_INLINE 256
+#define MESSAGE_BODY_INLINE 256
+#define MESSAGE_CHUNK_SIZE (ALIGN(sizeof(sd_bus_message)) + MESSAGE_FIELDS_INLINE + MESSAGE_BODY_INLINE)
+
+/* Freed chunks are kept around per bus for reuse, up to this many */
+#define MESSAGE_CACHE_MAX 64
+
+#define MESSAGE_CONTAINERS_FIXED 4
+
+struct message_cache;
+
 struct bus_container {
         char enclosing;
 
@@ -55,6 +69,7 @@ struct bus_body_part {
         struct bus_body_part *next;
         void *data;
         size_t size;
+        size_t allocated;
         size_t mapped;
         int memfd;
         bool free_this:1;
@@ -67,6 +82,7 @@ struct sd_bus_message {
         unsigned n_ref;
 
         sd_bus *bus;
+        struct message_cache *cache;
 
         uint32_t reply_serial;
 
@@ -101,6 +117,7 @@ struct sd_bus_message {
         struct bus_body_part body;
         struct bus_body_part *body_end;
         unsigned n_body_parts;
+        void *body_inline;
 
         char *label;
 
@@ -112,7 +129,13 @@ struct sd_bus_message {
         int *fds;
 
         struct bus_container root_container, *containers;
-        unsigned n_containers;
+        unsigned n_containers, n_containers_allocated;
+        struct bus_container containers_fixed[MESSAGE_CONTAINERS_FIXED];
+
+        /* Container signatures are pushed and popped in stack
+         * order, short ones are kept here */
+        char signature_buffer[64];
+        size_t signature_buffer_used;
 
         struct iovec *iovec;
         struct iovec iovec_fixed[2];
@@ -194,7 +217,11 @@ int bus_message_dump(sd_bus_message *m);
 int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz);
 int bus_message_read_strv_extend(sd_bus_message *m, char ***l);
 
+struct message_cache *message_cache_new(void);
+struct message_cache *message_cache_unref(struct message_cache *c);
+
 int bus_message_from_header(
+                sd_bus *bus,
                 void *header,
                 size_t length,
                 int *fds,
@@ -205,6 +232,7 @@ int bus_message_from_header(
                 sd_bus_message **ret);
 
 int bus_message_from_malloc(
+                sd_bus *bus,
                 void *buffer,
                 size_t length,
                 int *fds,
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/poll.h>
 #include <byteswap.h>
 
@@ -779,56 +780,76 @@ int bus_socket_take_fd(sd_bus *b) {
         return bus_socket_start_auth(b);
 }
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+int bus_socket_write_message(sd_bus *bus, sd_bus_message **m, unsigned n, size_t *idx) {
         struct iovec *iov;
         ssize_t k;
-        size_t n;
-        unsigned j;
+        unsigned i, j, n_iovec = 0;
         int r;
 
         assert(bus);
         assert(m);
+        assert(n > 0);
         assert(idx);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (*idx >= BUS_MESSAGE_SIZE(m))
+        if (*idx >= BUS_MESSAGE_SIZE(m[0]))
                 return 0;
 
-        r = bus_message_setup_iovec(m);
-        if (r < 0)
-                return r;
+        /* Write as many of the queued messages as we can in a single
+         * syscall. *idx is the index into all of them concatenated.
+         * File descriptors are passed along with the first message of
+         * a batch only, hence we stop at the next one carrying
+         * some. */
+        for (i = 0; i < n; i++) {
+
+                if (i > 0 && m[i]->n_fds > 0)
+                        break;
+
+                r = bus_message_setup_iovec(m[i]);
+                if (r < 0)
+                        return r;
+
+                if (i > 0 && n_iovec + m[i]->n_iovec > IOV_MAX)
+                        break;
+
+                n_iovec += m[i]->n_iovec;
+        }
+
+        n = i;
 
-        n = m->n_iovec * sizeof(struct iovec);
-        iov = alloca(n);
-        memcpy(iov, m->iovec, n);
+        iov = alloca(n_iovec * sizeof(struct iovec));
+        for (i = 0, j = 0; i < n; i++) {
+                memcpy(iov + j, m[i]->iovec, m[i]->n_iovec * sizeof(struct iovec));
+                j += m[i]->n_iovec;
+        }
 
         j = 0;
         iovec_advance(iov, &j, *idx);
 
         if (bus->prefer_writev)
-                k = writev(bus->output_fd, iov, m->n_iovec);
+                k = writev(bus->output_fd, iov + j, n_iovec - j);
         else {
                 struct msghdr mh;
                 zero(mh);
 
-                if (m->n_fds > 0) {
+                if (m[0]->n_fds > 0) {
                         struct cmsghdr *control;
-                        control = alloca(CMSG_SPACE(sizeof(int) * m->n_fds));
+                        control = alloca(CMSG_SPACE(sizeof(int) * m[0]->n_fds));
 
                         mh.msg_control = control;
                         control->cmsg_level = SOL_SOCKET;
                         control->cmsg_type = SCM_RIGHTS;
-                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m->n_fds);
-                        memcpy(CMSG_DATA(control), m->fds, sizeof(int) * m->n_fds);
+                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m[0]->n_fds);
+                        memcpy(CMSG_DATA(control), m[0]->fds, sizeof(int) * m[0]->n_fds);
                 }
 
-                mh.msg_iov = iov;
-                mh.msg_iovlen = m->n_iovec;
+                mh.msg_iov = iov + j;
+                mh.msg_iovlen = n_iovec - j;
 
                 k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
                 if (k < 0 && errno == ENOTSOCK) {
                         bus->prefer_writev = true;
-                        k = writev(bus->output_fd, iov, m->n_iovec);
+                        k = writev(bus->output_fd, iov + j, n_iovec - j);
                 }
         }
 
@@ -909,7 +930,7 @@ static int bus_socket_make_message(sd_bus *bus, size_t size, sd_bus_message **m)
         } else
                 b = NULL;
 
-        r = bus_message_from_malloc(bus->rbuffer, size,
+        r = bus_message_from_malloc(bus, bus->rbuffer, size,
                                     bus->fds, bus->n_fds,
                                     bus->ucred_valid ? &bus->ucred : NULL,
                                     bus->label[0] ? bus->label : NULL,
@@ -27,7 +27,7 @@ int bus_socket_connect(sd_bus *b);
 int bus_socket_exec(sd_bus *b);
 int bus_socket_take_fd(sd_bus *b);
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx);
+int bus_socket_write_message(sd_bus *bus, sd_bus_message **m, unsigned n, size_t *idx);
 int bus_socket_read_message(sd_bus *bus, sd_bus_message **m);
 
 int bus_socket_process_opening(sd_bus *b);
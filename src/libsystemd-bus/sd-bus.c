@@ -98,10 +98,86 @@ static void bus_node_destroy(sd_bus *b, struct node *n) {
         free(n);
 }
 
+static int bus_queue_make_room(struct bus_queue *q, unsigned max) {
+        sd_bus_message **items;
+        unsigned n, i;
+
+        assert(q);
+
+        if (q->size < q->allocated)
+                return 0;
+
+        if (q->size >= max)
+                return -ENOBUFS;
+
+        n = MAX(q->allocated * 2, 8U);
+        n = MIN(n, max);
+
+        items = new(sd_bus_message*, n);
+        if (!items)
+                return -ENOMEM;
+
+        /* Unwrap the ring while copying it over */
+        for (i = 0; i < q->size; i++)
+                items[i] = q->items[(q->head + i) % q->allocated];
+
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->allocated = n;
+
+        return 0;
+}
+
+static void bus_queue_push(struct bus_queue *q, sd_bus_message *m) {
+        assert(q);
+        assert(q->size < q->allocated);
+
+        q->items[(q->head + q->size) % q->allocated] = m;
+        q->size ++;
+}
+
+static sd_bus_message *bus_queue_pop(struct bus_queue *q) {
+        sd_bus_message *m;
+
+        assert(q);
+        assert(q->size > 0);
+
+        m = q->items[q->head];
+        q->head = (q->head + 1) % q->allocated;
+        q->size --;
+
+        return m;
+}
+
+static void bus_queue_free(struct bus_queue *q) {
+        assert(q);
+
+        while (q->size > 0)
+                sd_bus_message_unref(bus_queue_pop(q));
+
+        free(q->items);
+        zero(*q);
+}
+
+static void bus_update_congestion(sd_bus *bus) {
+        assert(bus);
+
+        /* Senders are asked to back off once the write queue reaches
+         * the high watermark, and are notified again when it drained
+         * down to the low watermark */
+
+        if (!bus->congested && bus->wqueue.size >= bus->wqueue_high)
+                bus->congested = true;
+        else if (bus->congested && bus->wqueue.size <= bus->wqueue_low) {
+                bus->congested = false;
+                bus->writable_pending = true;
+        }
+}
+
 static void bus_free(sd_bus *b) {
         struct filter_callback *f;
         struct node *n;
-        unsigned i;
 
         assert(b);
 
@@ -124,13 +200,8 @@ static void bus_free(sd_bus *b) {
         close_many(b->fds, b->n_fds);
         free(b->fds);
 
-        for (i = 0; i < b->rqueue_size; i++)
-                sd_bus_message_unref(b->rqueue[i]);
-        free(b->rqueue);
-
-        for (i = 0; i < b->wqueue_size; i++)
-                sd_bus_message_unref(b->wqueue[i]);
-        free(b->wqueue);
+        bus_queue_free(&b->rqueue);
+        bus_queue_free(&b->wqueue);
 
         hashmap_free_free(b->reply_callbacks);
         prioq_free(b->reply_callbacks_prioq);
@@ -154,6 +225,8 @@ static void bus_free(sd_bus *b) {
 
         assert_se(pthread_mutex_destroy(&b->memfd_cache_mutex) == 0);
 
+        message_cache_unref(b->message_cache);
+
         free(b);
 }
 
@@ -174,10 +247,19 @@ int sd_bus_new(sd_bus **ret) {
 
         assert_se(pthread_mutex_init(&r->memfd_cache_mutex, NULL) == 0);
 
+        r->message_cache = message_cache_new();
+        if (!r->message_cache) {
+                free(r);
+                return -ENOMEM;
+        }
+
+        r->wqueue_low = BUS_WQUEUE_LOW_DEFAULT;
+        r->wqueue_high = BUS_WQUEUE_HIGH_DEFAULT;
+
         /* We guarantee that wqueue always has space for at least one
          * entry */
-        r->wqueue = new(sd_bus_message*, 1);
-        if (!r->wqueue) {
+        if (bus_queue_make_room(&r->wqueue, BUS_WQUEUE_MAX) < 0) {
+                message_cache_unref(r->message_cache);
                 free(r);
                 return -ENOMEM;
         }
@@ -1136,39 +1218,44 @@ static int dispatch_wqueue(sd_bus *bus) {
         assert(bus);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        while (bus->wqueue_size > 0) {
+        while (bus->wqueue.size > 0) {
 
                 if (bus->is_kernel)
-                        r = bus_kernel_write_message(bus, bus->wqueue[0]);
+                        r = bus_kernel_write_message(bus, bus_queue_peek(&bus->wqueue));
                 else
-                        r = bus_socket_write_message(bus, bus->wqueue[0], &bus->windex);
+                        /* Hand over the part of the ring up to
+                         * the wrap-around, so that it can be
+                         * written in one go */
+                        r = bus_socket_write_message(bus,
+                                                     bus->wqueue.items + bus->wqueue.head,
+                                                     MIN(bus->wqueue.size, bus->wqueue.allocated - bus->wqueue.head),
+                                                     &bus->windex);
 
                 if (r < 0) {
                         sd_bus_close(bus);
                         return r;
                 } else if (r == 0)
                         /* Didn't do anything this time */
-                        return ret;
-                else if (bus->is_kernel || bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[0])) {
-                        /* Fully written. Let's drop the entry from
-                         * the queue.
-                         *
-                         * This isn't particularly optimized, but
-                         * well, this is supposed to be our worst-case
-                         * buffer only, and the socket buffer is
-                         * supposed to be our primary buffer, and if
-                         * it got full, then all bets are off
-                         * anyway. */
-
-                        sd_bus_message_unref(bus->wqueue[0]);
-                        bus->wqueue_size --;
-                        memmove(bus->wqueue, bus->wqueue + 1, sizeof(sd_bus_message*) * bus->wqueue_size);
-                        bus->windex = 0;
-
+                        break;
+                else if (bus->is_kernel) {
+                        sd_bus_message_unref(bus_queue_pop(&bus->wqueue));
                         ret = 1;
+                } else {
+                        sd_bus_message *m;
+
+                        /* Drop all entries that have been fully
+                         * written from the queue */
+                        while ((m = bus_queue_peek(&bus->wqueue)) &&
+                               bus->windex >= BUS_MESSAGE_SIZE(m)) {
+                                bus->windex -= BUS_MESSAGE_SIZE(m);
+                                sd_bus_message_unref(bus_queue_pop(&bus->wqueue));
+                                ret = 1;
+                        }
                 }
         }
 
+        bus_update_congestion(bus);
+
         return ret;
 }
 
@@ -1180,12 +1267,10 @@ static int dispatch_rqueue(sd_bus *bus, sd_bus_message **m) {
         assert(m);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (bus->rqueue_size > 0) {
+        if (bus->rqueue.size > 0) {
                 /* Dispatch a queued message */
 
-                *m = bus->rqueue[0];
-                bus->rqueue_size --;
-                memmove(bus->rqueue, bus->rqueue + 1, sizeof(sd_bus_message*) * bus->rqueue_size);
+                *m = bus_queue_pop(&bus->rqueue);
                 return 1;
         }
 
@@ -1240,43 +1325,41 @@ int sd_bus_send(sd_bus *bus, sd_bus_message *m, uint64_t *serial) {
         if (m->dont_send && !serial)
                 return 1;
 
-        if ((bus->state == BUS_RUNNING || bus->state == BUS_HELLO) && bus->wqueue_size <= 0) {
+        if ((bus->state == BUS_RUNNING || bus->state == BUS_HELLO) && bus->wqueue.size <= 0) {
                 size_t idx = 0;
 
                 if (bus->is_kernel)
                         r = bus_kernel_write_message(bus, m);
                 else
-                        r = bus_socket_write_message(bus, m, &idx);
+                        r = bus_socket_write_message(bus, &m, 1, &idx);
 
                 if (r < 0) {
                         sd_bus_close(bus);
                         return r;
                 } else if (!bus->is_kernel && idx < BUS_MESSAGE_SIZE(m))  {
                         /* Wasn't fully written. So let's remember how
-                         * much was written. Note that the first entry
-                         * of the wqueue array is always allocated so
+                         * much was written. Note that the wqueue
+                         * always has room for at least one entry so
                          * that we always can remember how much was
                          * written. */
-                        bus->wqueue[0] = sd_bus_message_ref(m);
-                        bus->wqueue_size = 1;
+                        bus_queue_push(&bus->wqueue, sd_bus_message_ref(m));
                         bus->windex = idx;
                 }
         } else {
-                sd_bus_message **q;
-
-                /* Just append it to the queue. */
+                /* Just append it to the queue. There's no limit
+                 * on this besides a safety net, senders are
+                 * supposed to check sd_bus_is_congested() and wait
+                 * for the writable callback instead. */
 
-                if (bus->wqueue_size >= BUS_WQUEUE_MAX)
-                        return -ENOBUFS;
-
-                q = realloc(bus->wqueue, sizeof(sd_bus_message*) * (bus->wqueue_size + 1));
-                if (!q)
-                        return -ENOMEM;
+                r = bus_queue_make_room(&bus->wqueue, BUS_WQUEUE_MAX);
+                if (r < 0)
+                        return r;
 
-                bus->wqueue = q;
-                q[bus->wqueue_size ++] = sd_bus_message_ref(m);
+                bus_queue_push(&bus->wqueue, sd_bus_message_ref(m));
         }
 
+        bus_update_congestion(bus);
+
         if (serial)
                 *serial = BUS_MESSAGE_SERIAL(m);
 
@@ -1430,7 +1513,6 @@ int sd_bus_send_with_reply_and_block(
         int r;
         usec_t timeout;
         uint64_t serial;
-        bool room = false;
 
         assert_return(bus, -EINVAL);
         assert_return(BUS_IS_OPEN(bus->state), -ENOTCONN);
@@ -1454,22 +1536,11 @@ int sd_bus_send_with_reply_and_block(
                 usec_t left;
                 sd_bus_message *incoming = NULL;
 
-                if (!room) {
-                        sd_bus_message **q;
-
-                        if (bus->rqueue_size >= BUS_RQUEUE_MAX)
-                                return -ENOBUFS;
-
-                        /* Make sure there's room for queuing this
-                         * locally, before we read the message */
-
-                        q = realloc(bus->rqueue, (bus->rqueue_size + 1) * sizeof(sd_bus_message*));
-                        if (!q)
-                                return -ENOMEM;
-
-                        bus->rqueue = q;
-                        room = true;
-                }
+                /* Make sure there's room for queuing this
+                 * locally, before we read the message */
+                r = bus_queue_make_room(&bus->rqueue, BUS_RQUEUE_MAX);
+                if (r < 0)
+                        return r;
 
                 if (bus->is_kernel)
                         r = bus_kernel_read_message(bus, &incoming);
@@ -1512,8 +1583,7 @@ int sd_bus_send_with_reply_and_block(
 
                         /* There's already guaranteed to be room for
                          * this, so need to resize things here */
-                        bus->rqueue[bus->rqueue_size ++] = incoming;
-                        room = false;
+                        bus_queue_push(&bus->rqueue, incoming);
 
                         /* Try to read more, right-away */
                         continue;
@@ -1569,9 +1639,9 @@ int sd_bus_get_events(sd_bus *bus) {
                 flags |= POLLIN;
 
         } else if (bus->state == BUS_RUNNING || bus->state == BUS_HELLO) {
-                if (bus->rqueue_size <= 0)
+                if (bus->rqueue.size <= 0)
                         flags |= POLLIN;
-                if (bus->wqueue_size > 0)
+                if (bus->wqueue.size > 0)
                         flags |= POLLOUT;
         }
 
@@ -1596,7 +1666,7 @@ int sd_bus_get_timeout(sd_bus *bus, uint64_t *timeout_usec) {
                 return 0;
         }
 
-        if (bus->rqueue_size > 0) {
+        if (bus->rqueue.size > 0 || bus->writable_pending) {
                 *timeout_usec = 0;
                 return 1;
         }
@@ -1833,6 +1903,20 @@ static int process_message(sd_bus *bus, sd_bus_message *m) {
         return bus_process_object(bus, m);
 }
 
+static int process_writable(sd_bus *bus) {
+        assert(bus);
+
+        if (!bus->writable_pending)
+                return 0;
+
+        bus->writable_pending = false;
+
+        if (!bus->writable_callback)
+                return 0;
+
+        return bus->writable_callback(bus, bus->writable_userdata);
+}
+
 static int process_running(sd_bus *bus, sd_bus_message **ret) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
         int r;
@@ -1848,6 +1932,10 @@ static int process_running(sd_bus *bus, sd_bus_message **ret) {
         if (r != 0)
                 goto null_message;
 
+        r = process_writable(bus);
+        if (r != 0)
+                goto null_message;
+
         r = dispatch_rqueue(bus, &m);
         if (r < 0)
                 return r;
@@ -1998,7 +2086,7 @@ int sd_bus_wait(sd_bus *bus, uint64_t timeout_usec) {
         assert_return(BUS_IS_OPEN(bus->state), -ENOTCONN);
         assert_return(!bus_pid_changed(bus), -ECHILD);
 
-        if (bus->rqueue_size > 0)
+        if (bus->rqueue.size > 0)
                 return 0;
 
         return bus_poll(bus, false, timeout_usec);
@@ -2015,7 +2103,7 @@ int sd_bus_flush(sd_bus *bus) {
         if (r < 0)
                 return r;
 
-        if (bus->wqueue_size <= 0)
+        if (bus->wqueue.size <= 0)
                 return 0;
 
         for (;;) {
@@ -2023,7 +2111,7 @@ int sd_bus_flush(sd_bus *bus) {
                 if (r < 0)
                         return r;
 
-                if (bus->wqueue_size <= 0)
+                if (bus->wqueue.size <= 0)
                         return 0;
 
                 r = bus_poll(bus, false, (uint64_t) -1);
@@ -2032,6 +2120,38 @@ int sd_bus_flush(sd_bus *bus) {
         }
 }
 
+int sd_bus_set_write_watermarks(sd_bus *bus, unsigned low, unsigned high) {
+
+        assert_return(bus, -EINVAL);
+        assert_return(high > 0, -EINVAL);
+        assert_return(low < high, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        bus->wqueue_low = low;
+        bus->wqueue_high = high;
+
+        bus_update_congestion(bus);
+        return 0;
+}
+
+int sd_bus_is_congested(sd_bus *bus) {
+
+        assert_return(bus, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        return bus->congested;
+}
+
+int sd_bus_set_writable_callback(sd_bus *bus, sd_bus_writable_handler_t callback, void *userdata) {
+
+        assert_return(bus, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        bus->writable_callback = callback;
+        bus->writable_userdata = userdata;
+        return 0;
+}
+
 int sd_bus_add_filter(sd_bus *bus, sd_bus_message_handler_t callback, void *userdata) {
         struct filter_callback *f;
 
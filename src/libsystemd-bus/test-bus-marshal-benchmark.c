@@ -0,0 +1,138 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "util.h"
+
+#include "sd-bus.h"
+#include "bus-message.h"
+#include "bus-util.h"
+
+/* Shows how many allocations and how much time building, marshalling
+ * and parsing a typical method call takes, with and without a bus to
+ * carve the messages from. Takes the number of messages (default
+ * 10000). */
+
+/* Count calls into the allocator, to see what building and parsing
+ * a message costs us. This replaces malloc(), calloc() and realloc()
+ * with wrappers around the glibc internals, and hence is not run as
+ * part of the test suite, nor should it be run under valgrind. */
+static unsigned long n_allocs = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) {
+        n_allocs++;
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+        n_allocs++;
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *p, size_t size) {
+        n_allocs++;
+        return __libc_realloc(p, size);
+}
+
+static void benchmark(sd_bus *bus, unsigned n) {
+        unsigned long allocs;
+        usec_t t;
+        unsigned i;
+
+        /* Builds, marshals and parses a typical method call, with
+         * or without a bus to carve the messages from */
+
+        allocs = n_allocs;
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *p = NULL;
+                const char *x, *y, *k, *v;
+                void *buffer;
+                size_t sz;
+
+                assert_se(sd_bus_message_new_method_call(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                                                         "org.freedesktop.systemd1.Manager", "StartUnit", &m) >= 0);
+                assert_se(sd_bus_message_append(m, "ssa{sv}", "foobar.service", "replace",
+                                                1, "Description", "s", "Foobar") >= 0);
+                assert_se(bus_message_seal(m, i + 1) >= 0);
+
+                assert_se(bus_message_get_blob(m, &buffer, &sz) >= 0);
+                assert_se(bus_message_from_malloc(bus, buffer, sz, NULL, 0, NULL, NULL, &p) >= 0);
+
+                assert_se(sd_bus_message_read(p, "ssa{sv}", &x, &y, 1, &k, "s", &v) > 0);
+                assert_se(streq(x, "foobar.service"));
+                assert_se(streq(v, "Foobar"));
+        }
+
+        t = now(CLOCK_MONOTONIC) - t;
+        allocs = n_allocs - allocs;
+
+        log_info("%s: %.1f allocations/message, %llu ns/message",
+                 bus ? "with bus" : "without bus",
+                 (double) allocs / n, (unsigned long long) (t * 1000 / n));
+
+        /* With the messages from the cache, all that is left is
+         * growing the signature while building, and the blob */
+        if (bus)
+                assert_se(allocs < n * 5);
+}
+
+static void test_benchmark(unsigned n) {
+        _cleanup_bus_unref_ sd_bus *bus = NULL;
+        int pair[2];
+
+        /* A bus that is started is enough to build messages, the
+         * other side need not talk to us */
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, pair[0], pair[0]) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        benchmark(NULL, n);
+        benchmark(bus, n);
+
+        close_nointr_nofail(pair[1]);
+}
+
+int main(int argc, char *argv[]) {
+        unsigned n = 10000;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &n) < 0 || n == 0)) {
+                log_error("Failed to parse number of messages: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        test_benchmark(n);
+
+        return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <byteswap.h>
+#include <sys/socket.h>
 
 #ifdef HAVE_GLIB
 #include <gio/gio.h>
@@ -36,6 +37,43 @@
 #include "bus-message.h"
 #include "bus-util.h"
 
+static void test_cached(void) {
+        _cleanup_bus_unref_ sd_bus *bus = NULL;
+        int pair[2];
+        unsigned i;
+
+        /* Messages of a bus are carved from its cache, make sure
+         * they come out the same when reused */
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, pair[0], pair[0]) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        for (i = 0; i < 100; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *p = NULL;
+                const char *x, *y, *k, *v;
+                void *buffer;
+                size_t sz;
+
+                assert_se(sd_bus_message_new_method_call(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                                                         "org.freedesktop.systemd1.Manager", "StartUnit", &m) >= 0);
+                assert_se(sd_bus_message_append(m, "ssa{sv}", "foobar.service", "replace",
+                                                1, "Description", "s", "Foobar") >= 0);
+                assert_se(bus_message_seal(m, i + 1) >= 0);
+
+                assert_se(bus_message_get_blob(m, &buffer, &sz) >= 0);
+                assert_se(bus_message_from_malloc(bus, buffer, sz, NULL, 0, NULL, NULL, &p) >= 0);
+
+                assert_se(sd_bus_message_read(p, "ssa{sv}", &x, &y, 1, &k, "s", &v) > 0);
+                assert_se(streq(x, "foobar.service"));
+                assert_se(streq(y, "replace"));
+                assert_se(streq(k, "Description"));
+                assert_se(streq(v, "Foobar"));
+        }
+
+        close_nointr_nofail(pair[1]);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
         int r, boolean;
@@ -133,7 +171,7 @@ int main(int argc, char *argv[]) {
 
         m = sd_bus_message_unref(m);
 
-        r = bus_message_from_malloc(buffer, sz, NULL, 0, NULL, NULL, &m);
+        r = bus_message_from_malloc(NULL, buffer, sz, NULL, 0, NULL, NULL, &m);
         assert_se(r >= 0);
 
         bus_message_dump(m);
@@ -190,5 +228,7 @@ int main(int argc, char *argv[]) {
         r = sd_bus_message_peek_type(m, NULL, NULL);
         assert_se(r == 0);
 
+        test_cached();
+
         return 0;
 }
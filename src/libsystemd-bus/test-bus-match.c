@@ -27,9 +27,11 @@
 
 #include "bus-match.h"
 #include "bus-message.h"
+#include "bus-internal.h"
 #include "bus-util.h"
 
 static bool mask[32];
+static unsigned n_called;
 
 static int filter(sd_bus *b, sd_bus_message *m, void *userdata) {
         log_info("Ran %i", PTR_TO_INT(userdata));
@@ -71,6 +73,11 @@ static int match_add(struct bus_match_node *root, const char *match, int value)
         return r;
 }
 
+static int count(sd_bus *b, sd_bus_message *m, void *userdata) {
+        n_called++;
+        return 0;
+}
+
 static int match_remove(struct bus_match_node *root, const char *match, int value) {
         struct bus_match_component *components = NULL;
         unsigned n_components = 0;
@@ -86,10 +93,155 @@ static int match_remove(struct bus_match_node *root, const char *match, int valu
         return r;
 }
 
+static void test_prefixes(void) {
+        static const struct {
+                const char *match;
+                bool (*test)(const char *pattern, const char *value);
+                const char *pattern;
+                bool path;
+        } table[] = {
+                { "path_namespace", path_simple_pattern, "/", true },
+                { "path_namespace", path_simple_pattern, "/foo", true },
+                { "path_namespace", path_simple_pattern, "/foo/bar", true },
+                { "path_namespace", path_simple_pattern, "/foobar", true },
+                { "path_namespace", path_simple_pattern, "/foo/bar/baz", true },
+                { "arg0path", path_complex_pattern, "/", false },
+                { "arg0path", path_complex_pattern, "/foo", false },
+                { "arg0path", path_complex_pattern, "/foo/", false },
+                { "arg0path", path_complex_pattern, "/foo/bar", false },
+                { "arg0path", path_complex_pattern, "/foo/bar/", false },
+                { "arg0path", path_complex_pattern, "/quux/", false },
+                { "arg0namespace", namespace_simple_pattern, "org", false },
+                { "arg0namespace", namespace_simple_pattern, "org.freedesktop", false },
+                { "arg0namespace", namespace_simple_pattern, "org.freedesktop.DBus", false },
+                { "arg0namespace", namespace_simple_pattern, "orga", false },
+        };
+        static const char *paths[] = {
+                "/", "/foo", "/foo/bar", "/foo/bar/baz", "/foo/barbaz", "/foobar/x", "/quux",
+        };
+        static const char *args[] = {
+                "/", "/foo", "/foo/", "/foo/bar", "/foo/bar/", "/foo/bar/baz", "/foobar", "/quux/a",
+                "org", "org.", "org.freedesktop", "org.freedesktop.DBus.Properties", "orga.foo", "",
+        };
+        struct bus_match_node root;
+        unsigned i, j, k;
+
+        assert_cc(ELEMENTSOF(table) <= ELEMENTSOF(mask));
+
+        /* The prefix lookups have to give the same results as
+         * testing each pattern on its own */
+
+        zero(root);
+        root.type = BUS_MATCH_ROOT;
+
+        for (k = 0; k < ELEMENTSOF(table); k++) {
+                _cleanup_free_ char *match = NULL;
+
+                assert_se(asprintf(&match, "%s='%s'", table[k].match, table[k].pattern) >= 0);
+                assert_se(match_add(&root, match, k) >= 0);
+        }
+
+        for (i = 0; i < ELEMENTSOF(paths); i++)
+                for (j = 0; j < ELEMENTSOF(args); j++) {
+                        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                        assert_se(sd_bus_message_new_signal(NULL, paths[i], "foo.bar", "waldo", &m) >= 0);
+                        assert_se(sd_bus_message_append(m, "s", args[j]) >= 0);
+                        assert_se(bus_message_seal(m, 1) >= 0);
+
+                        zero(mask);
+                        assert_se(bus_match_run(NULL, &root, m) == 0);
+
+                        for (k = 0; k < ELEMENTSOF(table); k++)
+                                assert_se(mask[k] == table[k].test(table[k].pattern, table[k].path ? paths[i] : args[j]));
+                }
+
+        bus_match_free(&root);
+}
+
+static void test_benchmark(unsigned n_matches) {
+        struct bus_match_node root;
+        sd_bus_message *m[64];
+        unsigned i, k, n_groups;
+        usec_t usec;
+
+        /* Installs matches of four kinds, and sends messages each of
+         * which triggers exactly one match of each kind. The time
+         * per message should hardly depend on the number of
+         * matches. */
+
+        n_groups = MAX(n_matches / 4, 1U);
+
+        zero(root);
+        root.type = BUS_MATCH_ROOT;
+
+        for (i = 0; i < n_groups; i++) {
+                char match[LINE_MAX];
+                struct bus_match_component *components;
+                unsigned n_components;
+                static const char *const prefix[] = {
+                        "type='signal',path_namespace='/org/example/o",
+                        "type='signal',arg0namespace='org.example.n",
+                        "type='signal',arg1path='/org/example/p",
+                        "type='signal',member='M",
+                };
+                static const char *const suffix[] = {
+                        "'",
+                        "'",
+                        "/'",
+                        "'",
+                };
+
+                for (k = 0; k < ELEMENTSOF(prefix); k++) {
+                        snprintf(match, sizeof(match), "%s%u%s", prefix[k], i, suffix[k]);
+
+                        assert_se(bus_match_parse(match, &components, &n_components) >= 0);
+                        assert_se(bus_match_add(&root, components, n_components, count, NULL, 0, NULL) >= 0);
+                        bus_match_parse_free(components, n_components);
+                }
+        }
+
+        for (k = 0; k < ELEMENTSOF(m); k++) {
+                char path[LINE_MAX], member[LINE_MAX], arg0[LINE_MAX], arg1[LINE_MAX];
+
+                i = (k * 7919) % n_groups;
+
+                snprintf(path, sizeof(path), "/org/example/o%u/object", i);
+                snprintf(member, sizeof(member), "M%u", i);
+                snprintf(arg0, sizeof(arg0), "org.example.n%u.Interface", i);
+                snprintf(arg1, sizeof(arg1), "/org/example/p%u/a/b", i);
+
+                assert_se(sd_bus_message_new_signal(NULL, path, "org.example", member, &m[k]) >= 0);
+                assert_se(sd_bus_message_append(m[k], "ss", arg0, arg1) >= 0);
+                assert_se(bus_message_seal(m[k], 1) >= 0);
+        }
+
+        n_called = 0;
+        usec = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < 10000; i++)
+                assert_se(bus_match_run(NULL, &root, m[i % ELEMENTSOF(m)]) == 0);
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+
+        assert_se(n_called == 4 * 10000);
+
+        printf("%6u matches: %8.0f ns/message\n", n_groups * 4, (double) usec * 1000.0 / 10000);
+
+        for (k = 0; k < ELEMENTSOF(m); k++)
+                sd_bus_message_unref(m[k]);
+
+        bus_match_free(&root);
+}
+
 int main(int argc, char *argv[]) {
         struct bus_match_node root;
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
         enum bus_match_node_type i;
+        unsigned n_matches = 10000, n;
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &n_matches) >= 0);
 
         zero(root);
         root.type = BUS_MATCH_ROOT;
@@ -141,5 +293,11 @@ int main(int argc, char *argv[]) {
 
         bus_match_free(&root);
 
+        test_prefixes();
+
+        for (n = 100; n < n_matches; n *= 10)
+                test_benchmark(n);
+        test_benchmark(n_matches);
+
         return 0;
 }
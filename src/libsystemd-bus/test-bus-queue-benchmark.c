@@ -0,0 +1,244 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+#include "time-util.h"
+
+#include "sd-bus.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+#include "bus-util.h"
+
+/* Shows how many method calls per second pass over a socket pair with
+ * 1, 10 and 1000 of them in flight at a time. Takes the number of
+ * calls per run (default 10000). */
+
+static unsigned arg_calls = 10000;
+
+/* The server stops reading from the bus until this one becomes
+ * readable */
+static int pause_fds[2] = { -1, -1 };
+
+struct context {
+        unsigned n_sent;
+        unsigned n_replies;
+        unsigned n_in_flight;
+        unsigned n_writable;
+};
+
+static void *server(void *p) {
+        sd_bus *bus = NULL;
+        int *fd = p;
+        sd_id128_t id;
+        bool quit = false;
+        int r;
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, *fd, *fd) >= 0);
+        assert_se(sd_bus_set_server(bus, 1, id) >= 0);
+        assert_se(sd_bus_set_anonymous(bus, true) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        while (!quit) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                r = sd_bus_process(bus, &m);
+                assert_se(r >= 0);
+
+                if (r == 0) {
+                        assert_se(sd_bus_wait(bus, (uint64_t) -1) >= 0);
+                        continue;
+                }
+
+                if (!m)
+                        continue;
+
+                if (sd_bus_message_is_method_call(m, "benchmark.server", "Pause")) {
+                        char x;
+
+                        assert_se(read(pause_fds[0], &x, 1) == 1);
+                } else if (sd_bus_message_is_method_call(m, "benchmark.server", "Exit"))
+                        quit = true;
+
+                assert_se(sd_bus_reply_method_return(bus, m, NULL) >= 0);
+        }
+
+        assert_se(sd_bus_flush(bus) >= 0);
+        sd_bus_unref(bus);
+
+        return NULL;
+}
+
+static int reply_handler(sd_bus *bus, sd_bus_message *m, void *userdata) {
+        struct context *c = userdata;
+        uint8_t type;
+
+        assert_se(sd_bus_message_get_type(m, &type) >= 0);
+        assert_se(type == SD_BUS_MESSAGE_METHOD_RETURN);
+
+        c->n_replies++;
+        c->n_in_flight--;
+
+        return 1;
+}
+
+static int writable_handler(sd_bus *bus, void *userdata) {
+        struct context *c = userdata;
+
+        assert_se(!sd_bus_is_congested(bus));
+        c->n_writable++;
+
+        return 1;
+}
+
+static void call(sd_bus *bus, struct context *c, const char *member) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+        assert_se(sd_bus_message_new_method_call(bus, NULL, "/", "benchmark.server", member, &m) >= 0);
+        assert_se(sd_bus_send_with_reply(bus, m, reply_handler, c, 0, NULL) >= 0);
+
+        c->n_sent++;
+        c->n_in_flight++;
+}
+
+static void run(sd_bus *bus, unsigned depth) {
+        struct context c = {};
+        usec_t usec;
+        int r;
+
+        assert_se(sd_bus_set_writable_callback(bus, writable_handler, &c) >= 0);
+
+        usec = now(CLOCK_MONOTONIC);
+
+        while (c.n_replies < arg_calls) {
+
+                /* Keep the pipe full, unless the write queue asks
+                 * us to back off */
+                while (c.n_sent < arg_calls && c.n_in_flight < depth && !sd_bus_is_congested(bus))
+                        call(bus, &c, "Ping");
+
+                r = sd_bus_process(bus, NULL);
+                assert_se(r >= 0);
+
+                if (r == 0)
+                        assert_se(sd_bus_wait(bus, (uint64_t) -1) >= 0);
+        }
+
+        usec = now(CLOCK_MONOTONIC) - usec;
+
+        assert_se(c.n_sent == arg_calls);
+        assert_se(c.n_in_flight == 0);
+
+        printf("%4u in flight: %8.0f calls/s, %u times writable again\n",
+               depth, (double) arg_calls * USEC_PER_SEC / usec, c.n_writable);
+}
+
+static void test_watermarks(sd_bus *bus) {
+        struct context c = {};
+        unsigned i;
+
+        assert_se(sd_bus_set_write_watermarks(bus, 4, 4) == -EINVAL);
+        assert_se(sd_bus_set_write_watermarks(bus, 2, 8) >= 0);
+        assert_se(sd_bus_set_writable_callback(bus, writable_handler, &c) >= 0);
+
+        call(bus, &c, "Pause");
+        assert_se(sd_bus_flush(bus) >= 0);
+
+        /* Everything that doesn't fit into the socket buffer right
+         * away is queued, rather than refused */
+        while (!sd_bus_is_congested(bus))
+                call(bus, &c, "Ping");
+
+        assert_se(bus->wqueue.size == 8);
+
+        for (i = 0; i < 1000; i++)
+                call(bus, &c, "Ping");
+
+        assert_se(bus->wqueue.size == 1008);
+        assert_se(sd_bus_is_congested(bus));
+        assert_se(c.n_writable == 0);
+
+        assert_se(write(pause_fds[1], "x", 1) == 1);
+
+        while (c.n_replies < c.n_sent)
+                if (sd_bus_process(bus, NULL) == 0)
+                        assert_se(sd_bus_wait(bus, (uint64_t) -1) >= 0);
+
+        assert_se(!sd_bus_is_congested(bus));
+        assert_se(c.n_writable == 1);
+
+        assert_se(sd_bus_set_write_watermarks(bus, BUS_WQUEUE_LOW_DEFAULT, BUS_WQUEUE_HIGH_DEFAULT) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        sd_bus *bus;
+        pthread_t s;
+        int fds[2];
+        struct context c = {};
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_calls) < 0 || arg_calls == 0)) {
+                log_error("Failed to parse number of calls: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        assert_se(pipe2(pause_fds, O_CLOEXEC) >= 0);
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) >= 0);
+        assert_se(pthread_create(&s, NULL, server, &fds[0]) == 0);
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, fds[1], fds[1]) >= 0);
+        assert_se(sd_bus_set_anonymous(bus, true) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        test_watermarks(bus);
+
+        run(bus, 1);
+        run(bus, 10);
+        run(bus, 1000);
+
+        assert_se(sd_bus_set_writable_callback(bus, NULL, NULL) >= 0);
+
+        call(bus, &c, "Exit");
+        while (c.n_replies < c.n_sent)
+                if (sd_bus_process(bus, NULL) == 0)
+                        assert_se(sd_bus_wait(bus, (uint64_t) -1) >= 0);
+
+        assert_se(pthread_join(s, NULL) == 0);
+
+        sd_bus_unref(bus);
+
+        close_pipe(pause_fds);
+
+        return EXIT_SUCCESS;
+}
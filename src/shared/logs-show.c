@@ -29,7 +29,6 @@
 #include "log.h"
 #include "util.h"
 #include "utf8.h"
-#include "hashmap.h"
 #include "journal-internal.h"
 
 /* up to three lines (each up to 100 characters),
@@ -41,20 +40,30 @@
 
 static int print_catalog(FILE *f, sd_journal *j) {
         int r;
-        _cleanup_free_ char *t = NULL, *z = NULL;
-
+        _cleanup_free_ char *t = NULL;
+        const char *s;
 
         r = sd_journal_get_catalog(j, &t);
         if (r < 0)
                 return r;
 
-        z = strreplace(strstrip(t), "\n", "\n-- ");
-        if (!z)
-                return log_oom();
+        /* Prefix every line, without building another copy of the
+         * text for it */
+        s = strstrip(t);
+        for (;;) {
+                size_t n;
 
-        fputs("-- ", f);
-        fputs(z, f);
-        fputc('\n', f);
+                n = strcspn(s, "\n");
+
+                fputs("-- ", f);
+                fwrite(s, 1, n, f);
+                fputc('\n', f);
+
+                if (s[n] == 0)
+                        break;
+
+                s += n + 1;
+        }
 
         return 0;
 }
@@ -568,6 +577,78 @@ static int output_export(
         return 0;
 }
 
+#define WORD_ONES UINT64_C(0x0101010101010101)
+#define WORD_HIGHS UINT64_C(0x8080808080808080)
+
+/* Looks at eight bytes at once, and returns non-zero if any of them
+ * is a control character, a quote or a backslash. Might flag bytes
+ * following those spuriously, but never misses one. */
+static inline uint64_t json_word_needs_escape(uint64_t w) {
+        uint64_t q = w ^ (WORD_ONES * '"'), b = w ^ (WORD_ONES * '\\');
+
+        return (((w - WORD_ONES * ' ') & ~w) |
+                ((q - WORD_ONES) & ~q) |
+                ((b - WORD_ONES) & ~b)) & WORD_HIGHS;
+}
+
+static inline bool json_char_needs_escape(uint8_t c) {
+        return c < ' ' || c == '"' || c == '\\';
+}
+
+static size_t json_span(const char *p, size_t l) {
+        size_t i = 0;
+
+        /* Returns the number of bytes at the beginning of p that
+         * may be copied verbatim */
+
+        for (; i + sizeof(uint64_t) <= l; i += sizeof(uint64_t)) {
+                uint64_t w;
+
+                memcpy(&w, p + i, sizeof(w));
+                if (json_word_needs_escape(w))
+                        break;
+        }
+
+        for (; i < l; i++)
+                if (json_char_needs_escape(p[i]))
+                        break;
+
+        return i;
+}
+
+static void json_escape_bytes(FILE *f, const uint8_t *p, size_t l) {
+        char buf[LINE_MAX];
+        size_t n = 0, i;
+
+        /* Binary data is shown as an array of numbers, formatted
+         * into a buffer first rather than by one fprintf() each */
+
+        fputs("[ ", f);
+
+        for (i = 0; i < l; i++) {
+                uint8_t c = p[i];
+
+                if (n + sizeof(", 255") > sizeof(buf)) {
+                        fwrite(buf, 1, n, f);
+                        n = 0;
+                }
+
+                if (i > 0) {
+                        buf[n++] = ',';
+                        buf[n++] = ' ';
+                }
+
+                if (c >= 100)
+                        buf[n++] = '0' + c / 100;
+                if (c >= 10)
+                        buf[n++] = '0' + c / 10 % 10;
+                buf[n++] = '0' + c % 10;
+        }
+
+        fwrite(buf, 1, n, f);
+        fputs(" ]", f);
+}
+
 void json_escape(
                 FILE *f,
                 const char* p,
@@ -581,37 +662,33 @@ void json_escape(
 
                 fputs("null", f);
 
-        else if (!utf8_is_printable(p, l)) {
-                bool not_first = false;
-
-                fputs("[ ", f);
+        else if (!utf8_is_printable(p, l))
+                json_escape_bytes(f, (const uint8_t*) p, l);
+        else {
+                fputc('\"', f);
 
                 while (l > 0) {
-                        if (not_first)
-                                fprintf(f, ", %u", (uint8_t) *p);
-                        else {
-                                not_first = true;
-                                fprintf(f, "%u", (uint8_t) *p);
+                        size_t n;
+
+                        /* Copy everything up to the next character
+                         * that needs escaping in one go */
+                        n = json_span(p, l);
+                        if (n > 0) {
+                                fwrite(p, 1, n, f);
+                                p += n;
+                                l -= n;
+
+                                if (l <= 0)
+                                        break;
                         }
 
-                        p++;
-                        l--;
-                }
-
-                fputs(" ]", f);
-        } else {
-                fputc('\"', f);
-
-                while (l > 0) {
                         if (*p == '"' || *p == '\\') {
                                 fputc('\\', f);
                                 fputc(*p, f);
                         } else if (*p == '\n')
                                 fputs("\\n", f);
-                        else if (*p < ' ')
-                                fprintf(f, "\\u%04x", *p);
                         else
-                                fputc(*p, f);
+                                fprintf(f, "\\u%04x", (uint8_t) *p);
 
                         p++;
                         l--;
@@ -621,6 +698,13 @@ void json_escape(
         }
 }
 
+typedef struct JsonField {
+        size_t offset;
+        size_t length;
+        size_t name_length;
+        bool shown;
+} JsonField;
+
 static int output_json(
                 FILE *f,
                 sd_journal *j,
@@ -629,14 +713,14 @@ static int output_json(
                 OutputFlags flags) {
 
         uint64_t realtime, monotonic;
-        _cleanup_free_ char *cursor = NULL;
+        _cleanup_free_ char *cursor = NULL, *buffer = NULL;
+        _cleanup_free_ JsonField *fields = NULL;
+        size_t n_fields = 0, fields_allocated = 0, buffer_size = 0, buffer_allocated = 0, i;
         const void *data;
         size_t length;
         sd_id128_t boot_id;
-        char sid[33], *k;
+        char sid[33];
         int r;
-        Hashmap *h = NULL;
-        bool done, separator;
 
         assert(j);
 
@@ -660,6 +744,39 @@ static int output_json(
                 return r;
         }
 
+        /* Collect all fields in one go. The data returned by
+         * sd_journal_enumerate_data() is only valid until the next
+         * call, hence we need to make a copy. */
+        JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
+                const char *eq;
+
+                /* We already print the boot id, from the data in
+                 * the header, hence let's suppress it here */
+                if (length >= 9 &&
+                    memcmp(data, "_BOOT_ID=", 9) == 0)
+                        continue;
+
+                eq = memchr(data, '=', length);
+                if (!eq)
+                        continue;
+
+                if (!GREEDY_REALLOC(fields, fields_allocated, n_fields + 1) ||
+                    !GREEDY_REALLOC(buffer, buffer_allocated, buffer_size + length))
+                        return -ENOMEM;
+
+                fields[n_fields].offset = buffer_size;
+                fields[n_fields].length = length;
+                fields[n_fields].name_length = eq - (const char*) data;
+                fields[n_fields].shown = false;
+                n_fields++;
+
+                memcpy(buffer + buffer_size, data, length);
+                buffer_size += length;
+        }
+
+        if (r < 0)
+                return r;
+
         if (mode == OUTPUT_JSON_PRETTY)
                 fprintf(f,
                         "{\n"
@@ -686,143 +803,49 @@ static int output_json(
                         sd_id128_to_string(boot_id, sid));
         }
 
-        h = hashmap_new(string_hash_func, string_compare_func);
-        if (!h)
-                return -ENOMEM;
-
-        /* First round, iterate through the entry and count how often each field appears */
-        JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
-                const char *eq;
-                char *n;
-                unsigned u;
-
-                if (length >= 9 &&
-                    memcmp(data, "_BOOT_ID=", 9) == 0)
-                        continue;
+        /* Fields which appear more than once are shown as an array,
+         * at the place of their first appearance */
+        for (i = 0; i < n_fields; i++) {
+                JsonField *a = fields + i;
+                const char *d = buffer + a->offset;
+                bool array = false;
+                size_t k;
 
-                eq = memchr(data, '=', length);
-                if (!eq)
+                if (a->shown)
                         continue;
 
-                n = strndup(data, eq - (const char*) data);
-                if (!n) {
-                        r = -ENOMEM;
-                        goto finish;
-                }
-
-                u = PTR_TO_UINT(hashmap_get(h, n));
-                if (u == 0) {
-                        r = hashmap_put(h, n, UINT_TO_PTR(1));
-                        if (r < 0) {
-                                free(n);
-                                goto finish;
-                        }
-                } else {
-                        r = hashmap_update(h, n, UINT_TO_PTR(u + 1));
-                        free(n);
-                        if (r < 0)
-                                goto finish;
-                }
-        }
-
-        if (r < 0)
-                return r;
+                if (mode == OUTPUT_JSON_PRETTY)
+                        fputs(",\n\t", f);
+                else
+                        fputs(", ", f);
 
-        separator = true;
-        do {
-                done = true;
+                json_escape(f, d, a->name_length, flags);
+                fputs(" : ", f);
 
-                SD_JOURNAL_FOREACH_DATA(j, data, length) {
-                        const char *eq;
-                        char *kk, *n;
-                        size_t m;
-                        unsigned u;
+                for (k = i + 1; k < n_fields; k++) {
+                        JsonField *b = fields + k;
 
-                        /* We already printed the boot id, from the data in
-                         * the header, hence let's suppress it here */
-                        if (length >= 9 &&
-                            memcmp(data, "_BOOT_ID=", 9) == 0)
+                        if (b->name_length != a->name_length ||
+                            memcmp(buffer + b->offset, d, a->name_length) != 0)
                                 continue;
 
-                        eq = memchr(data, '=', length);
-                        if (!eq)
-                                continue;
-
-                        if (separator) {
-                                if (mode == OUTPUT_JSON_PRETTY)
-                                        fputs(",\n\t", f);
-                                else
-                                        fputs(", ", f);
-                        }
-
-                        m = eq - (const char*) data;
-
-                        n = strndup(data, m);
-                        if (!n) {
-                                r = -ENOMEM;
-                                goto finish;
+                        if (!array) {
+                                fputs("[ ", f);
+                                json_escape(f, d + a->name_length + 1, a->length - a->name_length - 1, flags);
+                                array = true;
                         }
 
-                        u = PTR_TO_UINT(hashmap_get2(h, n, (void**) &kk));
-                        if (u == 0) {
-                                /* We already printed this, let's jump to the next */
-                                free(n);
-                                separator = false;
-
-                                continue;
-                        } else if (u == 1) {
-                                /* Field only appears once, output it directly */
-
-                                json_escape(f, data, m, flags);
-                                fputs(" : ", f);
-
-                                json_escape(f, eq + 1, length - m - 1, flags);
-
-                                hashmap_remove(h, n);
-                                free(kk);
-                                free(n);
-
-                                separator = true;
-
-                                continue;
-
-                        } else {
-                                /* Field appears multiple times, output it as array */
-                                json_escape(f, data, m, flags);
-                                fputs(" : [ ", f);
-                                json_escape(f, eq + 1, length - m - 1, flags);
-
-                                /* Iterate through the end of the list */
-
-                                while (sd_journal_enumerate_data(j, &data, &length) > 0) {
-                                        if (length < m + 1)
-                                                continue;
-
-                                        if (memcmp(data, n, m) != 0)
-                                                continue;
-
-                                        if (((const char*) data)[m] != '=')
-                                                continue;
+                        fputs(", ", f);
+                        json_escape(f, buffer + b->offset + b->name_length + 1, b->length - b->name_length - 1, flags);
 
-                                        fputs(", ", f);
-                                        json_escape(f, (const char*) data + m + 1, length - m - 1, flags);
-                                }
-
-                                fputs(" ]", f);
-
-                                hashmap_remove(h, n);
-                                free(kk);
-                                free(n);
-
-                                /* Iterate data fields form the beginning */
-                                done = false;
-                                separator = true;
-
-                                break;
-                        }
+                        b->shown = true;
                 }
 
-        } while (!done);
+                if (array)
+                        fputs(" ]", f);
+                else
+                        json_escape(f, d + a->name_length + 1, a->length - a->name_length - 1, flags);
+        }
 
         if (mode == OUTPUT_JSON_PRETTY)
                 fputs("\n}\n", f);
@@ -831,15 +854,7 @@ static int output_json(
         else
                 fputs(" }\n", f);
 
-        r = 0;
-
-finish:
-        while ((k = hashmap_steal_first_key(h)))
-                free(k);
-
-        hashmap_free(h);
-
-        return r;
+        return 0;
 }
 
 static int output_cat(
@@ -910,8 +925,9 @@ int output_journal(
         if (n_columns <= 0)
                 n_columns = columns();
 
+        /* Flushing is left to the caller, so that output of many
+         * entries is written in large chunks */
         ret = output_funcs[mode](f, j, mode, n_columns, flags);
-        fflush(stdout);
 
         if (ellipsized && ret > 0)
                 *ellipsized = true;
@@ -919,6 +935,61 @@ int output_journal(
         return ret;
 }
 
+int output_journal_set_fields(sd_journal *j, OutputMode mode) {
+        static const char * const short_fields[] = {
+                "PRIORITY",
+                "_HOSTNAME",
+                "SYSLOG_IDENTIFIER",
+                "_COMM",
+                "_PID",
+                "SYSLOG_PID",
+                "_SOURCE_REALTIME_TIMESTAMP",
+                "_SOURCE_MONOTONIC_TIMESTAMP",
+                "MESSAGE",
+                NULL
+        };
+        static const char * const cat_fields[] = {
+                "MESSAGE",
+                NULL
+        };
+        const char * const *fields, * const *i;
+        int r;
+
+        assert(j);
+        assert(mode >= 0);
+        assert(mode < _OUTPUT_MODE_MAX);
+
+        /* Makes the reader hand out only the fields the output mode
+         * prints, so that the others are not even looked at */
+
+        sd_journal_flush_data_fields(j);
+
+        switch (mode) {
+
+        case OUTPUT_SHORT:
+        case OUTPUT_SHORT_ISO:
+        case OUTPUT_SHORT_PRECISE:
+        case OUTPUT_SHORT_MONOTONIC:
+                fields = short_fields;
+                break;
+
+        case OUTPUT_CAT:
+                fields = cat_fields;
+                break;
+
+        default:
+                return 0;
+        }
+
+        for (i = fields; *i; i++) {
+                r = sd_journal_add_data_field(j, *i);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 static int show_journal(FILE *f,
                         sd_journal *j,
                         OutputMode mode,
@@ -1005,6 +1076,8 @@ static int show_journal(FILE *f,
                 if (!(flags & OUTPUT_FOLLOW))
                         break;
 
+                fflush(f);
+
                 r = sd_journal_wait(j, (usec_t) -1);
                 if (r < 0)
                         goto finish;
@@ -1012,6 +1085,7 @@ static int show_journal(FILE *f,
         }
 
 finish:
+        fflush(f);
         return r;
 }
 
@@ -1184,6 +1258,10 @@ int show_journal_by_unit(
                 log_debug("Journal filter: %s", filter);
         }
 
+        r = output_journal_set_fields(j, mode);
+        if (r < 0)
+                return r;
+
         return show_journal(f, j, mode, n_columns, not_before, how_many, flags, ellipsized);
 }
 
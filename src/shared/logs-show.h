@@ -38,6 +38,8 @@ int output_journal(
                 OutputFlags flags,
                 bool *ellipsized);
 
+int output_journal_set_fields(sd_journal *j, OutputMode mode);
+
 int add_match_this_boot(sd_journal *j);
 
 int add_matches_for_unit(
@@ -78,7 +78,12 @@ char *replace_var(const char *text, char *(*lookup)(const char *variable, void*u
                 if (k < 0)
                         goto oom;
                 if (k == 0) {
-                        *(t++) = *(f++);
+                        /* Copy everything up to the next candidate
+                         * in one go */
+                        d = strcspn(f + 1, "@") + 1;
+                        memcpy(t, f, d);
+                        t += d;
+                        f += d;
                         continue;
                 }
 
@@ -142,8 +142,17 @@ bool utf8_is_printable(const char* str, size_t length) {
         assert(str);
 
         for (p = (const uint8_t*) str; length;) {
-                int encoded_len = utf8_encoded_valid_unichar((const char *)p);
-                int val = utf8_encoded_to_unichar((const char*)p);
+                int encoded_len, val;
+
+                /* Skip over plain printable ASCII quickly */
+                if (*p >= ' ' && *p < 0x7F) {
+                        p++;
+                        length--;
+                        continue;
+                }
+
+                encoded_len = utf8_encoded_valid_unichar((const char *)p);
+                val = utf8_encoded_to_unichar((const char*)p);
 
                 if (encoded_len < 0 || val < 0 || is_unicode_control(val))
                         return false;
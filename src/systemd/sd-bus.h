@@ -59,6 +59,7 @@ typedef struct {
 /* Callbacks */
 
 typedef int (*sd_bus_message_handler_t)(sd_bus *bus, sd_bus_message *m, void *userdata);
+typedef int (*sd_bus_writable_handler_t)(sd_bus *bus, void *userdata);
 typedef int (*sd_bus_property_get_t) (sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *reply, sd_bus_error *error, void *userdata);
 typedef int (*sd_bus_property_set_t) (sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *value, sd_bus_error *error, void *userdata);
 typedef int (*sd_bus_object_find_t) (sd_bus *bus, const char *path, const char *interface, void **found, void *userdata);
@@ -110,6 +111,10 @@ int sd_bus_process(sd_bus *bus, sd_bus_message **r);
 int sd_bus_wait(sd_bus *bus, uint64_t timeout_usec);
 int sd_bus_flush(sd_bus *bus);
 
+int sd_bus_set_write_watermarks(sd_bus *bus, unsigned low, unsigned high);
+int sd_bus_is_congested(sd_bus *bus);
+int sd_bus_set_writable_callback(sd_bus *bus, sd_bus_writable_handler_t callback, void *userdata);
+
 int sd_bus_attach_event(sd_bus *bus, sd_event *e, int priority);
 int sd_bus_detach_event(sd_bus *bus);
 
@@ -120,6 +120,9 @@ int sd_journal_get_data(sd_journal *j, const char *field, const void **data, siz
 int sd_journal_enumerate_data(sd_journal *j, const void **data, size_t *l);
 void sd_journal_restart_data(sd_journal *j);
 
+int sd_journal_add_data_field(sd_journal *j, const char *field);
+void sd_journal_flush_data_fields(sd_journal *j);
+
 int sd_journal_add_match(sd_journal *j, const void *data, size_t size);
 int sd_journal_add_disjunction(sd_journal *j);
 int sd_journal_add_conjunction(sd_journal *j);
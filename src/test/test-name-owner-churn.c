@@ -0,0 +1,233 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <dbus/dbus.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+/* Shows what NameOwnerChanged costs a watcher like PID 1 on a bus
+ * where clients come and go all the time: once subscribed to all of
+ * them, once only to the names it watches. Starts a private
+ * dbus-daemon, and a generator that connects and disconnects the
+ * given number of clients (default 5000). */
+
+#define N_WATCHED 64
+
+static unsigned arg_clients = 5000;
+
+struct stats {
+        unsigned n_received;
+        unsigned n_handled;
+};
+
+static const char *watched_name(unsigned i) {
+        static char buf[64];
+
+        snprintf(buf, sizeof(buf), "org.example.Service%u", i);
+        return buf;
+}
+
+static char *name_owner_match(const char *name) {
+        return strjoin("type='signal',"
+                       "sender='"DBUS_SERVICE_DBUS"',"
+                       "interface='"DBUS_INTERFACE_DBUS"',"
+                       "member='NameOwnerChanged',"
+                       "path='"DBUS_PATH_DBUS"'",
+                       name ? ",arg0='" : "", strempty(name), name ? "'" : "", NULL);
+}
+
+static DBusHandlerResult filter(DBusConnection *c, DBusMessage *m, void *userdata) {
+        struct stats *s = userdata;
+        const char *name, *old_owner, *new_owner;
+        unsigned i;
+
+        if (!dbus_message_is_signal(m, DBUS_INTERFACE_DBUS, "NameOwnerChanged"))
+                return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+        s->n_received++;
+
+        assert_se(dbus_message_get_args(m, NULL,
+                                        DBUS_TYPE_STRING, &name,
+                                        DBUS_TYPE_STRING, &old_owner,
+                                        DBUS_TYPE_STRING, &new_owner,
+                                        DBUS_TYPE_INVALID));
+
+        for (i = 0; i < N_WATCHED; i++)
+                if (streq(name, watched_name(i))) {
+                        s->n_handled++;
+                        break;
+                }
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static DBusConnection *connect_to(const char *address) {
+        DBusConnection *c;
+
+        assert_se(c = dbus_connection_open_private(address, NULL));
+        assert_se(dbus_bus_register(c, NULL));
+
+        return c;
+}
+
+static void disconnect(DBusConnection *c) {
+        dbus_connection_close(c);
+        dbus_connection_unref(c);
+}
+
+static void churn(const char *address) {
+        DBusConnection *c;
+        unsigned i;
+
+        for (i = 0; i < arg_clients; i++)
+                disconnect(connect_to(address));
+
+        /* And one change the watcher cares about */
+        c = connect_to(address);
+        assert_se(dbus_bus_request_name(c, watched_name(0), 0, NULL) == DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER);
+        disconnect(c);
+}
+
+static void run(const char *address, bool targeted) {
+        DBusConnection *c;
+        DBusMessage *m, *reply;
+        struct stats s = {};
+        struct rusage before, after;
+        usec_t cpu;
+        pid_t pid;
+        int status;
+        unsigned i;
+
+        c = connect_to(address);
+        assert_se(dbus_connection_add_filter(c, filter, &s, NULL));
+
+        if (targeted)
+                for (i = 0; i < N_WATCHED; i++) {
+                        _cleanup_free_ char *match = NULL;
+
+                        assert_se(match = name_owner_match(watched_name(i)));
+                        dbus_bus_add_match(c, match, NULL);
+                }
+        else {
+                _cleanup_free_ char *match = NULL;
+
+                assert_se(match = name_owner_match(NULL));
+                dbus_bus_add_match(c, match, NULL);
+        }
+
+        /* Make sure the matches are in place */
+        assert_se(m = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_PEER, "Ping"));
+        assert_se(reply = dbus_connection_send_with_reply_and_block(c, m, -1, NULL));
+        dbus_message_unref(reply);
+
+        assert_se(getrusage(RUSAGE_SELF, &before) >= 0);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                churn(address);
+                _exit(EXIT_SUCCESS);
+        }
+
+        while (waitpid(pid, &status, WNOHANG) == 0)
+                dbus_connection_read_write_dispatch(c, 10);
+
+        assert_se(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        /* The daemon delivers in order, hence once this is answered
+         * all signals are in */
+        assert_se(reply = dbus_connection_send_with_reply_and_block(c, m, -1, NULL));
+        dbus_message_unref(reply);
+        dbus_message_unref(m);
+
+        while (dbus_connection_dispatch(c) == DBUS_DISPATCH_DATA_REMAINS)
+                ;
+
+        assert_se(getrusage(RUSAGE_SELF, &after) >= 0);
+
+        cpu = timeval_load(&after.ru_utime) + timeval_load(&after.ru_stime) -
+              timeval_load(&before.ru_utime) - timeval_load(&before.ru_stime);
+
+        /* The name was acquired and released */
+        assert_se(s.n_handled == 2);
+        assert_se(targeted ? s.n_received == 2 : s.n_received >= arg_clients * 2);
+
+        printf("%-12s %8u signals received, %u handled, %8llu us CPU\n",
+               targeted ? "targeted:" : "all names:", s.n_received, s.n_handled,
+               (unsigned long long) cpu);
+
+        disconnect(c);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_fclose_ FILE *f = NULL;
+        char address[LINE_MAX];
+        int p[2];
+        pid_t bus_pid;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_clients) < 0 || arg_clients == 0)) {
+                log_error("Failed to parse number of clients: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+
+        bus_pid = fork();
+        assert_se(bus_pid >= 0);
+
+        if (bus_pid == 0) {
+                assert_se(dup2(p[1], 3) == 3);
+
+                execlp("dbus-daemon", "dbus-daemon", "--session", "--nofork", "--print-address=3", NULL);
+                _exit(EXIT_TEST_SKIP);
+        }
+
+        close_nointr_nofail(p[1]);
+
+        assert_se(f = fdopen(p[0], "re"));
+        if (!fgets(address, sizeof(address), f)) {
+                log_info("Failed to start dbus-daemon, skipping.");
+                return EXIT_TEST_SKIP;
+        }
+
+        truncate_nl(address);
+
+        run(address, false);
+        run(address, true);
+
+        assert_se(kill(bus_pid, SIGTERM) >= 0);
+        assert_se(wait_for_terminate(bus_pid, NULL) >= 0);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "udev.h"
+
+/* Shows what formatting the values of the storage and input rules
+ * costs per device, once parsing the format strings on every use,
+ * once split up in advance, like the rules do. Takes the number of
+ * synthetic devices (default 10000). */
+
+static unsigned arg_devices = 10000;
+
+static const char *formats[] = {
+        "disk/by-id/$env{ID_BUS}-$env{ID_SERIAL}",
+        "disk/by-id/$env{ID_BUS}-$env{ID_SERIAL}-part%n",
+        "disk/by-id/wwn-$env{ID_WWN_WITH_EXTENSION}",
+        "disk/by-id/wwn-$env{ID_WWN_WITH_EXTENSION}-part%n",
+        "disk/by-path/$env{ID_PATH}",
+        "disk/by-path/$env{ID_PATH}-part%n",
+        "disk/by-uuid/$env{ID_FS_UUID_ENC}",
+        "disk/by-label/$env{ID_FS_LABEL_ENC}",
+        "disk/by-partuuid/$env{ID_PART_ENTRY_UUID}",
+        "input/by-path/$env{ID_PATH}-event-$env{.INPUT_CLASS}",
+        "ata_id --export $devnode",
+        "scsi_id --export --whitelisted -d $devnode",
+        "blkid --offset=$env{ID_CDROM_MEDIA_SESSION_LAST_OFFSET}",
+        "accelerometer %p",
+        "block/%M:%m",
+        "$root/$name",
+        "%S%p",
+        "$links",
+        "%c{2+}",
+        "$kernel $number $major:$minor %%$$",
+        /* no substitutions */
+        "0660",
+        "disk",
+        "systemd",
+        "uaccess",
+};
+
+static struct udev_device *device_new(struct udev *udev, unsigned i) {
+        struct udev_device *dev;
+        char buf[UTIL_PATH_SIZE];
+        unsigned disk = i / 16, part = i % 16;
+
+        assert_se(dev = udev_device_new(udev));
+        udev_device_set_info_loaded(dev);
+
+#define ADD(...)                                                        \
+        do {                                                            \
+                snprintf(buf, sizeof(buf), __VA_ARGS__);                \
+                udev_device_add_property_from_string_parse(dev, buf);   \
+        } while (false)
+
+        ADD("ACTION=add");
+        ADD("SEQNUM=%u", i + 1);
+        ADD("SUBSYSTEM=block");
+        ADD("DEVPATH=/devices/pci0000:00/0000:00:1f.2/ata1/host0/target0:0:%u/0:0:%u:0/block/sd%u/sd%u%u",
+            disk, disk, disk, disk, part + 1);
+        ADD("DEVNAME=/dev/sd%u%u", disk, part + 1);
+        ADD("MAJOR=8");
+        ADD("MINOR=%u", i);
+        ADD("DEVLINKS=/dev/disk/by-id/ata-DISK_%u-part%u /dev/disk/by-path/pci-0000:00:1f.2-ata-%u-part%u",
+            disk, part + 1, disk, part + 1);
+        ADD("ID_BUS=ata");
+        ADD("ID_SERIAL=Benchmark_Disk_%08u", disk);
+        ADD("ID_WWN_WITH_EXTENSION=0x5000c500%08x", disk);
+        ADD("ID_PATH=pci-0000:00:1f.2-ata-%u", disk);
+        ADD("ID_FS_UUID_ENC=%08x-1234-5678-9abc-%012u", disk, i);
+        ADD("ID_FS_LABEL_ENC=data%u", i);
+        ADD("ID_PART_ENTRY_UUID=%08x-0000-0000-0000-%012u", disk, part);
+        ADD("ID_CDROM_MEDIA_SESSION_LAST_OFFSET=%u", i * 2048);
+        ADD(".INPUT_CLASS=kbd");
+
+#undef ADD
+
+        assert_se(udev_device_add_property_from_string_parse_finish(dev) >= 0);
+
+        return dev;
+}
+
+static void check(struct udev_event *event, const char *format, const struct udev_format_part *parts, size_t size) {
+        char a[UTIL_PATH_SIZE], b[UTIL_PATH_SIZE];
+        size_t la, lb;
+
+        assert_se(size <= sizeof(a));
+
+        la = udev_event_apply_format(event, format, a, size);
+        lb = udev_event_apply_compiled_format(event, format, parts, b, size);
+
+        if (la != lb || !streq(a, b)) {
+                log_error("'%s' formatted differently: '%s' (%zu) vs. '%s' (%zu)", format, a, la, b, lb);
+                assert_not_reached("Formats differ");
+        }
+}
+
+static usec_t run(struct udev_event **events, struct udev_format_part **parts, bool compiled) {
+        char result[UTIL_PATH_SIZE];
+        usec_t usec;
+        unsigned i, j;
+
+        usec = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < arg_devices; i++)
+                for (j = 0; j < ELEMENTSOF(formats); j++)
+                        if (compiled)
+                                udev_event_apply_compiled_format(events[i], formats[j], parts[j], result, sizeof(result));
+                        else
+                                udev_event_apply_format(events[i], formats[j], result, sizeof(result));
+
+        return now(CLOCK_MONOTONIC) - usec;
+}
+
+int main(int argc, char *argv[]) {
+        struct udev *udev;
+        struct udev_event **events;
+        struct udev_format_part *parts[ELEMENTSOF(formats)];
+        usec_t plain, compiled;
+        unsigned i, j, n;
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && (safe_atou(argv[1], &arg_devices) < 0 || arg_devices == 0)) {
+                log_error("Failed to parse number of devices: %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        assert_se(udev = udev_new());
+
+        for (j = 0; j < ELEMENTSOF(formats); j++) {
+                n = udev_format_compile(formats[j], NULL, 0);
+                assert_se(parts[j] = new(struct udev_format_part, n));
+                assert_se(udev_format_compile(formats[j], parts[j], n) == n);
+        }
+
+        assert_se(events = new(struct udev_event*, arg_devices));
+        for (i = 0; i < arg_devices; i++) {
+                assert_se(events[i] = udev_event_new(device_new(udev, i)));
+                assert_se(events[i]->program_result = strdup("first second third"));
+        }
+
+        /* Both agree, also when cutting the result short anywhere */
+        for (j = 0; j < ELEMENTSOF(formats); j++) {
+                size_t size;
+
+                for (size = 1; size <= 96; size++)
+                        check(events[0], formats[j], parts[j], size);
+                check(events[arg_devices-1], formats[j], parts[j], UTIL_PATH_SIZE);
+        }
+
+        plain = run(events, parts, false);
+        compiled = run(events, parts, true);
+
+        printf("%-12s %8.0f ns/device, %u formats\n", "parsed:",
+               (double) plain * 1000.0 / arg_devices, (unsigned) ELEMENTSOF(formats));
+        printf("%-12s %8.0f ns/device, %u formats\n", "compiled:",
+               (double) compiled * 1000.0 / arg_devices, (unsigned) ELEMENTSOF(formats));
+
+        for (i = 0; i < arg_devices; i++) {
+                udev_device_unref(events[i]->dev);
+                udev_event_unref(events[i]);
+        }
+        free(events);
+
+        for (j = 0; j < ELEMENTSOF(formats); j++)
+                free(parts[j]);
+
+        udev_unref(udev);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2026 agent <agent@local>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "udev.h"
+
+/* Checks the results of udev_event_apply_format() and of applying
+ * the same format split up in advance, like the rules do */
+
+static const char *formats[] = {
+        "disk/by-id/$env{ID_BUS}-$env{ID_SERIAL}-part%n",
+        "block/%M:%m",
+        "$root/$name",
+        "%S%p",
+        "$links",
+        "%c{2+}",
+        "$kernel $number $major:$minor %%$$",
+        "0660",
+};
+
+static struct udev_device *device_new(struct udev *udev, unsigned i) {
+        struct udev_device *dev;
+        char buf[UTIL_PATH_SIZE];
+        unsigned disk = i / 16, part = i % 16;
+
+        assert_se(dev = udev_device_new(udev));
+        udev_device_set_info_loaded(dev);
+
+#define ADD(...)                                                        \
+        do {                                                            \
+                snprintf(buf, sizeof(buf), __VA_ARGS__);                \
+                udev_device_add_property_from_string_parse(dev, buf);   \
+        } while (false)
+
+        ADD("ACTION=add");
+        ADD("SEQNUM=%u", i + 1);
+        ADD("SUBSYSTEM=block");
+        ADD("DEVPATH=/devices/pci0000:00/0000:00:1f.2/ata1/host0/target0:0:%u/0:0:%u:0/block/sd%u/sd%u%u",
+            disk, disk, disk, disk, part + 1);
+        ADD("DEVNAME=/dev/sd%u%u", disk, part + 1);
+        ADD("MAJOR=8");
+        ADD("MINOR=%u", i);
+        ADD("DEVLINKS=/dev/disk/by-id/ata-DISK_%u-part%u /dev/disk/by-path/pci-0000:00:1f.2-ata-%u-part%u",
+            disk, part + 1, disk, part + 1);
+        ADD("ID_BUS=ata");
+        ADD("ID_SERIAL=Benchmark_Disk_%08u", disk);
+        ADD("ID_WWN_WITH_EXTENSION=0x5000c500%08x", disk);
+        ADD("ID_PATH=pci-0000:00:1f.2-ata-%u", disk);
+        ADD("ID_FS_UUID_ENC=%08x-1234-5678-9abc-%012u", disk, i);
+        ADD("ID_FS_LABEL_ENC=data%u", i);
+        ADD("ID_PART_ENTRY_UUID=%08x-0000-0000-0000-%012u", disk, part);
+        ADD("ID_CDROM_MEDIA_SESSION_LAST_OFFSET=%u", i * 2048);
+        ADD(".INPUT_CLASS=kbd");
+
+#undef ADD
+
+        assert_se(udev_device_add_property_from_string_parse_finish(dev) >= 0);
+
+        return dev;
+}
+
+static void test_compile(void) {
+        struct udev_format_part parts[8];
+
+        /* The count includes the terminating part, even if there
+         * is no room for it */
+        assert_se(udev_format_compile("", parts, 0) == 1);
+        assert_se(udev_format_compile("", parts, ELEMENTSOF(parts)) == 1);
+        assert_se(udev_format_compile("disk", parts, ELEMENTSOF(parts)) == 2);
+        assert_se(udev_format_compile("disk/by-id/$env{ID_BUS}-%n", NULL, 0) == 5);
+        assert_se(udev_format_compile("$$%%", NULL, 0) == 3);
+        assert_se(udev_format_compile("%z$unknown", NULL, 0) == 2);
+
+        /* An unterminated argument ends the format */
+        assert_se(udev_format_compile("a$env{ID_BUS", NULL, 0) == 2);
+}
+
+static void check(struct udev_event *event, const char *format, const struct udev_format_part *parts, size_t size) {
+        char a[UTIL_PATH_SIZE], b[UTIL_PATH_SIZE];
+        size_t la, lb;
+
+        assert_se(size <= sizeof(a));
+
+        la = udev_event_apply_format(event, format, a, size);
+        lb = udev_event_apply_compiled_format(event, format, parts, b, size);
+
+        if (la != lb || !streq(a, b)) {
+                log_error("'%s' formatted differently: '%s' (%zu) vs. '%s' (%zu)", format, a, la, b, lb);
+                assert_not_reached("Formats differ");
+        }
+}
+
+static void check_result(struct udev_event *event, const char *format, size_t size, const char *expected, size_t left) {
+        struct udev_format_part parts[8];
+        char a[UTIL_PATH_SIZE], b[UTIL_PATH_SIZE];
+        size_t la, lb;
+
+        assert_se(size <= sizeof(a));
+        assert_se(udev_format_compile(format, parts, ELEMENTSOF(parts)) <= ELEMENTSOF(parts));
+
+        la = udev_event_apply_format(event, format, a, size);
+        lb = udev_event_apply_compiled_format(event, format, parts, b, size);
+
+        if (!streq(a, expected) || la != left || !streq(b, expected) || lb != left) {
+                log_error("'%s' formatted to '%s' (%zu) and '%s' (%zu), expected '%s' (%zu)",
+                          format, a, la, b, lb, expected, left);
+                assert_not_reached("Unexpected result");
+        }
+}
+
+static void test_results(struct udev_event *event) {
+        /* Escaped characters */
+        check_result(event, "$$", 16, "$", 15);
+        check_result(event, "%%", 16, "%", 15);
+        check_result(event, "100%% $$HOME", 16, "100% $HOME", 6);
+
+        /* Parts of the program result */
+        check_result(event, "%c", 32, "first second third", 14);
+        check_result(event, "%c{2}", 32, "second", 26);
+        check_result(event, "%c{2+}", 32, "second third", 20);
+        check_result(event, "$result{3}", 32, "third", 27);
+
+        /* Unknown substitutions are copied as they are */
+        check_result(event, "$foo/%z", 16, "$foo/%z", 9);
+
+        /* An unterminated argument ends the result */
+        check_result(event, "a$env{ID_BUS", 16, "a", 15);
+        check_result(event, "a$env{ID_BUS}b$env{ID_SERIAL", 16, "aatab", 11);
+
+        /* Cut short exactly at the end of the buffer */
+        check_result(event, "disk", 5, "disk", 1);
+        check_result(event, "disk", 4, "dis", 0);
+        check_result(event, "$env{ID_BUS}x", 5, "atax", 1);
+        check_result(event, "$env{ID_BUS}x", 4, "ata", 0);
+        check_result(event, "$env{ID_BUS}x", 3, "at", 0);
+        check_result(event, "disk/by-id/$env{ID_BUS}", 15, "disk/by-id/ata", 1);
+        check_result(event, "disk/by-id/$env{ID_BUS}", 14, "disk/by-id/at", 0);
+        check_result(event, "x", 1, "", 0);
+}
+
+int main(int argc, char *argv[]) {
+        struct udev *udev;
+        struct udev_event *event;
+        unsigned j;
+
+        log_parse_environment();
+        log_open();
+
+        test_compile();
+
+        assert_se(udev = udev_new());
+        assert_se(event = udev_event_new(device_new(udev, 0)));
+        assert_se(event->program_result = strdup("first second third"));
+
+        test_results(event);
+
+        /* Both agree, also when cutting the result short anywhere */
+        for (j = 0; j < ELEMENTSOF(formats); j++) {
+                struct udev_format_part parts[16];
+                size_t size;
+
+                assert_se(udev_format_compile(formats[j], parts, ELEMENTSOF(parts)) <= ELEMENTSOF(parts));
+
+                for (size = 1; size <= 96; size++)
+                        check(event, formats[j], parts, size);
+                check(event, formats[j], parts, UTIL_PATH_SIZE);
+        }
+
+        udev_device_unref(event->dev);
+        udev_event_unref(event);
+        udev_unref(udev);
+
+        return EXIT_SUCCESS;
+}
@@ -65,313 +65,404 @@ void udev_event_unref(struct udev_event *event)
         free(event);
 }
 
-size_t udev_event_apply_format(struct udev_event *event, const char *src, char *dest, size_t size)
+enum subst_type {
+        SUBST_END,
+        SUBST_TEXT,
+        SUBST_DEVNODE,
+        SUBST_ATTR,
+        SUBST_ENV,
+        SUBST_KERNEL,
+        SUBST_KERNEL_NUMBER,
+        SUBST_DRIVER,
+        SUBST_DEVPATH,
+        SUBST_ID,
+        SUBST_MAJOR,
+        SUBST_MINOR,
+        SUBST_RESULT,
+        SUBST_PARENT,
+        SUBST_NAME,
+        SUBST_LINKS,
+        SUBST_ROOT,
+        SUBST_SYS,
+};
+
+static const struct subst_map {
+        const char *name;
+        const char fmt;
+        enum subst_type type;
+} map[] = {
+        { .name = "devnode",  .fmt = 'N', .type = SUBST_DEVNODE },
+        { .name = "tempnode", .fmt = 'N', .type = SUBST_DEVNODE },
+        { .name = "attr",     .fmt = 's', .type = SUBST_ATTR },
+        { .name = "sysfs",    .fmt = 's', .type = SUBST_ATTR },
+        { .name = "env",      .fmt = 'E', .type = SUBST_ENV },
+        { .name = "kernel",   .fmt = 'k', .type = SUBST_KERNEL },
+        { .name = "number",   .fmt = 'n', .type = SUBST_KERNEL_NUMBER },
+        { .name = "driver",   .fmt = 'd', .type = SUBST_DRIVER },
+        { .name = "devpath",  .fmt = 'p', .type = SUBST_DEVPATH },
+        { .name = "id",       .fmt = 'b', .type = SUBST_ID },
+        { .name = "major",    .fmt = 'M', .type = SUBST_MAJOR },
+        { .name = "minor",    .fmt = 'm', .type = SUBST_MINOR },
+        { .name = "result",   .fmt = 'c', .type = SUBST_RESULT },
+        { .name = "parent",   .fmt = 'P', .type = SUBST_PARENT },
+        { .name = "name",     .fmt = 'D', .type = SUBST_NAME },
+        { .name = "links",    .fmt = 'L', .type = SUBST_LINKS },
+        { .name = "root",     .fmt = 'r', .type = SUBST_ROOT },
+        { .name = "sys",      .fmt = 'S', .type = SUBST_SYS },
+};
+
+static const struct subst_map *subst_find(const char *f)
 {
-        struct udev_device *dev = event->dev;
-        enum subst_type {
-                SUBST_UNKNOWN,
-                SUBST_DEVNODE,
-                SUBST_ATTR,
-                SUBST_ENV,
-                SUBST_KERNEL,
-                SUBST_KERNEL_NUMBER,
-                SUBST_DRIVER,
-                SUBST_DEVPATH,
-                SUBST_ID,
-                SUBST_MAJOR,
-                SUBST_MINOR,
-                SUBST_RESULT,
-                SUBST_PARENT,
-                SUBST_NAME,
-                SUBST_LINKS,
-                SUBST_ROOT,
-                SUBST_SYS,
-        };
-        static const struct subst_map {
-                const char *name;
-                const char fmt;
-                enum subst_type type;
-        } map[] = {
-                { .name = "devnode",  .fmt = 'N', .type = SUBST_DEVNODE },
-                { .name = "tempnode", .fmt = 'N', .type = SUBST_DEVNODE },
-                { .name = "attr",     .fmt = 's', .type = SUBST_ATTR },
-                { .name = "sysfs",    .fmt = 's', .type = SUBST_ATTR },
-                { .name = "env",      .fmt = 'E', .type = SUBST_ENV },
-                { .name = "kernel",   .fmt = 'k', .type = SUBST_KERNEL },
-                { .name = "number",   .fmt = 'n', .type = SUBST_KERNEL_NUMBER },
-                { .name = "driver",   .fmt = 'd', .type = SUBST_DRIVER },
-                { .name = "devpath",  .fmt = 'p', .type = SUBST_DEVPATH },
-                { .name = "id",       .fmt = 'b', .type = SUBST_ID },
-                { .name = "major",    .fmt = 'M', .type = SUBST_MAJOR },
-                { .name = "minor",    .fmt = 'm', .type = SUBST_MINOR },
-                { .name = "result",   .fmt = 'c', .type = SUBST_RESULT },
-                { .name = "parent",   .fmt = 'P', .type = SUBST_PARENT },
-                { .name = "name",     .fmt = 'D', .type = SUBST_NAME },
-                { .name = "links",    .fmt = 'L', .type = SUBST_LINKS },
-                { .name = "root",     .fmt = 'r', .type = SUBST_ROOT },
-                { .name = "sys",      .fmt = 'S', .type = SUBST_SYS },
-        };
-        const char *from;
-        char *s;
-        size_t l;
-
-        from = src;
-        s = dest;
-        l = size;
-
-        for (;;) {
-                enum subst_type type = SUBST_UNKNOWN;
-                char attrbuf[UTIL_PATH_SIZE];
-                char *attr = NULL;
-
-                while (from[0] != '\0') {
-                        if (from[0] == '$') {
-                                /* substitute named variable */
-                                unsigned int i;
-
-                                if (from[1] == '$') {
-                                        from++;
-                                        goto copy;
-                                }
+        unsigned int i;
+
+        if (f[0] == '$') {
+                /* substitute named variable */
+                for (i = 0; i < ELEMENTSOF(map); i++)
+                        if (startswith(&f[1], map[i].name))
+                                return &map[i];
+        } else if (f[0] == '%') {
+                /* substitute format char */
+                for (i = 0; i < ELEMENTSOF(map); i++)
+                        if (f[1] == map[i].fmt)
+                                return &map[i];
+        }
 
-                                for (i = 0; i < ELEMENTSOF(map); i++) {
-                                        if (startswith(&from[1], map[i].name)) {
-                                                type = map[i].type;
-                                                from += strlen(map[i].name)+1;
-                                                goto subst;
-                                        }
-                                }
-                        } else if (from[0] == '%') {
-                                /* substitute format char */
-                                unsigned int i;
+        return NULL;
+}
 
-                                if (from[1] == '%') {
-                                        from++;
-                                        goto copy;
-                                }
+/* Split off the next run of literal text or the next substitution,
+ * returns false at the end. A substitution found right behind the
+ * text is handed over in *next, for the following call. */
+static bool format_next_part(const char *src, const char **from, const struct subst_map **next,
+                             struct udev_format_part *part)
+{
+        const struct subst_map *m = *next;
+        const char *text = *from;
+        const char *f = *from;
+
+        *next = NULL;
+        if (m != NULL)
+                goto subst;
+
+        while (f[0] != '\0') {
+                if (f[0] == '$' || f[0] == '%') {
+                        /* "$$" and "%%" end the text with a single '$' or '%' */
+                        if (f[1] == f[0]) {
+                                part->type = SUBST_TEXT;
+                                part->off = text - src;
+                                part->len = f + 1 - text;
+                                *from = f + 2;
+                                return true;
+                        }
 
-                                for (i = 0; i < ELEMENTSOF(map); i++) {
-                                        if (from[1] == map[i].fmt) {
-                                                type = map[i].type;
-                                                from += 2;
-                                                goto subst;
-                                        }
-                                }
+                        m = subst_find(f);
+                        if (m != NULL) {
+                                if (f == text)
+                                        goto subst;
+                                *next = m;
+                                break;
                         }
-copy:
-                        /* copy char */
-                        if (l == 0)
-                                goto out;
-                        s[0] = from[0];
-                        from++;
-                        s++;
-                        l--;
                 }
+                f++;
+        }
+
+        if (f == text)
+                return false;
+
+        part->type = SUBST_TEXT;
+        part->off = text - src;
+        part->len = f - text;
+        *from = f;
+        return true;
 
-                goto out;
 subst:
-                /* extract possible $format{attr} */
-                if (from[0] == '{') {
-                        unsigned int i;
-
-                        from++;
-                        for (i = 0; from[i] != '}'; i++) {
-                                if (from[i] == '\0') {
-                                        log_error("missing closing brace for format '%s'\n", src);
-                                        goto out;
-                                }
-                        }
-                        if (i >= sizeof(attrbuf))
-                                goto out;
-                        memcpy(attrbuf, from, i);
-                        attrbuf[i] = '\0';
-                        from += i+1;
-                        attr = attrbuf;
-                } else {
-                        attr = NULL;
+        f += f[0] == '$' ? strlen(m->name) + 1 : 2;
+
+        part->type = m->type;
+        part->off = 0;
+        part->len = 0;
+
+        /* extract possible $format{attr} */
+        if (f[0] == '{') {
+                const char *end;
+
+                f++;
+                end = strchr(f, '}');
+                if (end == NULL) {
+                        log_error("missing closing brace for format '%s'\n", src);
+                        return false;
                 }
+                if ((size_t) (end - f) >= UTIL_PATH_SIZE)
+                        return false;
+                part->off = f - src;
+                part->len = end - f;
+                f = end + 1;
+        }
 
-                switch (type) {
-                case SUBST_DEVPATH:
-                        l = strpcpy(&s, l, udev_device_get_devpath(dev));
-                        break;
-                case SUBST_KERNEL:
-                        l = strpcpy(&s, l, udev_device_get_sysname(dev));
-                        break;
-                case SUBST_KERNEL_NUMBER:
-                        if (udev_device_get_sysnum(dev) == NULL)
-                                break;
-                        l = strpcpy(&s, l, udev_device_get_sysnum(dev));
-                        break;
-                case SUBST_ID:
-                        if (event->dev_parent == NULL)
-                                break;
-                        l = strpcpy(&s, l, udev_device_get_sysname(event->dev_parent));
-                        break;
-                case SUBST_DRIVER: {
-                        const char *driver;
+        *from = f;
+        return true;
+}
 
-                        if (event->dev_parent == NULL)
-                                break;
+static size_t strnpcpy(char **dest, size_t size, const char *src, size_t len)
+{
+        if (len >= size) {
+                if (size > 1)
+                        *dest = mempcpy(*dest, src, size-1);
+                size = 0;
+        } else if (len > 0) {
+                *dest = mempcpy(*dest, src, len);
+                size -= len;
+        }
+        *dest[0] = '\0';
+        return size;
+}
 
-                        driver = udev_device_get_driver(event->dev_parent);
-                        if (driver == NULL)
-                                break;
-                        l = strpcpy(&s, l, driver);
+static size_t format_apply_part(struct udev_event *event, const char *src, const struct udev_format_part *part,
+                                char **dest, size_t l)
+{
+        struct udev_device *dev = event->dev;
+        char attrbuf[UTIL_PATH_SIZE];
+        char *attr = NULL;
+        char *s = *dest;
+
+        if (part->type == SUBST_TEXT)
+                return strnpcpy(dest, l, src + part->off, part->len);
+
+        if (part->off > 0) {
+                memcpy(attrbuf, src + part->off, part->len);
+                attrbuf[part->len] = '\0';
+                attr = attrbuf;
+        }
+
+        switch (part->type) {
+        case SUBST_DEVPATH:
+                l = strpcpy(&s, l, udev_device_get_devpath(dev));
+                break;
+        case SUBST_KERNEL:
+                l = strpcpy(&s, l, udev_device_get_sysname(dev));
+                break;
+        case SUBST_KERNEL_NUMBER:
+                if (udev_device_get_sysnum(dev) == NULL)
                         break;
-                }
-                case SUBST_MAJOR: {
-                        char num[UTIL_PATH_SIZE];
+                l = strpcpy(&s, l, udev_device_get_sysnum(dev));
+                break;
+        case SUBST_ID:
+                if (event->dev_parent == NULL)
+                        break;
+                l = strpcpy(&s, l, udev_device_get_sysname(event->dev_parent));
+                break;
+        case SUBST_DRIVER: {
+                const char *driver;
 
-                        sprintf(num, "%d", major(udev_device_get_devnum(dev)));
-                        l = strpcpy(&s, l, num);
+                if (event->dev_parent == NULL)
                         break;
-                }
-                case SUBST_MINOR: {
-                        char num[UTIL_PATH_SIZE];
 
-                        sprintf(num, "%d", minor(udev_device_get_devnum(dev)));
-                        l = strpcpy(&s, l, num);
+                driver = udev_device_get_driver(event->dev_parent);
+                if (driver == NULL)
                         break;
-                }
-                case SUBST_RESULT: {
-                        char *rest;
-                        int i;
+                l = strpcpy(&s, l, driver);
+                break;
+        }
+        case SUBST_MAJOR: {
+                char num[UTIL_PATH_SIZE];
 
-                        if (event->program_result == NULL)
-                                break;
-                        /* get part part of the result string */
-                        i = 0;
-                        if (attr != NULL)
-                                i = strtoul(attr, &rest, 10);
+                sprintf(num, "%d", major(udev_device_get_devnum(dev)));
+                l = strpcpy(&s, l, num);
+                break;
+        }
+        case SUBST_MINOR: {
+                char num[UTIL_PATH_SIZE];
+
+                sprintf(num, "%d", minor(udev_device_get_devnum(dev)));
+                l = strpcpy(&s, l, num);
+                break;
+        }
+        case SUBST_RESULT: {
+                char *rest;
+                int i;
+
+                if (event->program_result == NULL)
+                        break;
+                /* get part part of the result string */
+                i = 0;
+                if (attr != NULL)
+                        i = strtoul(attr, &rest, 10);
+                if (i > 0) {
+                        char result[UTIL_PATH_SIZE];
+                        char tmp[UTIL_PATH_SIZE];
+                        char *cpos;
+
+                        strscpy(result, sizeof(result), event->program_result);
+                        cpos = result;
+                        while (--i) {
+                                while (cpos[0] != '\0' && !isspace(cpos[0]))
+                                        cpos++;
+                                while (isspace(cpos[0]))
+                                        cpos++;
+                        }
                         if (i > 0) {
-                                char result[UTIL_PATH_SIZE];
-                                char tmp[UTIL_PATH_SIZE];
-                                char *cpos;
-
-                                strscpy(result, sizeof(result), event->program_result);
-                                cpos = result;
-                                while (--i) {
-                                        while (cpos[0] != '\0' && !isspace(cpos[0]))
-                                                cpos++;
-                                        while (isspace(cpos[0]))
-                                                cpos++;
-                                }
-                                if (i > 0) {
-                                        log_error("requested part of result string not found\n");
-                                        break;
-                                }
-                                strscpy(tmp, sizeof(tmp), cpos);
-                                /* %{2+}c copies the whole string from the second part on */
-                                if (rest[0] != '+') {
-                                        cpos = strchr(tmp, ' ');
-                                        if (cpos)
-                                                cpos[0] = '\0';
-                                }
-                                l = strpcpy(&s, l, tmp);
-                        } else {
-                                l = strpcpy(&s, l, event->program_result);
+                                log_error("requested part of result string not found\n");
+                                break;
                         }
+                        strscpy(tmp, sizeof(tmp), cpos);
+                        /* %{2+}c copies the whole string from the second part on */
+                        if (rest[0] != '+') {
+                                cpos = strchr(tmp, ' ');
+                                if (cpos)
+                                        cpos[0] = '\0';
+                        }
+                        l = strpcpy(&s, l, tmp);
+                } else {
+                        l = strpcpy(&s, l, event->program_result);
+                }
+                break;
+        }
+        case SUBST_ATTR: {
+                const char *value = NULL;
+                char vbuf[UTIL_NAME_SIZE];
+                size_t len;
+                int count;
+
+                if (attr == NULL) {
+                        log_error("missing file parameter for attr\n");
                         break;
                 }
-                case SUBST_ATTR: {
-                        const char *value = NULL;
-                        char vbuf[UTIL_NAME_SIZE];
-                        size_t len;
-                        int count;
-
-                        if (attr == NULL) {
-                                log_error("missing file parameter for attr\n");
-                                break;
-                        }
 
-                        /* try to read the value specified by "[dmi/id]product_name" */
-                        if (util_resolve_subsys_kernel(event->udev, attr, vbuf, sizeof(vbuf), 1) == 0)
-                                value = vbuf;
+                /* try to read the value specified by "[dmi/id]product_name" */
+                if (util_resolve_subsys_kernel(event->udev, attr, vbuf, sizeof(vbuf), 1) == 0)
+                        value = vbuf;
 
-                        /* try to read the attribute the device */
-                        if (value == NULL)
-                                value = udev_device_get_sysattr_value(event->dev, attr);
+                /* try to read the attribute the device */
+                if (value == NULL)
+                        value = udev_device_get_sysattr_value(event->dev, attr);
 
-                        /* try to read the attribute of the parent device, other matches have selected */
-                        if (value == NULL && event->dev_parent != NULL && event->dev_parent != event->dev)
-                                value = udev_device_get_sysattr_value(event->dev_parent, attr);
+                /* try to read the attribute of the parent device, other matches have selected */
+                if (value == NULL && event->dev_parent != NULL && event->dev_parent != event->dev)
+                        value = udev_device_get_sysattr_value(event->dev_parent, attr);
 
-                        if (value == NULL)
-                                break;
-
-                        /* strip trailing whitespace, and replace unwanted characters */
-                        if (value != vbuf)
-                                strscpy(vbuf, sizeof(vbuf), value);
-                        len = strlen(vbuf);
-                        while (len > 0 && isspace(vbuf[--len]))
-                                vbuf[len] = '\0';
-                        count = util_replace_chars(vbuf, UDEV_ALLOWED_CHARS_INPUT);
-                        if (count > 0)
-                                log_debug("%i character(s) replaced\n" , count);
-                        l = strpcpy(&s, l, vbuf);
+                if (value == NULL)
                         break;
-                }
-                case SUBST_PARENT: {
-                        struct udev_device *dev_parent;
-                        const char *devnode;
 
-                        dev_parent = udev_device_get_parent(event->dev);
-                        if (dev_parent == NULL)
-                                break;
-                        devnode = udev_device_get_devnode(dev_parent);
-                        if (devnode != NULL)
-                                l = strpcpy(&s, l, devnode + strlen("/dev/"));
-                        break;
-                }
-                case SUBST_DEVNODE:
-                        if (udev_device_get_devnode(dev) != NULL)
-                                l = strpcpy(&s, l, udev_device_get_devnode(dev));
-                        break;
-                case SUBST_NAME:
-                        if (event->name != NULL)
-                                l = strpcpy(&s, l, event->name);
-                        else if (udev_device_get_devnode(dev) != NULL)
-                                l = strpcpy(&s, l, udev_device_get_devnode(dev) + strlen("/dev/"));
-                        else
-                                l = strpcpy(&s, l, udev_device_get_sysname(dev));
-                        break;
-                case SUBST_LINKS: {
-                        struct udev_list_entry *list_entry;
+                /* strip trailing whitespace, and replace unwanted characters */
+                if (value != vbuf)
+                        strscpy(vbuf, sizeof(vbuf), value);
+                len = strlen(vbuf);
+                while (len > 0 && isspace(vbuf[--len]))
+                        vbuf[len] = '\0';
+                count = util_replace_chars(vbuf, UDEV_ALLOWED_CHARS_INPUT);
+                if (count > 0)
+                        log_debug("%i character(s) replaced\n" , count);
+                l = strpcpy(&s, l, vbuf);
+                break;
+        }
+        case SUBST_PARENT: {
+                struct udev_device *dev_parent;
+                const char *devnode;
 
-                        list_entry = udev_device_get_devlinks_list_entry(dev);
-                        if (list_entry == NULL)
-                                break;
-                        l = strpcpy(&s, l, udev_list_entry_get_name(list_entry) + strlen("/dev/"));
-                        udev_list_entry_foreach(list_entry, udev_list_entry_get_next(list_entry))
-                                l = strpcpyl(&s, l, " ", udev_list_entry_get_name(list_entry) + strlen("/dev/"), NULL);
+                dev_parent = udev_device_get_parent(event->dev);
+                if (dev_parent == NULL)
                         break;
-                }
-                case SUBST_ROOT:
-                        l = strpcpy(&s, l, "/dev");
+                devnode = udev_device_get_devnode(dev_parent);
+                if (devnode != NULL)
+                        l = strpcpy(&s, l, devnode + strlen("/dev/"));
+                break;
+        }
+        case SUBST_DEVNODE:
+                if (udev_device_get_devnode(dev) != NULL)
+                        l = strpcpy(&s, l, udev_device_get_devnode(dev));
+                break;
+        case SUBST_NAME:
+                if (event->name != NULL)
+                        l = strpcpy(&s, l, event->name);
+                else if (udev_device_get_devnode(dev) != NULL)
+                        l = strpcpy(&s, l, udev_device_get_devnode(dev) + strlen("/dev/"));
+                else
+                        l = strpcpy(&s, l, udev_device_get_sysname(dev));
+                break;
+        case SUBST_LINKS: {
+                struct udev_list_entry *list_entry;
+
+                list_entry = udev_device_get_devlinks_list_entry(dev);
+                if (list_entry == NULL)
                         break;
-                case SUBST_SYS:
-                        l = strpcpy(&s, l, "/sys");
+                l = strpcpy(&s, l, udev_list_entry_get_name(list_entry) + strlen("/dev/"));
+                udev_list_entry_foreach(list_entry, udev_list_entry_get_next(list_entry))
+                        l = strpcpyl(&s, l, " ", udev_list_entry_get_name(list_entry) + strlen("/dev/"), NULL);
+                break;
+        }
+        case SUBST_ROOT:
+                l = strpcpy(&s, l, "/dev");
+                break;
+        case SUBST_SYS:
+                l = strpcpy(&s, l, "/sys");
+                break;
+        case SUBST_ENV:
+                if (attr == NULL) {
                         break;
-                case SUBST_ENV:
-                        if (attr == NULL) {
-                                break;
-                        } else {
-                                const char *value;
+                } else {
+                        const char *value;
 
-                                value = udev_device_get_property_value(event->dev, attr);
-                                if (value == NULL)
-                                        break;
-                                l = strpcpy(&s, l, value);
+                        value = udev_device_get_property_value(event->dev, attr);
+                        if (value == NULL)
                                 break;
-                        }
-                default:
-                        log_error("unknown substitution type=%i\n", type);
+                        l = strpcpy(&s, l, value);
                         break;
                 }
+        default:
+                log_error("unknown substitution type=%u\n", part->type);
+                break;
         }
 
-out:
+        *dest = s;
+        return l;
+}
+
+size_t udev_event_apply_format(struct udev_event *event, const char *src, char *dest, size_t size)
+{
+        const struct subst_map *next = NULL;
+        struct udev_format_part part;
+        const char *from = src;
+        char *s = dest;
+        size_t l = size;
+
+        while (l > 0 && format_next_part(src, &from, &next, &part))
+                l = format_apply_part(event, src, &part, &s, l);
+
+        s[0] = '\0';
+        return l;
+}
+
+/* Splits up the format string, for udev_event_apply_compiled_format()
+ * to skip the parsing. Fills in up to n_parts parts, and returns how
+ * many are needed, including the terminating one. */
+unsigned int udev_format_compile(const char *src, struct udev_format_part *parts, unsigned int n_parts)
+{
+        const struct subst_map *next = NULL;
+        struct udev_format_part part;
+        const char *from = src;
+        unsigned int n = 0;
+
+        while (format_next_part(src, &from, &next, &part)) {
+                if (n < n_parts)
+                        parts[n] = part;
+                n++;
+        }
+
+        if (n < n_parts)
+                parts[n].type = SUBST_END;
+
+        return n + 1;
+}
+
+size_t udev_event_apply_compiled_format(struct udev_event *event, const char *src, const struct udev_format_part *parts,
+                                        char *dest, size_t size)
+{
+        char *s = dest;
+        size_t l = size;
+
+        for (; l > 0 && parts->type != SUBST_END; parts++)
+                l = format_apply_part(event, src, parts, &s, l);
+
         s[0] = '\0';
         return l;
 }
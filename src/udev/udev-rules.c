@@ -46,6 +46,11 @@ struct uid_gid {
         };
 };
 
+struct format_index {
+        unsigned int value_off;
+        unsigned int format_off;
+};
+
 struct udev_rules {
         struct udev *udev;
         char **dirs;
@@ -60,6 +65,15 @@ struct udev_rules {
         /* all key strings are copied and de-duplicated in a single continuous string buffer */
         struct strbuf *strbuf;
 
+        /* key values with substitutions are split up into their parts only once,
+         * looked up by the offset of the value, sorted after parsing */
+        struct udev_format_part *formats;
+        unsigned int formats_cur;
+        unsigned int formats_max;
+        struct format_index *format_index;
+        unsigned int format_index_cur;
+        unsigned int format_index_max;
+
         /* during rule parsing, uid/gid lookup results are cached */
         struct uid_gid *uids;
         unsigned int uids_cur;
@@ -464,6 +478,96 @@ static int add_token(struct udev_rules *rules, struct token *token)
         return 0;
 }
 
+static int add_format(struct udev_rules *rules, unsigned int value_off)
+{
+        const char *value = rules_str(rules, value_off);
+        unsigned int n;
+
+        /* grow index if needed */
+        if (rules->format_index_cur >= rules->format_index_max) {
+                struct format_index *format_index;
+                unsigned int add;
+
+                /* double the buffer size */
+                add = rules->format_index_max;
+                if (add < 8)
+                        add = 8;
+
+                format_index = realloc(rules->format_index, (rules->format_index_max + add) * sizeof(struct format_index));
+                if (format_index == NULL)
+                        return -1;
+                rules->format_index = format_index;
+                rules->format_index_max += add;
+        }
+
+        if (rules->formats == NULL)
+                n = udev_format_compile(value, NULL, 0);
+        else
+                n = udev_format_compile(value, rules->formats + rules->formats_cur,
+                                        rules->formats_max - rules->formats_cur);
+
+        /* grow buffer if needed, and split it up again */
+        if (rules->formats_cur + n > rules->formats_max) {
+                struct udev_format_part *formats;
+                unsigned int add;
+
+                /* double the buffer size */
+                add = rules->formats_max;
+                if (add < n + 8)
+                        add = n + 8;
+
+                formats = realloc(rules->formats, (rules->formats_max + add) * sizeof(struct udev_format_part));
+                if (formats == NULL)
+                        return -1;
+                rules->formats = formats;
+                rules->formats_max += add;
+
+                udev_format_compile(value, rules->formats + rules->formats_cur, n);
+        }
+
+        rules->format_index[rules->format_index_cur].value_off = value_off;
+        rules->format_index[rules->format_index_cur].format_off = rules->formats_cur;
+        rules->format_index_cur++;
+        rules->formats_cur += n;
+        return 0;
+}
+
+static int format_index_cmp(const void *a, const void *b)
+{
+        const struct format_index *x = a, *y = b;
+
+        if (x->value_off < y->value_off)
+                return -1;
+        if (x->value_off > y->value_off)
+                return 1;
+        return 0;
+}
+
+/* only these token types run their value through rules_apply_format() */
+static bool token_value_is_format(enum token_type type)
+{
+        switch (type) {
+        case TK_M_WAITFOR:
+        case TK_M_TEST:
+        case TK_M_PROGRAM:
+        case TK_M_IMPORT_FILE:
+        case TK_M_IMPORT_PROG:
+        case TK_M_IMPORT_BUILTIN:
+        case TK_M_IMPORT_PARENT:
+        case TK_A_OWNER:
+        case TK_A_GROUP:
+        case TK_A_MODE:
+        case TK_A_ENV:
+        case TK_A_TAG:
+        case TK_A_NAME:
+        case TK_A_DEVLINK:
+        case TK_A_ATTR:
+                return true;
+        default:
+                return false;
+        }
+}
+
 static uid_t add_uid(struct udev_rules *rules, const char *owner)
 {
         unsigned int i;
@@ -987,13 +1091,13 @@ static int rule_add_key(struct rule_tmp *rule_tmp, enum token_type type,
                 token->key.glob = glob;
         }
 
-        if (value != NULL && type > TK_M_MAX) {
-                /* check if assigned value has substitution chars */
-                if (value[0] == '[')
-                        token->key.subst = SB_SUBSYS;
-                else if (strchr(value, '%') != NULL || strchr(value, '$') != NULL)
+        if (value != NULL) {
+                /* check if the value has substitution chars, and split it up only once, here */
+                if (token_value_is_format(type) && (strchr(value, '%') != NULL || strchr(value, '$') != NULL)) {
                         token->key.subst = SB_FORMAT;
-                else
+                        if (add_format(rule_tmp->rules, token->key.value_off) != 0)
+                                return -1;
+                } else
                         token->key.subst = SB_NONE;
         }
 
@@ -1681,6 +1785,11 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names)
         add_token(rules, &end_token);
         log_debug("rules contain %zu bytes tokens (%u * %zu bytes), %zu bytes strings\n",
                   rules->token_max * sizeof(struct token), rules->token_max, sizeof(struct token), rules->strbuf->len);
+        log_debug("%zu bytes formats (%u * %zu bytes) for %u values\n",
+                  rules->formats_cur * sizeof(struct udev_format_part), rules->formats_cur, sizeof(struct udev_format_part),
+                  rules->format_index_cur);
+        if (rules->format_index != NULL)
+                qsort(rules->format_index, rules->format_index_cur, sizeof(struct format_index), format_index_cmp);
 
         /* cleanup temporary strbuf data */
         log_debug("%zu strings (%zu bytes), %zu de-duplicated (%zu bytes), %zu trie nodes used\n",
@@ -1708,6 +1817,8 @@ struct udev_rules *udev_rules_unref(struct udev_rules *rules)
                 return NULL;
         free(rules->tokens);
         strbuf_cleanup(rules->strbuf);
+        free(rules->formats);
+        free(rules->format_index);
         free(rules->uids);
         free(rules->gids);
         strv_free(rules->dirs);
@@ -1820,6 +1931,26 @@ static int match_key(struct udev_rules *rules, struct token *token, const char *
         return -1;
 }
 
+static void rules_apply_format(struct udev_rules *rules, struct udev_event *event, struct token *token,
+                               char *result, size_t size)
+{
+        const char *value = rules_str(rules, token->key.value_off);
+        struct format_index key = { .value_off = token->key.value_off };
+        const struct format_index *found;
+
+        /* values without substitutions are copied as they are */
+        if (token->key.subst != SB_FORMAT) {
+                strscpy(result, size, value);
+                return;
+        }
+
+        found = bsearch(&key, rules->format_index, rules->format_index_cur, sizeof(struct format_index), format_index_cmp);
+        if (found != NULL)
+                udev_event_apply_compiled_format(event, value, &rules->formats[found->format_off], result, size);
+        else
+                udev_event_apply_format(event, value, result, size);
+}
+
 static int match_attr(struct udev_rules *rules, struct udev_device *dev, struct udev_event *event, struct token *cur)
 {
         const char *name;
@@ -1973,7 +2104,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                         char filename[UTIL_PATH_SIZE];
                         int found;
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), filename, sizeof(filename));
+                        rules_apply_format(rules, event, cur, filename, sizeof(filename));
                         found = (wait_for_file(event->dev, filename, 10) == 0);
                         if (!found && (cur->key.op != OP_NOMATCH))
                                 goto nomatch;
@@ -2049,7 +2180,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                         struct stat statbuf;
                         int match;
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), filename, sizeof(filename));
+                        rules_apply_format(rules, event, cur, filename, sizeof(filename));
                         if (util_resolve_subsys_kernel(event->udev, filename, filename, sizeof(filename), 0) != 0) {
                                 if (filename[0] != '/') {
                                         char tmp[UTIL_PATH_SIZE];
@@ -2081,7 +2212,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
 
                         free(event->program_result);
                         event->program_result = NULL;
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), program, sizeof(program));
+                        rules_apply_format(rules, event, cur, program, sizeof(program));
                         envp = udev_device_get_properties_envp(event->dev);
                         log_debug("PROGRAM '%s' %s:%u\n",
                                   program,
@@ -2109,7 +2240,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                 case TK_M_IMPORT_FILE: {
                         char import[UTIL_PATH_SIZE];
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), import, sizeof(import));
+                        rules_apply_format(rules, event, cur, import, sizeof(import));
                         if (import_file_into_properties(event->dev, import) != 0)
                                 if (cur->key.op != OP_NOMATCH)
                                         goto nomatch;
@@ -2118,7 +2249,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                 case TK_M_IMPORT_PROG: {
                         char import[UTIL_PATH_SIZE];
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), import, sizeof(import));
+                        rules_apply_format(rules, event, cur, import, sizeof(import));
                         log_debug("IMPORT '%s' %s:%u\n",
                                   import,
                                   rules_str(rules, rule->rule.filename_off),
@@ -2149,7 +2280,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                 event->builtin_run |= (1 << cur->key.builtin_cmd);
                         }
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), command, sizeof(command));
+                        rules_apply_format(rules, event, cur, command, sizeof(command));
                         log_debug("IMPORT builtin '%s' %s:%u\n",
                                   udev_builtin_name(cur->key.builtin_cmd),
                                   rules_str(rules, rule->rule.filename_off),
@@ -2226,7 +2357,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                 case TK_M_IMPORT_PARENT: {
                         char import[UTIL_PATH_SIZE];
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), import, sizeof(import));
+                        rules_apply_format(rules, event, cur, import, sizeof(import));
                         if (import_parent_into_properties(event->dev, import) != 0)
                                 if (cur->key.op != OP_NOMATCH)
                                         goto nomatch;
@@ -2262,7 +2393,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                 break;
                         if (cur->key.op == OP_ASSIGN_FINAL)
                                 event->owner_final = true;
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), owner, sizeof(owner));
+                        rules_apply_format(rules, event, cur, owner, sizeof(owner));
                         event->owner_set = true;
                         event->uid = util_lookup_user(event->udev, owner);
                         log_debug("OWNER %u %s:%u\n",
@@ -2278,7 +2409,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                 break;
                         if (cur->key.op == OP_ASSIGN_FINAL)
                                 event->group_final = true;
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), group, sizeof(group));
+                        rules_apply_format(rules, event, cur, group, sizeof(group));
                         event->group_set = true;
                         event->gid = util_lookup_group(event->udev, group);
                         log_debug("GROUP %u %s:%u\n",
@@ -2294,7 +2425,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
 
                         if (event->mode_final)
                                 break;
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), mode_str, sizeof(mode_str));
+                        rules_apply_format(rules, event, cur, mode_str, sizeof(mode_str));
                         mode = strtol(mode_str, &endptr, 8);
                         if (endptr[0] != '\0') {
                                 log_error("ignoring invalid mode '%s'\n", mode_str);
@@ -2380,10 +2511,10 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                 char temp[UTIL_NAME_SIZE];
 
                                 /* append value separated by space */
-                                udev_event_apply_format(event, value, temp, sizeof(temp));
+                                rules_apply_format(rules, event, cur, temp, sizeof(temp));
                                 strscpyl(value_new, sizeof(value_new), value_old, " ", temp, NULL);
                         } else
-                                udev_event_apply_format(event, value, value_new, sizeof(value_new));
+                                rules_apply_format(rules, event, cur, value_new, sizeof(value_new));
 
                         entry = udev_device_add_property(event->dev, name, value_new);
                         /* store in db, skip private keys */
@@ -2395,7 +2526,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                         char tag[UTIL_PATH_SIZE];
                         const char *p;
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), tag, sizeof(tag));
+                        rules_apply_format(rules, event, cur, tag, sizeof(tag));
                         if (cur->key.op == OP_ASSIGN || cur->key.op == OP_ASSIGN_FINAL)
                                 udev_device_cleanup_tags_list(event->dev);
                         for (p = tag; *p != '\0'; p++) {
@@ -2420,7 +2551,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                 break;
                         if (cur->key.op == OP_ASSIGN_FINAL)
                                 event->name_final = true;
-                        udev_event_apply_format(event, name, name_str, sizeof(name_str));
+                        rules_apply_format(rules, event, cur, name_str, sizeof(name_str));
                         if (esc == ESCAPE_UNSET || esc == ESCAPE_REPLACE) {
                                 count = util_replace_chars(name_str, "/");
                                 if (count > 0)
@@ -2457,7 +2588,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                 udev_device_cleanup_devlinks_list(event->dev);
 
                         /* allow  multiple symlinks separated by spaces */
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), temp, sizeof(temp));
+                        rules_apply_format(rules, event, cur, temp, sizeof(temp));
                         if (esc == ESCAPE_UNSET)
                                 count = util_replace_chars(temp, "/ ");
                         else if (esc == ESCAPE_REPLACE)
@@ -2497,7 +2628,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                 strscpyl(attr, sizeof(attr), udev_device_get_syspath(event->dev), "/", key_name, NULL);
                         attr_subst_subdir(attr, sizeof(attr));
 
-                        udev_event_apply_format(event, rules_str(rules, cur->key.value_off), value, sizeof(value));
+                        rules_apply_format(rules, event, cur, value, sizeof(value));
                         log_debug("ATTR '%s' writing '%s' %s:%u\n", attr, value,
                                   rules_str(rules, rule->rule.filename_off),
                                   rule->rule.filename_line);
@@ -67,6 +67,15 @@ struct udev_watch {
         char *name;
 };
 
+/* a format string split up by udev_format_compile() into runs of
+ * literal text and substitutions, terminated by a part of type 0 */
+struct udev_format_part {
+        unsigned int type;
+        /* of the text, or of the {attr} argument, in the format string; 0 if there is none */
+        unsigned int off;
+        unsigned int len;
+};
+
 /* udev-rules.c */
 struct udev_rules;
 struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names);
@@ -79,6 +88,9 @@ int udev_rules_apply_static_dev_perms(struct udev_rules *rules);
 struct udev_event *udev_event_new(struct udev_device *dev);
 void udev_event_unref(struct udev_event *event);
 size_t udev_event_apply_format(struct udev_event *event, const char *src, char *dest, size_t size);
+unsigned int udev_format_compile(const char *src, struct udev_format_part *parts, unsigned int n_parts);
+size_t udev_event_apply_compiled_format(struct udev_event *event, const char *src, const struct udev_format_part *parts,
+                                        char *dest, size_t size);
 int udev_event_apply_subsys_kernel(struct udev_event *event, const char *string,
                                    char *result, size_t maxsize, int read_value);
 int udev_event_spawn(struct udev_event *event,